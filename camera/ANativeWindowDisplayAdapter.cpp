@@ -23,6 +23,8 @@
 #include <ui/Region.h>
 #include <ui/egl/android_natives.h>
 #include <utils/RefBase.h>
+#include <cutils/properties.h>
+#include <sys/time.h>
 
 namespace android {
 
@@ -33,6 +35,36 @@ namespace android {
 	//Suspends buffers after given amount of failed dq's
 	const int ANativeWindowDisplayAdapter::FAILED_DQS_TO_SUSPEND = 3;
 
+	//Display thread wake-up period in ms while buffers wait for a gralloc lock
+	const int ANativeWindowDisplayAdapter::LOCK_RETRY_INTERVAL = 3;
+
+	//Buffers that cannot be locked for this long go back to the window
+	const nsecs_t ANativeWindowDisplayAdapter::LOCK_RETRY_LIMIT = ms2ns(500);
+
+	//Panel refresh used for pacing unless debug.camera.display.fps says otherwise
+	const int ANativeWindowDisplayAdapter::DEFAULT_DISPLAY_FPS = 60;
+
+	static int gralloc_lock(buffer_handle_t handle, int usage, const Rect &bounds, void **vaddr)
+	{
+		return GraphicBufferMapper::get().lock(handle, usage, bounds, vaddr);
+	}
+
+	static int gralloc_unlock(buffer_handle_t handle)
+	{
+		return GraphicBufferMapper::get().unlock(handle);
+	}
+
+	static const ANativeWindowDisplayAdapter::BufferMapperOps gGrallocMapper = {
+		gralloc_lock,
+		gralloc_unlock
+	};
+
+	static inline int slotHash(const void *key)
+	{
+		uintptr_t k = (uintptr_t) key;
+		return (int) (((k >> 4) ^ (k >> 12)) & (ANativeWindowDisplayAdapter::SLOT_TABLE_SIZE - 1));
+	}
+
 
 	const char* getPixFormatConstant(const char* parameters_format)
 	{
@@ -119,6 +151,25 @@ namespace android {
 		mFrameProvider = NULL;
 		mANativeWindow = NULL;
 
+		mMapper = &gGrallocMapper;
+		mSlotState = NULL;
+		mBuffersWithWindow = 0;
+		mMinUndequeued = 0;
+		mLockRetryGeneration = 0;
+		clearSlots(mHandleSlots);
+		clearSlots(mBufferSlots);
+		memset(&mStats, 0, sizeof(mStats));
+
+		mFramePending = false;
+		mFrameInterval = 0;
+		mNextPostTime = 0;
+		mStatsPeriodStart = 0;
+		mFirstFrameRef = 0;
+		mPeriodDisplayed = 0;
+		mPeriodDropped = 0;
+		mPeriodLatencyTotal = 0;
+		mPeriodLatencyMax = 0;
+
 		mFrameWidth = 0;
 		mFrameHeight = 0;
 		mPreviewWidth = 0;
@@ -279,10 +330,17 @@ namespace android {
 		return ret;
 	}
 
+	void ANativeWindowDisplayAdapter::setPipelineStats(const sp<PipelineStats> &stats)
+	{
+		mPipelineStats = stats;
+	}
+
 	int ANativeWindowDisplayAdapter::enableDisplay(int width, int height, struct timeval *refTime, S3DParameters *s3dParams)
 	{
 		Semaphore sem;
 		TIUTILS::Message msg;
+		char value[PROPERTY_VALUE_MAX];
+		int fps;
 
 		LOG_FUNCTION_NAME;
 
@@ -294,6 +352,35 @@ namespace android {
 			return NO_ERROR;
 		}
 
+		// pace to the panel refresh, frames in between are dropped
+		property_get("debug.camera.display.fps", value, "0");
+		fps = atoi(value);
+		if ( fps <= 0 ) {
+			fps = DEFAULT_DISPLAY_FPS;
+		}
+
+		dropPendingFrame();
+
+		{
+			Mutex::Autolock lock(mLock);
+			mFrameInterval = s2ns(1) / fps;
+			mNextPostTime = 0;
+			mStatsPeriodStart = systemTime();
+			mPeriodDisplayed = 0;
+			mPeriodDropped = 0;
+			mPeriodLatencyTotal = 0;
+			mPeriodLatencyMax = 0;
+
+			// the request time is on the wall clock, move it to ours so the first post can be measured
+			mFirstFrameRef = 0;
+			if ( NULL != refTime ) {
+				struct timeval now;
+				gettimeofday(&now, NULL);
+				mFirstFrameRef = mStatsPeriodStart -
+					( s2ns(now.tv_sec - refTime->tv_sec) + us2ns(now.tv_usec - refTime->tv_usec) );
+			}
+		}
+
 		//Send START_DISPLAY COMMAND to display thread. Display thread will start and then wait for a message
 		sem.Create();
 		msg.command = DisplayThread::DISPLAY_START;
@@ -326,7 +413,6 @@ namespace android {
 		LOG_FUNCTION_NAME;
 
 		status_t ret = NO_ERROR;
-		GraphicBufferMapper &mapper = GraphicBufferMapper::get();
 
 		if(!mDisplayEnabled)
 		{
@@ -360,6 +446,9 @@ namespace android {
 
 		}
 
+		///A frame waiting for its display slot goes back to the camera adapter before the buffers are cancelled
+		dropPendingFrame();
+
 		Mutex::Autolock lock(mLock);
 		{
 			///Reset the display enabled flag
@@ -432,16 +521,28 @@ namespace android {
 		status_t err;
 		int i = -1;
 		const int lnumBufs = numBufs;
-		mBufferHandleMap = new buffer_handle_t*[lnumBufs];
-		mGrallocHandleMap = new IMG_native_handle_t*[lnumBufs];
 		int undequeued = 0;
-		GraphicBufferMapper &mapper = GraphicBufferMapper::get();
 		Rect bounds;
 
 		if (NULL == mANativeWindow) {
 			return NULL;
 		}
 
+		if (numBufs > (SLOT_TABLE_SIZE / 2)) {
+			LOGINFO("Too many preview buffers requested %d", numBufs);
+			return NULL;
+		}
+
+		mBufferHandleMap = new buffer_handle_t*[lnumBufs];
+		mGrallocHandleMap = new IMG_native_handle_t*[lnumBufs];
+		mSlotState = new int[lnumBufs];
+		for (int slot = 0; slot < lnumBufs; slot++) {
+			mSlotState[slot] = SLOT_WITH_WINDOW;
+		}
+		mBuffersWithWindow = lnumBufs;
+		clearSlots(mHandleSlots);
+		clearSlots(mBufferSlots);
+
 		// Set gralloc usage bits for window.
 		err = mANativeWindow->set_usage(mANativeWindow, CAMHAL_GRALLOC_USAGE);
 		if (err != 0) {
@@ -501,6 +602,7 @@ namespace android {
 
 		mANativeWindow->get_min_undequeued_buffer_count(mANativeWindow, &undequeued);
 		LOGINFO("mBufferCount %d, undequeued %d\n", mBufferCount, undequeued);
+		mMinUndequeued = undequeued;
 
 		// lock the initial queueable buffers
 		bounds.left = 0;
@@ -525,11 +627,15 @@ namespace android {
 			}
 
 			mBufferHandleMap[i] = buf;
+			addSlot(mHandleSlots, buf, i);
 
 			//if(i < mBufferCount - undequeued){
 			if(true){
-				mapper.lock((buffer_handle_t) *mBufferHandleMap[i], CAMHAL_GRALLOC_USAGE, bounds, &y_uv);
+				mMapper->lock((buffer_handle_t) *mBufferHandleMap[i], CAMHAL_GRALLOC_USAGE, bounds, &y_uv);
 				mGrallocHandleMap[i] = (IMG_native_handle_t*)y_uv;
+				addSlot(mBufferSlots, y_uv, i);
+				mSlotState[i] = SLOT_WITH_CAMERA;
+				mBuffersWithWindow--;
 				mANativeWindow->lock_buffer(mANativeWindow, mBufferHandleMap[i]);
 				mFramesWithCameraAdapterMap.add((int) mGrallocHandleMap[i], i);
 				mFrameProvider->addFramePointers((void*)mGrallocHandleMap[i] , NULL);
@@ -537,7 +643,7 @@ namespace android {
 			else{
 				mANativeWindow->cancel_buffer(mANativeWindow, mBufferHandleMap[i]);
 				//mFramesWithCameraAdapterMap.removeItem((int) mGrallocHandleMap[i]);
-				mapper.unlock((buffer_handle_t) *mBufferHandleMap[i]);
+				mMapper->unlock((buffer_handle_t) *mBufferHandleMap[i]);
 			}
 		}
 
@@ -558,6 +664,8 @@ fail:
 				break;
 			}
 			mFramesWithCameraAdapterMap.removeItem((int) mGrallocHandleMap[start]);
+			mSlotState[start] = SLOT_WITH_WINDOW;
+			mBuffersWithWindow++;
 		}
 
 		freeBuffers(mGrallocHandleMap);
@@ -605,6 +713,15 @@ fail:
 			mBufferHandleMap = NULL;
 		}
 
+		if ( NULL != mSlotState )
+		{
+			delete [] mSlotState;
+			mSlotState = NULL;
+		}
+		clearSlots(mHandleSlots);
+		clearSlots(mBufferSlots);
+		mBuffersWithWindow = 0;
+
 		if ( NULL != mOffsetsMap )
 		{
 			delete [] mOffsetsMap;
@@ -626,14 +743,24 @@ fail:
 		LOG_FUNCTION_NAME;
 
 		status_t ret = NO_ERROR;
-		GraphicBufferMapper &mapper = GraphicBufferMapper::get();
 		//Give the buffers back to display here -  sort of free it
 		if (mANativeWindow){
 			for(unsigned int i = 0; i < mBufferCount; i++) {
 
+				// buffers already queued to the window are not ours to cancel
+				if ( (NULL != mSlotState) && (SLOT_WITH_WINDOW == mSlotState[i]) ) {
+					continue;
+				}
+
 				LOGE("returnBuffersToWindow i %d\n", i);
 
-				mapper.unlock((buffer_handle_t) *mBufferHandleMap[i]);
+				if ( (NULL == mSlotState) || (SLOT_WITH_CAMERA == mSlotState[i]) ) {
+					mMapper->unlock((buffer_handle_t) *mBufferHandleMap[i]);
+				}
+				if ( NULL != mSlotState ) {
+					mSlotState[i] = SLOT_WITH_WINDOW;
+					mBuffersWithWindow++;
+				}
 				ret = mANativeWindow->cancel_buffer(mANativeWindow, mBufferHandleMap[i]);
 
 				if ( ENODEV == ret ) {
@@ -653,6 +780,12 @@ fail:
 		}
 
 		mFramesWithCameraAdapterMap.clear();
+		{
+			// the display thread may be retrying these, it drops what it holds on seeing the bump
+			Mutex::Autolock lock(mLock);
+			mLockRetries.clear();
+			mLockRetryGeneration++;
+		}
 		LOG_FUNCTION_NAME_EXIT;
 		return ret;
 
@@ -784,10 +917,13 @@ end:
 
 		while(shouldLive)
 		{
+			// wake up early for the next display slot or for parked gralloc locks
+			timeout = nextWakeup();
+
 			ret = TIUTILS::MessageQueue::waitForMsg(&mDisplayThread->msgQ()
 					,  &mDisplayQ
 					, NULL
-					, ANativeWindowDisplayAdapter::DISPLAY_TIMEOUT);
+					, timeout);
 
 			if ( !mDisplayThread->msgQ().isEmpty() )
 			{
@@ -804,18 +940,22 @@ end:
 				else
 				{
 					TIUTILS::Message msg;
-					///Get the dummy msg from the displayQ
-					if(mDisplayQ.get(&msg)!=NO_ERROR)
+					///Get the dummy msgs from the displayQ, one refill pass covers all of them
+					while(!mDisplayQ.isEmpty())
 					{
-						LOGINFO("Error in getting message from display Q");
-						continue;
+						if(mDisplayQ.get(&msg)!=NO_ERROR)
+						{
+							LOGINFO("Error in getting message from display Q");
+							break;
+						}
 					}
 
-					// There is a frame from ANativeWindow for us to dequeue
-					// We dequeue and return the frame back to Camera adapter
+					// There are frames with ANativeWindow for us to dequeue
+					// We dequeue ahead and return them back to Camera adapter
 					if(mDisplayState == ANativeWindowDisplayAdapter::DISPLAY_STARTED)
 					{
-						handleFrameReturn();
+						postPendingFrame();
+						dequeueAhead();
 					}
 
 					if (mDisplayState == ANativeWindowDisplayAdapter::DISPLAY_EXITED)
@@ -826,6 +966,16 @@ end:
 					}
 				}
 			}
+
+			if ( shouldLive && (mDisplayState == ANativeWindowDisplayAdapter::DISPLAY_STARTED) )
+			{
+				if ( postPendingFrame() )
+				{
+					dequeueAhead();
+				}
+
+				processLockRetries();
+			}
 		}
 
 		LOG_FUNCTION_NAME_EXIT;
@@ -853,6 +1003,7 @@ end:
 				///mOverlay->setParameter("enabled", false);
 				LOGINFO("Display thread received DISPLAY_STOP command from Camera HAL");
 				mDisplayState = ANativeWindowDisplayAdapter::DISPLAY_STOPPED;
+				dropPendingFrame();
 				break;
 			case DisplayThread::DISPLAY_EXIT:
 				LOGINFO("Display thread received DISPLAY_EXIT command from Camera HAL.");
@@ -889,9 +1040,6 @@ end:
 		buffer_handle_t* buf;
 		int i = 0;
 		int stride; // dummy variable to get stride
-		GraphicBufferMapper &mapper = GraphicBufferMapper::get();
-		Rect bounds;
-		void *y_uv;
 
 		if (NULL == mANativeWindow) {
 			return false;
@@ -920,47 +1068,344 @@ end:
 			return false;
 		}
 
-		for (i = 0; i < mBufferCount; i++) {
-			if (mBufferHandleMap[i] == buf)
-				break;
+		// from the window handing a buffer back, not the wait for it
+		FrameTraceScope trace("handleFrameReturn");
+
+		i = findSlot(mHandleSlots, buf);
+		LOGFRAME("HandleFrameReturn index %d\n", i);
+		trace.setFrame(-1, i);
+
+		if((i < 0) || (i >= mBufferCount)){
+			LOGINFO("Error!! dequeued buffer %p is not one of ours\n", buf);
+			return false;
 		}
-		LOGINFO("HandleFrameReturn index %d\n", i);
 
-		if(i >= mBufferCount){
-			LOGINFO("Error!! index >= mBufferCount!\n");
-			return -EINVAL;
+		{
+			Mutex::Autolock lock(mLock);
+			if (SLOT_WITH_WINDOW == mSlotState[i]) {
+				mBuffersWithWindow--;
+			}
+			mSlotState[i] = SLOT_DEQUEUED;
+			if (NULL != mPipelineStats.get()) {
+				mPipelineStats->setOwned(PipelineStats::OWNER_DISPLAY, mBuffersWithWindow);
+			}
+		}
+
+		if (!lockAndReturnSlot(i)) {
+			// park it, the rest of the buffers keep flowing while it is retried
+			LockRetry retry;
+			retry.mSlot = i;
+			retry.mTries = 1;
+			retry.mFirstFailure = systemTime();
+			Mutex::Autolock lock(mLock);
+			mLockRetries.add(retry);
+			LOGINFO("Gralloc Lock FrameReturn Error: buffer %d parked for retry", i);
 		}
 
+		LOG_FUNCTION_NAME_EXIT;
+		return true;
+	}
+
+	bool ANativeWindowDisplayAdapter::lockAndReturnSlot(int i)
+	{
+		Rect bounds;
+		void *y_uv;
+
 		// lock buffer before sending to FrameProvider for filling
 		bounds.left = 0;
 		bounds.top = 0;
 		bounds.right = mFrameWidth;
 		bounds.bottom = mFrameHeight;
 
-		int lock_try_count = 0;
-		while (mapper.lock((buffer_handle_t) *mBufferHandleMap[i],
+		if (mMapper->lock((buffer_handle_t) *mBufferHandleMap[i],
 					CAMHAL_GRALLOC_USAGE, bounds, &y_uv) < 0) {
-			if (++lock_try_count > LOCK_BUFFER_TRIES) {
-				if (NULL != mErrorNotifier.get()) {
-					//mErrorNotifier->errorNotify(CAMERA_ERROR_UNKNOWN);
-				}
-				return false;
-			}
-			LOGINFO("Gralloc Lock FrameReturn Error: Sleeping 15ms");
-			usleep(15000);
+			Mutex::Autolock lock(mLock);
+			mStats.mLockFailures++;
+			return false;
+		}
+
+		if (mGrallocHandleMap[i] != (IMG_native_handle_t*)y_uv) {
+			LOGINFO("Buffer %d mapped at a new address", i);
+			mGrallocHandleMap[i] = (IMG_native_handle_t*)y_uv;
+			rebuildBufferSlots();
 		}
 
-		mGrallocHandleMap[i] = (IMG_native_handle_t*)y_uv;
-		mFramesWithCameraAdapterMap.add((int) mGrallocHandleMap[i], i);
+		{
+			Mutex::Autolock lock(mLock);
+			mSlotState[i] = SLOT_WITH_CAMERA;
+			mFramesWithCameraAdapterMap.add((int) mGrallocHandleMap[i], i);
+		}
 		mFrameProvider->returnFrame( (void*)mGrallocHandleMap[i], CameraFrame::PREVIEW_FRAME_SYNC);
 
-		LOGINFO("handleFrameReturn: found graphic buffer %d of %d", i,
+		LOGFRAME("handleFrameReturn: found graphic buffer %d of %d", i,
 				mBufferCount - 1);
 
+		return true;
+	}
+
+	void ANativeWindowDisplayAdapter::processLockRetries()
+	{
+		LOG_FUNCTION_NAME;
+
+		nsecs_t now = systemTime();
+		Vector<LockRetry> retries;
+		unsigned int generation;
+
+		// worked on outside mLock, which lockAndReturnSlot() takes
+		{
+			Mutex::Autolock lock(mLock);
+			if ( mLockRetries.isEmpty() ) {
+				return;
+			}
+			retries = mLockRetries;
+			mLockRetries.clear();
+			generation = mLockRetryGeneration;
+		}
+
+		for (size_t n = 0; n < retries.size(); ) {
+			LockRetry &retry = retries.editItemAt(n);
+			nsecs_t waited = now - retry.mFirstFailure;
+
+			if (lockAndReturnSlot(retry.mSlot)) {
+				Mutex::Autolock lock(mLock);
+				mStats.mLockRecovered++;
+				mStats.mRetryLatencyTotal += waited;
+				if (waited > mStats.mRetryLatencyMax) {
+					mStats.mRetryLatencyMax = waited;
+				}
+				LOGINFO("Buffer %d locked after %d tries, %lld us", retry.mSlot,
+						retry.mTries + 1, ns2us(waited));
+				retries.removeAt(n);
+				continue;
+			}
+
+			retry.mTries++;
+			if (waited < LOCK_RETRY_LIMIT) {
+				n++;
+				continue;
+			}
+
+			// give it back so the window can hand it out again later
+			LOGINFO("Buffer %d could not be locked in %lld us, cancelling", retry.mSlot, ns2us(waited));
+			if ( (NULL != mANativeWindow) &&
+					(mANativeWindow->cancel_buffer(mANativeWindow, mBufferHandleMap[retry.mSlot]) == 0) ) {
+				Mutex::Autolock lock(mLock);
+				mSlotState[retry.mSlot] = SLOT_WITH_WINDOW;
+				mBuffersWithWindow++;
+			}
+			{
+				Mutex::Autolock lock(mLock);
+				mStats.mLockAbandoned++;
+			}
+			retries.removeAt(n);
+		}
+
+		{
+			Mutex::Autolock lock(mLock);
+			// buffers returned to the window meanwhile are no longer ours to retry
+			if ( generation == mLockRetryGeneration ) {
+				mLockRetries.appendVector(retries);
+			}
+		}
+
 		LOG_FUNCTION_NAME_EXIT;
+	}
+
+	void ANativeWindowDisplayAdapter::getDisplayStats(DisplayStats &stats)
+	{
+		Mutex::Autolock lock(mLock);
+		stats = mStats;
+	}
+
+	void ANativeWindowDisplayAdapter::setBufferMapper(const BufferMapperOps *ops)
+	{
+		Mutex::Autolock lock(mLock);
+		mMapper = (NULL != ops) ? ops : &gGrallocMapper;
+	}
+
+	int ANativeWindowDisplayAdapter::nextWakeup()
+	{
+		int timeout = ANativeWindowDisplayAdapter::DISPLAY_TIMEOUT;
+
+		Mutex::Autolock lock(mLock);
+		if ( !mLockRetries.isEmpty() ) {
+			timeout = ANativeWindowDisplayAdapter::LOCK_RETRY_INTERVAL;
+		}
+
+		if ( mFramePending ) {
+			nsecs_t wait = mNextPostTime - systemTime();
+			int ms = (wait <= 0) ? 0 : (int) ((wait + ms2ns(1) - 1) / ms2ns(1));
+			if ( ms < timeout ) {
+				timeout = ms;
+			}
+		}
+
+		return timeout;
+	}
+
+	bool ANativeWindowDisplayAdapter::postPendingFrame()
+	{
+		DisplayFrame df;
+		nsecs_t now = systemTime();
+
+		{
+			Mutex::Autolock lock(mLock);
+
+			if ( !mFramePending || (now < mNextPostTime) ) {
+				return false;
+			}
+
+			df = mPendingFrame;
+			mFramePending = false;
+
+			// next slot on the panel cadence, restart it if we fell behind
+			if ( (now - mNextPostTime) > mFrameInterval ) {
+				mNextPostTime = now + mFrameInterval;
+			} else {
+				mNextPostTime += mFrameInterval;
+			}
+		}
+
+		if ( NO_ERROR != postFrame(df) ) {
+			mFrameProvider->returnFrame(df.mBuffer, CameraFrame::PREVIEW_FRAME_SYNC);
+			return false;
+		}
+
+		// the compositor latches on the next refresh, count one interval on glass
+		nsecs_t latency = now - df.mTimestamp + mFrameInterval;
+		updatePacingStats(now, latency);
+		if (NULL != mPipelineStats.get()) {
+			mPipelineStats->frame(PipelineStats::STAGE_DISPLAY, latency);
+		}
+
 		return true;
 	}
 
+	void ANativeWindowDisplayAdapter::dropPendingFrame()
+	{
+		void *dropped = NULL;
+
+		{
+			Mutex::Autolock lock(mLock);
+			if ( mFramePending ) {
+				dropped = mPendingFrame.mBuffer;
+				mFramePending = false;
+			}
+		}
+
+		// the frame was never posted, the adapter still counts it as out
+		if ( ( NULL != dropped ) && ( NULL != mFrameProvider ) ) {
+			mFrameProvider->returnFrame(dropped, CameraFrame::PREVIEW_FRAME_SYNC);
+		}
+	}
+
+	void ANativeWindowDisplayAdapter::updatePacingStats(nsecs_t now, nsecs_t latency)
+	{
+		Mutex::Autolock lock(mLock);
+
+		if ( 0 != mFirstFrameRef ) {
+			nsecs_t firstFrame = now - mFirstFrameRef;
+			mStats.mFirstFrames++;
+			mStats.mFirstFrameLast = firstFrame;
+			if ( firstFrame > mStats.mFirstFrameMax ) {
+				mStats.mFirstFrameMax = firstFrame;
+			}
+			mFirstFrameRef = 0;
+			LOGINFO("Display: first frame %lld us after the preview start request", ns2us(firstFrame));
+		}
+
+		mStats.mFramesDisplayed++;
+		mPeriodDisplayed++;
+		mPeriodLatencyTotal += latency;
+		if ( latency > mPeriodLatencyMax ) {
+			mPeriodLatencyMax = latency;
+		}
+
+		if ( (now - mStatsPeriodStart) < s2ns(1) ) {
+			return;
+		}
+
+		mStats.mLastSecondDisplayed = mPeriodDisplayed;
+		mStats.mLastSecondDropped = mPeriodDropped;
+		mStats.mLastSecondLatencyAvg = mPeriodLatencyTotal / mPeriodDisplayed;
+		mStats.mLastSecondLatencyMax = mPeriodLatencyMax;
+
+		LOGINFO("Display: %u shown, %u dropped, latency avg %lld us max %lld us",
+				mPeriodDisplayed, mPeriodDropped,
+				ns2us(mStats.mLastSecondLatencyAvg), ns2us(mPeriodLatencyMax));
+
+		mStatsPeriodStart = now;
+		mPeriodDisplayed = 0;
+		mPeriodDropped = 0;
+		mPeriodLatencyTotal = 0;
+		mPeriodLatencyMax = 0;
+	}
+
+	void ANativeWindowDisplayAdapter::dequeueAhead()
+	{
+		LOG_FUNCTION_NAME;
+
+		// Keep every buffer the window can spare dequeued, locked and with the
+		// camera adapter, so capture never waits on the compositor for a buffer
+		while (true) {
+			{
+				Mutex::Autolock lock(mLock);
+				if ( (NULL == mSlotState) || (mBuffersWithWindow <= mMinUndequeued) ) {
+					break;
+				}
+			}
+
+			if (!handleFrameReturn()) {
+				break;
+			}
+		}
+
+		LOG_FUNCTION_NAME_EXIT;
+	}
+
+	void ANativeWindowDisplayAdapter::clearSlots(SlotEntry *table)
+	{
+		for (int i = 0; i < SLOT_TABLE_SIZE; i++) {
+			table[i].mKey = NULL;
+			table[i].mSlot = -1;
+		}
+	}
+
+	void ANativeWindowDisplayAdapter::addSlot(SlotEntry *table, const void *key, int slot)
+	{
+		int pos = slotHash(key);
+
+		// linear probing, the table is never more than half full
+		while ( (NULL != table[pos].mKey) && (key != table[pos].mKey) ) {
+			pos = (pos + 1) & (SLOT_TABLE_SIZE - 1);
+		}
+
+		table[pos].mKey = key;
+		table[pos].mSlot = slot;
+	}
+
+	int ANativeWindowDisplayAdapter::findSlot(const SlotEntry *table, const void *key)
+	{
+		int pos = slotHash(key);
+
+		while (NULL != table[pos].mKey) {
+			if (key == table[pos].mKey) {
+				return table[pos].mSlot;
+			}
+			pos = (pos + 1) & (SLOT_TABLE_SIZE - 1);
+		}
+
+		return -1;
+	}
+
+	void ANativeWindowDisplayAdapter::rebuildBufferSlots()
+	{
+		clearSlots(mBufferSlots);
+		for (int i = 0; i < mBufferCount; i++) {
+			addSlot(mBufferSlots, mGrallocHandleMap[i], i);
+		}
+	}
+
 	status_t ANativeWindowDisplayAdapter::postFrame(
 			ANativeWindowDisplayAdapter::DisplayFrame &dispFrame) {
 		LOG_FUNCTION_NAME;
@@ -968,41 +1413,41 @@ end:
 		status_t ret = NO_ERROR;
 		uint32_t actualFramesWithDisplay = 0;
 		android_native_buffer_t *buffer = NULL;
-		GraphicBufferMapper &mapper = GraphicBufferMapper::get();
 		int index;
+		FrameTraceScope trace("postFrame", dispFrame.mSequence);
 
 		if (!mGrallocHandleMap || !dispFrame.mBuffer) {
 			LOGINFO("NULL sent to postFrame");
 			return -EINVAL;
 		}
-		LOGINFO("mPaused %d, mSuspend %d", mPaused, mSuspend);
+		LOGFRAME("mPaused %d, mSuspend %d", mPaused, mSuspend);
 
-		for ( index = 0; index < mBufferCount; index++ )
-		{
-			if ( ((int) dispFrame.mBuffer ) == (int)mGrallocHandleMap[index] )
-			{
-				break;
-			}
-		}
-		
-		LOGINFO("postFrame index %d\n", index);
-		if(index >= mBufferCount){
-			LOGINFO("Error!! index >= mBufferCount!\n");
+		index = findSlot(mBufferSlots, dispFrame.mBuffer);
+
+		LOGFRAME("postFrame index %d\n", index);
+		trace.setFrame(dispFrame.mSequence, index);
+		if((index < 0) || (index >= mBufferCount)){
+			LOGINFO("Error!! buffer %p is not a display buffer\n", dispFrame.mBuffer);
 			return -EINVAL;
 		}
 
 		// unlock buffer before sending to display
-		mapper.unlock((buffer_handle_t) *mBufferHandleMap[index]);
+		mMapper->unlock((buffer_handle_t) *mBufferHandleMap[index]);
 		ret = mANativeWindow->enqueue_buffer(mANativeWindow,
 				mBufferHandleMap[index]);
 		if (ret != 0) {
 			LOGINFO("Surface::queueBuffer returned error %d", ret);
 		}
 
-		mFramesWithCameraAdapterMap.removeItem((int) dispFrame.mBuffer);
-
-		TIUTILS::Message msg;
-		mDisplayQ.put(&msg);
+		{
+			Mutex::Autolock lock(mLock);
+			mSlotState[index] = SLOT_WITH_WINDOW;
+			mBuffersWithWindow++;
+			mFramesWithCameraAdapterMap.removeItem((int) dispFrame.mBuffer);
+			if (NULL != mPipelineStats.get()) {
+				mPipelineStats->setOwned(PipelineStats::OWNER_DISPLAY, mBuffersWithWindow);
+			}
+		}
 
 		ret = NO_ERROR;
 		LOG_FUNCTION_NAME_EXIT;
@@ -1038,6 +1483,9 @@ end:
 		LOG_FUNCTION_NAME;
 
 		DisplayFrame df;
+		void *superseded = NULL;
+		TIUTILS::Message msg;
+
 		df.mBuffer = cameraFrame->mBuffer;
 		df.mType = (CameraFrame::FrameType) cameraFrame->mFrameType;
 		df.mOffset = cameraFrame->mOffset;
@@ -1045,7 +1493,32 @@ end:
 		df.mLength = cameraFrame->mLength;
 		df.mWidth = cameraFrame->mWidth;
 		df.mHeight = cameraFrame->mHeight;
-		postFrame(df);
+		df.mTimestamp = cameraFrame->mTimestamp;
+		df.mSequence = cameraFrame->mSequence;
+
+		// only the newest frame waits for the display slot, an older one
+		// goes straight back to the adapter to be refilled
+		{
+			Mutex::Autolock lock(mLock);
+
+			if ( mFramePending ) {
+				superseded = mPendingFrame.mBuffer;
+				mStats.mFramesDropped++;
+				mPeriodDropped++;
+				if (NULL != mPipelineStats.get()) {
+					mPipelineStats->drop(PipelineStats::STAGE_DISPLAY);
+				}
+			}
+
+			mPendingFrame = df;
+			mFramePending = true;
+		}
+
+		if ( NULL != superseded ) {
+			mFrameProvider->returnFrame(superseded, CameraFrame::PREVIEW_FRAME_SYNC);
+		}
+
+		mDisplayQ.put(&msg);
 
 		LOG_FUNCTION_NAME_EXIT;
 	}
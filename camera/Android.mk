@@ -12,14 +12,25 @@ CAMERA_HAL_SRC := \
 	ANativeWindowDisplayAdapter.cpp \
 	CameraProperties.cpp \
 	MemoryManager.cpp \
+	MemoryBackend.cpp \
+	IonMemoryBackend.cpp \
+	MemoryAccounting.cpp \
+	PipelineStats.cpp \
+	CameraLog.cpp \
+	FrameTrace.cpp \
+	ParameterStore.cpp \
 	Encoder_libjpeg.cpp \
+	FrameTransform.cpp \
 	SensorListener.cpp  \
 
 CAMERA_COMMON_SRC:= \
 	BaseCameraAdapter.cpp \
 
 CAMERA_USB_SRC:= \
-	V4LCameraAdapter.cpp
+	V4LCameraAdapter.cpp \
+	V4LControls.cpp \
+	CapabilityCache.cpp \
+	DeviceManager.cpp
 
 
 LOCAL_SRC_FILES:= \
@@ -55,10 +66,134 @@ LOCAL_SHARED_LIBRARIES:= \
     libjpeg \
     libexif \
 
-LOCAL_CFLAGS := -fno-short-enums
+LOCAL_CFLAGS := -fno-short-enums -DCAMERA_ION_BACKEND
+
+# kernels with dma-buf sync get explicit cache maintenance on cached ION buffers
+ifeq ($(CAMERA_DMABUF_SYNC),true)
+LOCAL_CFLAGS += -DCAMERA_DMABUF_SYNC
+endif
+
+# function entry and exit logging, shown at debug.camera.loglevel 3
+ifeq ($(CAMERA_FUNCTION_TRACE),true)
+LOCAL_CFLAGS += -DCAMERA_FUNCTION_TRACE
+endif
 
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_MODULE:= camera.mv88de3100
 LOCAL_MODULE_TAGS:= optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+###############################
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	ANativeWindowDisplayAdapter.cpp \
+	CameraHalUtil.cpp \
+	MemoryAccounting.cpp \
+	PipelineStats.cpp \
+	CameraLog.cpp \
+	FrameTrace.cpp \
+	tools/FakePreviewWindow.cpp \
+	tools/DisplayBench.cpp \
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/include \
+    $(LOCAL_PATH)/tools \
+    hardware/ti/omap4xxx/include \
+    hardware/ti/omap4xxx/libtiutils \
+    hardware/ti/omap4xxx/hwc \
+    hardware/ti/omap4xxx/domx/omx_core/inc \
+    hardware/ti/omap4xxx/domx/mm_osal/inc \
+    frameworks/base/include/ui \
+    frameworks/base/include/utils \
+
+LOCAL_SHARED_LIBRARIES:= \
+    libui \
+    libutils \
+    libcutils \
+    libtiutils \
+    libcamera_client \
+
+LOCAL_CFLAGS := -fno-short-enums
+
+LOCAL_MODULE:= camera_display_bench
+LOCAL_MODULE_TAGS:= debug
+
+include $(BUILD_EXECUTABLE)
+
+###############################
+# Device only, like the other benches: CameraHal.h pulls in binder, gralloc and
+# libcamera_client, none of which build for the host. -m memfd runs the same
+# passes without ION.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	MemoryManager.cpp \
+	MemoryBackend.cpp \
+	IonMemoryBackend.cpp \
+	MemoryAccounting.cpp \
+	Encoder_libjpeg.cpp \
+	CameraLog.cpp \
+	FrameTrace.cpp \
+	tools/CacheBench.cpp \
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/include \
+    hardware/ti/omap4xxx/include \
+    hardware/ti/omap4xxx/libtiutils \
+    hardware/ti/omap4xxx/ion \
+    frameworks/base/include/ui \
+    frameworks/base/include/utils \
+    external/jpeg \
+    external/jhead
+
+LOCAL_SHARED_LIBRARIES:= \
+    libutils \
+    libcutils \
+    libcamera_client \
+    libion \
+    libjpeg \
+    libexif \
+
+LOCAL_CFLAGS := -fno-short-enums -DCAMERA_ION_BACKEND
+
+ifeq ($(CAMERA_DMABUF_SYNC),true)
+LOCAL_CFLAGS += -DCAMERA_DMABUF_SYNC
+endif
+
+LOCAL_MODULE:= camera_cache_bench
+LOCAL_MODULE_TAGS:= debug
+
+include $(BUILD_EXECUTABLE)
+
+###############################
+# Loads the installed camera module through libhardware, so the HAL sources are not linked in
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:= \
+	tools/MultiCameraBench.cpp \
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/include \
+    hardware/ti/omap4xxx/include \
+    hardware/ti/omap4xxx/libtiutils \
+    hardware/ti/omap4xxx/ion \
+    frameworks/base/include/ui \
+    frameworks/base/include/utils \
+    external/jpeg \
+    external/jhead
+
+LOCAL_SHARED_LIBRARIES:= \
+    libhardware \
+    libui \
+    libutils \
+    libcutils \
+    libcamera_client \
+
+LOCAL_CFLAGS := -fno-short-enums
+
+LOCAL_MODULE:= camera_multi_bench
+LOCAL_MODULE_TAGS:= debug
+
+include $(BUILD_EXECUTABLE)
@@ -26,6 +26,7 @@
 #include "VideoMetadata.h"
 #include "Encoder_libjpeg.h"
 #include <MetadataBufferType.h>
+#include <cutils/atomic.h>
 #include <ui/GraphicBuffer.h>
 #include <ui/GraphicBufferMapper.h>
 
@@ -259,6 +260,11 @@ namespace android {
 
 					if(thumb_jpeg) {
 						thumb_param = (Encoder_libjpeg::params *) thumb_jpeg;
+						// a thumbnail that overflowed the APP1 room comes back empty
+						if (0 == thumb_param->jpeg_size) {
+							LOGINFO("Thumbnail %dx%d did not fit in %d bytes, dropped",
+									thumb_param->out_width, thumb_param->out_height, thumb_param->dst_size);
+						}
 						exif->insertExifThumbnailImage((const char*)thumb_param->dst,
 								(int)thumb_param->jpeg_size);
 					}
@@ -266,7 +272,7 @@ namespace android {
 					exif_section = FindSection(M_EXIF);
 
 					if (exif_section) {
-						picture = mRequestMemory(-1, jpeg_size + exif_section->Size, 1, NULL);
+						picture = requestMemory(jpeg_size + exif_section->Size, 1, MemoryAccounting::MEM_PICTURE);
 						if (picture && picture->data) {
 							exif->saveJpeg((unsigned char*) picture->data, jpeg_size + exif_section->Size);
 						}
@@ -275,7 +281,7 @@ namespace android {
 					cookie2 = NULL;
 				} else {
 					LOGINFO("Copy data to picture\n");
-					picture = mRequestMemory(-1, jpeg_size, 1, NULL);
+					picture = requestMemory(jpeg_size, 1, MemoryAccounting::MEM_PICTURE);
 					if (picture && picture->data) {
 						memcpy(picture->data, encoded_mem->data, jpeg_size);
 					}
@@ -289,21 +295,31 @@ namespace android {
 			mRawAvailable = false;
 		}
 
-		// Send the callback to the application only if the notifier is started and the message is enabled
-		if(picture && (mNotifierState==AppCallbackNotifier::NOTIFIER_STARTED) &&
-				(mCameraHal->msgTypeEnabled(CAMERA_MSG_COMPRESSED_IMAGE)))
+		// Encoders finish out of order in a burst; park the picture under its
+		// capture sequence number and release everything that is now in order.
+		// A failed encode still takes its slot so it cannot stall the queue.
 		{
 			Mutex::Autolock lock(mBurstLock);
-#if 0 //TODO: enable burst mode later
-			if ( mBurst )
-			{
-				`(CAMERA_MSG_BURST_IMAGE, JPEGPictureMemBase, mCallbackCookie);
+			ssize_t index = mEncodeSeq.indexOfKey(src);
+
+			if (index >= 0) {
+				mPendingPictures.add(mEncodeSeq.valueAt(index), picture);
+				mEncodeSeq.removeItemsAt(index);
+				picture = NULL;
+				sendPendingPictures();
 			}
-			else
-#endif
-			{
-				LOGINFO("Send callback to application\n");
-				mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, picture, 0, NULL, mCallbackCookie);
+
+			index = mEncodeTimestamp.indexOfKey(src);
+			if (index >= 0) {
+				if (NULL != mPipelineStats.get()) {
+					mPipelineStats->frame(PipelineStats::STAGE_ENCODE,
+							systemTime(SYSTEM_TIME_MONOTONIC) - mEncodeTimestamp.valueAt(index));
+				}
+				mEncodeTimestamp.removeItemsAt(index);
+			}
+
+			if (NULL != mPipelineStats.get()) {
+				mPipelineStats->setOwned(PipelineStats::OWNER_ENCODER, mEncodeSeq.size());
 			}
 		}
 
@@ -316,23 +332,21 @@ exit:
 		if (thumb_jpeg) {
 			if (((Encoder_libjpeg::params *) thumb_jpeg)->dst) {
 				free(((Encoder_libjpeg::params *) thumb_jpeg)->dst);
+				MemoryAccounting::remove(MemoryAccounting::MEM_THUMBNAIL,
+						((Encoder_libjpeg::params *) thumb_jpeg)->dst_size);
 			}
 			free(thumb_jpeg);
 		}
 
-		if (encoded_mem) {
-			encoded_mem->release(encoded_mem);
-		}
-
-		if (picture) {
-			picture->release(picture);
-		}
+		releaseMemory(encoded_mem, MemoryAccounting::MEM_PICTURE);
+		releaseMemory(picture, MemoryAccounting::MEM_PICTURE);
 
 		if (cookie2) {
 			delete (ExifElementsTable*) cookie2;
 		}
 
 		if (mNotifierState == AppCallbackNotifier::NOTIFIER_STARTED) {
+			// returning the frame frees its capture ring slot for the next burst frame
 			encoder = gEncoderQueue.valueFor(src);
 			if (encoder.get()) {
 				gEncoderQueue.removeItem(src);
@@ -354,6 +368,7 @@ exit:
 		LOG_FUNCTION_NAME;
 
 		mMeasurementEnabled = false;
+		mFramesQueued = 0;
 
 		///Create the app notifier thread
 		mNotificationThread = new NotificationThread(this);
@@ -374,6 +389,9 @@ exit:
 
 		mUseMetaDataBufferMode = true;
 		mRawAvailable = false;
+		mBurst = false;
+		mEncodeSeqNext = 0;
+		mEncodeSeqSent = 0;
 
 		LOG_FUNCTION_NAME_EXIT;
 
@@ -401,6 +419,26 @@ exit:
 		LOG_FUNCTION_NAME_EXIT;
 	}
 
+	camera_memory_t* AppCallbackNotifier::requestMemory(size_t size, unsigned int count,
+			MemoryAccounting::Category category)
+	{
+		camera_memory_t* memory = mRequestMemory(-1, size, count, NULL);
+
+		if (NULL != memory) {
+			MemoryAccounting::add(category, memory->size);
+		}
+
+		return memory;
+	}
+
+	void AppCallbackNotifier::releaseMemory(camera_memory_t* memory, MemoryAccounting::Category category)
+	{
+		if (NULL != memory) {
+			MemoryAccounting::remove(category, memory->size);
+			memory->release(memory);
+		}
+	}
+
 	void AppCallbackNotifier::setMeasurements(bool enable)
 	{
 		Mutex::Autolock lock(mLock);
@@ -418,6 +456,11 @@ exit:
 	}
 
 
+	void AppCallbackNotifier::setPipelineStats(const sp<PipelineStats> &stats)
+	{
+		mPipelineStats = stats;
+	}
+
 	//All sub-components of Camera HAL call this whenever any error happens
 	void AppCallbackNotifier::errorNotify(int error)
 	{
@@ -623,7 +666,7 @@ exit:
 				goto exit;
 			}
 
-			picture = mRequestMemory(-1, frame->mLength, 1, NULL);
+			picture = requestMemory(frame->mLength, 1, MemoryAccounting::MEM_PICTURE);
 
 			if (NULL != picture) {
 				dest = picture->data;
@@ -642,7 +685,7 @@ exit:
 					mCameraHal->msgTypeEnabled(msgType)) {
 				mDataCb(msgType, picture, 0, NULL, mCallbackCookie);
 			}
-			picture->release(picture);
+			releaseMemory(picture, MemoryAccounting::MEM_PICTURE);
 		}
 	}
 
@@ -650,6 +693,7 @@ exit:
 	{
 		camera_memory_t* picture = NULL;
 		void* dest = NULL;
+		FrameTraceScope trace("copyAndSendPreviewFrame", frame->mSequence);
 
 		// scope for lock
 		{
@@ -667,7 +711,7 @@ exit:
 
 			dest = (void*) mPreviewBufs[mPreviewBufCount];
 
-			LOGINFO("%d:copy2Dto1D(%p, %p, %d, %d, %d, %d, %d,%s)",
+			LOGFRAME("%d:copy2Dto1D(%p, %p, %d, %d, %d, %d, %d,%s)",
 					__LINE__,
 					0,
 					frame->mBuffer,
@@ -713,6 +757,11 @@ exit:
 				mCameraHal->msgTypeEnabled(msgType) &&
 				(dest != NULL)) {
 			mDataCb(msgType, mPreviewMemory, mPreviewBufCount, NULL, mCallbackCookie);
+
+			if ( (CAMERA_MSG_PREVIEW_FRAME == msgType) && (NULL != mPipelineStats.get()) ) {
+				mPipelineStats->frame(PipelineStats::STAGE_PREVIEW_CALLBACK,
+						systemTime(SYSTEM_TIME_MONOTONIC) - frame->mTimestamp);
+			}
 		}
 
 		// increment for next buffer
@@ -774,10 +823,14 @@ exit:
 			}
 		}
 
+		// the depth this frame found, itself included
+		int32_t queued = android_atomic_dec(&mFramesQueued);
+		FrameTraceScope trace("notifyFrame");
+
 		bool ret = true;
 
 		frame = NULL;
-		LOGINFO("command %d, mDataCb %x, mCameraHal %x\n",msg.command, mDataCb, mCameraHal);
+		LOGFRAME("command %d, mDataCb %x, mCameraHal %x\n",msg.command, mDataCb, mCameraHal);
 
 		switch(msg.command)
 		{
@@ -788,6 +841,13 @@ exit:
 			{
 				break;
 			}
+			trace.setFrame(frame->mSequence, -1);
+
+			if ( NULL != mPipelineStats.get() )
+			{
+				mPipelineStats->queueDepth((CameraFrame::VIDEO_FRAME_SYNC == frame->mFrameType) ?
+						PipelineStats::STAGE_VIDEO : PipelineStats::STAGE_PREVIEW_CALLBACK, queued);
+			}
 
 			if ( (CameraFrame::RAW_FRAME == frame->mFrameType )&&
 					( NULL != mCameraHal ) &&
@@ -814,13 +874,12 @@ exit:
 					(NULL != mDataCb) &&
 					(CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG & frame->mQuirks) )
 			{
-				LOGINFO("notifyFrame CameraFrame::IMAGE_FRAME\n");
+				LOGINFO("notifyFrame CameraFrame::IMAGE_FRAME burst %d\n", mBurst);
 				int encode_quality = 100, tn_quality = 100;
 				int tn_width, tn_height;
-				unsigned int current_snapshot = 0;
 				Encoder_libjpeg::params *main_jpeg = NULL, *tn_jpeg = NULL;
 				void* exif_data = NULL;
-				camera_memory_t* raw_picture = mRequestMemory(-1, frame->mLength, 1, NULL);
+				camera_memory_t* raw_picture = requestMemory(frame->mLength, 1, MemoryAccounting::MEM_PICTURE);
 
 				if(raw_picture) {
 					buf = raw_picture->data;
@@ -848,8 +907,10 @@ exit:
 					main_jpeg->dst = (uint8_t*) buf;
 					main_jpeg->dst_size = frame->mLength;
 					main_jpeg->quality = encode_quality;
+					main_jpeg->target_size = mParameters.getInt(CameraProperties::JPEG_TARGET_SIZE);
 					main_jpeg->in_width = frame->mWidth;
 					main_jpeg->in_height = frame->mHeight;
+					main_jpeg->in_stride = frame->mAlignment;
 					main_jpeg->out_width = frame->mWidth;
 					main_jpeg->out_height = frame->mHeight;
 					main_jpeg->format = CameraParameters::PIXEL_FORMAT_YUV422I;
@@ -858,7 +919,13 @@ exit:
 				tn_width = mParameters.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH);
 				tn_height = mParameters.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT);
 
-				if ((tn_width > 0) && (tn_height > 0)) {
+				// over the memory budget the picture goes out without a thumbnail,
+				// which needs its jpeg output and a 24 bit RGB scratch
+				if ((tn_width > 0) && (tn_height > 0) &&
+						!MemoryAccounting::fits(tn_width * tn_height * 5)) {
+					LOGINFO("No thumbnail, %dx%d does not fit the memory budget", tn_width, tn_height);
+					MemoryAccounting::noteDegraded(MemoryAccounting::MEM_THUMBNAIL);
+				} else if ((tn_width > 0) && (tn_height > 0)) {
 					tn_jpeg = (Encoder_libjpeg::params*)
 						malloc(sizeof(Encoder_libjpeg::params));
 					// if malloc fails just keep going and encode main jpeg
@@ -868,19 +935,31 @@ exit:
 				}
 
 				if (tn_jpeg) {
-					int width, height;
-					mParameters.getPreviewSize(&width,&height);
-					current_snapshot = (mPreviewBufCount + MAX_BUFFERS - 1) % MAX_BUFFERS;
-					tn_jpeg->src = (uint8_t*) mPreviewBufs[current_snapshot];
-					tn_jpeg->src_size = mPreviewMemory->size / MAX_BUFFERS;
-					tn_jpeg->dst = (uint8_t*) malloc(tn_jpeg->src_size);
-					tn_jpeg->dst_size = tn_jpeg->src_size;
+					// Thumbnail is box-downscaled from the captured frame itself and
+					// encoded by the encoder's thumbnail thread alongside the main image.
+					// The output is bounded by what fits in the EXIF APP1 segment so
+					// it can be handed to jhead as-is.
+					tn_jpeg->src = (uint8_t*) frame->mBuffer;
+					tn_jpeg->src_size = frame->mLength;
+					tn_jpeg->dst_size = tn_width * tn_height * 2;
+					if (tn_jpeg->dst_size > EXIF_THUMBNAIL_MAX_SIZE) {
+						tn_jpeg->dst_size = EXIF_THUMBNAIL_MAX_SIZE;
+					}
+					tn_jpeg->dst = (uint8_t*) malloc(tn_jpeg->dst_size);
 					tn_jpeg->quality = tn_quality;
-					tn_jpeg->in_width = width;
-					tn_jpeg->in_height = height;
+					tn_jpeg->target_size = 0;
+					tn_jpeg->in_width = frame->mWidth;
+					tn_jpeg->in_height = frame->mHeight;
+					tn_jpeg->in_stride = frame->mAlignment;
 					tn_jpeg->out_width = tn_width;
 					tn_jpeg->out_height = tn_height;
-					tn_jpeg->format = CameraParameters::PIXEL_FORMAT_YUV420SP;;
+					tn_jpeg->format = CameraParameters::PIXEL_FORMAT_YUV422I;
+					if (!tn_jpeg->dst) {
+						free(tn_jpeg);
+						tn_jpeg = NULL;
+					} else {
+						MemoryAccounting::add(MemoryAccounting::MEM_THUMBNAIL, tn_jpeg->dst_size);
+					}
 				}
 
 				sp<Encoder_libjpeg> encoder = new Encoder_libjpeg(main_jpeg,
@@ -890,8 +969,16 @@ exit:
 						this,
 						raw_picture,
 						exif_data);
-				encoder->run();
+				{
+					Mutex::Autolock lock(mBurstLock);
+					mEncodeSeq.add(frame->mBuffer, mEncodeSeqNext++);
+					mEncodeTimestamp.add(frame->mBuffer, frame->mTimestamp);
+					if (NULL != mPipelineStats.get()) {
+						mPipelineStats->setOwned(PipelineStats::OWNER_ENCODER, mEncodeSeq.size());
+					}
+				}
 				gEncoderQueue.add(frame->mBuffer, encoder);
+				encoder->run();
 				encoder.clear();
 			}
 			else if ( ( CameraFrame::IMAGE_FRAME == frame->mFrameType ) &&
@@ -912,16 +999,7 @@ exit:
 #ifdef COPY_IMAGE_BUFFER
 				{
 					Mutex::Autolock lock(mBurstLock);
-#if 0 //TODO: enable burst mode later
-					if ( mBurst )
-					{
-						`(CAMERA_MSG_BURST_IMAGE, JPEGPictureMemBase, mCallbackCookie);
-					}
-					else
-#endif
-					{
-						copyAndSendPictureFrame(frame, CAMERA_MSG_COMPRESSED_IMAGE);
-					}
+					copyAndSendPictureFrame(frame, CAMERA_MSG_COMPRESSED_IMAGE);
 				}
 #else
 				//TODO: Find a way to map a Tiler buffer to a MemoryHeapBase
@@ -947,7 +1025,7 @@ exit:
 							break;
 						}
 
-						LOGINFO("mDataCbTimestamp : frame->mBuffer=0x%x, videoMetadataBuffer=0x%x, videoMedatadaBufferMemory=0x%x",
+						LOGFRAME("mDataCbTimestamp : frame->mBuffer=0x%x, videoMetadataBuffer=0x%x, videoMedatadaBufferMemory=0x%x",
 								frame->mBuffer, videoMetadataBuffer, videoMedatadaBufferMemory);
 
 						mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME,
@@ -967,6 +1045,14 @@ exit:
 						mDataCbTimestamp(frame->mTimestamp, CAMERA_MSG_VIDEO_FRAME, fakebuf, 0, mCallbackCookie);
 						fakebuf->release(fakebuf);
 					}
+
+					///Held by the recorder until releaseRecordingFrame()
+					if ( NULL != mPipelineStats.get() )
+					{
+						mPipelineStats->frame(PipelineStats::STAGE_VIDEO,
+								systemTime(SYSTEM_TIME_MONOTONIC) - frame->mTimestamp);
+						mPipelineStats->acquire(PipelineStats::OWNER_APP);
+					}
 				}
 				mRecordingLock.unlock();
 
@@ -1047,6 +1133,7 @@ exit:
 			{
 				msg.command = AppCallbackNotifier::NOTIFIER_CMD_PROCESS_FRAME;
 				msg.arg1 = frame;
+				android_atomic_inc(&mFramesQueued);
 				mFrameQ.put(&msg);
 			}
 			else
@@ -1067,6 +1154,7 @@ exit:
 		Mutex::Autolock lock(mLock);
 		while (!mFrameQ.isEmpty()) {
 			mFrameQ.get(&msg);
+			android_atomic_dec(&mFramesQueued);
 			frame = (CameraFrame*) msg.arg1;
 			if (frame) {
 				mFrameProvider->returnFrame(frame->mBuffer,
@@ -1219,7 +1307,7 @@ exit:
 				videoMedatadaBufferMemory = (camera_memory_t*) mVideoMetadataBufferMemoryMap.valueAt(i);
 				if(NULL != videoMedatadaBufferMemory)
 				{
-					videoMedatadaBufferMemory->release(videoMedatadaBufferMemory);
+					releaseMemory(videoMedatadaBufferMemory, MemoryAccounting::MEM_VIDEO_METADATA);
 					LOGINFO("Released  videoMedatadaBufferMemory=0x%x", videoMedatadaBufferMemory);
 				}
 			}
@@ -1324,7 +1412,8 @@ exit:
 			mPreviewPixelFormat = CameraParameters::PIXEL_FORMAT_RGB565;
 		}
 
-		mPreviewMemory = mRequestMemory(-1, size, AppCallbackNotifier::MAX_BUFFERS, NULL);
+		mPreviewMemory = requestMemory(size, AppCallbackNotifier::MAX_BUFFERS,
+				MemoryAccounting::MEM_PREVIEW_CALLBACK);
 		if (!mPreviewMemory) {
 			return NO_MEMORY;
 		}
@@ -1357,6 +1446,36 @@ exit:
 		LOG_FUNCTION_NAME_EXIT;
 	}
 
+	/**
+	  @brief Delivers finished jpegs to the application in capture order.
+
+	  Must be called with mBurstLock held.
+	  */
+	void AppCallbackNotifier::sendPendingPictures()
+	{
+		LOG_FUNCTION_NAME;
+
+		ssize_t index;
+
+		while ((index = mPendingPictures.indexOfKey(mEncodeSeqSent)) >= 0) {
+			camera_memory_t* picture = mPendingPictures.valueAt(index);
+			mPendingPictures.removeItemsAt(index);
+
+			// Send the callback to the application only if the notifier is started and the message is enabled
+			if (picture && (mNotifierState == AppCallbackNotifier::NOTIFIER_STARTED) &&
+					(mCameraHal->msgTypeEnabled(CAMERA_MSG_COMPRESSED_IMAGE))) {
+				LOGINFO("Send picture %u to application, burst %d\n", mEncodeSeqSent, mBurst);
+				mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, picture, 0, NULL, mCallbackCookie);
+			}
+
+			releaseMemory(picture, MemoryAccounting::MEM_PICTURE);
+
+			mEncodeSeqSent++;
+		}
+
+		LOG_FUNCTION_NAME_EXIT;
+	}
+
 	void AppCallbackNotifier::useVideoBuffers(bool useVideoBuffers)
 	{
 		LOG_FUNCTION_NAME;
@@ -1413,7 +1532,7 @@ exit:
 
 		{
 			Mutex::Autolock lock(mLock);
-			mPreviewMemory->release(mPreviewMemory);
+			releaseMemory(mPreviewMemory, MemoryAccounting::MEM_PREVIEW_CALLBACK);
 		}
 
 		mPreviewing = false;
@@ -1483,7 +1602,8 @@ exit:
 
 			for (uint32_t i = 0; i < count; i++)
 			{
-				videoMedatadaBufferMemory = mRequestMemory(-1, sizeof(video_metadata_t), 1, NULL);
+				videoMedatadaBufferMemory = requestMemory(sizeof(video_metadata_t), 1,
+						MemoryAccounting::MEM_VIDEO_METADATA);
 				if((NULL == videoMedatadaBufferMemory) || (NULL == videoMedatadaBufferMemory->data))
 				{
 					LOGINFO("Error! Could not allocate memory for Video Metadata Buffers");
@@ -1539,6 +1659,12 @@ exit:
 
 		mRecording = false;
 
+		///Whatever the recorder still holds is not counted against it any more
+		if ( NULL != mPipelineStats.get() )
+		{
+			mPipelineStats->setOwned(PipelineStats::OWNER_APP, 0);
+		}
+
 		LOG_FUNCTION_NAME_EXIT;
 
 		return ret;
@@ -1571,7 +1697,7 @@ exit:
 		{
 			video_metadata_t *videoMetadataBuffer = (video_metadata_t *) mem ;
 			frame = (void*) mVideoMetadataBufferReverseMap.valueFor((uint32_t) videoMetadataBuffer);
-			LOGINFO("Releasing frame with videoMetadataBuffer=0x%x, videoMetadataBuffer->handle=0x%x & frame handle=0x%x\n",
+			LOGFRAME("Releasing frame with videoMetadataBuffer=0x%x, videoMetadataBuffer->handle=0x%x & frame handle=0x%x\n",
 					videoMetadataBuffer, videoMetadataBuffer->handle, frame);
 		}
 		else
@@ -1584,6 +1710,11 @@ exit:
 			ret = mFrameProvider->returnFrame(frame, CameraFrame::VIDEO_FRAME_SYNC);
 		}
 
+		if ( NULL != mPipelineStats.get() )
+		{
+			mPipelineStats->release(PipelineStats::OWNER_APP);
+		}
+
 		LOG_FUNCTION_NAME_EXIT;
 
 		return ret;
@@ -1676,6 +1807,22 @@ exit:
 			gEncoderQueue.removeItemsAt(0);
 		}
 
+		{
+			Mutex::Autolock lock(mBurstLock);
+
+			for (size_t i = 0; i < mPendingPictures.size(); i++) {
+				releaseMemory(mPendingPictures.valueAt(i), MemoryAccounting::MEM_PICTURE);
+			}
+			mPendingPictures.clear();
+			mEncodeSeq.clear();
+			mEncodeTimestamp.clear();
+			mEncodeSeqNext = 0;
+			if (NULL != mPipelineStats.get()) {
+				mPipelineStats->setOwned(PipelineStats::OWNER_ENCODER, 0);
+			}
+			mEncodeSeqSent = 0;
+		}
+
 		LOG_FUNCTION_NAME_EXIT;
 		return NO_ERROR;
 	}
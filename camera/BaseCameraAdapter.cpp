@@ -40,6 +40,8 @@ namespace android {
 		mCaptureBuffers = NULL;
 		mCaptureBuffersCount = 0;
 		mCaptureBuffersLength = 0;
+		mCaptureBuffersStride = 0;
+		mBurstFrames = 1;
 
 		mPreviewDataBuffers = NULL;
 		mPreviewDataBuffersCount = 0;
@@ -94,6 +96,13 @@ namespace android {
 		return ret;
 	}
 
+	status_t BaseCameraAdapter::updateParameters(const CameraParameters& params,
+			const ParameterStore::ChangeSet& changes)
+	{
+		// adapters that cannot apply single keys take the whole set
+		return setParameters(params);
+	}
+
 	status_t BaseCameraAdapter::setErrorHandler(ErrorNotifier *errorNotifier)
 	{
 		status_t ret = NO_ERROR;
@@ -116,6 +125,11 @@ namespace android {
 		return ret;
 	}
 
+	void BaseCameraAdapter::setPipelineStats(const sp<PipelineStats> &stats)
+	{
+		mPipelineStats = stats;
+	}
+
 	void BaseCameraAdapter::enableMsgType(int32_t msgs, frame_callback callback, event_callback eventCb, void* cookie)
 	{
 		Mutex::Autolock lock(mSubscriberLock);
@@ -262,7 +276,7 @@ namespace android {
 			mFramesWithEncoder--;
 		}
 		
-		LOGINFO("REFCOUNT 0x%x %d", frameBuf, refCount);
+		LOGFRAME("REFCOUNT 0x%x %d", frameBuf, refCount);
 
 		if ( 0 < refCount )
 		{
@@ -419,18 +433,26 @@ namespace android {
 			if ( ret == NO_ERROR )
 			{
 				Mutex::Autolock lock(mCaptureBufferLock);
-				mCaptureBuffers = (int *) desc->mBuffers;
-				mCaptureBuffersLength = desc->mLength;
-				mCaptureBuffersAvailable.clear();
-				for ( uint32_t i = 0 ; i < desc->mMaxQueueable ; i++ )
-				{
-					mCaptureBuffersAvailable.add(mCaptureBuffers[i], 0);
-				}
-				// initial ref count for undeqeueued buffers is 1 since buffer provider
-				// is still holding on to it
-				for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ )
+				// The same ring handed in again keeps its refcounts, slots
+				// may still be with the encoder from the previous shot
+				if ( ( mCaptureBuffers != (int *) desc->mBuffers ) ||
+						( mCaptureBuffersCount != (int) desc->mCount ) )
 				{
-					mCaptureBuffersAvailable.add(mCaptureBuffers[i], 1);
+					mCaptureBuffers = (int *) desc->mBuffers;
+					mCaptureBuffersLength = desc->mLength;
+					mCaptureBuffersStride = desc->mStride;
+					mCaptureBuffersCount = desc->mCount;
+					mCaptureBuffersAvailable.clear();
+					for ( uint32_t i = 0 ; i < desc->mMaxQueueable ; i++ )
+					{
+						mCaptureBuffersAvailable.add(mCaptureBuffers[i], 0);
+					}
+					// initial ref count for undeqeueued buffers is 1 since buffer provider
+					// is still holding on to it
+					for ( uint32_t i = desc->mMaxQueueable ; i < desc->mCount ; i++ )
+					{
+						mCaptureBuffersAvailable.add(mCaptureBuffers[i], 1);
+					}
 				}
 			}
 
@@ -653,6 +675,7 @@ namespace android {
 
 				if ( ret == NO_ERROR )
 				{
+					mBurstFrames = ( value1 > 1 ) ? value1 : 1;
 					ret = takePicture();
 				}
 
@@ -1069,7 +1092,7 @@ namespace android {
 			return -EINVAL;
 		}
 
-		LOGINFO("iiiiiii frame.mFrameType %d\n", frame->mFrameType);
+		LOGFRAME("iiiiiii frame.mFrameType %d\n", frame->mFrameType);
 		switch (frame->mFrameType) {
 		case CameraFrame::IMAGE_FRAME:
 			{
@@ -1124,6 +1147,7 @@ EXIT:
 		size_t refCount = 0;
 		status_t ret = NO_ERROR;
 		frame_callback callback = NULL;
+		FrameTraceScope trace("sendFrameToSubscribers", frame->mSequence);
 
 		frame->mFrameType = frameType;
 		if (NULL != subscribers) {
@@ -1135,7 +1159,7 @@ EXIT:
 					LOGINFO("callback not set for frame type: 0x%x", frameType);
 					return -EINVAL;
 				}
-				LOGINFO("Post frame to callback %x\n",callback);
+				LOGFRAME("Post frame to callback %x\n",callback);
 				callback(frame);
 			}
 		} else {
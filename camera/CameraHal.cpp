@@ -28,6 +28,7 @@
 #include "ANativeWindowDisplayAdapter.h"
 #include "V4LCameraAdapter.h"
 #include "CameraProperties.h"
+#include "Encoder_libjpeg.h"
 #include <cutils/properties.h>
 
 #include <poll.h>
@@ -176,6 +177,17 @@ namespace android {
 		}
 
 
+		///Without a device there is no frame provider, only the failed open is reported
+		if ( NO_ERROR != mOpenStatus )
+		{
+			if ( msgType & CAMERA_MSG_ERROR )
+			{
+				mAppCallbackNotifier->errorNotify(mOpenStatus);
+			}
+			LOG_FUNCTION_NAME_EXIT;
+			return;
+		}
+
 		///Configure app callback notifier with the message callback required
 		mAppCallbackNotifier->enableMsgType (msgType);
 
@@ -204,7 +216,10 @@ namespace android {
 		}
 
 		///Configure app callback notifier
-		mAppCallbackNotifier->disableMsgType (msgType);
+		if ( NO_ERROR == mOpenStatus )
+		{
+			mAppCallbackNotifier->disableMsgType (msgType);
+		}
 
 		LOG_FUNCTION_NAME_EXIT;
 	}
@@ -253,518 +268,135 @@ namespace android {
 	/**
 	  @brief Set the camera parameters.
 
+	  Only the keys that differ from the current set are validated and applied.
+	  Keys the adapter applies live are pushed to it right away while previewing,
+	  keys that change the stream format restart the preview.
+
 	  @param[in] params Camera parameters to configure the camera
 	  @return NO_ERROR
-	  @todo Define error codes
+	  @return -EINVAL if any changed key holds an unsupported value, nothing is applied then
 
 */
 	int CameraHal::setParameters(const CameraParameters& params)
 	{
-
-		LOG_FUNCTION_NAME;
-
-		return NO_ERROR;
-
-		LOG_FUNCTION_NAME_EXIT;
-		// TODO: Wether need to set parameters here need to discuss later!
-
-		int w, h;
-		int w_orig, h_orig;
-		int framerate,minframerate;
-		int maxFPS, minFPS;
-		int error;
-		int base;
+		ParameterStore::ChangeSet changes;
+		ParameterStore::ChangeSet adapterChanges;
 		const char *valstr = NULL;
-		const char *prevFormat;
-		char *af_coord;
+		int oldWidth, oldHeight, w, h;
+		int minFPS, maxFPS;
 		status_t ret = NO_ERROR;
-		// Needed for KEY_RECORDING_HINT
-		bool restartPreviewRequired = false;
-		bool updateRequired = false;
-		CameraParameters oldParams(mParameters.flatten());
-		bool videoMode = false;
-		char range[MAX_PROP_VALUE_LENGTH];
 
-		Mutex::Autolock lock(mLock);
-
-		///Ensure that preview is not enabled when the below parameters are changed.
-		if(!previewEnabled())
-		{
-
-			LOGINFO("PreviewFormat %s", params.getPreviewFormat());
-
-			if ((valstr = params.getPreviewFormat()) != NULL) {
-				if ( isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FORMATS))) {
-					mParameters.setPreviewFormat(valstr);
-				} else {
-					LOGINFO("Invalid preview format.Supported: %s",  mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FORMATS));
-					return -EINVAL;
-				}
-			}
+		LOG_FUNCTION_NAME;
 
-			if ((valstr = params.get(CameraParameters::KEY_VIDEO_STABILIZATION)) != NULL) {
-				// make sure we support vstab...if we don't and application is trying to set
-				// vstab then return an error
-				if (strcmp(mCameraProperties->get(CameraProperties::VSTAB_SUPPORTED),
-							CameraParameters::TRUE) == 0) {
-					LOGINFO("VSTAB %s",
-							params.get(CameraParameters::KEY_VIDEO_STABILIZATION));
-					mParameters.set(CameraParameters::KEY_VIDEO_STABILIZATION,
-							params.get(CameraParameters::KEY_VIDEO_STABILIZATION));
-				} else if (strcmp(valstr, CameraParameters::TRUE) == 0) {
-					LOGINFO("ERROR: Invalid VSTAB: %s", valstr);
-					ret = -EINVAL;
-				} else {
-					mParameters.set(CameraParameters::KEY_VIDEO_STABILIZATION,
-							CameraParameters::FALSE);
-				}
-			}
+		Mutex::Autolock lock(mLock);
 
+		if ( NO_ERROR != mParameterStore.update(params, changes) ) {
+			LOG_FUNCTION_NAME_EXIT;
+			return -EINVAL;
 		}
 
-		params.getPreviewSize(&w, &h);
-		if (w == -1 && h == -1) {
-			LOGINFO("Unable to get preview size");
-			return -EINVAL;
+		///Applications hand back the whole set on every call, usually with nothing changed
+		if ( changes.isEmpty() ) {
+			LOG_FUNCTION_NAME_EXIT;
+			return NO_ERROR;
 		}
 
-		int oldWidth, oldHeight;
 		mParameters.getPreviewSize(&oldWidth, &oldHeight);
+		mParameterStore.apply(changes, mParameters);
 
-		int orientation =0;
-
-		if(orientation ==90 || orientation ==270)
-		{
-			/*if ( !isResolutionValid(h,w, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIZES)))
-			  {
-			  LOGINFO("Invalid preview resolution %d x %d", w, h);
-			  return -EINVAL;
-			  }
-			  else*/
-			{
-				mParameters.setPreviewSize(w, h);
-				mVideoWidth = w;
-				mVideoHeight = h;
-			}
-		}
-		else
-		{
-			/*if ( !isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_SIZES)))
-			  {
-			  LOGINFO("Invalid preview resolution %d x %d", w, h);
-			  return -EINVAL;
-			  }
-			  else*/
-			{
-				mParameters.setPreviewSize(w, h);
-			}
-		}
-
-		if ( ( oldWidth != w ) || ( oldHeight != h ) )
-		{
-			restartPreviewRequired |= true;
+		// Variable framerate ranges have higher priority over
+		// deprecated constant FPS.
+		if ( changes.has(ParameterStore::PARAM_PREVIEW_FPS_RANGE) ) {
+			mParameterStore.getPair(ParameterStore::PARAM_PREVIEW_FPS_RANGE, minFPS, maxFPS);
+			LOGINFO("FPS range %d - %d", minFPS, maxFPS);
+			mParameters.setPreviewFrameRate(maxFPS / CameraHal::VFR_SCALE);
 		}
 
-		LOGINFO("PreviewResolution by App %d x %d", w, h);
-
 		// Handle RECORDING_HINT to Set/Reset Video Mode Parameters
-		valstr = params.get(CameraParameters::KEY_RECORDING_HINT);
-		if(valstr != NULL)
-		{
-			if(strcmp(valstr, CameraParameters::TRUE) == 0)
-			{
-				LOGINFO("Recording Hint is set to %s", valstr);
-				mParameters.set(CameraParameters::KEY_RECORDING_HINT, valstr);
-				videoMode = true;
-				int w, h;
-
-				params.getPreviewSize(&w, &h);
-				LOGINFO("%s Preview Width=%d Height=%d\n", __FUNCTION__, w, h);
-				//HACK FOR MMS
-				mVideoWidth = w;
-				mVideoHeight = h;
-				LOGINFO("%s Video Width=%d Height=%d\n", __FUNCTION__, mVideoWidth, mVideoHeight);
-
-				setPreferredPreviewRes(w, h);
-				mParameters.getPreviewSize(&w, &h);
-				LOGINFO("%s Preview Width=%d Height=%d\n", __FUNCTION__, w, h);
-				//Avoid restarting preview for MMS HACK
-				if ((w != mVideoWidth) && (h != mVideoHeight))
-				{
-					restartPreviewRequired = false;
-				}
-
-				restartPreviewRequired |= setVideoModeParameters(params);
-			}
-			else if(strcmp(valstr, CameraParameters::FALSE) == 0)
-			{
-				LOGINFO("Recording Hint is set to %s", valstr);
-				mParameters.set(CameraParameters::KEY_RECORDING_HINT, valstr);
-				restartPreviewRequired |= resetVideoModeParameters();
-				params.getPreviewSize(&mVideoWidth, &mVideoHeight);
-			}
-			else
-			{
-				LOGINFO("Invalid RECORDING_HINT");
-				return -EINVAL;
+		if ( changes.has(ParameterStore::PARAM_RECORDING_HINT) ||
+				changes.has(ParameterStore::PARAM_PREVIEW_SIZE) ) {
+			// the store keeps the size the application asked for, start over from it
+			if ( mParameterStore.isSet(ParameterStore::PARAM_PREVIEW_SIZE) ) {
+				mParameters.set(CameraParameters::KEY_PREVIEW_SIZE,
+						mParameterStore.getString(ParameterStore::PARAM_PREVIEW_SIZE));
 			}
-		}
-		else
-		{
-			// This check is required in following case.
-			// If VideoRecording activity sets KEY_RECORDING_HINT to TRUE and
-			// ImageCapture activity doesnot set KEY_RECORDING_HINT to FALSE (i.e. simply NULL),
-			// then Video Mode parameters may remain present in ImageCapture activity as well.
-			LOGINFO("Recording Hint is set to NULL");
-			mParameters.set(CameraParameters::KEY_RECORDING_HINT, "");
-			restartPreviewRequired |= resetVideoModeParameters();
-			params.getPreviewSize(&mVideoWidth, &mVideoHeight);
-		}
-
-		if ((valstr = params.get(CameraParameters::KEY_FOCUS_MODE)) != NULL) {
-			if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_FOCUS_MODES))) {
-				LOGINFO("Focus mode set %s", params.get(CameraParameters::KEY_FOCUS_MODE));
-
-				// we need to take a decision on the capture mode based on whether CAF picture or
-				// video is chosen so the behavior of each is consistent to the application
-				if(strcmp(valstr, CameraParameters::FOCUS_MODE_CONTINUOUS_PICTURE) == 0){
-					restartPreviewRequired |= resetVideoModeParameters();
-				} else if (strcmp(valstr, CameraParameters::FOCUS_MODE_CONTINUOUS_VIDEO) == 0){
-					restartPreviewRequired |= setVideoModeParameters(params);
-				}
+			mParameters.getPreviewSize(&mVideoWidth, &mVideoHeight);
 
-				mParameters.set(CameraParameters::KEY_FOCUS_MODE, valstr);
-			} else {
-				LOGINFO("ERROR: Invalid FOCUS mode = %s", valstr);
-				ret = -EINVAL;
+			valstr = mParameters.get(CameraParameters::KEY_RECORDING_HINT);
+			if ( (NULL != valstr) && (strcmp(valstr, CameraParameters::TRUE) == 0) ) {
+				//HACK FOR MMS
+				setPreferredPreviewRes(mVideoWidth, mVideoHeight);
 			}
+			LOGINFO("%s Video Width=%d Height=%d", __FUNCTION__, mVideoWidth, mVideoHeight);
 		}
 
-		///Below parameters can be changed when the preview is running
-		if ( (valstr = params.getPictureFormat()) != NULL ) {
-			if (isParameterValid(params.getPictureFormat(),mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_FORMATS))) {
-				mParameters.setPictureFormat(valstr);
-			} else {
-				LOGINFO("ERROR: Invalid picture format: %s",valstr);
-				ret = -EINVAL;
-			}
-		}
+		adapterChanges = changes.only(ParameterStore::APPLY_LIVE);
+		adapterChanges.merge(changes.only(ParameterStore::APPLY_RESTART));
 
-		params.getPictureSize(&w, &h);
-		if ( isResolutionValid(w, h, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SIZES))) {
-			mParameters.setPictureSize(w, h);
+		///What the stream runs at may differ from what was asked for, only a real move restarts it
+		mParameters.getPreviewSize(&w, &h);
+		if ( ( w != oldWidth ) || ( h != oldHeight ) ) {
+			adapterChanges.add(ParameterStore::PARAM_PREVIEW_SIZE);
 		} else {
-			LOGINFO("ERROR: Invalid picture resolution %dx%d", w, h);
-			ret = -EINVAL;
+			adapterChanges.remove(ParameterStore::PARAM_PREVIEW_SIZE);
 		}
 
-		LOGINFO("Picture Size by App %d x %d", w, h);
+		mAdapterChanges.merge(adapterChanges);
 
-		framerate = params.getPreviewFrameRate();
-		valstr = params.get(CameraParameters::KEY_PREVIEW_FPS_RANGE);
-		LOGINFO("FRAMERATE %d", framerate);
-
-		LOGINFO("Passed FRR: %s, Supported FRR %s", valstr
-				, mCameraProperties->get(CameraProperties::FRAMERATE_RANGE_SUPPORTED));
-		LOGINFO("Passed FR: %d, Supported FR %s", framerate
-				, mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FRAME_RATES));
-
-
-		//Perform parameter validation
-		if(!isParameterValid(valstr
-					, mCameraProperties->get(CameraProperties::FRAMERATE_RANGE_SUPPORTED))
-				|| !isParameterValid(framerate,
-					mCameraProperties->get(CameraProperties::SUPPORTED_PREVIEW_FRAME_RATES)))
-		{
-			LOGINFO("Invalid frame rate range or frame rate");
-			return -EINVAL;
-		}
-
-		// Variable framerate ranges have higher priority over
-		// deprecated constant FPS. "KEY_PREVIEW_FPS_RANGE" should
-		// be cleared by the client in order for constant FPS to get
-		// applied.
-		if ( strcmp(valstr, mCameraProperties->get(CameraProperties::FRAMERATE_RANGE))  != 0)
-		{
-			// APP wants to set FPS range
-			//Set framerate = MAXFPS
-			LOGINFO("APP IS CHANGING FRAME RATE RANGE");
-			params.getPreviewFpsRange(&minFPS, &maxFPS);
-
-			if ( ( 0 > minFPS ) || ( 0 > maxFPS ) )
-			{
-				LOGINFO("ERROR: FPS Range is negative!");
-				return -EINVAL;
-			}
-
-			framerate = maxFPS /CameraHal::VFR_SCALE;
-
-		}
-		else
-		{
-			if ( framerate != atoi(mCameraProperties->get(CameraProperties::PREVIEW_FRAME_RATE)) )
-			{
-				selectFPSRange(framerate, &minFPS, &maxFPS);
-				LOGINFO("Select FPS Range %d %d", minFPS, maxFPS);
-			}
-			else
-			{
-				if (videoMode) {
-					valstr = mCameraProperties->get(CameraProperties::FRAMERATE_RANGE_VIDEO);
-					CameraParameters temp;
-					temp.set(CameraParameters::KEY_PREVIEW_FPS_RANGE, valstr);
-					temp.getPreviewFpsRange(&minFPS, &maxFPS);
-				}
-				else {
-					valstr = mCameraProperties->get(CameraProperties::FRAMERATE_RANGE_IMAGE);
-					CameraParameters temp;
-					temp.set(CameraParameters::KEY_PREVIEW_FPS_RANGE, valstr);
-					temp.getPreviewFpsRange(&minFPS, &maxFPS);
-				}
-
-				framerate = maxFPS / CameraHal::VFR_SCALE;
-			}
-
-		}
-
-		LOGINFO("FPS Range = %s", valstr);
-		LOGINFO("DEFAULT FPS Range = %s", mCameraProperties->get(CameraProperties::FRAMERATE_RANGE));
-
-		minFPS /= CameraHal::VFR_SCALE;
-		maxFPS /= CameraHal::VFR_SCALE;
-
-		if ( ( 0 == minFPS ) || ( 0 == maxFPS ) )
-		{
-			LOGINFO("ERROR: FPS Range is invalid!");
-			ret = -EINVAL;
-		}
-
-		if ( maxFPS < minFPS )
-		{
-			LOGINFO("ERROR: Max FPS is smaller than Min FPS!");
-			ret = -EINVAL;
-		}
-		LOGINFO("SET FRAMERATE %d", framerate);
-		mParameters.setPreviewFrameRate(framerate);
-		mParameters.set(CameraParameters::KEY_PREVIEW_FPS_RANGE, params.get(CameraParameters::KEY_PREVIEW_FPS_RANGE));
-
-		if ((valstr = params.get(CameraParameters::KEY_WHITE_BALANCE)) != NULL) {
-			if ( isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_WHITE_BALANCE))) {
-				LOGINFO("White balance set %s", valstr);
-				mParameters.set(CameraParameters::KEY_WHITE_BALANCE, valstr);
-			} else {
-				LOGINFO("ERROR: Invalid white balance  = %s", valstr);
-				ret = -EINVAL;
-			}
-		}
-
-
-		if ((valstr = params.get(CameraParameters::KEY_ANTIBANDING)) != NULL) {
-			if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_ANTIBANDING))) {
-				LOGINFO("Antibanding set %s", valstr);
-				mParameters.set(CameraParameters::KEY_ANTIBANDING, valstr);
-			} else {
-				LOGINFO("ERROR: Invalid Antibanding = %s", valstr);
-				ret = -EINVAL;
-			}
-		}
-
-		if( (valstr = params.get(CameraParameters::KEY_FOCUS_AREAS)) != NULL )
-		{
-			LOGINFO("Focus areas position set %s", params.get(CameraParameters::KEY_FOCUS_AREAS));
-			mParameters.set(CameraParameters::KEY_FOCUS_AREAS, valstr);
-		}
-
-
-		if( (valstr = params.get(CameraParameters::KEY_EXPOSURE_COMPENSATION)) != NULL)
-		{
-			LOGINFO("Exposure compensation set %s", params.get(CameraParameters::KEY_EXPOSURE_COMPENSATION));
-			mParameters.set(CameraParameters::KEY_EXPOSURE_COMPENSATION, valstr);
-		}
-
-		if ((valstr = params.get(CameraParameters::KEY_SCENE_MODE)) != NULL) {
-			if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_SCENE_MODES))) {
-				LOGINFO("Scene mode set %s", valstr);
-				doesSetParameterNeedUpdate(valstr,
-						mParameters.get(CameraParameters::KEY_SCENE_MODE),
-						updateRequired);
-				mParameters.set(CameraParameters::KEY_SCENE_MODE, valstr);
-			} else {
-				LOGINFO("ERROR: Invalid Scene mode = %s", valstr);
-				ret = -EINVAL;
-			}
+		if ( NULL != mAppCallbackNotifier.get() ) {
+			mAppCallbackNotifier->setParameters(mParameters);
 		}
 
-		if ((valstr = params.get(CameraParameters::KEY_FLASH_MODE)) != NULL) {
-			if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_FLASH_MODES))) {
-				LOGINFO("Flash mode set %s", valstr);
-				mParameters.set(CameraParameters::KEY_FLASH_MODE, valstr);
-			} else {
-				LOGINFO("ERROR: Invalid Flash mode = %s", valstr);
-				ret = -EINVAL;
+		// A new stream format needs a preview restart, which is not done while recording;
+		// the format then waits for the next start and the live keys are applied now
+		if ( mAdapterChanges.needs(ParameterStore::APPLY_RESTART) && previewEnabled() && !mRecordingEnabled ) {
+			LOGINFO("Restarting Preview");
+			ret = restartPreview();
+		} else {
+			if ( mAdapterChanges.needs(ParameterStore::APPLY_RESTART) && !previewEnabled() &&
+					mDisplayPaused && !mRecordingEnabled ) {
+				LOGINFO("Stopping Preview");
+				forceStopPreview();
 			}
-		}
 
-		if ((valstr = params.get(CameraParameters::KEY_EFFECT)) != NULL) {
-			if (isParameterValid(valstr, mCameraProperties->get(CameraProperties::SUPPORTED_EFFECTS))) {
-				LOGINFO("Effect set %s", valstr);
-				mParameters.set(CameraParameters::KEY_EFFECT, valstr);
-			} else {
-				LOGINFO("ERROR: Invalid Effect = %s", valstr);
-				ret = -EINVAL;
+			if ( mPreviewEnabled ) {
+				ret = applyAdapterParameters(false);
 			}
 		}
 
-		if(( (valstr = params.get(CameraParameters::KEY_ROTATION)) != NULL)
-				&& (params.getInt(CameraParameters::KEY_ROTATION) >=0))
-		{
-			LOGINFO("Rotation set %s", params.get(CameraParameters::KEY_ROTATION));
-			mParameters.set(CameraParameters::KEY_ROTATION, valstr);
-		}
-
-		if(( (valstr = params.get(CameraParameters::KEY_JPEG_QUALITY)) != NULL)
-				&& (params.getInt(CameraParameters::KEY_JPEG_QUALITY) >=0))
-		{
-			LOGINFO("Jpeg quality set %s", params.get(CameraParameters::KEY_JPEG_QUALITY));
-			mParameters.set(CameraParameters::KEY_JPEG_QUALITY, valstr);
-		}
-
-		if(( (valstr = params.get(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH)) != NULL)
-				&& (params.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH) >=0))
-		{
-			LOGINFO("Thumbnail width set %s", params.get(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH));
-			mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH, valstr);
-		}
-
-		if(( (valstr = params.get(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT)) != NULL)
-				&& (params.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT) >=0))
-		{
-			LOGINFO("Thumbnail width set %s", params.get(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT));
-			mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT, valstr);
-		}
-
-		if(( (valstr = params.get(CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY)) != NULL )
-				&& (params.getInt(CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY) >=0))
-		{
-			LOGINFO("Thumbnail quality set %s", params.get(CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY));
-			mParameters.set(CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY, valstr);
-		}
-
-		if( (valstr = params.get(CameraParameters::KEY_GPS_LATITUDE)) != NULL )
-		{
-			LOGINFO("GPS latitude set %s", params.get(CameraParameters::KEY_GPS_LATITUDE));
-			mParameters.set(CameraParameters::KEY_GPS_LATITUDE, valstr);
-		}else{
-			mParameters.remove(CameraParameters::KEY_GPS_LATITUDE);
-		}
-
-		if( (valstr = params.get(CameraParameters::KEY_GPS_LONGITUDE)) != NULL )
-		{
-			LOGINFO("GPS longitude set %s", params.get(CameraParameters::KEY_GPS_LONGITUDE));
-			mParameters.set(CameraParameters::KEY_GPS_LONGITUDE, valstr);
-		}else{
-			mParameters.remove(CameraParameters::KEY_GPS_LONGITUDE);
-		}
-
-		if( (valstr = params.get(CameraParameters::KEY_GPS_ALTITUDE)) != NULL )
-		{
-			LOGINFO("GPS altitude set %s", params.get(CameraParameters::KEY_GPS_ALTITUDE));
-			mParameters.set(CameraParameters::KEY_GPS_ALTITUDE, valstr);
-		}else{
-			mParameters.remove(CameraParameters::KEY_GPS_ALTITUDE);
-		}
-
-		if( (valstr = params.get(CameraParameters::KEY_GPS_TIMESTAMP)) != NULL )
-		{
-			LOGINFO("GPS timestamp set %s", params.get(CameraParameters::KEY_GPS_TIMESTAMP));
-			mParameters.set(CameraParameters::KEY_GPS_TIMESTAMP, valstr);
-		}else{
-			mParameters.remove(CameraParameters::KEY_GPS_TIMESTAMP);
-		}
-
-		if( (valstr = params.get(CameraParameters::KEY_GPS_PROCESSING_METHOD)) != NULL )
+		if (ret != NO_ERROR)
 		{
-			LOGINFO("GPS processing method set %s", params.get(CameraParameters::KEY_GPS_PROCESSING_METHOD));
-			mParameters.set(CameraParameters::KEY_GPS_PROCESSING_METHOD, valstr);
-		}else{
-			mParameters.remove(CameraParameters::KEY_GPS_PROCESSING_METHOD);
+			LOGINFO("Failed to apply parameters %d", ret);
 		}
 
-		if ((valstr = params.get(CameraParameters::KEY_ZOOM)) != NULL ) {
-			if ((params.getInt(CameraParameters::KEY_ZOOM) >= 0 ) &&
-					(params.getInt(CameraParameters::KEY_ZOOM) <= mMaxZoomSupported )) {
-				LOGINFO("Zoom set %s", valstr);
-				doesSetParameterNeedUpdate(valstr,
-						mParameters.get(CameraParameters::KEY_ZOOM),
-						updateRequired);
-				mParameters.set(CameraParameters::KEY_ZOOM, valstr);
-			} else {
-				LOGINFO("ERROR: Invalid Zoom: %s", valstr);
-				ret = -EINVAL;
-			}
-		}
+		LOG_FUNCTION_NAME_EXIT;
 
-		if( (valstr = params.get(CameraParameters::KEY_AUTO_EXPOSURE_LOCK)) != NULL )
-		{
-			LOGINFO("Auto Exposure Lock set %s", params.get(CameraParameters::KEY_AUTO_EXPOSURE_LOCK));
-			doesSetParameterNeedUpdate(valstr,
-					mParameters.get(CameraParameters::KEY_AUTO_EXPOSURE_LOCK),
-					updateRequired);
-			mParameters.set(CameraParameters::KEY_AUTO_EXPOSURE_LOCK, valstr);
-		}
+		return ret;
+	}
 
-		if( (valstr = params.get(CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK)) != NULL )
-		{
-			LOGINFO("Auto WhiteBalance Lock set %s", params.get(CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK));
-			doesSetParameterNeedUpdate(valstr,
-					mParameters.get(CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK),
-					updateRequired);
-			mParameters.set(CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK, valstr);
-		}
-		if( (valstr = params.get(CameraParameters::KEY_METERING_AREAS)) != NULL )
-		{
-			LOGINFO("Metering areas position set %s", params.get(CameraParameters::KEY_METERING_AREAS));
-			mParameters.set(CameraParameters::KEY_METERING_AREAS, valstr);
-		}
+	/**
+	  @brief Pushes the parameters changed since the last push to the adapter.
 
-		CameraParameters adapterParams = mParameters;
+	  @param[in] restart true when the stream is stopped and may change format
+	  @return NO_ERROR, or the adapter error; failed keys stay pending
 
-		// Only send parameters to adapter if preview is already
-		// enabled or doesSetParameterNeedUpdate says so. Initial setParameters to camera adapter,
-		// will be called in startPreview()
-		// TODO(XXX): Need to identify other parameters that need update from camera adapter
-		if ( (NULL != mCameraAdapter) && (mPreviewEnabled || updateRequired) ) {
-			ret |= mCameraAdapter->setParameters(adapterParams);
-		}
+*/
+	status_t CameraHal::applyAdapterParameters(bool restart)
+	{
+		ParameterStore::ChangeSet changes;
+		status_t ret = NO_ERROR;
 
-		//On fail restore old parameters
-		if ( NO_ERROR != ret ) {
-			mParameters.unflatten(oldParams.flatten());
-		}
+		changes = restart ? mAdapterChanges : mAdapterChanges.only(ParameterStore::APPLY_LIVE);
 
-		if ( NULL != mAppCallbackNotifier.get() ) {
-			mAppCallbackNotifier->setParameters(mParameters);
-		}
-
-		// Restart Preview if needed by KEY_RECODING_HINT only if preview is already running.
-		// If preview is not started yet, Video Mode parameters will take effect on next startPreview()
-		if (restartPreviewRequired && previewEnabled() && !mRecordingEnabled) {
-			LOGINFO("Restarting Preview");
-			ret = restartPreview();
-		} else if (restartPreviewRequired && !previewEnabled() &&
-				mDisplayPaused && !mRecordingEnabled) {
-			LOGINFO("Stopping Preview");
-			forceStopPreview();
+		if ( changes.isEmpty() || ( NULL == mCameraAdapter ) ) {
+			return NO_ERROR;
 		}
 
-		if (ret != NO_ERROR)
-		{
-			LOGINFO("Failed to restart Preview");
-			return ret;
+		ret = mCameraAdapter->updateParameters(mParameters, changes);
+		if ( NO_ERROR == ret ) {
+			mAdapterChanges.subtract(changes);
 		}
 
-		LOG_FUNCTION_NAME_EXIT;
-
 		return ret;
 	}
 
@@ -795,6 +427,9 @@ namespace android {
 				return NO_MEMORY;
 			}
 
+			mPreviewBufsBytes = mPreviewLength * buffercount;
+			MemoryAccounting::add(MemoryAccounting::MEM_PREVIEW_BUFFERS, mPreviewBufsBytes);
+
 			mPreviewOffsets = (uint32_t *) mDisplayAdapter->getOffsets();
 			if ( NULL == mPreviewOffsets ) {
 				LOGINFO("Buffer mapping failed");
@@ -827,6 +462,8 @@ namespace android {
 		{
 			mDisplayAdapter->freeBuffers(mPreviewBufs);
 			mPreviewBufs = NULL;
+			MemoryAccounting::remove(MemoryAccounting::MEM_PREVIEW_BUFFERS, mPreviewBufsBytes);
+			mPreviewBufsBytes = 0;
 			LOG_FUNCTION_NAME_EXIT;
 			return ret;
 		}
@@ -841,44 +478,74 @@ namespace android {
 
 		LOG_FUNCTION_NAME;
 
-		bytes = size;
+		// under a memory budget a shorter ring still takes the whole burst,
+		// the adapter waits for the encoder to hand buffers back
+		bufferCount = MemoryAccounting::fitCount(MemoryAccounting::MEM_IMAGE_BUFFERS,
+				width * height * 2, bufferCount, 1,
+				( NULL != mImageBufs ) ? mImageLength * mImageBufCount : 0);
 
-		// allocate image buffers only if not already allocated
+		// allocate image buffers only if not already allocated, the ring is
+		// reused by every capture until the picture size changes
 		if(NULL != mImageBufs) {
-			return NO_ERROR;
+			if ( ( mImageLayout.mWidth == (int) width ) && ( mImageLayout.mHeight == (int) height ) &&
+					( mImageBufCount >= bufferCount ) ) {
+				LOG_FUNCTION_NAME_EXIT;
+				return NO_ERROR;
+			}
+			freeImageBufs();
 		}
 
 		if ( NO_ERROR == ret )
 		{
-			bytes = ((bytes+4095)/4096)*4096;
-			mImageBufs = (int32_t *)mMemoryManager->allocateBuffer(0, 0, previewFormat, bytes, bufferCount);
-
-			LOGINFO("Size of Image cap buffer = %d", bytes);
-			if( NULL == mImageBufs )
+			// the capture buffers hold the raw YUYV frame for the encoder, the
+			// picture format only describes what the encoder produces. A 2D
+			// request gives row aligned buffers and lets the layout decide the size.
+			// Only the CPU touches them, so they come from a cached heap
+			bytes = 0;
+			mImageBufs = (int32_t *)mMemoryManager->allocateBuffer(width, height,
+					CameraParameters::PIXEL_FORMAT_YUV422I, bytes, bufferCount, true);
+
+			LOGINFO("Size of Image cap buffer = %d, %d bytes needed", bytes, size);
+			if( ( NULL == mImageBufs ) ||
+					( NO_ERROR != mMemoryManager->getLayout(mImageBufs, mImageLayout) ) )
 			{
 				LOGINFO("Couldn't allocate image buffers using memory manager");
+				if ( NULL != mImageBufs )
+				{
+					mMemoryManager->freeBuffers(mImageBufs);
+					mImageBufs = NULL;
+				}
 				ret = -NO_MEMORY;
 			}
-			else
-			{
-				bytes = size;
-			}
+		}
+
+		// the adapter copies frames in and the encoder reads them back for as
+		// long as the ring lives, freeBuffers() hands them back to the device
+		if ( ( NO_ERROR == ret ) &&
+				( NO_ERROR != mMemoryManager->beginCpuAccess(mImageBufs,
+					MemoryManager::CPU_ACCESS_READ | MemoryManager::CPU_ACCESS_WRITE) ) )
+		{
+			LOGINFO("Cache maintenance on the image buffers failed");
 		}
 
 		if ( NO_ERROR == ret )
 		{
 			mImageFd = mMemoryManager->getFd();
 			mImageLength = bytes;
-			mImageOffsets = mMemoryManager->getOffsets();
+			///Our own copy, the next allocation cannot move it
+			mImageOffsets = mImageLayout.mOffset;
+			mImageBufCount = bufferCount;
 		}
 		else
 		{
 			mImageFd = -1;
 			mImageLength = 0;
 			mImageOffsets = NULL;
+			mImageBufCount = 0;
+			memset(&mImageLayout, 0, sizeof(mImageLayout));
 		}
 
-		LOG_FUNCTION_NAME;
+		LOG_FUNCTION_NAME_EXIT;
 
 		return ret;
 	}
@@ -1011,12 +678,65 @@ exit:
 	/**
 	  @brief Start preview mode.
 
+	  The start is posted to the worker thread, behind an open that may still be probing
+	  the device, and previewEnabled() reports it right away. An open that has already
+	  failed is reported here, later failures reach the application as CAMERA_MSG_ERROR,
+	  stopPreview() abandons a start not yet done.
+
+	  @param none
+	  @return NO_ERROR Start posted
+	  @return NO_INIT The worker thread is not running
+	  @return The open status when the device failed to open
+
+*/
+	status_t CameraHal::startPreview()
+	{
+		TIUTILS::Message msg = {0,0,0,0,0,0};
+
+		LOG_FUNCTION_NAME;
+
+		Mutex::Autolock lock(mWorkerLock);
+
+		if ( NULL == mWorkerThread.get() ) {
+			LOG_FUNCTION_NAME_EXIT;
+			return NO_INIT;
+		}
+
+		if ( mPreviewStartPending ) {
+			LOGINFO("Preview start already posted");
+			LOG_FUNCTION_NAME_EXIT;
+			return NO_ERROR;
+		}
+
+		// with no start posted the only job left in flight is the open
+		if ( ( 0 == mWorkerPending ) && ( NO_ERROR != mOpenStatus ) ) {
+			LOGINFO("Device open failed %d, preview not started", mOpenStatus);
+			LOG_FUNCTION_NAME_EXIT;
+			return mOpenStatus;
+		}
+
+		gettimeofday(&mPreviewRequestTime, NULL);
+		mPreviewStartPending = true;
+		mWorkerPending++;
+
+		msg.command = WorkerThread::WORKER_START_PREVIEW;
+		mWorkerThread->msgQ().put(&msg);
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_ERROR;
+	}
+
+	/**
+	  @brief Starts the preview on the calling thread.
+
 	  @param none
 	  @return NO_ERROR Camera switched to VF mode
+	  @return -ECANCELED stopPreview() abandoned the start posted to the worker
 	  @todo Update function header with the different errors that are possible
 
 */
-	status_t CameraHal::startPreview()
+	status_t CameraHal::startPreviewInternal()
 	{
 
 		status_t ret = NO_ERROR;
@@ -1025,6 +745,7 @@ exit:
 		const char *valstr = NULL;
 		unsigned int required_buffer_count;
 		unsigned int max_queueble_buffers;
+		nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
 
 		LOG_FUNCTION_NAME;
 
@@ -1034,8 +755,12 @@ exit:
 			return ALREADY_EXISTS;
 		}
 
-		if ( NULL != mCameraAdapter ) {
-			ret = mCameraAdapter->setParameters(mParameters);
+		///Only what changed since the last start reaches the adapter
+		ret = applyAdapterParameters(true);
+		if ( NO_ERROR != ret ) {
+			LOGINFO("Error: applying parameters to the adapter %d", ret);
+			LOG_FUNCTION_NAME_EXIT;
+			return ret;
 		}
 
 		if ((mPreviewStartInProgress == false) && (mDisplayPaused == false)){
@@ -1082,6 +807,7 @@ exit:
 			{
 				mAppCallbackNotifier->enableMsgType (CAMERA_MSG_PREVIEW_FRAME);
 			}
+			noteRestart(RESTART_RESUME, start);
 			return ret;
 		}
 
@@ -1097,11 +823,20 @@ exit:
 			goto error;
 		}
 
+		///Last point a posted start can be abandoned, the adapter has not been given anything yet
+		if ( previewStartCancelled() )
+		{
+			LOGINFO("Preview start cancelled");
+			freePreviewBufs();
+			return -ECANCELED;
+		}
+
 		///Pass the buffers to Camera Adapter
 		desc.mBuffers = mPreviewBufs;
 		desc.mOffsets = mPreviewOffsets;
 		desc.mFd = mPreviewFd;
 		desc.mLength = mPreviewLength;
+		desc.mStride = 0;
 		desc.mCount = ( size_t ) required_buffer_count;
 		desc.mMaxQueueable = (size_t) max_queueble_buffers;
 
@@ -1145,7 +880,8 @@ exit:
 			int width, height;
 			mParameters.getPreviewSize(&width, &height);
 
-			ret = mDisplayAdapter->enableDisplay(width, height, NULL, isS3d ? &s3dParams : NULL);
+			// time to first frame is measured by the display from the start request
+			ret = mDisplayAdapter->enableDisplay(width, height, &mPreviewRequestTime, isS3d ? &s3dParams : NULL);
 			if ( ret != NO_ERROR )
 			{
 				LOGINFO("Couldn't enable display");
@@ -1182,6 +918,7 @@ error:
 			mDisplayAdapter->disableDisplay(false);
 		}
 		mAppCallbackNotifier->stop();
+		mAppCallbackNotifier->stopPreviewCallbacks();
 		mPreviewStartInProgress = false;
 		mPreviewEnabled = false;
 		LOG_FUNCTION_NAME_EXIT;
@@ -1254,6 +991,8 @@ error:
 			// Set it as the error handler for the DisplayAdapter
 			mDisplayAdapter->setErrorHandler(mAppCallbackNotifier.get());
 
+			mDisplayAdapter->setPipelineStats(mPipelineStats);
+
 			// Update the display adapter with the new window that is passed from CameraService
 			ret  = mDisplayAdapter->setPreviewWindow(window);
 			if(ret!=NO_ERROR)
@@ -1265,7 +1004,7 @@ error:
 			{
 				LOGINFO("setPreviewWindow called when preview running");
 				// Start the preview since the window is now available
-				ret = startPreview();
+				ret = startPreviewInternal();
 			}
 		}else
 		{
@@ -1326,7 +1065,7 @@ error:
 	{
 		LOG_FUNCTION_NAME;
 
-		bool ret = mPreviewEnabled || mPreviewStartInProgress;
+		bool ret = mPreviewEnabled || mPreviewStartInProgress || mPreviewStartPending;
 
 		LOG_FUNCTION_NAME_EXIT;
 		return ret;
@@ -1472,10 +1211,16 @@ error:
 		return restartPreviewRequired;
 	}
 
+	//indexed by PreviewRestartKind
+	static const char* const sRestartKindNames[] = { "resume", "settings", "format", "geometry" };
+
 	/**
 	  @brief Restart the preview with setParameter.
 
-	  This function restarts preview, for some VIDEO_MODE parameters to take effect.
+	  While the frame size stays the same the stream, its buffers and the display keep
+	  running: the pending keys are pushed to the adapter as they are, and a new preview
+	  format only restarts the callback stage that converts to it. A new frame size stops
+	  the preview and starts it again, the adapter keeps what it can of its buffers.
 
 	  @param none
 	  @return NO_ERROR If recording parameters could be set without any issues
@@ -1483,22 +1228,66 @@ error:
 */
 	status_t CameraHal::restartPreview()
 	{
-		const char *valstr = NULL;
-		char tmpvalstr[30];
+		nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+		int width, height;
 		status_t ret = NO_ERROR;
 
 		LOG_FUNCTION_NAME;
 
+		mParameters.getPreviewSize(&width, &height);
+
+		if ( mPreviewEnabled && ( ( uint32_t ) width == mPreviewWidth ) &&
+				( ( uint32_t ) height == mPreviewHeight ) ) {
+			bool formatChanged = mAdapterChanges.has(ParameterStore::PARAM_PREVIEW_FORMAT);
+
+			///The adapter only touches the stream format when the frame size moves
+			ret = applyAdapterParameters(true);
+
+			if ( ( NO_ERROR == ret ) && formatChanged && ( NULL != mAppCallbackNotifier.get() ) ) {
+				mAppCallbackNotifier->stopPreviewCallbacks();
+				ret = mAppCallbackNotifier->startPreviewCallbacks(mParameters, mPreviewBufs, mPreviewOffsets,
+						mPreviewFd, mPreviewLength, atoi(mCameraProperties->get(CameraProperties::REQUIRED_PREVIEW_BUFS)));
+			}
+
+			noteRestart(formatChanged ? RESTART_FORMAT : RESTART_SETTINGS, start);
+
+			LOG_FUNCTION_NAME_EXIT;
+
+			return ret;
+		}
+
+		///startPreviewInternal() pushes the pending format once the stream is off
 		forceStopPreview();
-		mCameraAdapter->setParameters(mParameters);
 
-		ret = startPreview();
+		gettimeofday(&mPreviewRequestTime, NULL);
+		ret = startPreviewInternal();
+
+		if ( NO_ERROR == ret ) {
+			noteRestart(RESTART_GEOMETRY, start);
+		}
 
 		LOG_FUNCTION_NAME_EXIT;
 
 		return ret;
 	}
 
+	void CameraHal::noteRestart(PreviewRestartKind kind, nsecs_t start)
+	{
+		nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+		Mutex::Autolock lock(mRestartStatsLock);
+
+		RestartStats &stats = mRestartStats[kind];
+		stats.mCount++;
+		stats.mLast = elapsed;
+		stats.mTotal += elapsed;
+		if ( elapsed > stats.mMax ) {
+			stats.mMax = elapsed;
+		}
+
+		LOGINFO("Preview restart (%s) took %lld us", sRestartKindNames[kind], ns2us(elapsed));
+	}
+
 	/**
 	  @brief Stop a previously started recording.
 
@@ -1640,12 +1429,11 @@ error:
 		LOG_FUNCTION_NAME;
 
 		Mutex::Autolock lock(mLock);
-		CameraParameters adapterParams = mParameters;
 		mMsgEnabled &= ~CAMERA_MSG_FOCUS;
 
 		if( NULL != mCameraAdapter )
 		{
-			mCameraAdapter->setParameters(adapterParams);
+			applyAdapterParameters(!mPreviewEnabled);
 			mCameraAdapter->sendCommand(CameraAdapter::CAMERA_CANCEL_AUTOFOCUS);
 		}
 
@@ -1781,8 +1569,9 @@ error:
 			desc.mOffsets = mImageOffsets;
 			desc.mFd = mImageFd;
 			desc.mLength = mImageLength;
-			desc.mCount = ( size_t ) ( mBracketRangeNegative + 1 );
-			desc.mMaxQueueable = ( size_t ) ( mBracketRangeNegative + 1 );
+			desc.mStride = mImageLayout.mStride[0];
+			desc.mCount = ( size_t ) mImageBufCount;
+			desc.mMaxQueueable = ( size_t ) mImageBufCount;
 
 			ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_USE_BUFFERS_IMAGE_CAPTURE,
 					( int ) &desc);
@@ -1829,7 +1618,8 @@ error:
 		status_t ret = NO_ERROR;
 		CameraFrame frame;
 		CameraAdapter::BuffersDescriptor desc;
-		int burst;
+		int burst = 1;
+		bool zsl = false;
 		const char *valstr = NULL;
 		unsigned int bufferCount = 1;
 
@@ -1837,6 +1627,24 @@ error:
 
 		LOG_FUNCTION_NAME;
 
+		if ( (valstr = mParameters.get(CameraProperties::BURST)) != NULL ) {
+			burst = atoi(valstr);
+			if ( burst < 1 ) {
+				burst = 1;
+			}
+		}
+
+		// with ZSL the shot is already in the adapter's history, preview keeps going
+		zsl = (mParameters.getInt(CameraProperties::ZSL_HISTORY) > 0);
+
+		// the capture ring is allocated once and recycled across shots and bursts
+		if ( (valstr = mCameraProperties->get(CameraProperties::REQUIRED_IMAGE_BUFS)) != NULL ) {
+			bufferCount = atoi(valstr);
+		}
+		if ( bufferCount < 1 ) {
+			bufferCount = 1;
+		}
+
 		if(!previewEnabled() && !mDisplayPaused)
 		{
 			LOG_FUNCTION_NAME_EXIT;
@@ -1853,9 +1661,11 @@ error:
 			return NO_INIT;
 		}
 
+		// a video snapshot is one recording frame, lent to the encoder by the adapter,
+		// the single image buffer is only filled if no driver buffer can be spared
 		if (mCameraAdapter->getState() == CameraAdapter::VIDEO_STATE) {
-			LOGINFO("Trying to capture while recording without recording hint set...");
-			return INVALID_OPERATION;
+			burst = 1;
+			bufferCount = 1;
 		}
 
 		if ( !mBracketingRunning )
@@ -1864,7 +1674,7 @@ error:
 			// do not pause preview if recording (video state)
 			if (NO_ERROR == ret &&
 					NULL != mDisplayAdapter.get() &&
-					burst < 1) {
+					burst <= 1 && !zsl) {
 				if (mCameraAdapter->getState() != CameraAdapter::VIDEO_STATE) {
 					mDisplayPaused = true;
 					mPreviewEnabled = false;
@@ -1876,15 +1686,6 @@ error:
 				}
 			}
 
-			// if we taking video snapshot...
-			if ((NO_ERROR == ret) && (mCameraAdapter->getState() == CameraAdapter::VIDEO_STATE)) {
-				// enable post view frames if not already enabled so we can internally
-				// save snapshot frames for generating thumbnail
-				if((mMsgEnabled & CAMERA_MSG_POSTVIEW_FRAME) == 0) {
-					mAppCallbackNotifier->enableMsgType(CAMERA_MSG_POSTVIEW_FRAME);
-				}
-			}
-
 			if ( (NO_ERROR == ret) && (NULL != mCameraAdapter) )
 			{
 				if ( NO_ERROR == ret )
@@ -1920,17 +1721,27 @@ error:
 				desc.mOffsets = mImageOffsets;
 				desc.mFd = mImageFd;
 				desc.mLength = mImageLength;
-				desc.mCount = ( size_t ) bufferCount;
-				desc.mMaxQueueable = ( size_t ) bufferCount;
+				desc.mStride = mImageLayout.mStride[0];
+				desc.mCount = ( size_t ) mImageBufCount;
+				desc.mMaxQueueable = ( size_t ) mImageBufCount;
 
 				ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_USE_BUFFERS_IMAGE_CAPTURE,
 						( int ) &desc);
 			}
 		}
 
+		// encoder reads jpeg and thumbnail settings from the notifier's copy
+		if ( ( NO_ERROR == ret ) && ( NULL != mAppCallbackNotifier.get() ) )
+		{
+			mAppCallbackNotifier->setParameters(mParameters);
+			if ( !mBracketingRunning ) {
+				mAppCallbackNotifier->setBurst(burst > 1);
+			}
+		}
+
 		if ( ( NO_ERROR == ret ) && ( NULL != mCameraAdapter ) )
 		{
-			ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_IMAGE_CAPTURE);
+			ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_IMAGE_CAPTURE, burst);
 		}
 
 		return ret;
@@ -1972,10 +1783,8 @@ error:
 
 		LOG_FUNCTION_NAME;
 
-		if( NULL != mCameraAdapter )
-		{
-			mCameraAdapter->getParameters(mParameters);
-		}
+		///The adapter only holds what the HAL pushed to it, mParameters is always current
+		Mutex::Autolock lock(mLock);
 
 		CameraParameters mParams = mParameters;
 
@@ -2014,13 +1823,46 @@ error:
 	  @return NO_ERROR If the command succeeds
 	  @todo Define the error codes that this function can return
 
-*/
-	status_t CameraHal::sendCommand(int32_t cmd, int32_t arg1, int32_t arg2)
-	{
-		status_t ret = NO_ERROR;
+*/
+	status_t CameraHal::sendCommand(int32_t cmd, int32_t arg1, int32_t arg2)
+	{
+		status_t ret = NO_ERROR;
+
+		LOG_FUNCTION_NAME;
+
+		///Diagnostics work whether or not the device is open and previewing
+		if ( CAMERA_CMD_DUMP_PIPELINE_STATS == cmd )
+		{
+			ret = dumpPipelineStats(0 != arg2);
+			LOG_FUNCTION_NAME_EXIT;
+			return ret;
+		}
+
+		if ( CAMERA_CMD_SET_LOG_LEVEL == cmd )
+		{
+			CameraLog::setLevel(arg1);
+			LOG_FUNCTION_NAME_EXIT;
+			return NO_ERROR;
+		}
 
-		LOG_FUNCTION_NAME;
+		if ( CAMERA_CMD_ENABLE_TRACE == cmd )
+		{
+			FrameTrace::setEnabled(0 != arg1);
+			LOG_FUNCTION_NAME_EXIT;
+			return NO_ERROR;
+		}
+
+		if ( CAMERA_CMD_DUMP_TRACE == cmd )
+		{
+			char path[128];
 
+			ret = FrameTrace::dumpToFile(path, sizeof(path));
+			if ( NO_ERROR == ret ) {
+				LOGI("Frame trace written to %s", path);
+			}
+			LOG_FUNCTION_NAME_EXIT;
+			return ret;
+		}
 
 		if ( ( NO_ERROR == ret ) && ( NULL == mCameraAdapter ) )
 		{
@@ -2047,6 +1889,8 @@ error:
 
 				ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_STOP_SMOOTH_ZOOM);
 
+				break;
+
 			case CAMERA_CMD_START_FACE_DETECTION:
 
 				ret = mCameraAdapter->sendCommand(CameraAdapter::CAMERA_START_FD);
@@ -2099,8 +1943,98 @@ error:
 */
 	status_t  CameraHal::dump(int fd) const
 	{
+		RestartStats stats[RESTART_KIND_COUNT];
+		sp<DisplayAdapter> display = mDisplayAdapter;
+		status_t openStatus;
+		nsecs_t openTime;
+		char line[128];
+
 		LOG_FUNCTION_NAME;
-		///Implement this method when the h/w dump function is supported on Ducati side
+
+		MemoryAccounting::dump(fd);
+
+		if ( NULL != mPipelineStats.get() ) {
+			mPipelineStats->dump(fd);
+		}
+
+		{
+			Mutex::Autolock lock(mRestartStatsLock);
+			memcpy(stats, mRestartStats, sizeof(stats));
+		}
+
+		{
+			Mutex::Autolock lock(mWorkerLock);
+			openStatus = mOpenStatus;
+			openTime = mOpenTime;
+		}
+
+		snprintf(line, sizeof(line), "Device open: status %d, %lld us on the worker\n", openStatus, ns2us(openTime));
+		write(fd, line, strlen(line));
+
+		///Encoder counters are process wide, every camera reports the same
+		Encoder_libjpeg::RateControlStats rateStats;
+		Encoder_libjpeg::getRateControlStats(rateStats);
+		snprintf(line, sizeof(line), "JPEG target size: %u requests, %u hits, %u retries\n",
+				rateStats.requests, rateStats.hits, rateStats.retries);
+		write(fd, line, strlen(line));
+
+		Encoder_libjpeg::CompressorStats compressorStats;
+		Encoder_libjpeg::getCompressorStats(compressorStats);
+		snprintf(line, sizeof(line), "JPEG compressors: %u images, %u one-shot, %u contexts, "
+				"tables %u reused %u built, setup avg %lld us\n",
+				compressorStats.images, compressorStats.oneshot, compressorStats.contexts_created,
+				compressorStats.table_hits, compressorStats.table_misses,
+				compressorStats.images ? ns2us(compressorStats.setup_ns / compressorStats.images) : 0LL);
+		write(fd, line, strlen(line));
+
+		///Only ANativeWindowDisplayAdapter is ever created
+		if ( NULL != display.get() ) {
+			ANativeWindowDisplayAdapter::DisplayStats displayStats;
+			static_cast<ANativeWindowDisplayAdapter *>(display.get())->getDisplayStats(displayStats);
+			snprintf(line, sizeof(line), "Time to first frame: last %lld us, max %lld us, %u starts\n",
+					ns2us(displayStats.mFirstFrameLast), ns2us(displayStats.mFirstFrameMax), displayStats.mFirstFrames);
+			write(fd, line, strlen(line));
+		}
+
+		snprintf(line, sizeof(line), "Preview restarts\n  %-10s %8s %10s %10s %10s\n",
+				"kind", "count", "last us", "max us", "avg us");
+		write(fd, line, strlen(line));
+
+		for (int i = 0; i < RESTART_KIND_COUNT; i++) {
+			snprintf(line, sizeof(line), "  %-10s %8u %10lld %10lld %10lld\n",
+					sRestartKindNames[i], stats[i].mCount, ns2us(stats[i].mLast), ns2us(stats[i].mMax),
+					stats[i].mCount ? ns2us(stats[i].mTotal / stats[i].mCount) : 0LL);
+			write(fd, line, strlen(line));
+		}
+
+		LOG_FUNCTION_NAME_EXIT;
+		return NO_ERROR;
+	}
+
+	/**
+	  @brief Logs the pipeline counters for CAMERA_CMD_DUMP_PIPELINE_STATS
+
+	  Only dump() writes them to an fd, the framework hands that one in.
+
+	  @param[in] reset Clear the counters once reported
+	  @return NO_ERROR
+	  NO_INIT - Nothing has been counted yet
+
+*/
+	status_t CameraHal::dumpPipelineStats(bool reset)
+	{
+		sp<PipelineStats> stats = mPipelineStats;
+
+		if ( NULL == stats.get() ) {
+			return NO_INIT;
+		}
+
+		stats->log();
+
+		if ( reset ) {
+			stats->reset();
+		}
+
 		return NO_ERROR;
 	}
 
@@ -2122,6 +2056,9 @@ error:
 	{
 		LOG_FUNCTION_NAME;
 
+		CameraLog::loadLevel();
+		FrameTrace::loadEnabled();
+
 		///Initialize all the member variables to their defaults
 		mPreviewEnabled = false;
 		mPreviewBufs = NULL;
@@ -2149,6 +2086,8 @@ error:
 		mFalsePreview = 0;
 		mImageOffsets = NULL;
 		mImageLength = 0;
+		mImageBufCount = 0;
+		memset(&mImageLayout, 0, sizeof(mImageLayout));
 		mImageFd = 0;
 		mVideoOffsets = NULL;
 		mVideoFd = 0;
@@ -2160,6 +2099,7 @@ error:
 		mPreviewWidth = 0;
 		mPreviewHeight = 0;
 		mPreviewLength = 0;
+		mPreviewBufsBytes = 0;
 		mPreviewOffsets = NULL;
 		mPreviewRunning = 0;
 		mPreviewStateOld = 0;
@@ -2168,6 +2108,13 @@ error:
 //		mSensorListener = NULL;
 		mVideoWidth = 0;
 		mVideoHeight = 0;
+		memset(mRestartStats, 0, sizeof(mRestartStats));
+		mWorkerPending = 0;
+		mWorkerCancel = false;
+		mOpenStatus = NO_INIT;
+		mOpenTime = 0;
+		mPreviewStartPending = false;
+		memset(&mPreviewRequestTime, 0, sizeof(mPreviewRequestTime));
 		mCameraIndex = cameraId;
 
 		LOG_FUNCTION_NAME_EXIT;
@@ -2183,6 +2130,20 @@ error:
 	{
 		LOG_FUNCTION_NAME;
 
+		///Let a posted open finish and drop a posted preview start before tearing down
+		if ( NULL != mWorkerThread.get() )
+		{
+			TIUTILS::Message msg = {0,0,0,0,0,0};
+
+			cancelPreviewStart();
+
+			msg.command = WorkerThread::WORKER_EXIT;
+			mWorkerThread->msgQ().put(&msg);
+			mWorkerThread->requestExit();
+			mWorkerThread->join();
+			mWorkerThread.clear();
+		}
+
 		///Call de-initialize here once more - it is the last chance for us to relinquish all the h/w and s/w resources
 		deinitialize();
 
@@ -2218,7 +2179,9 @@ error:
 	/**
 	  @brief Initialize the Camera HAL
 
-	  Creates CameraAdapter, AppCallbackNotifier, DisplayAdapter and MemoryManager
+	  Creates AppCallbackNotifier and MemoryManager, then posts the open to the worker
+	  thread, which creates the CameraAdapter and probes the device while the caller goes
+	  on. The entry points needing the device wait for it with waitForWorker().
 
 	  @param None
 	  @return NO_ERROR - On success
@@ -2231,11 +2194,7 @@ error:
 	{
 		LOG_FUNCTION_NAME;
 
-		int sensor_index = 0;
-
-		///Initialize the event mask used for registering an event provider for AppCallbackNotifier
-		///Currently, registering all events as to be coming from CameraAdapter
-		int32_t eventMask = CameraHalEvent::ALL_EVENTS;
+		TIUTILS::Message msg = {0,0,0,0,0,0};
 
 		// Get my camera properties
 		mCameraProperties = properties;
@@ -2249,25 +2208,16 @@ error:
 		// will only print if DEBUG macro is defined
 		mCameraProperties->dump();
 
-		if (strcmp(CameraProperties::DEFAULT_VALUE, mCameraProperties->get(CameraProperties::CAMERA_SENSOR_INDEX)) != 0 )
-		{
-			sensor_index = atoi(mCameraProperties->get(CameraProperties::CAMERA_SENSOR_INDEX));
-		}
-
-		LOGINFO("Sensor index %d", sensor_index);
-
-		mCameraAdapter = CameraAdapter_Factory(sensor_index);
-		if ( ( NULL == mCameraAdapter ) || (mCameraAdapter->initialize(properties)!=NO_ERROR))
+		if(!mPipelineStats.get())
 		{
-			LOGINFO("Unable to create or initialize CameraAdapter");
-			mCameraAdapter = NULL;
-			goto fail_loop;
+			mPipelineStats = new PipelineStats();
+			if( NULL == mPipelineStats.get() )
+			{
+				LOGINFO("Unable to create PipelineStats");
+				goto fail_loop;
+			}
 		}
 
-		mCameraAdapter->incStrong(mCameraAdapter);
-		mCameraAdapter->registerImageReleaseCallback(releaseImageBuffers, (void *) this);
-		mCameraAdapter->registerEndCaptureCallback(endImageCapture, (void *)this);
-
 		if(!mAppCallbackNotifier.get())
 		{
 			/// Create the callback notifier
@@ -2277,6 +2227,7 @@ error:
 				LOGINFO("Unable to create or initialize AppCallbackNotifier");
 				goto fail_loop;
 			}
+			mAppCallbackNotifier->setPipelineStats(mPipelineStats);
 		}
 
 		if(!mMemoryManager.get())
@@ -2290,6 +2241,79 @@ error:
 			}
 		}
 
+		mWorkerThread = new WorkerThread(this);
+		if( ( NULL == mWorkerThread.get() ) ||
+				( mWorkerThread->run("CameraHalWorker", PRIORITY_URGENT_DISPLAY) != NO_ERROR ) )
+		{
+			LOGINFO("Couldn't run worker thread");
+			mWorkerThread.clear();
+			goto fail_loop;
+		}
+
+		{
+			Mutex::Autolock lock(mWorkerLock);
+			mOpenStatus = NO_INIT;
+			mWorkerPending++;
+		}
+
+		msg.command = WorkerThread::WORKER_OPEN;
+		mWorkerThread->msgQ().put(&msg);
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_ERROR;
+
+fail_loop:
+
+		///Free up the resources because we failed somewhere up
+		deinitialize();
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_MEMORY;
+
+	}
+
+	/**
+	  @brief Creates the CameraAdapter, probes the device and applies the defaults.
+
+	  Runs on the worker thread for initialize().
+
+	  @param None
+	  @return NO_ERROR - On success
+	  -ENODEV - The device could not be opened or probed
+	  NO_MEMORY - AppCallbackNotifier could not be started
+
+*/
+	status_t CameraHal::openDevice()
+	{
+		LOG_FUNCTION_NAME;
+
+		int sensor_index = 0;
+
+		///Initialize the event mask used for registering an event provider for AppCallbackNotifier
+		///Currently, registering all events as to be coming from CameraAdapter
+		int32_t eventMask = CameraHalEvent::ALL_EVENTS;
+
+		if (strcmp(CameraProperties::DEFAULT_VALUE, mCameraProperties->get(CameraProperties::CAMERA_SENSOR_INDEX)) != 0 )
+		{
+			sensor_index = atoi(mCameraProperties->get(CameraProperties::CAMERA_SENSOR_INDEX));
+		}
+
+		LOGINFO("Sensor index %d", sensor_index);
+
+		mCameraAdapter = CameraAdapter_Factory(sensor_index);
+		if ( ( NULL == mCameraAdapter ) || (mCameraAdapter->initialize(mCameraProperties)!=NO_ERROR))
+		{
+			LOGINFO("Unable to create or initialize CameraAdapter");
+			mCameraAdapter = NULL;
+			LOG_FUNCTION_NAME_EXIT;
+			return -ENODEV;
+		}
+
+		mCameraAdapter->incStrong(mCameraAdapter);
+		mCameraAdapter->registerImageReleaseCallback(releaseImageBuffers, (void *) this);
+		mCameraAdapter->registerEndCaptureCallback(endImageCapture, (void *)this);
+
 		///Setup the class dependencies...
 
 		///AppCallbackNotifier has to know where to get the Camera frames and the events like auto focus lock etc from.
@@ -2306,11 +2330,14 @@ error:
 		///Set it as the error handler for CameraAdapter
 		mCameraAdapter->setErrorHandler(mAppCallbackNotifier.get());
 
+		mCameraAdapter->setPipelineStats(mPipelineStats);
+
 		///Start the callback notifier
 		if(mAppCallbackNotifier->start() != NO_ERROR)
 		{
 			LOGINFO("Couldn't start AppCallbackNotifier");
-			goto fail_loop;
+			LOG_FUNCTION_NAME_EXIT;
+			return NO_MEMORY;
 		}
 
 		LOGINFO("Started AppCallbackNotifier..");
@@ -2344,169 +2371,125 @@ error:
 		LOG_FUNCTION_NAME_EXIT;
 
 		return NO_ERROR;
-
-fail_loop:
-
-		///Free up the resources because we failed somewhere up
-		deinitialize();
-		LOG_FUNCTION_NAME_EXIT;
-
-		return NO_MEMORY;
-
 	}
 
-
-
-	CameraAdapter* CameraHal::CameraAdapter_Factory(size_t sensor_index)
+	bool CameraHal::workerThread()
 	{
-		LOG_FUNCTION_NAME;
+		TIUTILS::Message msg;
+		status_t ret = NO_ERROR;
+		nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
 
-		CameraAdapter *adapter = NULL;
-		adapter = new V4LCameraAdapter();
-		if ( adapter ) {
-			LOGINFO("Camera adapter created, sensor_index %d",sensor_index);
-		} else {
-			LOGINFO("Camera adapter create failed!");
-		}
+		LOG_FUNCTION_NAME;
 
-		LOG_FUNCTION_NAME_EXIT;
+		mWorkerThread->msgQ().get(&msg);
 
-		return adapter;
-	}
+		switch ( msg.command )
+		{
+		case WorkerThread::WORKER_OPEN:
+			{
+				ret = openDevice();
 
+				Mutex::Autolock lock(mWorkerLock);
+				mOpenStatus = ret;
+				mOpenTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+				LOGINFO("Device open took %lld us, status %d", ns2us(mOpenTime), ret);
+				break;
+			}
 
-	bool CameraHal::isResolutionValid(unsigned int width, unsigned int height, const char *supportedResolutions)
-	{
-		bool ret = true;
-		status_t status = NO_ERROR;
-		char tmpBuffer[PARAM_BUFFER + 1];
-		char *pos = NULL;
+		case WorkerThread::WORKER_START_PREVIEW:
+			{
+				if ( NO_ERROR != mOpenStatus ) {
+					ret = mOpenStatus;
+				} else if ( previewStartCancelled() ) {
+					ret = -ECANCELED;
+				} else {
+					ret = startPreviewInternal();
+				}
 
-		LOG_FUNCTION_NAME;
+				// the caller has long returned, failures go out as CAMERA_MSG_ERROR
+				if ( ( NO_ERROR != ret ) && ( ALREADY_EXISTS != ret ) && ( -ECANCELED != ret ) ) {
+					LOGINFO("Preview start failed %d", ret);
+					mAppCallbackNotifier->errorNotify(ret);
+				}
+				break;
+			}
 
-		if ( NULL == supportedResolutions )
-		{
-			LOGINFO("Invalid supported resolutions string");
-			ret = false;
-			goto exit;
-		}
+		case WorkerThread::WORKER_EXIT:
+			{
+				LOGINFO("Worker thread exiting");
+				LOG_FUNCTION_NAME_EXIT;
+				return false;
+			}
 
-		status = snprintf(tmpBuffer, PARAM_BUFFER, "%dx%d", width, height);
-		if ( 0 > status )
-		{
-			LOGINFO("Error encountered while generating validation string");
-			ret = false;
-			goto exit;
+		default:
+			{
+				LOGINFO("Error: unknown worker command %d", msg.command);
+				break;
+			}
 		}
 
-		pos = strstr(supportedResolutions, tmpBuffer);
-		if ( NULL == pos )
 		{
-			ret = false;
-		}
-		else
-		{
-			ret = true;
+			Mutex::Autolock lock(mWorkerLock);
+			if ( WorkerThread::WORKER_START_PREVIEW == msg.command ) {
+				mPreviewStartPending = false;
+			}
+			mWorkerPending--;
+			mWorkerDone.broadcast();
 		}
 
-exit:
-
 		LOG_FUNCTION_NAME_EXIT;
 
-		return ret;
+		return true;
 	}
 
-	bool CameraHal::isParameterValid(const char *param, const char *supportedParams)
+	status_t CameraHal::waitForWorker()
 	{
-		bool ret = true;
-		char *pos = NULL;
-
-		LOG_FUNCTION_NAME;
-
-		if ( NULL == supportedParams )
-		{
-			LOGINFO("Invalid supported parameters string");
-			ret = false;
-			goto exit;
-		}
+		Mutex::Autolock lock(mWorkerLock);
 
-		if ( NULL == param )
-		{
-			LOGINFO("Invalid parameter string");
-			ret = false;
-			goto exit;
-		}
-
-		pos = strstr(supportedParams, param);
-		if ( NULL == pos )
-		{
-			ret = false;
-		}
-		else
-		{
-			ret = true;
+		while ( 0 < mWorkerPending ) {
+			mWorkerDone.wait(mWorkerLock);
 		}
 
-exit:
+		return mOpenStatus;
+	}
 
-		LOG_FUNCTION_NAME_EXIT;
+	void CameraHal::cancelPreviewStart()
+	{
+		Mutex::Autolock lock(mWorkerLock);
 
-		return ret;
+		///An open in progress is waited for, only a preview start checks the flag
+		mWorkerCancel = true;
+		while ( 0 < mWorkerPending ) {
+			mWorkerDone.wait(mWorkerLock);
+		}
+		mWorkerCancel = false;
 	}
 
-	bool CameraHal::isParameterValid(int param, const char *supportedParams)
+	bool CameraHal::previewStartCancelled()
 	{
-		bool ret = true;
-		char *pos = NULL;
-		status_t status;
-		char tmpBuffer[PARAM_BUFFER + 1];
+		Mutex::Autolock lock(mWorkerLock);
+		return mWorkerCancel;
+	}
 
-		LOG_FUNCTION_NAME;
 
-		if ( NULL == supportedParams )
-		{
-			LOGINFO("Invalid supported parameters string");
-			ret = false;
-			goto exit;
-		}
 
-		status = snprintf(tmpBuffer, PARAM_BUFFER, "%d", param);
-		if ( 0 > status )
-		{
-			LOGINFO("Error encountered while generating validation string");
-			ret = false;
-			goto exit;
-		}
+	CameraAdapter* CameraHal::CameraAdapter_Factory(size_t sensor_index)
+	{
+		LOG_FUNCTION_NAME;
 
-		pos = strstr(supportedParams, tmpBuffer);
-		if ( NULL == pos )
-		{
-			ret = false;
-		}
-		else
-		{
-			ret = true;
+		CameraAdapter *adapter = NULL;
+		adapter = new V4LCameraAdapter();
+		if ( adapter ) {
+			LOGINFO("Camera adapter created, sensor_index %d",sensor_index);
+		} else {
+			LOGINFO("Camera adapter create failed!");
 		}
 
-exit:
-
 		LOG_FUNCTION_NAME_EXIT;
 
-		return ret;
+		return adapter;
 	}
 
-	status_t CameraHal::doesSetParameterNeedUpdate(const char* new_param, const char* old_param, bool& update) {
-		if (!new_param || !old_param) {
-			return -EINVAL;
-		}
-
-		// if params mismatch we should update parameters for camera adapter
-		if ((strcmp(new_param, old_param) != 0)) {
-			update = true;
-		}
-
-		return NO_ERROR;
-	}
 
 	status_t CameraHal::parseResolution(const char *resStr, int &width, int &height)
 	{
@@ -2564,6 +2547,28 @@ exit:
 		return ret;
 	}
 
+	//parameters the adapter publishes as camera properties once it has queried the sensor controls
+	static const char* const sControlParameters[][2] = {
+		{ CameraParameters::KEY_SUPPORTED_WHITE_BALANCE, CameraProperties::SUPPORTED_WHITE_BALANCE },
+		{ CameraParameters::KEY_WHITE_BALANCE, CameraProperties::WHITEBALANCE },
+		{ CameraParameters::KEY_SUPPORTED_ANTIBANDING, CameraProperties::SUPPORTED_ANTIBANDING },
+		{ CameraParameters::KEY_ANTIBANDING, CameraProperties::ANTIBANDING },
+		{ CameraParameters::KEY_SUPPORTED_EFFECTS, CameraProperties::SUPPORTED_EFFECTS },
+		{ CameraParameters::KEY_EFFECT, CameraProperties::EFFECT },
+		{ CameraParameters::KEY_MIN_EXPOSURE_COMPENSATION, CameraProperties::SUPPORTED_EV_MIN },
+		{ CameraParameters::KEY_MAX_EXPOSURE_COMPENSATION, CameraProperties::SUPPORTED_EV_MAX },
+		{ CameraParameters::KEY_EXPOSURE_COMPENSATION_STEP, CameraProperties::SUPPORTED_EV_STEP },
+		{ CameraParameters::KEY_EXPOSURE_COMPENSATION, CameraProperties::EV_COMPENSATION },
+		{ CameraParameters::KEY_AUTO_EXPOSURE_LOCK_SUPPORTED, CameraProperties::AUTO_EXPOSURE_LOCK_SUPPORTED },
+		{ CameraParameters::KEY_AUTO_EXPOSURE_LOCK, CameraProperties::AUTO_EXPOSURE_LOCK },
+		{ CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK_SUPPORTED, CameraProperties::AUTO_WHITEBALANCE_LOCK_SUPPORTED },
+		{ CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK, CameraProperties::AUTO_WHITEBALANCE_LOCK },
+		{ CameraProperties::BRIGHTNESS_LEVEL, CameraProperties::BRIGHTNESS },
+		{ CameraProperties::CONTRAST_LEVEL, CameraProperties::CONTRAST },
+		{ CameraProperties::SATURATION_LEVEL, CameraProperties::SATURATION },
+		{ CameraProperties::SHARPNESS_LEVEL, CameraProperties::SHARPNESS },
+	};
+
 	void CameraHal::initDefaultParameters()
 	{
 		//Purpose of this function is to initialize the default current and supported parameters for the currently
@@ -2593,8 +2598,20 @@ exit:
 
 		p.set(CameraProperties::REQUIRED_PREVIEW_BUFS, 8);
 
+		// only what the sensor has controls for is advertised
+		for (unsigned int i = 0; i < sizeof(sControlParameters) / sizeof(sControlParameters[0]); i++) {
+			const char *valstr = mCameraProperties->get(sControlParameters[i][1]);
+			if ( (NULL != valstr) && (*valstr != '\0') ) {
+				p.set(sControlParameters[i][0], valstr);
+			}
+		}
+
 		mCameraAdapter->setParameters(mParameters);
 
+		///Validation sets come from the supported lists above, later changes are diffed against these values
+		mParameterStore.initialize(mParameters);
+		mAdapterChanges.clear();
+
 
 		/*
 		ret = parseResolution(mCameraProperties->get(CameraProperties::PREVIEW_SIZE), width, height);
@@ -2613,12 +2630,13 @@ exit:
 
 		ret = parseResolution(mCameraProperties->get(CameraProperties::JPEG_THUMBNAIL_SIZE), width, height);
 
-		if ( NO_ERROR == ret )
+		if ( NO_ERROR == ret ) {
 			p.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH, width);
 			p.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT, height);
-		else
-			p.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH, MIN_WIDTH);
-			p.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT, MIN_HEIGHT);
+		} else {
+			p.set(CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH, THUMB_WIDTH);
+			p.set(CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT, THUMB_HEIGHT);
+		}
 		
 		p.set(CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_SIZES));
 		p.set(CameraParameters::KEY_SUPPORTED_PICTURE_FORMATS, mCameraProperties->get(CameraProperties::SUPPORTED_PICTURE_FORMATS));
@@ -2638,6 +2656,7 @@ exit:
 		p.set(CameraParameters::KEY_SUPPORTED_SCENE_MODES, mCameraProperties->get(CameraProperties::SUPPORTED_SCENE_MODES));
 		p.set(CameraParameters::KEY_ZOOM_RATIOS, mCameraProperties->get(CameraProperties::SUPPORTED_ZOOM_RATIOS));
 		p.set(CameraParameters::KEY_MAX_ZOOM, mCameraProperties->get(CameraProperties::SUPPORTED_ZOOM_STAGES));
+		mMaxZoomSupported = atoi(mCameraProperties->get(CameraProperties::SUPPORTED_ZOOM_STAGES));
 		p.set(CameraParameters::KEY_ZOOM_SUPPORTED, mCameraProperties->get(CameraProperties::ZOOM_SUPPORTED));
 		p.set(CameraParameters::KEY_SMOOTH_ZOOM_SUPPORTED, mCameraProperties->get(CameraProperties::SMOOTH_ZOOM_SUPPORTED));
 		p.set(CameraParameters::KEY_VIDEO_STABILIZATION_SUPPORTED, mCameraProperties->get(CameraProperties::VSTAB_SUPPORTED));
@@ -2662,6 +2681,11 @@ exit:
 		p.set(CameraParameters::KEY_VERTICAL_VIEW_ANGLE, mCameraProperties->get(CameraProperties::VER_ANGLE));
 		p.set(CameraParameters::KEY_PREVIEW_FPS_RANGE,mCameraProperties->get(CameraProperties::FRAMERATE_RANGE));
 		p.set(CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY, mCameraProperties->get(CameraProperties::JPEG_THUMBNAIL_QUALITY));
+		p.set(CameraProperties::JPEG_TARGET_SIZE, 0);
+		p.set(CameraProperties::BURST, 1);
+		p.set(CameraProperties::ZSL_HISTORY, 0);
+		p.set(CameraProperties::ZSL_SELECT, CameraProperties::ZSL_SELECT_NEAREST);
+		p.set(CameraProperties::PREVIEW_ROTATION, 0);
 		p.set(CameraParameters::KEY_VIDEO_FRAME_FORMAT, "OMX_TI_COLOR_FormatYUV420PackedSemiPlanar");
 		p.set(CameraParameters::KEY_MAX_NUM_DETECTED_FACES_SW, mCameraProperties->get(CameraProperties::MAX_FD_SW_FACES));
 
@@ -29,12 +29,16 @@
 
 #include "CameraHal.h"
 #include "CameraProperties.h"
+#include "DeviceManager.h"
 
 
 static android::CameraProperties gCameraProperties;
 static android::CameraHal* mCameraHals[MAX_CAMERAS_SUPPORTED];
 static unsigned int gCamerasOpen = 0;
+// guards mCameraHals and gCamerasOpen only, never held across a camera's construction or teardown
 static android::Mutex gCameraHalDeviceLock;
+// serialises open and close of one camera, so tearing one down does not stall the others
+static android::Mutex gCameraDeviceLocks[MAX_CAMERAS_SUPPORTED];
 
 static int camera_device_open(const hw_module_t* module, const char* name,
 		hw_device_t** device);
@@ -86,6 +90,9 @@ int camera_set_preview_window(struct camera_device * device,
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return rv;
+
 	rv = mCameraHals[ti_dev->cameraid]->setPreviewWindow(window);
 
 	return rv;
@@ -121,6 +128,9 @@ void camera_enable_msg_type(struct camera_device * device, int32_t msg_type)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	// a failed open is reported by the HAL itself
+	mCameraHals[ti_dev->cameraid]->waitForWorker();
+
 	mCameraHals[ti_dev->cameraid]->enableMsgType(msg_type);
 }
 
@@ -135,6 +145,9 @@ void camera_disable_msg_type(struct camera_device * device, int32_t msg_type)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	// a failed open is reported by the HAL itself
+	mCameraHals[ti_dev->cameraid]->waitForWorker();
+
 	mCameraHals[ti_dev->cameraid]->disableMsgType(msg_type);
 }
 
@@ -180,6 +193,9 @@ void camera_stop_preview(struct camera_device * device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	// a preview start still posted to the worker is dropped
+	mCameraHals[ti_dev->cameraid]->cancelPreviewStart();
+
 	mCameraHals[ti_dev->cameraid]->stopPreview();
 }
 
@@ -211,6 +227,9 @@ int camera_store_meta_data_in_buffers(struct camera_device * device, int enable)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return rv;
+
 	//  TODO: meta data buffer not current supported
 	rv = mCameraHals[ti_dev->cameraid]->storeMetaDataInBuffers(enable);
 	return rv;
@@ -229,6 +248,9 @@ int camera_start_recording(struct camera_device * device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return rv;
+
 	rv = mCameraHals[ti_dev->cameraid]->startRecording();
 	return rv;
 }
@@ -244,6 +266,9 @@ void camera_stop_recording(struct camera_device * device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return;
+
 	mCameraHals[ti_dev->cameraid]->stopRecording();
 }
 
@@ -290,6 +315,9 @@ int camera_auto_focus(struct camera_device * device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return rv;
+
 	rv = mCameraHals[ti_dev->cameraid]->autoFocus();
 	return rv;
 }
@@ -306,6 +334,9 @@ int camera_cancel_auto_focus(struct camera_device * device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return rv;
+
 	rv = mCameraHals[ti_dev->cameraid]->cancelAutoFocus();
 	return rv;
 }
@@ -322,6 +353,9 @@ int camera_take_picture(struct camera_device * device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return rv;
+
 	rv = mCameraHals[ti_dev->cameraid]->takePicture();
 	return rv;
 }
@@ -338,6 +372,9 @@ int camera_cancel_picture(struct camera_device * device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return rv;
+
 	rv = mCameraHals[ti_dev->cameraid]->cancelPicture();
 	return rv;
 }
@@ -354,6 +391,9 @@ int camera_set_parameters(struct camera_device * device, const char *params)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return rv;
+
 	rv = mCameraHals[ti_dev->cameraid]->setParameters(params);
 	return rv;
 }
@@ -370,6 +410,9 @@ char* camera_get_parameters(struct camera_device * device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	// a failed open is reported by the HAL itself
+	mCameraHals[ti_dev->cameraid]->waitForWorker();
+
 	param = mCameraHals[ti_dev->cameraid]->getParameters();
 
 	return param;
@@ -402,6 +445,9 @@ int camera_send_command(struct camera_device * device,
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	if(mCameraHals[ti_dev->cameraid]->waitForWorker() != android::NO_ERROR)
+		return rv;
+
 	rv = mCameraHals[ti_dev->cameraid]->sendCommand(cmd, arg1, arg2);
 	return rv;
 }
@@ -417,6 +463,9 @@ void camera_release(struct camera_device * device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
+	// a preview start still posted to the worker is dropped
+	mCameraHals[ti_dev->cameraid]->cancelPreviewStart();
+
 	mCameraHals[ti_dev->cameraid]->release();
 }
 
@@ -440,11 +489,10 @@ int camera_device_close(hw_device_t* device)
 {
 	int ret = 0;
 	ti_camera_device_t* ti_dev = NULL;
+	android::CameraHal* camera = NULL;
 
 	LOGINFO("%s", __FUNCTION__);
 
-	android::Mutex::Autolock lock(gCameraHalDeviceLock);
-
 	if (!device) {
 		ret = -EINVAL;
 		goto done;
@@ -452,13 +500,21 @@ int camera_device_close(hw_device_t* device)
 
 	ti_dev = (ti_camera_device_t*) device;
 
-	if (ti_dev) {
-		if (mCameraHals[ti_dev->cameraid]) {
-			delete mCameraHals[ti_dev->cameraid];
-			mCameraHals[ti_dev->cameraid] = NULL;
-			gCamerasOpen--;
+	{
+		android::Mutex::Autolock deviceLock(gCameraDeviceLocks[ti_dev->cameraid]);
+
+		{
+			android::Mutex::Autolock lock(gCameraHalDeviceLock);
+			camera = mCameraHals[ti_dev->cameraid];
+			if (camera) {
+				mCameraHals[ti_dev->cameraid] = NULL;
+				gCamerasOpen--;
+			}
 		}
 
+		// joins this camera's threads and frees its buffers, the other cameras keep running
+		delete camera;
+
 		if (ti_dev->base.ops) {
 			free(ti_dev->base.ops);
 		}
@@ -492,15 +548,13 @@ int camera_device_open(const hw_module_t* module, const char* name,
 	android::CameraHal* camera = NULL;
 	android::CameraProperties::Properties* properties = NULL;
 
-	android::Mutex::Autolock lock(gCameraHalDeviceLock);
-
 	LOGD("camera_device open");
 
 	if (name != NULL) {
 		cameraid = atoi(name);
 		num_cameras = gCameraProperties.camerasSupported();
 
-		if(cameraid > num_cameras)
+		if((cameraid < 0) || (cameraid >= num_cameras))
 		{
 			LOGINFO("camera service provided cameraid out of bounds, "
 					"cameraid = %d, num supported = %d",
@@ -509,11 +563,24 @@ int camera_device_open(const hw_module_t* module, const char* name,
 			goto fail;
 		}
 
-		if(gCamerasOpen >= MAX_SIMUL_CAMERAS_SUPPORTED)
+		android::Mutex::Autolock deviceLock(gCameraDeviceLocks[cameraid]);
+
 		{
-			LOGINFO("maximum number of cameras already open");
-			rv = -ENOMEM;
-			goto fail;
+			android::Mutex::Autolock lock(gCameraHalDeviceLock);
+
+			if(mCameraHals[cameraid])
+			{
+				LOGINFO("camera %d is already open", cameraid);
+				rv = -EBUSY;
+				goto fail;
+			}
+
+			if(gCamerasOpen >= MAX_SIMUL_CAMERAS_SUPPORTED)
+			{
+				LOGINFO("maximum number of cameras already open");
+				rv = -ENOMEM;
+				goto fail;
+			}
 		}
 
 		camera_device = (ti_camera_device_t*)malloc(sizeof(*camera_device));
@@ -587,6 +654,8 @@ int camera_device_open(const hw_module_t* module, const char* name,
 			goto fail;
 		}
 
+		// only posts the device probe to the HAL worker, neither device lock is held across it;
+		// a failed probe reaches the client as CAMERA_MSG_ERROR and fails the calls needing the device
 		if(properties && (camera->initialize(properties) != android::NO_ERROR))
 		{
 			LOGINFO("Couldn't initialize camera instance");
@@ -594,8 +663,20 @@ int camera_device_open(const hw_module_t* module, const char* name,
 			goto fail;
 		}
 
-		mCameraHals[cameraid] = camera;
-		gCamerasOpen++;
+		{
+			android::Mutex::Autolock lock(gCameraHalDeviceLock);
+
+			// a concurrent open of another camera may have taken the last slot meanwhile
+			if(gCamerasOpen >= MAX_SIMUL_CAMERAS_SUPPORTED)
+			{
+				LOGINFO("maximum number of cameras already open");
+				rv = -ENOMEM;
+				goto fail;
+			}
+
+			mCameraHals[cameraid] = camera;
+			gCamerasOpen++;
+		}
 	}
 
 	return rv;
@@ -618,8 +699,32 @@ fail:
 }
 
 int camera_get_number_of_cameras(void) {
+	// the first call in the process, before anything worth logging
+	android::CameraLog::loadLevel();
+	android::FrameTrace::loadEnabled();
+
 	LOGINFO("camera_get_number_of_cameras\n");
-	int num_cameras = 1;
+
+	// the capture nodes are discovered once, on the first call from camera service
+	if(gCameraProperties.initialize() != android::NO_ERROR)
+	{
+		LOGINFO("Unable to create or initialize CameraProperties");
+		return 0;
+	}
+
+	int num_cameras = gCameraProperties.camerasSupported();
+
+	// each id stays bound to its device, wherever it shows up again after a reset or replug
+	android::DeviceManager* devices = android::DeviceManager::getInstance();
+	for (int i = 0; i < num_cameras; i++) {
+		android::CameraProperties::Properties* properties = NULL;
+		if(gCameraProperties.getProperties(i, &properties) == 0)
+		{
+			devices->registerCamera(i, properties->get(android::CameraProperties::DEVICE_NODE));
+		}
+	}
+	devices->start();
+
 	return num_cameras;
 }
 
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraLog.cpp
+*
+* This file implements the runtime log level and the per call site rate
+* limit behind LOGINFO.
+*
+*/
+
+#define LOG_TAG "CameraHAL"
+
+#include "CameraHal.h"
+#include "CameraLog.h"
+#include <cutils/properties.h>
+
+namespace android {
+
+#define LOG_SITES 64
+
+	typedef struct
+		{
+		const char *mFile;
+		int mLine;
+		nsecs_t mWindowStart;
+		unsigned int mCount;
+		unsigned int mSuppressed;
+		} LogSite;
+
+	volatile int CameraLog::sLevel = CAMERA_LOG_INFO;
+
+	static Mutex gLogLock;
+	static LogSite gSites[LOG_SITES];
+
+	void CameraLog::setLevel(int level)
+	{
+		if (level < CAMERA_LOG_ERROR) {
+			level = CAMERA_LOG_ERROR;
+		} else if (level > CAMERA_LOG_TRACE) {
+			level = CAMERA_LOG_TRACE;
+		}
+
+		if (level != sLevel) {
+			LOGI("Log level %d", level);
+		}
+		sLevel = level;
+	}
+
+	void CameraLog::loadLevel()
+	{
+		char value[PROPERTY_VALUE_MAX];
+
+		if (0 < property_get(CAMERA_LOG_LEVEL_PROPERTY, value, NULL)) {
+			setLevel(atoi(value));
+		}
+	}
+
+	bool CameraLog::allow(const char *file, int line)
+	{
+		// the same __FILE__ literal is not guaranteed a single address, its contents tell sites apart
+		unsigned int slot = (line * 31 + strlen(file)) % LOG_SITES;
+		nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+		unsigned int suppressed = 0;
+
+		{
+			Mutex::Autolock lock(gLogLock);
+			LogSite &site = gSites[slot];
+
+			if ( (site.mLine != line) || ( (site.mFile != file) &&
+					((NULL == site.mFile) || (0 != strcmp(site.mFile, file))) ) ) {
+				// a colliding site takes the slot over, its pending drops are lost
+				site.mFile = file;
+				site.mLine = line;
+				site.mWindowStart = now;
+				site.mCount = 0;
+				site.mSuppressed = 0;
+			} else if ( (now - site.mWindowStart) >= s2ns(1) ) {
+				suppressed = site.mSuppressed;
+				site.mWindowStart = now;
+				site.mCount = 0;
+				site.mSuppressed = 0;
+			}
+
+			if (site.mCount >= CAMERA_LOG_RATE) {
+				site.mSuppressed++;
+				return false;
+			}
+			site.mCount++;
+		}
+
+		if (suppressed) {
+			const char *name = strrchr(file, '/');
+			LOGE("%s:%d: %u messages suppressed", (NULL != name) ? name + 1 : file, line, suppressed);
+		}
+
+		return true;
+	}
+
+};
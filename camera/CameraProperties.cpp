@@ -27,15 +27,28 @@
 #include "CameraHal.h"
 #include "DebugUtils.h"
 #include "CameraProperties.h"
+#include "DeviceManager.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
 
 #define CAMERA_ROOT         "CameraRoot"
 #define CAMERA_INSTANCE     "CameraInstance"
 
+///Video nodes are looked up here, in ascending node number
+#define VIDEO_DEVICE_DIR    "/dev"
+#define VIDEO_DEVICE_PREFIX "video"
+
 namespace android {
 
 const char CameraProperties::INVALID[]="invalid-key";
 const char CameraProperties::CAMERA_NAME[]="camera-name";
 const char CameraProperties::CAMERA_SENSOR_INDEX[]="sensor-index";
+const char CameraProperties::DEVICE_NODE[]="device-node";
 const char CameraProperties::ORIENTATION_INDEX[]="orientation";
 const char CameraProperties::FACING_INDEX[]="facing";
 const char CameraProperties::S3D_SUPPORTED[]="s3d-supported";
@@ -106,6 +119,18 @@ const char CameraProperties::SENSOR_ORIENTATION_VALUES[]= "sensor-orientation-va
 const char CameraProperties::EXIF_MAKE[] = "exif-make";
 const char CameraProperties::EXIF_MODEL[] = "exif-model";
 const char CameraProperties::JPEG_THUMBNAIL_QUALITY[] = "jpeg-thumbnail-quality-default";
+const char CameraProperties::JPEG_TARGET_SIZE[] = "jpeg-target-size";
+const char CameraProperties::BURST[] = "burst-capture";
+const char CameraProperties::ZSL_HISTORY[] = "zsl-history";
+const char CameraProperties::ZSL_SELECT[] = "zsl-select";
+const char CameraProperties::ZSL_SELECT_NEAREST[] = "nearest";
+const char CameraProperties::ZSL_SELECT_SHARPEST[] = "sharpest";
+const char CameraProperties::PREVIEW_ROTATION[] = "preview-rotation";
+const char CameraProperties::PREVIEW_ROTATION_AUTO[] = "auto";
+const char CameraProperties::BRIGHTNESS_LEVEL[] = "brightness";
+const char CameraProperties::CONTRAST_LEVEL[] = "contrast";
+const char CameraProperties::SATURATION_LEVEL[] = "saturation";
+const char CameraProperties::SHARPNESS_LEVEL[] = "sharpness";
 const char CameraProperties::MAX_FOCUS_AREAS[] = "max-focus-areas";
 const char CameraProperties::MAX_FD_HW_FACES[] = "max-fd-hw-faces";
 const char CameraProperties::MAX_FD_SW_FACES[] = "max-fd-sw-faces";
@@ -130,6 +155,17 @@ extern "C" int CameraAdapter_Capabilities(CameraProperties::Properties* properti
 		const unsigned int max_camera) {
 	int num_cameras_supported = 0;
 	CameraProperties::Properties* properties = NULL;
+	int nodes[MAX_CAMERAS_SUPPORTED * 4];
+	unsigned int nodeCount = 0;
+	struct {
+		struct v4l2_capability cap;
+		char node[32];
+	} captures[MAX_CAMERAS_SUPPORTED];
+	unsigned int captureCount = 0;
+	struct v4l2_capability cap;
+	struct dirent *entry;
+	char path[32];
+	DIR *dir;
 
 	LOG_FUNCTION_NAME;
 
@@ -138,11 +174,68 @@ extern "C" int CameraAdapter_Capabilities(CameraProperties::Properties* properti
 		return -EINVAL;
 	}
 
-	// TODO: Need to tell camera properties what other cameras we can support
-	if (starting_camera + num_cameras_supported < max_camera) {
+	dir = opendir(VIDEO_DEVICE_DIR);
+	if (NULL == dir) {
+		LOGINFO("cannot list %s: %s", VIDEO_DEVICE_DIR, strerror(errno));
+		LOG_FUNCTION_NAME_EXIT;
+		return 0;
+	}
+
+	// sorted by node number, the lowest node of a device is its capture node
+	while ( (NULL != (entry = readdir(dir))) && (nodeCount < sizeof(nodes) / sizeof(nodes[0])) ) {
+		const char *num = entry->d_name + sizeof(VIDEO_DEVICE_PREFIX) - 1;
+		char *end;
+
+		if ( (0 != strncmp(entry->d_name, VIDEO_DEVICE_PREFIX, sizeof(VIDEO_DEVICE_PREFIX) - 1)) ||
+				('\0' == *num) ) {
+			continue;
+		}
+
+		long node = strtol(num, &end, 10);
+		if ( ('\0' != *end) || (node < 0) ) {
+			continue;
+		}
+
+		unsigned int i = nodeCount++;
+		while ( (i > 0) && (nodes[i - 1] > node) ) {
+			nodes[i] = nodes[i - 1];
+			i--;
+		}
+		nodes[i] = (int) node;
+	}
+	closedir(dir);
+
+	// ids follow the bus path, so a camera keeps its id across reboots and replug order as long
+	// as it stays on the same port; node numbers only break ties
+	for (unsigned int i = 0; i < nodeCount; i++) {
+		snprintf(path, sizeof(path), "%s/%s%d", VIDEO_DEVICE_DIR, VIDEO_DEVICE_PREFIX, nodes[i]);
+		if (!DeviceManager::isCaptureNode(path, cap)) {
+			continue;
+		}
+
+		if ( (captureCount >= MAX_CAMERAS_SUPPORTED) || (starting_camera + captureCount >= max_camera) ) {
+			LOGINFO("more capture devices than the %u supported, ignoring %s", max_camera, path);
+			continue;
+		}
+
+		unsigned int pos = captureCount++;
+		while ( (pos > 0) && (strcmp((const char *) captures[pos - 1].cap.bus_info,
+						(const char *) cap.bus_info) > 0) ) {
+			captures[pos] = captures[pos - 1];
+			pos--;
+		}
+		captures[pos].cap = cap;
+		strncpy(captures[pos].node, path, sizeof(captures[pos].node) - 1);
+		captures[pos].node[sizeof(captures[pos].node) - 1] = '\0';
+	}
+
+	for (unsigned int i = 0; i < captureCount; i++) {
+		properties = properties_array + starting_camera + num_cameras_supported;
+		properties->set(CameraProperties::CAMERA_NAME, (const char *) captures[i].cap.card);
+		properties->set(CameraProperties::DEVICE_NODE, captures[i].node);
+		LOGINFO("camera %d: %s on %s (%s)", starting_camera + num_cameras_supported,
+				captures[i].cap.card, captures[i].node, captures[i].cap.bus_info);
 		num_cameras_supported++;
-		properties = properties_array + starting_camera;
-		properties->set(CameraProperties::CAMERA_NAME, "USBCamera");
 	}
 
 	LOG_FUNCTION_NAME_EXIT;
@@ -220,8 +313,17 @@ status_t CameraProperties::loadProperties()
 			mCameraProps[i].set(CameraParameters::KEY_SCENE_MODE, "auto");
 			mCameraProps[i].set(CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, "640x480");
 			mCameraProps[i].set(CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES, "640x480");
+			mCameraProps[i].set(CameraProperties::JPEG_THUMBNAIL_SIZE, "160x120");
+			mCameraProps[i].set(CameraProperties::SUPPORTED_THUMBNAIL_SIZES, "160x120,0x0");
+			mCameraProps[i].set(CameraProperties::JPEG_THUMBNAIL_QUALITY, 90);
+			mCameraProps[i].set(CameraProperties::SUPPORTED_ZOOM_RATIOS, "100,125,150,175,200,250,300,350,400");
+			mCameraProps[i].set(CameraProperties::SUPPORTED_ZOOM_STAGES, 8);
+			mCameraProps[i].set(CameraProperties::ZOOM_SUPPORTED, CameraParameters::TRUE);
+			mCameraProps[i].set(CameraProperties::SMOOTH_ZOOM_SUPPORTED, CameraParameters::TRUE);
+			mCameraProps[i].set(CameraProperties::ZOOM, 0);
 
 			mCameraProps[i].set(CameraProperties::REQUIRED_PREVIEW_BUFS, 8);
+			mCameraProps[i].set(CameraProperties::REQUIRED_IMAGE_BUFS, 3);
 
             mCameraProps[i].dump();
         }
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CapabilityCache.cpp
+*
+* This file implements the persistent device capability cache read by the
+* V4L camera adapter at open.
+*
+*/
+
+#define LOG_TAG "CapabilityCache"
+
+#include "CameraHal.h"
+#include "CapabilityCache.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <cutils/properties.h>
+
+namespace android {
+
+	// "V4CC"
+	static const uint32_t CAPABILITY_CACHE_MAGIC = 0x43433456;
+
+	// FNV-1a
+	static const uint32_t HASH_SEED = 2166136261u;
+	static const uint32_t HASH_PRIME = 16777619u;
+
+	CapabilityCache::CapabilityCache()
+		: mEnabled(false), mValid(false), mDirty(false), mIdentity(0)
+	{
+		memset(&mUsb, 0, sizeof(mUsb));
+		memset(mPath, 0, sizeof(mPath));
+		memset(mControls, 0, sizeof(mControls));
+	}
+
+	uint32_t CapabilityCache::hash(uint32_t seed, const void *data, size_t length)
+	{
+		const unsigned char *bytes = (const unsigned char *) data;
+
+		for (size_t i = 0; i < length; i++) {
+			seed ^= bytes[i];
+			seed *= HASH_PRIME;
+		}
+
+		return seed;
+	}
+
+	void CapabilityCache::readSysfs(const char *path, char *value, size_t length)
+	{
+		int fd;
+		ssize_t len;
+
+		value[0] = '\0';
+
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+
+		len = read(fd, value, length - 1);
+		close(fd);
+
+		if (len <= 0) {
+			value[0] = '\0';
+			return;
+		}
+
+		while ((len > 0) && ((value[len - 1] == '\n') || (value[len - 1] == ' '))) {
+			len--;
+		}
+		value[len] = '\0';
+	}
+
+	status_t CapabilityCache::identify(int fd, const char *node, const struct v4l2_capability &cap)
+	{
+		char value[PROPERTY_VALUE_MAX];
+		char path[96];
+		struct stat st;
+		const char *name;
+
+		LOG_FUNCTION_NAME;
+
+		mValid = false;
+		mDirty = false;
+		memset(&mUsb, 0, sizeof(mUsb));
+		memset(mControls, 0, sizeof(mControls));
+
+		property_get(CAPABILITY_CACHE_PROPERTY, value, CAPABILITY_CACHE_DIR);
+		mEnabled = (0 != strcmp(value, "0")) && ('\0' != value[0]);
+		if (!mEnabled) {
+			LOGINFO("capability cache disabled");
+			LOG_FUNCTION_NAME_EXIT;
+			return NO_ERROR;
+		}
+
+		name = strrchr(node, '/');
+		name = (NULL != name) ? name + 1 : node;
+		snprintf(mPath, sizeof(mPath), "%s/caps-%s.bin", value, name);
+
+		// the video node's device is the UVC interface, its parent the USB device
+		if ((0 == fstat(fd, &st)) && S_ISCHR(st.st_mode)) {
+			unsigned int maj = major(st.st_rdev);
+			unsigned int min = minor(st.st_rdev);
+
+			snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/../idVendor", maj, min);
+			readSysfs(path, mUsb.mVendor, sizeof(mUsb.mVendor));
+			snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/../idProduct", maj, min);
+			readSysfs(path, mUsb.mProduct, sizeof(mUsb.mProduct));
+			snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/../bcdDevice", maj, min);
+			readSysfs(path, mUsb.mRevision, sizeof(mUsb.mRevision));
+			snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/../serial", maj, min);
+			readSysfs(path, mUsb.mSerial, sizeof(mUsb.mSerial));
+		}
+
+		mIdentity = hash(HASH_SEED, &mUsb, sizeof(mUsb));
+		mIdentity = hash(mIdentity, cap.driver, sizeof(cap.driver));
+		mIdentity = hash(mIdentity, cap.card, sizeof(cap.card));
+		mIdentity = hash(mIdentity, cap.bus_info, sizeof(cap.bus_info));
+		mIdentity = hash(mIdentity, &cap.version, sizeof(cap.version));
+		mIdentity = hash(mIdentity, &cap.capabilities, sizeof(cap.capabilities));
+
+		LOGINFO("%s: %s:%s rev %s serial '%s', identity %08x", node, mUsb.mVendor, mUsb.mProduct,
+				mUsb.mRevision, mUsb.mSerial, mIdentity);
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_ERROR;
+	}
+
+	bool CapabilityCache::load()
+	{
+		Header header;
+		ControlRecord controls[CAPABILITY_CACHE_MAX_CONTROLS];
+		int fd;
+		ssize_t len;
+
+		LOG_FUNCTION_NAME;
+
+		mValid = false;
+
+		if (!mEnabled) {
+			LOG_FUNCTION_NAME_EXIT;
+			return false;
+		}
+
+		fd = open(mPath, O_RDONLY);
+		if (fd < 0) {
+			LOGINFO("no capability cache at %s", mPath);
+			LOG_FUNCTION_NAME_EXIT;
+			return false;
+		}
+
+		len = read(fd, &header, sizeof(header));
+		if ( (len != (ssize_t) sizeof(header)) ||
+				(CAPABILITY_CACHE_MAGIC != header.mMagic) ||
+				(CAPABILITY_CACHE_VERSION != header.mVersion) ||
+				(header.mControlCount > CAPABILITY_CACHE_MAX_CONTROLS) ) {
+			LOGINFO("capability cache %s has an unknown format", mPath);
+			close(fd);
+			LOG_FUNCTION_NAME_EXIT;
+			return false;
+		}
+
+		if (mIdentity != header.mIdentity) {
+			LOGINFO("capability cache %s is for device %08x, this is %08x", mPath, header.mIdentity, mIdentity);
+			close(fd);
+			LOG_FUNCTION_NAME_EXIT;
+			return false;
+		}
+
+		memset(controls, 0, sizeof(controls));
+		len = read(fd, controls, header.mControlCount * sizeof(ControlRecord));
+		close(fd);
+
+		if ( (len != (ssize_t) (header.mControlCount * sizeof(ControlRecord))) ||
+				(header.mChecksum != hash(HASH_SEED, controls, len)) ) {
+			LOGINFO("capability cache %s is truncated or corrupt", mPath);
+			LOG_FUNCTION_NAME_EXIT;
+			return false;
+		}
+
+		memcpy(mControls, controls, sizeof(mControls));
+		mValid = true;
+		mDirty = false;
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return true;
+	}
+
+	status_t CapabilityCache::store()
+	{
+		Header header;
+		char tmp[sizeof(mPath) + 4];
+		unsigned int count = 0;
+		ssize_t len;
+		int fd;
+
+		LOG_FUNCTION_NAME;
+
+		if (!mEnabled || !mDirty) {
+			LOG_FUNCTION_NAME_EXIT;
+			return NO_ERROR;
+		}
+
+		for (unsigned int i = 0; i < CAPABILITY_CACHE_MAX_CONTROLS; i++) {
+			if (0 != mControls[i].mId) {
+				count = i + 1;
+			}
+		}
+
+		header.mMagic = CAPABILITY_CACHE_MAGIC;
+		header.mVersion = CAPABILITY_CACHE_VERSION;
+		header.mIdentity = mIdentity;
+		header.mControlCount = count;
+		header.mChecksum = hash(HASH_SEED, mControls, count * sizeof(ControlRecord));
+
+		// written aside and renamed so a crash never leaves a half written cache behind
+		snprintf(tmp, sizeof(tmp), "%s.tmp", mPath);
+		fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0) {
+			status_t err = -errno;
+			LOGINFO("cannot create %s: %s", tmp, strerror(-err));
+			LOG_FUNCTION_NAME_EXIT;
+			return err;
+		}
+
+		len = write(fd, &header, sizeof(header));
+		if (len == (ssize_t) sizeof(header)) {
+			len = write(fd, mControls, count * sizeof(ControlRecord));
+		} else {
+			len = -1;
+		}
+
+		if ( (len != (ssize_t) (count * sizeof(ControlRecord))) || (0 != fsync(fd)) ) {
+			LOGINFO("cannot write %s: %s", tmp, strerror(errno));
+			close(fd);
+			unlink(tmp);
+			LOG_FUNCTION_NAME_EXIT;
+			return UNKNOWN_ERROR;
+		}
+		close(fd);
+
+		if (0 != rename(tmp, mPath)) {
+			LOGINFO("cannot rename %s: %s", tmp, strerror(errno));
+			unlink(tmp);
+			LOG_FUNCTION_NAME_EXIT;
+			return UNKNOWN_ERROR;
+		}
+
+		mValid = true;
+		mDirty = false;
+
+		LOGINFO("stored %u controls for device %08x in %s", count, mIdentity, mPath);
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_ERROR;
+	}
+
+	bool CapabilityCache::getControl(unsigned int index, uint32_t id, struct v4l2_queryctrl &query, bool &queried) const
+	{
+		if ( !mValid || (index >= CAPABILITY_CACHE_MAX_CONTROLS) || (id != mControls[index].mId) ) {
+			return false;
+		}
+
+		query = mControls[index].mQuery;
+		queried = (0 != mControls[index].mQueried);
+
+		return true;
+	}
+
+	void CapabilityCache::setControl(unsigned int index, uint32_t id, const struct v4l2_queryctrl *query)
+	{
+		if (index >= CAPABILITY_CACHE_MAX_CONTROLS) {
+			return;
+		}
+
+		ControlRecord &record = mControls[index];
+
+		memset(&record, 0, sizeof(record));
+		record.mId = id;
+		if (NULL != query) {
+			record.mQueried = 1;
+			record.mQuery = *query;
+		}
+		record.mQuery.id = id;
+
+		mDirty = true;
+	}
+
+};
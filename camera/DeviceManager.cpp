@@ -0,0 +1,512 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file DeviceManager.cpp
+*
+* This file implements the hotplug aware mapping of camera ids to video
+* nodes.
+*
+*/
+
+#define LOG_TAG "DeviceManager"
+
+#include "CameraHal.h"
+#include "DeviceManager.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/netlink.h>
+
+namespace android {
+
+#define VIDEO_DEVICE_DIR "/dev"
+#define VIDEO_DEVICE_PREFIX "video"
+#define UEVENT_BUFFER_SIZE 2048
+
+	static Mutex gInstanceLock;
+	static DeviceManager *gInstance = NULL;
+
+	DeviceManager* DeviceManager::getInstance()
+	{
+		Mutex::Autolock lock(gInstanceLock);
+
+		if (NULL == gInstance) {
+			gInstance = new DeviceManager();
+		}
+
+		return gInstance;
+	}
+
+	DeviceManager::DeviceManager()
+		: mUeventFd(-1), mInotifyFd(-1), mInotifyWatch(-1)
+	{
+		memset(mCameras, 0, sizeof(mCameras));
+	}
+
+	static void readAttribute(const char *dir, const char *name, char *value, size_t length)
+	{
+		char path[PATH_MAX];
+		ssize_t len;
+		int fd;
+
+		value[0] = '\0';
+
+		snprintf(path, sizeof(path), "%s/%s", dir, name);
+		fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+
+		len = read(fd, value, length - 1);
+		close(fd);
+
+		while ((len > 0) && ((value[len - 1] == '\n') || (value[len - 1] == ' '))) {
+			len--;
+		}
+		value[(len > 0) ? len : 0] = '\0';
+	}
+
+	status_t DeviceManager::readIdentity(const char *node, Identity &identity)
+	{
+		char link[64];
+		char device[PATH_MAX];
+		const char *name;
+		struct stat st;
+
+		memset(&identity, 0, sizeof(identity));
+
+		if ( (0 != stat(node, &st)) || !S_ISCHR(st.st_mode) ) {
+			return NAME_NOT_FOUND;
+		}
+
+		// the node's device is the UVC interface, its parent the USB device named by its port path
+		snprintf(link, sizeof(link), "/sys/dev/char/%u:%u/device/..",
+				(unsigned int) major(st.st_rdev), (unsigned int) minor(st.st_rdev));
+		if (NULL == realpath(link, device)) {
+			return NAME_NOT_FOUND;
+		}
+
+		name = strrchr(device, '/');
+		name = (NULL != name) ? name + 1 : device;
+		strncpy(identity.mBusPath, name, sizeof(identity.mBusPath) - 1);
+		readAttribute(device, "idVendor", identity.mVendor, sizeof(identity.mVendor));
+		readAttribute(device, "idProduct", identity.mProduct, sizeof(identity.mProduct));
+		readAttribute(device, "serial", identity.mSerial, sizeof(identity.mSerial));
+
+		return NO_ERROR;
+	}
+
+	// cheap cameras often report a placeholder such as "0000" that every unit shares
+	static bool isUsableSerial(const char *serial)
+	{
+		if ('\0' == serial[0]) {
+			return false;
+		}
+
+		for (const char *p = serial + 1; '\0' != *p; p++) {
+			if (*p != serial[0]) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool DeviceManager::sameDevice(const Identity &a, const Identity &b)
+	{
+		if ( (0 != strcmp(a.mVendor, b.mVendor)) || (0 != strcmp(a.mProduct, b.mProduct)) ) {
+			return false;
+		}
+
+		// a serial number follows the camera to another port, the port is all there is otherwise
+		if ( isUsableSerial(a.mSerial) && isUsableSerial(b.mSerial) ) {
+			return 0 == strcmp(a.mSerial, b.mSerial);
+		}
+
+		return ('\0' != a.mBusPath[0]) && (0 == strcmp(a.mBusPath, b.mBusPath));
+	}
+
+	// A node is a camera when it streams video capture and lists at least one capture format,
+	// which rules out the metadata and output nodes UVC and other drivers register alongside
+	bool DeviceManager::isCaptureNode(const char *node, struct v4l2_capability &cap)
+	{
+		struct v4l2_fmtdesc fmt;
+		unsigned int caps;
+		bool capture = false;
+		int fd;
+
+		fd = open(node, O_RDWR | O_NONBLOCK);
+		if (fd < 0) {
+			LOGINFO("cannot open %s: %s", node, strerror(errno));
+			return false;
+		}
+
+		memset(&cap, 0, sizeof(cap));
+		if (ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0) {
+			caps = cap.capabilities;
+#ifdef V4L2_CAP_DEVICE_CAPS
+			if (caps & V4L2_CAP_DEVICE_CAPS) {
+				caps = cap.device_caps;
+			}
+#endif
+			memset(&fmt, 0, sizeof(fmt));
+			fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			capture = (caps & V4L2_CAP_VIDEO_CAPTURE) && (caps & V4L2_CAP_STREAMING) &&
+					(ioctl(fd, VIDIOC_ENUM_FMT, &fmt) == 0);
+		}
+
+		close(fd);
+
+		return capture;
+	}
+
+	status_t DeviceManager::registerCamera(int cameraId, const char *node)
+	{
+		Identity identity;
+
+		if ( (cameraId < 0) || (cameraId >= MAX_CAMERAS_SUPPORTED) || (NULL == node) ) {
+			return BAD_VALUE;
+		}
+
+		if (NO_ERROR != readIdentity(node, identity)) {
+			LOGINFO("camera %d: no identity for %s, it is not followed across replugs", cameraId, node);
+		}
+
+		Mutex::Autolock lock(mLock);
+		Camera &camera = mCameras[cameraId];
+
+		if (camera.mRegistered) {
+			return NO_ERROR;
+		}
+
+		camera.mRegistered = true;
+		camera.mPresent = true;
+		camera.mIdentity = identity;
+		strncpy(camera.mNode, node, sizeof(camera.mNode) - 1);
+		camera.mGeneration = 1;
+
+		LOGINFO("camera %d: %s, %s:%s port %s serial '%s'", cameraId, node,
+				identity.mVendor, identity.mProduct, identity.mBusPath, identity.mSerial);
+
+		return NO_ERROR;
+	}
+
+	status_t DeviceManager::start()
+	{
+		struct sockaddr_nl addr;
+		int size = 64 * 1024;
+
+		LOG_FUNCTION_NAME;
+
+		Mutex::Autolock lock(mLock);
+
+		if (NULL != mWatchThread.get()) {
+			LOG_FUNCTION_NAME_EXIT;
+			return NO_ERROR;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.nl_family = AF_NETLINK;
+		addr.nl_pid = 0;
+		addr.nl_groups = 1;
+
+		mUeventFd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+		if (mUeventFd >= 0) {
+			setsockopt(mUeventFd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size));
+			if (bind(mUeventFd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+				LOGINFO("uevent socket bind failed: %s", strerror(errno));
+				close(mUeventFd);
+				mUeventFd = -1;
+			}
+		}
+
+		// node creation and removal in /dev, ueventd acts on the same events
+		if (mUeventFd < 0) {
+			mInotifyFd = inotify_init();
+			if (mInotifyFd >= 0) {
+				mInotifyWatch = inotify_add_watch(mInotifyFd, VIDEO_DEVICE_DIR, IN_CREATE | IN_DELETE | IN_ATTRIB);
+				if (mInotifyWatch < 0) {
+					LOGINFO("inotify on %s failed: %s", VIDEO_DEVICE_DIR, strerror(errno));
+					close(mInotifyFd);
+					mInotifyFd = -1;
+				}
+			}
+		}
+
+		LOGINFO("watching for camera nodes with %s", (mUeventFd >= 0) ? "uevents" :
+				((mInotifyFd >= 0) ? "inotify" : "periodic rescans"));
+
+		mWatchThread = new WatchThread(this);
+		if (NO_ERROR != mWatchThread->run("CameraDeviceWatch", PRIORITY_BACKGROUND)) {
+			LOGINFO("cannot start the device watch thread");
+			mWatchThread.clear();
+			LOG_FUNCTION_NAME_EXIT;
+			return UNKNOWN_ERROR;
+		}
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_ERROR;
+	}
+
+	bool DeviceManager::anyLostLocked() const
+	{
+		for (int i = 0; i < MAX_CAMERAS_SUPPORTED; i++) {
+			if (mCameras[i].mRegistered && !mCameras[i].mPresent) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool DeviceManager::watch()
+	{
+		char buf[UEVENT_BUFFER_SIZE];
+		struct pollfd fds;
+		bool lost;
+		bool changed = false;
+		int ret;
+
+		{
+			Mutex::Autolock lock(mLock);
+			lost = anyLostLocked();
+		}
+
+		fds.fd = (mUeventFd >= 0) ? mUeventFd : mInotifyFd;
+		fds.events = POLLIN;
+		fds.revents = 0;
+
+		// without an event source missing cameras are only found by rescanning
+		if (fds.fd < 0) {
+			usleep(DEVICE_RESCAN_INTERVAL_MS * 1000);
+			if (lost) {
+				rescan();
+			}
+			return true;
+		}
+
+		// bounded so a camera marked lost after the poll started is still rescanned for
+		ret = poll(&fds, 1, DEVICE_RESCAN_INTERVAL_MS);
+		if (ret < 0) {
+			if (EINTR != errno) {
+				LOGINFO("device watch poll failed: %s", strerror(errno));
+				usleep(DEVICE_RESCAN_INTERVAL_MS * 1000);
+			}
+			return true;
+		}
+
+		if (ret > 0) {
+			ssize_t len = read(fds.fd, buf, sizeof(buf) - 1);
+			if (len <= 0) {
+				return true;
+			}
+			buf[len] = '\0';
+
+			if (fds.fd == mUeventFd) {
+				// "action@devpath" followed by KEY=value strings, only video nodes matter
+				for (ssize_t pos = 0; pos < len; pos += strlen(buf + pos) + 1) {
+					if (0 == strcmp(buf + pos, "SUBSYSTEM=video4linux")) {
+						LOGINFO("uevent %s", buf);
+						changed = true;
+						break;
+					}
+				}
+			} else {
+				for (ssize_t pos = 0; pos + (ssize_t) sizeof(struct inotify_event) <= len; ) {
+					struct inotify_event *event = (struct inotify_event *) (buf + pos);
+					if ( (event->len > 0) &&
+							(0 == strncmp(event->name, VIDEO_DEVICE_PREFIX, sizeof(VIDEO_DEVICE_PREFIX) - 1)) ) {
+						changed = true;
+					}
+					pos += sizeof(struct inotify_event) + event->len;
+				}
+			}
+		}
+
+		// the periodic rescan covers nodes ueventd had not created yet when the event came in
+		if (changed || lost) {
+			rescan();
+		}
+
+		return true;
+	}
+
+	void DeviceManager::rescan()
+	{
+		Identity identities[MAX_CAMERAS_SUPPORTED * 4];
+		char nodes[MAX_CAMERAS_SUPPORTED * 4][32];
+		struct v4l2_capability cap;
+		unsigned int count = 0;
+		struct dirent *entry;
+		DIR *dir;
+
+		dir = opendir(VIDEO_DEVICE_DIR);
+		if (NULL == dir) {
+			return;
+		}
+
+		while ( (NULL != (entry = readdir(dir))) && (count < sizeof(nodes) / sizeof(nodes[0])) ) {
+			if (0 != strncmp(entry->d_name, VIDEO_DEVICE_PREFIX, sizeof(VIDEO_DEVICE_PREFIX) - 1)) {
+				continue;
+			}
+
+			// the same test discovery uses, UVC also registers a metadata node next to the capture one
+			snprintf(nodes[count], sizeof(nodes[count]), "%s/%s", VIDEO_DEVICE_DIR, entry->d_name);
+			if ( (NO_ERROR == readIdentity(nodes[count], identities[count])) &&
+					isCaptureNode(nodes[count], cap) ) {
+				count++;
+			}
+		}
+		closedir(dir);
+
+		Mutex::Autolock lock(mLock);
+		bool signal = false;
+
+		for (int i = 0; i < MAX_CAMERAS_SUPPORTED; i++) {
+			Camera &camera = mCameras[i];
+			int found = -1;
+
+			// a camera without identity cannot be told apart from another one, it is left alone
+			if ( !camera.mRegistered || ('\0' == camera.mIdentity.mBusPath[0]) ) {
+				continue;
+			}
+
+			// units sharing a serial are told apart by the port, a tie on another port is not guessed
+			bool ambiguous = false;
+			for (unsigned int n = 0; n < count; n++) {
+				if (!sameDevice(camera.mIdentity, identities[n])) {
+					continue;
+				}
+				if (found < 0) {
+					found = n;
+				} else if (0 == strcmp(identities[n].mBusPath, camera.mIdentity.mBusPath)) {
+					found = n;
+					ambiguous = false;
+				} else if ( (0 != strcmp(identities[found].mBusPath, camera.mIdentity.mBusPath)) &&
+						(0 != strcmp(identities[found].mBusPath, identities[n].mBusPath)) ) {
+					ambiguous = true;
+				}
+			}
+			if (ambiguous) {
+				LOGINFO("camera %d: more than one device with serial '%s', waiting for its port %s", i,
+						camera.mIdentity.mSerial, camera.mIdentity.mBusPath);
+				found = -1;
+			}
+
+			if ( camera.mPresent && ((found < 0) || (0 != strcmp(nodes[found], camera.mNode))) ) {
+				LOGINFO("camera %d: %s removed", i, camera.mNode);
+				camera.mPresent = false;
+				camera.mLostAt = systemTime();
+				signal = true;
+			}
+
+			if (!camera.mPresent && (found >= 0)) {
+				strncpy(camera.mNode, nodes[found], sizeof(camera.mNode) - 1);
+				camera.mNode[sizeof(camera.mNode) - 1] = '\0';
+				camera.mPresent = true;
+				camera.mGeneration++;
+				LOGINFO("camera %d: back on %s after %lld ms", i, camera.mNode,
+						ns2ms(systemTime() - camera.mLostAt));
+				signal = true;
+			}
+		}
+
+		if (signal) {
+			mChanged.broadcast();
+		}
+	}
+
+	bool DeviceManager::getNode(int cameraId, char *node, size_t length, unsigned int &generation)
+	{
+		if ( (cameraId < 0) || (cameraId >= MAX_CAMERAS_SUPPORTED) ) {
+			return false;
+		}
+
+		Mutex::Autolock lock(mLock);
+		const Camera &camera = mCameras[cameraId];
+
+		if (!camera.mRegistered || !camera.mPresent) {
+			return false;
+		}
+
+		strncpy(node, camera.mNode, length - 1);
+		node[length - 1] = '\0';
+		generation = camera.mGeneration;
+
+		return true;
+	}
+
+	void DeviceManager::markLost(int cameraId, unsigned int generation)
+	{
+		if ( (cameraId < 0) || (cameraId >= MAX_CAMERAS_SUPPORTED) ) {
+			return;
+		}
+
+		Mutex::Autolock lock(mLock);
+		Camera &camera = mCameras[cameraId];
+
+		// the camera may already be back, in which case the caller just reopens it
+		if (camera.mRegistered && camera.mPresent && (camera.mGeneration == generation)) {
+			camera.mPresent = false;
+			camera.mLostAt = systemTime();
+			mChanged.broadcast();
+		}
+	}
+
+	status_t DeviceManager::waitForCamera(int cameraId, unsigned int generation, nsecs_t timeout,
+			char *node, size_t length, unsigned int &newGeneration)
+	{
+		if ( (cameraId < 0) || (cameraId >= MAX_CAMERAS_SUPPORTED) ) {
+			return BAD_VALUE;
+		}
+
+		Mutex::Autolock lock(mLock);
+		Camera &camera = mCameras[cameraId];
+		const nsecs_t end = systemTime() + timeout;
+
+		if ( !camera.mRegistered || ('\0' == camera.mIdentity.mBusPath[0]) ) {
+			return NO_INIT;
+		}
+
+		while (!camera.mPresent || (camera.mGeneration == generation)) {
+			nsecs_t left = end - systemTime();
+			if (left <= 0) {
+				return TIMED_OUT;
+			}
+			mChanged.waitRelative(mLock, left);
+		}
+
+		strncpy(node, camera.mNode, length - 1);
+		node[length - 1] = '\0';
+		newGeneration = camera.mGeneration;
+
+		return NO_ERROR;
+	}
+
+};
@@ -37,6 +37,10 @@
 #include <errno.h>
 #include <math.h>
 
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
 extern "C" {
 #include "jpeglib.h"
 #include "jerror.h"
@@ -63,6 +67,7 @@ namespace android {
 		uint8_t* buf;
 		int bufsize;
 		size_t jpegsize;
+		bool overflow; // the image did not fit, jpegsize stays 0
 	};
 
 	static void libjpeg_init_destination (j_compress_ptr cinfo) {
@@ -71,19 +76,27 @@ namespace android {
 		dest->next_output_byte = dest->buf;
 		dest->free_in_buffer = dest->bufsize;
 		dest->jpegsize = 0;
+		dest->overflow = false;
 	}
 
+	/**
+	 * Called only once the buffer is full. The image is given up: the
+	 * compress loop aborts on the flag, and whatever libjpeg still flushes
+	 * before it gets there lands in the abandoned buffer. Suspending
+	 * instead would make jpeg_finish_compress() exit the process.
+	 */
 	static boolean libjpeg_empty_output_buffer(j_compress_ptr cinfo) {
 		libjpeg_destination_mgr* dest = (libjpeg_destination_mgr*)cinfo->dest;
 
+		dest->overflow = true;
 		dest->next_output_byte = dest->buf;
 		dest->free_in_buffer = dest->bufsize;
-		return TRUE; // ?
+		return TRUE;
 	}
 
 	static void libjpeg_term_destination (j_compress_ptr cinfo) {
 		libjpeg_destination_mgr* dest = (libjpeg_destination_mgr*)cinfo->dest;
-		dest->jpegsize = dest->bufsize - dest->free_in_buffer;
+		dest->jpegsize = dest->overflow ? 0 : dest->bufsize - dest->free_in_buffer;
 	}
 
 	libjpeg_destination_mgr::libjpeg_destination_mgr(uint8_t* input, int size) {
@@ -95,6 +108,7 @@ namespace android {
 		this->bufsize = size;
 
 		jpegsize = 0;
+		overflow = false;
 	}
 
 	/* private static functions */
@@ -173,8 +187,111 @@ namespace android {
 		}
 	}
 
+	/**
+	 * Adds one YUYV source row into the 32 bit column accumulator.
+	 * The vertical pass of the box filter, vectorised 16 bytes at a time.
+	 */
+	static void yuyv_accumulate_row(uint32_t* acc, const uint8_t* src, int bytes) {
+		int i = 0;
+#ifdef __ARM_NEON__
+		for (; i + 16 <= bytes; i += 16) {
+			uint8x16_t s = vld1q_u8(src + i);
+			uint16x8_t lo = vmovl_u8(vget_low_u8(s));
+			uint16x8_t hi = vmovl_u8(vget_high_u8(s));
+			vst1q_u32(acc + i,      vaddw_u16(vld1q_u32(acc + i),      vget_low_u16(lo)));
+			vst1q_u32(acc + i + 4,  vaddw_u16(vld1q_u32(acc + i + 4),  vget_high_u16(lo)));
+			vst1q_u32(acc + i + 8,  vaddw_u16(vld1q_u32(acc + i + 8),  vget_low_u16(hi)));
+			vst1q_u32(acc + i + 12, vaddw_u16(vld1q_u32(acc + i + 12), vget_high_u16(hi)));
+		}
+#endif
+		for (; i < bytes; i++) {
+			acc[i] += src[i];
+		}
+	}
 
-	static int yuv422_to_rgb(void* pYUV, void* pRGB, int width, int height)
+	/**
+	 * Area-averaging (box) downscale of a packed YUYV image.
+	 *
+	 * Every output pixel is the mean of the source rectangle it covers, so
+	 * no source pixel is skipped and the thumbnail does not alias. Rows are
+	 * summed into a column accumulator first, then collapsed horizontally.
+	 * Luma is averaged per output pixel, chroma per output YUYV pair.
+	 *
+	 * @param in_stride bytes per source row, at least in_width * 2
+	 * @param dst output buffer, out_width * out_height * 2 bytes
+	 * @param out_width must be even
+	 * @return 0 on success, -1 on bad arguments or allocation failure
+	 */
+	static int yuyv_downscale_box(const uint8_t* src, int in_width, int in_height, int in_stride,
+			uint8_t* dst, int out_width, int out_height)
+	{
+		LOG_FUNCTION_NAME;
+
+		uint32_t* acc = NULL;
+		int row_bytes = in_width * 2;
+
+		if (!src || !dst || (out_width < 2) || (out_height < 1) || (out_width & 1) ||
+				(in_width & 1) || (out_width > in_width) || (out_height > in_height) ||
+				(in_stride < row_bytes)) {
+			return -1;
+		}
+
+		acc = (uint32_t*) malloc(row_bytes * sizeof(uint32_t));
+		if (!acc) {
+			return -1;
+		}
+		MemoryAccounting::add(MemoryAccounting::MEM_ENCODER_SCRATCH, row_bytes * sizeof(uint32_t));
+
+		for (int oy = 0; oy < out_height; oy++) {
+			int y0 = (oy * in_height) / out_height;
+			int y1 = ((oy + 1) * in_height) / out_height;
+			int rows = y1 - y0;
+
+			memset(acc, 0, row_bytes * sizeof(uint32_t));
+			for (int y = y0; y < y1; y++) {
+				yuyv_accumulate_row(acc, src + y * in_stride, row_bytes);
+			}
+
+			uint8_t* out = dst + oy * out_width * 2;
+			for (int ox = 0; ox < out_width; ox += 2) {
+				int x0 = (ox * in_width) / out_width;
+				int xm = ((ox + 1) * in_width) / out_width;
+				int x1 = ((ox + 2) * in_width) / out_width;
+				uint32_t y_a = 0, y_b = 0, u = 0, v = 0;
+
+				for (int x = x0; x < xm; x++) {
+					y_a += acc[x * 2];
+				}
+				for (int x = xm; x < x1; x++) {
+					y_b += acc[x * 2];
+				}
+				// chroma lives on source pairs; average every pair the output pair touches
+				int p0 = x0 >> 1;
+				int p1 = (x1 + 1) >> 1;
+				for (int p = p0; p < p1; p++) {
+					u += acc[p * 4 + 1];
+					v += acc[p * 4 + 3];
+				}
+
+				uint32_t n_a = (xm - x0) * rows;
+				uint32_t n_b = (x1 - xm) * rows;
+				uint32_t n_c = (p1 - p0) * rows;
+				out[0] = (uint8_t) ((y_a + (n_a >> 1)) / n_a);
+				out[1] = (uint8_t) ((u + (n_c >> 1)) / n_c);
+				out[2] = (uint8_t) ((y_b + (n_b >> 1)) / n_b);
+				out[3] = (uint8_t) ((v + (n_c >> 1)) / n_c);
+				out += 4;
+			}
+		}
+
+		free(acc);
+		MemoryAccounting::remove(MemoryAccounting::MEM_ENCODER_SCRATCH, row_bytes * sizeof(uint32_t));
+		LOG_FUNCTION_NAME_EXIT;
+		return 0;
+	}
+
+
+	static int yuv422_to_rgb(void* pYUV, void* pRGB, int width, int height, int stride)
 	{
 		LOG_FUNCTION_NAME;
 
@@ -192,10 +309,10 @@ namespace android {
 		{
 			for (int j=0; j<width/2; ++j)
 			{
-				Y1 = *(pYUVData+i*width*2+j*4);
-				U1 = *(pYUVData+i*width*2+j*4+1);
-				Y2 = *(pYUVData+i*width*2+j*4+2);
-				V1 = *(pYUVData+i*width*2+j*4+3);
+				Y1 = *(pYUVData+i*stride+j*4);
+				U1 = *(pYUVData+i*stride+j*4+1);
+				Y2 = *(pYUVData+i*stride+j*4+2);
+				V1 = *(pYUVData+i*stride+j*4+3);
 				C1 = Y1-16;
 				C2 = Y2-16;
 				D1 = U1-128;
@@ -218,11 +335,167 @@ namespace android {
 		return 0;
 	}
 
+	// rows converted at a time when the encoder works in strips, one 4:2:0 MCU row
+#define ENCODER_STRIP_ROWS      16
+
+	/**
+	 * Where the compressor takes its RGB rows from.
+	 *
+	 * Normally the whole frame is converted up front. In strip mode, used
+	 * when a full RGB frame does not fit the memory budget, rgb holds only
+	 * strip_rows rows and they are converted from the YUYV source as the
+	 * compressor reaches them.
+	 */
+	struct rgb_source {
+		uint8_t* rgb;
+		const uint8_t* yuv;
+		int yuv_stride;
+		int width;
+		int height;
+		int strip_rows;     // 0 when rgb holds the whole frame
+		int strip_first;    // first row held in strip mode, -1 before the first strip
+	};
+
+	static JSAMPROW rgb_source_row(rgb_source* src, int row) {
+		if (!src->strip_rows) {
+			return src->rgb + row * src->width * 3;
+		}
+
+		if ((src->strip_first < 0) || (row < src->strip_first) ||
+				(row >= src->strip_first + src->strip_rows)) {
+			int rows = src->height - row;
+			if (rows > src->strip_rows) {
+				rows = src->strip_rows;
+			}
+			yuv422_to_rgb((void*) (src->yuv + row * src->yuv_stride), src->rgb,
+					src->width, rows, src->yuv_stride);
+			src->strip_first = row;
+		}
+
+		return src->rgb + (row - src->strip_first) * src->width * 3;
+	}
+
+
+
+	/* long-lived compressor contexts */
 
+	// one per concurrently running encoder thread (main + thumbnail per shot)
+#define MAX_JPEG_COMPRESSORS    4
+#define MAX_JPEG_TABLE_SETS     8
 
-	static int rgb24_to_jpeg(uint8_t *rgb24data, libjpeg_destination_mgr* dest_mgr, Encoder_libjpeg::params* input)
+	/**
+	 * A jpeg_compress_struct kept alive across images.
+	 *
+	 * jpeg_create_compress() and jpeg_set_defaults() run once per context.
+	 * jpeg_finish_compress() releases the per-image pool and keeps the
+	 * permanent one, so the quant/huffman table storage and the memory
+	 * manager itself are reused for the next image.
+	 */
+	struct jpeg_compressor {
+		jpeg_compress_struct cinfo;
+		jpeg_error_mgr jerr;
+		bool created;
+		bool in_use;
+		int quality;
+	};
+
+	/// Scaled quantisation tables for one quality, they do not depend on the image size
+	struct jpeg_table_set {
+		bool valid;
+		int quality;
+		UINT16 luma[DCTSIZE2];
+		UINT16 chroma[DCTSIZE2];
+	};
+
+	static Mutex gCompressorLock;
+	static jpeg_compressor gCompressors[MAX_JPEG_COMPRESSORS];
+	static jpeg_table_set gTableSets[MAX_JPEG_TABLE_SETS];
+	static unsigned int gNextTableSet = 0;
+	static Encoder_libjpeg::CompressorStats gCompressorStats;
+
+	static jpeg_compressor* acquire_compressor() {
+		Mutex::Autolock lock(gCompressorLock);
+
+		for (int i = 0; i < MAX_JPEG_COMPRESSORS; i++) {
+			jpeg_compressor* c = &gCompressors[i];
+			if (c->in_use) {
+				continue;
+			}
+
+			if (!c->created) {
+				c->cinfo.err = jpeg_std_error(&c->jerr);
+				jpeg_create_compress(&c->cinfo);
+				c->cinfo.input_components = 3;
+				c->cinfo.in_color_space = JCS_RGB;
+				jpeg_set_defaults(&c->cinfo);
+				c->cinfo.dct_method = JDCT_IFAST;
+				c->quality = -1;
+				c->created = true;
+				gCompressorStats.contexts_created++;
+			}
+
+			c->in_use = true;
+			return c;
+		}
+
+		return NULL;
+	}
+
+	static void release_compressor(jpeg_compressor* c) {
+		Mutex::Autolock lock(gCompressorLock);
+		c->in_use = false;
+	}
+
+	/**
+	 * Loads the tables for quality into the compressor.
+	 * Skipped entirely when the context last encoded with the same set.
+	 */
+	static void select_table_set(jpeg_compressor* c, int quality) {
+		jpeg_compress_struct* cinfo = &c->cinfo;
+		jpeg_table_set* set = NULL;
+
+		if (c->quality == quality) {
+			Mutex::Autolock lock(gCompressorLock);
+			gCompressorStats.table_hits++;
+			return;
+		}
+
+		{
+			Mutex::Autolock lock(gCompressorLock);
+			for (int i = 0; i < MAX_JPEG_TABLE_SETS; i++) {
+				if (gTableSets[i].valid && (gTableSets[i].quality == quality)) {
+					set = &gTableSets[i];
+					break;
+				}
+			}
+
+			if (set) {
+				memcpy(cinfo->quant_tbl_ptrs[0]->quantval, set->luma, sizeof(set->luma));
+				memcpy(cinfo->quant_tbl_ptrs[1]->quantval, set->chroma, sizeof(set->chroma));
+				cinfo->quant_tbl_ptrs[0]->sent_table = FALSE;
+				cinfo->quant_tbl_ptrs[1]->sent_table = FALSE;
+				gCompressorStats.table_hits++;
+			}
+		}
+
+		if (!set) {
+			jpeg_set_quality(cinfo, quality, TRUE);
+
+			Mutex::Autolock lock(gCompressorLock);
+			set = &gTableSets[gNextTableSet++ % MAX_JPEG_TABLE_SETS];
+			set->quality = quality;
+			memcpy(set->luma, cinfo->quant_tbl_ptrs[0]->quantval, sizeof(set->luma));
+			memcpy(set->chroma, cinfo->quant_tbl_ptrs[1]->quantval, sizeof(set->chroma));
+			set->valid = true;
+			gCompressorStats.table_misses++;
+		}
+
+		c->quality = quality;
+	}
+
+	/// One-shot path, used only when every cached context is busy
+	static void rgb24_to_jpeg_oneshot(rgb_source* rgb, libjpeg_destination_mgr* dest_mgr, Encoder_libjpeg::params* input)
 	{
-		LOG_FUNCTION_NAME;
 		struct jpeg_compress_struct cinfo;
 		struct jpeg_error_mgr jerr;
 		cinfo.err = jpeg_std_error(&jerr);
@@ -240,25 +513,306 @@ namespace android {
 		jpeg_set_quality(&cinfo, input->quality, TRUE);
 		cinfo.dct_method = JDCT_IFAST;
 
-
 		jpeg_start_compress(&cinfo, TRUE);
 
 		JSAMPROW row_pointer[1];
-		int row_stride;
 
-		row_stride = cinfo.image_width * 3;
-
-		while (cinfo.next_scanline < input->in_height) {
-			row_pointer[0] = & rgb24data[cinfo.next_scanline * row_stride];
+		while ((cinfo.next_scanline < cinfo.image_height) && !dest_mgr->overflow) {
+			row_pointer[0] = rgb_source_row(rgb, cinfo.next_scanline);
 			jpeg_write_scanlines(&cinfo, row_pointer, 1);
 		}
 
-		jpeg_finish_compress(&cinfo);
+		if (!dest_mgr->overflow) {
+			jpeg_finish_compress(&cinfo);
+		}
 		jpeg_destroy_compress(&cinfo);
+	}
+
+	static int rgb24_to_jpeg(rgb_source* rgb, libjpeg_destination_mgr* dest_mgr, Encoder_libjpeg::params* input)
+	{
+		LOG_FUNCTION_NAME;
+
+		nsecs_t start = systemTime();
+		nsecs_t setup;
+		jpeg_compressor* c = acquire_compressor();
+
+		if (!c) {
+			rgb24_to_jpeg_oneshot(rgb, dest_mgr, input);
+			Mutex::Autolock lock(gCompressorLock);
+			gCompressorStats.oneshot++;
+			LOG_FUNCTION_NAME_EXIT;
+			return 0;
+		}
+
+		jpeg_compress_struct* cinfo = &c->cinfo;
+
+		cinfo->dest = dest_mgr;
+		cinfo->image_width = input->out_width;
+		cinfo->image_height = input->out_height;
+		select_table_set(c, input->quality);
+
+		jpeg_start_compress(cinfo, TRUE);
+		setup = systemTime() - start;
+
+		JSAMPROW row_pointer[1];
+
+		while ((cinfo->next_scanline < cinfo->image_height) && !dest_mgr->overflow) {
+			row_pointer[0] = rgb_source_row(rgb, cinfo->next_scanline);
+			jpeg_write_scanlines(cinfo, row_pointer, 1);
+		}
+
+		// both free the image pool only; the context stays ready for the next image
+		if (dest_mgr->overflow) {
+			jpeg_abort_compress(cinfo);
+		} else {
+			jpeg_finish_compress(cinfo);
+		}
+		cinfo->dest = NULL;
+		release_compressor(c);
+
+		{
+			Mutex::Autolock lock(gCompressorLock);
+			gCompressorStats.images++;
+			gCompressorStats.setup_ns += setup;
+			LOGINFO("jpeg %dx%d q%d: setup %lld us, avg %lld us over %u images",
+					input->out_width, input->out_height, input->quality,
+					setup / 1000, gCompressorStats.setup_ns / gCompressorStats.images / 1000,
+					gCompressorStats.images);
+		}
+
 		LOG_FUNCTION_NAME_EXIT;
 		return 0;
 	}
 
+	void Encoder_libjpeg::getCompressorStats(CompressorStats& stats) {
+		Mutex::Autolock lock(gCompressorLock);
+		stats = gCompressorStats;
+	}
+
+	/* target-size rate control */
+
+	// markers, quantisation and huffman tables written regardless of content
+#define JPEG_HEADER_BYTES       620
+	// how many 4x4 blocks the activity estimate samples at most
+#define ACTIVITY_MAX_BLOCKS     1024
+	// aim this far under the target so the retry lands inside it
+#define RATE_TARGET_MARGIN      0.95
+	// accept a first pass that uses at least this much of the budget
+#define RATE_UNDERSHOOT_LIMIT   0.75
+
+	static Mutex gRateLock;
+	// bytes per pixel per (activity / libjpeg scale factor), refined after every encode
+	static double gRateModelK = 0.25;
+	static Encoder_libjpeg::RateControlStats gRateStats = { 0, 0, 0 };
+
+	/**
+	 * Estimates the high frequency energy of a YUYV frame.
+	 *
+	 * Luma is decimated 2:1 in both directions and a sparse grid of 4x4
+	 * blocks is run through a Walsh-Hadamard transform, which tracks the
+	 * AC energy the JPEG DCT will have to code at a fraction of the cost.
+	 *
+	 * @return mean absolute AC coefficient per block
+	 */
+	static double estimate_activity(const uint8_t* yuyv, int width, int height, int stride) {
+		// a decimated 4x4 block covers 8x8 source pixels
+		int blocks_x = width / 8;
+		int blocks_y = height / 8;
+		int step = 1;
+		uint32_t total = 0;
+		int count = 0;
+
+		if (!yuyv || (blocks_x < 1) || (blocks_y < 1)) {
+			return 0;
+		}
+
+		while ((blocks_x / step) * (blocks_y / step) > ACTIVITY_MAX_BLOCKS) {
+			step++;
+		}
+
+		for (int by = 0; by + step <= blocks_y; by += step) {
+			for (int bx = 0; bx + step <= blocks_x; bx += step) {
+				int m[4][4];
+				const uint8_t* base = yuyv + (by * 8) * stride + (bx * 8) * 2;
+
+				// every other luma sample on every other row
+				for (int r = 0; r < 4; r++) {
+					const uint8_t* row = base + (r * 2) * stride;
+					int a = row[0], b = row[4], c = row[8], d = row[12];
+					m[r][0] = a + b + c + d;
+					m[r][1] = a + b - c - d;
+					m[r][2] = a - b - c + d;
+					m[r][3] = a - b + c - d;
+				}
+				for (int col = 0; col < 4; col++) {
+					int a = m[0][col], b = m[1][col], c = m[2][col], d = m[3][col];
+					m[0][col] = a + b + c + d;
+					m[1][col] = a + b - c - d;
+					m[2][col] = a - b - c + d;
+					m[3][col] = a - b + c - d;
+				}
+
+				uint32_t ac = 0;
+				for (int r = 0; r < 4; r++) {
+					for (int col = 0; col < 4; col++) {
+						ac += abs(m[r][col]);
+					}
+				}
+				ac -= abs(m[0][0]);
+				total += ac;
+				count++;
+			}
+		}
+
+		// the 4x4 WHT gains 4x; bring it back to pixel units
+		return count ? (double) total / (count * 4.0) : 0;
+	}
+
+	/// libjpeg maps quality to a table scale factor in percent, see jpeg_quality_scaling()
+	static double quality_to_scale(int quality) {
+		if (quality < 1) quality = 1;
+		if (quality > 100) quality = 100;
+		return (quality < 50) ? 5000.0 / quality : 200.0 - quality * 2;
+	}
+
+	static int scale_to_quality(double scale) {
+		int quality;
+
+		if (scale < 1) {
+			scale = 1;
+		}
+
+		if (scale >= 100) {
+			quality = (int) (5000.0 / scale);
+		} else {
+			quality = (int) ((200.0 - scale) / 2);
+		}
+
+		if (quality < 1) quality = 1;
+		if (quality > 100) quality = 100;
+		return quality;
+	}
+
+	/**
+	 * Encodes so that the jpeg fits in input->target_size.
+	 *
+	 * The first pass uses a quality predicted from the activity estimate and
+	 * the running size model. If it overshoots, or wastes a large part of the
+	 * budget, the model is re-fitted to the measured size and the frame is
+	 * encoded exactly once more, into a scratch buffer only as large as a
+	 * better result can be: the target after a first pass that fitted, the
+	 * first pass itself otherwise. A retry that overflows the scratch is
+	 * worse and dropped. input->quality holds the quality kept.
+	 */
+	static void rgb24_to_jpeg_target(rgb_source* rgb, libjpeg_destination_mgr* dest_mgr,
+			Encoder_libjpeg::params* input, double activity)
+	{
+		LOG_FUNCTION_NAME;
+
+		double pixels = (double) input->out_width * input->out_height;
+		double budget = input->target_size * RATE_TARGET_MARGIN - JPEG_HEADER_BYTES;
+		double k;
+		int max_quality = input->quality;
+		bool retried = false;
+
+		if (activity < 0.5) {
+			activity = 0.5;
+		}
+		if (budget < pixels * 0.01) {
+			budget = pixels * 0.01;
+		}
+
+		{
+			Mutex::Autolock lock(gRateLock);
+			k = gRateModelK;
+			gRateStats.requests++;
+		}
+
+		input->quality = scale_to_quality(k * pixels * activity / budget);
+		if (input->quality > max_quality) {
+			input->quality = max_quality;
+		}
+		rgb24_to_jpeg(rgb, dest_mgr, input);
+
+		// an overflowed pass is at least as large as the buffer it ran out of
+		size_t first_size = dest_mgr->overflow ? (size_t) dest_mgr->bufsize : dest_mgr->jpegsize;
+		double scale = quality_to_scale(input->quality);
+		double body = (double) first_size - JPEG_HEADER_BYTES;
+		if (body < 1) {
+			body = 1;
+		}
+		double measured_k = body * scale / (pixels * activity);
+
+		bool fits = !dest_mgr->overflow && (dest_mgr->jpegsize <= (size_t) input->target_size);
+		if (!fits ||
+				((dest_mgr->jpegsize < input->target_size * RATE_UNDERSHOOT_LIMIT) &&
+				 (input->quality < max_quality))) {
+			// the retry aims at the margined budget, not the target itself
+			int quality = scale_to_quality(measured_k * pixels * activity / budget);
+			int first_quality = input->quality;
+			if (quality > max_quality) {
+				quality = max_quality;
+			}
+			// an undershoot only ever retries upwards, an overshoot downwards
+			if (fits ? (quality < first_quality) : (quality > first_quality)) {
+				quality = first_quality;
+			}
+
+			size_t scratch_size = fits ? (size_t) input->target_size : first_size;
+			if (scratch_size > (size_t) dest_mgr->bufsize) {
+				scratch_size = dest_mgr->bufsize;
+			}
+			uint8_t* scratch = (quality != first_quality) ? (uint8_t*) malloc(scratch_size) : NULL;
+
+			if (scratch) {
+				libjpeg_destination_mgr retry_mgr(scratch, scratch_size);
+
+				MemoryAccounting::add(MemoryAccounting::MEM_ENCODER_SCRATCH, scratch_size);
+				LOGINFO("rate control: %d bytes at q%d, retrying at q%d (target %d)",
+						dest_mgr->jpegsize, first_quality, quality, input->target_size);
+				input->quality = quality;
+				rgb24_to_jpeg(rgb, &retry_mgr, input);
+				retried = true;
+
+				if (!retry_mgr.overflow) {
+					memcpy(dest_mgr->buf, scratch, retry_mgr.jpegsize);
+					dest_mgr->jpegsize = retry_mgr.jpegsize;
+					dest_mgr->overflow = false;
+				} else {
+					LOGINFO("rate control: q%d did no better, keeping q%d", quality, first_quality);
+					input->quality = first_quality;
+				}
+
+				free(scratch);
+				MemoryAccounting::remove(MemoryAccounting::MEM_ENCODER_SCRATCH, scratch_size);
+			} else if (quality != first_quality) {
+				LOGINFO("rate control: no %d byte scratch for the retry, keeping q%d",
+						scratch_size, first_quality);
+			}
+		}
+
+		{
+			Mutex::Autolock lock(gRateLock);
+			gRateModelK = gRateModelK * 0.7 + measured_k * 0.3;
+			if (retried) {
+				gRateStats.retries++;
+			}
+			if (!dest_mgr->overflow && (dest_mgr->jpegsize <= (size_t) input->target_size)) {
+				gRateStats.hits++;
+			}
+			LOGINFO("rate control: %d/%d bytes at q%d, hits %u retries %u of %u",
+					dest_mgr->jpegsize, input->target_size, input->quality,
+					gRateStats.hits, gRateStats.retries, gRateStats.requests);
+		}
+
+		LOG_FUNCTION_NAME_EXIT;
+	}
+
+	void Encoder_libjpeg::getRateControlStats(RateControlStats& stats) {
+		Mutex::Autolock lock(gRateLock);
+		stats = gRateStats;
+	}
+
 	/* public static functions */
 	const char* ExifElementsTable::degreesToExifOrientation(const char* degrees) {
 		for (unsigned int i = 0; i < ARRAY_SIZE(degress_to_exif_lut); i++) {
@@ -419,10 +973,15 @@ namespace android {
 		uint8_t* row_uv = NULL; // used only for NV12
 
 		uint8_t* pRGB = NULL; // used only for yuv2
+		size_t rgb_bytes = 0, resize_bytes = 0;
+		rgb_source rgb;
 
 		int out_width = 0, in_width = 0;
 		int out_height = 0, in_height = 0;
+		int in_stride = 0, src_stride = 0;
 		int bpp = 2; // for uyvy
+		// the encoder only sees pixels, it has no frame number to report
+		FrameTraceScope trace("encode");
 
 		if (!input) {
 			return 0;
@@ -432,11 +991,12 @@ namespace android {
 		in_width = input->in_width;
 		out_height = input->out_height;
 		in_height = input->in_height;
+		in_stride = (input->in_stride > 0) ? input->in_stride : in_width * bpp;
 		src = input->src;
+		src_stride = in_stride;
 		input->jpeg_size = 0;
 
 		libjpeg_destination_mgr dest_mgr(input->dst, input->dst_size);
-		pRGB = (uint8_t *)calloc(1, in_width * in_height * 3);
 
 		LOGINFO("encoding...      \n\t"
 				"in_width:        %d\n\t"
@@ -471,8 +1031,58 @@ namespace android {
 			LOGINFO("Encode: format PIXEL_FORMAT_YUV420SP");
 		}else if (strcmp(input->format, CameraParameters::PIXEL_FORMAT_YUV422I) == 0) {
 			LOGINFO("Encoder: format PIXEL_FORMAT_YUV422I");
-			yuv422_to_rgb(src, pRGB,in_width, in_height);
-			rgb24_to_jpeg(pRGB, &dest_mgr, input);
+			if ((in_width != out_width) || (in_height != out_height)) {
+				// thumbnails: box filter the full frame down before colour conversion
+				out_width &= ~1;
+				resize_src = (uint8_t *)malloc(out_width * out_height * bpp);
+				if (resize_src) {
+					resize_bytes = out_width * out_height * bpp;
+					MemoryAccounting::add(MemoryAccounting::MEM_ENCODER_SCRATCH, resize_bytes);
+				}
+				if (!resize_src || yuyv_downscale_box(src, in_width, in_height, in_stride,
+							resize_src, out_width, out_height) != 0) {
+					LOGINFO("Encoder: downscale %dx%d -> %dx%d failed",
+							in_width, in_height, out_width, out_height);
+					goto exit;
+				}
+				input->out_width = out_width;
+				src = resize_src;
+				src_stride = out_width * bpp;
+			}
+			// the full RGB frame is the largest scratch of a capture; over the
+			// memory budget, or when it cannot be had, convert a strip at a time
+			rgb.yuv = src;
+			rgb.yuv_stride = src_stride;
+			rgb.width = out_width;
+			rgb.height = out_height;
+			rgb.strip_rows = 0;
+			rgb.strip_first = -1;
+			rgb_bytes = (size_t) out_width * out_height * 3;
+			if (MemoryAccounting::fits(rgb_bytes)) {
+				pRGB = (uint8_t *)malloc(rgb_bytes);
+			}
+			if (!pRGB) {
+				rgb_bytes = (size_t) out_width * ENCODER_STRIP_ROWS * 3;
+				pRGB = (uint8_t *)malloc(rgb_bytes);
+				if (!pRGB) {
+					rgb_bytes = 0;
+					goto exit;
+				}
+				rgb.strip_rows = ENCODER_STRIP_ROWS;
+				MemoryAccounting::noteDegraded(MemoryAccounting::MEM_ENCODER_SCRATCH);
+				LOGINFO("Encoder: %dx%d in strips of %d rows", out_width, out_height, ENCODER_STRIP_ROWS);
+			}
+			MemoryAccounting::add(MemoryAccounting::MEM_ENCODER_SCRATCH, rgb_bytes);
+			rgb.rgb = pRGB;
+			if (!rgb.strip_rows) {
+				yuv422_to_rgb(src, pRGB, out_width, out_height, src_stride);
+			}
+			if (input->target_size > 0) {
+				double activity = estimate_activity(src, out_width, out_height, src_stride);
+				rgb24_to_jpeg_target(&rgb, &dest_mgr, input, activity);
+			} else {
+				rgb24_to_jpeg(&rgb, &dest_mgr, input);
+			}
 		}else if ((in_width != out_width) || (in_height != out_height)) {
 			LOGINFO("Encoder: resizing is not supported for this format: %s", input->format);
 			goto exit;
@@ -486,6 +1096,13 @@ exit:
 		//release buffer memory
 		free(pRGB);
 		pRGB = NULL;
+		MemoryAccounting::remove(MemoryAccounting::MEM_ENCODER_SCRATCH, rgb_bytes);
+		free(resize_src);
+		resize_src = NULL;
+		MemoryAccounting::remove(MemoryAccounting::MEM_ENCODER_SCRATCH, resize_bytes);
+		if (dest_mgr.overflow) {
+			LOGINFO("Encoder: %dx%d jpeg does not fit in %d bytes", out_width, out_height, input->dst_size);
+		}
 		input->jpeg_size = dest_mgr.jpegsize;
 		LOGINFO("dest_mgr.jpegsize %d\n", dest_mgr.jpegsize);
 
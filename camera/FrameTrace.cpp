@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameTrace.cpp
+*
+* This file implements the per thread trace rings and their Chrome trace
+* JSON dump.
+*
+*/
+
+#define LOG_TAG "CameraHAL"
+
+#include "CameraHal.h"
+#include "FrameTrace.h"
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <pthread.h>
+#include <sys/prctl.h>
+
+namespace android {
+
+#define TRACE_THREAD_NAME_LENGTH 16
+///Dump output is gathered and written in pieces this big
+#define TRACE_WRITE_CHUNK 4096
+
+	typedef struct
+		{
+		nsecs_t mTime;
+		const char *mName;          ///< a literal, never copied
+		int mFrame;
+		int mBuffer;
+		pid_t mTid;                 ///< kept per event, a ring outlives its thread
+		char mPhase;
+		} TraceEvent;
+
+	typedef struct
+		{
+		volatile int32_t mHead;     ///< events ever written, only the owning thread advances it
+		bool mInUse;
+		pid_t mTid;
+		char mThreadName[TRACE_THREAD_NAME_LENGTH];
+		TraceEvent mEvents[FRAME_TRACE_EVENTS];
+		} TraceRing;
+
+	typedef struct
+		{
+		int mFd;
+		size_t mLength;
+		char mData[TRACE_WRITE_CHUNK];
+		} TraceWriter;
+
+	volatile int FrameTrace::sEnabled = 0;
+
+	static Mutex gTraceLock;
+	static TraceRing *gRings[FRAME_TRACE_MAX_THREADS];
+	static pthread_key_t gRingKey;
+	static pthread_once_t gRingKeyOnce = PTHREAD_ONCE_INIT;
+	static volatile int32_t gLostEvents = 0;
+	static volatile int32_t gDumpCount = 0;
+
+	static void releaseRing(void *data)
+	{
+		Mutex::Autolock lock(gTraceLock);
+		// the events stay for the next dump, only the ring is handed on
+		static_cast<TraceRing *>(data)->mInUse = false;
+	}
+
+	static void createRingKey()
+	{
+		pthread_key_create(&gRingKey, releaseRing);
+	}
+
+	static TraceRing* claimRing()
+	{
+		TraceRing *ring = NULL;
+
+		pthread_once(&gRingKeyOnce, createRingKey);
+
+		{
+			Mutex::Autolock lock(gTraceLock);
+
+			for (int i = 0; i < FRAME_TRACE_MAX_THREADS; i++) {
+				if (NULL == gRings[i]) {
+					gRings[i] = new TraceRing;
+					if (NULL == gRings[i]) {
+						break;
+					}
+					memset(gRings[i], 0, sizeof(TraceRing));
+				}
+
+				if (!gRings[i]->mInUse) {
+					ring = gRings[i];
+					break;
+				}
+			}
+
+			if (NULL == ring) {
+				return NULL;
+			}
+
+			ring->mInUse = true;
+			ring->mTid = gettid();
+			memset(ring->mThreadName, 0, sizeof(ring->mThreadName));
+			prctl(PR_GET_NAME, (unsigned long) ring->mThreadName, 0, 0, 0);
+			ring->mThreadName[TRACE_THREAD_NAME_LENGTH - 1] = '\0';
+		}
+
+		pthread_setspecific(gRingKey, ring);
+
+		return ring;
+	}
+
+	void FrameTrace::setEnabled(bool enable)
+	{
+		if ( (enable ? 1 : 0) != sEnabled ) {
+			LOGI("Frame trace %s", enable ? "on" : "off");
+		}
+		sEnabled = enable ? 1 : 0;
+	}
+
+	void FrameTrace::loadEnabled()
+	{
+		char value[PROPERTY_VALUE_MAX];
+
+		if (0 < property_get(FRAME_TRACE_PROPERTY, value, NULL)) {
+			setEnabled(0 != atoi(value));
+		}
+	}
+
+	void FrameTrace::record(const char *name, char phase, int frame, int buffer)
+	{
+		TraceRing *ring;
+		TraceEvent *event;
+		int32_t head;
+
+		if (!sEnabled) {
+			return;
+		}
+
+		pthread_once(&gRingKeyOnce, createRingKey);
+
+		ring = static_cast<TraceRing *>(pthread_getspecific(gRingKey));
+		if (NULL == ring) {
+			ring = claimRing();
+			if (NULL == ring) {
+				android_atomic_inc(&gLostEvents);
+				return;
+			}
+		}
+
+		head = ring->mHead;
+		event = &ring->mEvents[head & (FRAME_TRACE_EVENTS - 1)];
+		event->mTime = systemTime(SYSTEM_TIME_MONOTONIC);
+		event->mName = name;
+		event->mFrame = frame;
+		event->mBuffer = buffer;
+		event->mTid = ring->mTid;
+		event->mPhase = phase;
+
+		// the event is complete before a reader can see it counted
+		android_atomic_release_store(head + 1, &ring->mHead);
+	}
+
+	static void flushTrace(TraceWriter &writer)
+	{
+		if (0 < writer.mLength) {
+			write(writer.mFd, writer.mData, writer.mLength);
+			writer.mLength = 0;
+		}
+	}
+
+	static void appendTrace(TraceWriter &writer, const char *format, ...)
+	{
+		va_list args;
+		int length;
+
+		// no line of the dump comes near 256 bytes
+		if ( (sizeof(writer.mData) - writer.mLength) < 256 ) {
+			flushTrace(writer);
+		}
+
+		va_start(args, format);
+		length = vsnprintf(writer.mData + writer.mLength, sizeof(writer.mData) - writer.mLength, format, args);
+		va_end(args);
+
+		if (0 < length) {
+			writer.mLength += length;
+			if (writer.mLength > sizeof(writer.mData) - 1) {
+				writer.mLength = sizeof(writer.mData) - 1;
+			}
+		}
+	}
+
+	status_t FrameTrace::dump(int fd)
+	{
+		TraceWriter writer;
+		pid_t pid = getpid();
+		int enabled = sEnabled;
+		bool first = true;
+		unsigned int events = 0;
+
+		if (0 > fd) {
+			return BAD_VALUE;
+		}
+
+		writer.mFd = fd;
+		writer.mLength = 0;
+
+		Mutex::Autolock lock(gTraceLock);
+
+		// a writer past its check still lands one event, the oldest slots are skipped below
+		sEnabled = 0;
+
+		appendTrace(writer, "{\"traceEvents\":[\n");
+
+		for (int i = 0; i < FRAME_TRACE_MAX_THREADS; i++) {
+			TraceRing *ring = gRings[i];
+			int32_t head, start;
+
+			if (NULL == ring) {
+				continue;
+			}
+
+			if (ring->mInUse) {
+				appendTrace(writer, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,"
+						"\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", pid, ring->mTid, ring->mThreadName);
+				first = false;
+			}
+
+			head = android_atomic_acquire_load(&ring->mHead);
+			start = (head > FRAME_TRACE_EVENTS) ? head - FRAME_TRACE_EVENTS + 1 : 0;
+
+			for (int32_t n = start; n < head; n++) {
+				const TraceEvent &event = ring->mEvents[n & (FRAME_TRACE_EVENTS - 1)];
+				nsecs_t us = event.mTime / 1000;
+
+				appendTrace(writer, "%s{\"ph\":\"%c\",\"name\":\"%s\",\"cat\":\"camera\",\"pid\":%d,\"tid\":%d,"
+						"\"ts\":%lld.%03lld,\"args\":{\"frame\":%d,\"buffer\":%d}}",
+						first ? "" : ",\n", event.mPhase, event.mName, pid, event.mTid,
+						us, event.mTime - us * 1000, event.mFrame, event.mBuffer);
+				first = false;
+				events++;
+			}
+		}
+
+		appendTrace(writer, "\n],\"displayTimeUnit\":\"ms\"}\n");
+		flushTrace(writer);
+
+		sEnabled = enabled;
+
+		LOGI("Frame trace dumped %u events, %d lost to threads without a ring",
+				events, android_atomic_acquire_load(&gLostEvents));
+
+		return NO_ERROR;
+	}
+
+	status_t FrameTrace::dumpToFile(char *path, size_t length)
+	{
+		status_t ret;
+		int fd;
+
+		snprintf(path, length, FRAME_TRACE_DIR "/trace-%d-%d.json",
+				getpid(), android_atomic_inc(&gDumpCount));
+
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (0 > fd) {
+			ret = -errno;
+			LOGE("Unable to open %s: %s", path, strerror(-ret));
+			return ret;
+		}
+
+		ret = dump(fd);
+		close(fd);
+
+		return ret;
+	}
+
+};
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameTransform.cpp
+*
+* Crop, scale and rotate for packed YUYV frames. Sampling is nearest
+* neighbour through per-axis lookup tables, so zoom and rotation cost about
+* the same as the plain copy into the display buffer.
+*
+*/
+
+#include "FrameTransform.h"
+#include <string.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+namespace android {
+
+	//Y=16 U=128 Y=16 V=128, little endian
+#define YUYV_BLACK 0x80108010
+
+	void zoomToCrop(int width, int height, int zoomRatio, FrameTransform &transform)
+	{
+		if (zoomRatio < ZOOM_RATIO_UNITY) {
+			zoomRatio = ZOOM_RATIO_UNITY;
+		}
+
+		transform.mCropWidth = (width * ZOOM_RATIO_UNITY / zoomRatio) & ~1;
+		transform.mCropHeight = height * ZOOM_RATIO_UNITY / zoomRatio;
+		transform.mCropLeft = ((width - transform.mCropWidth) / 2) & ~1;
+		transform.mCropTop = (height - transform.mCropHeight) / 2;
+	}
+
+	bool isIdentityTransform(int srcWidth, int srcHeight, int dstWidth, int dstHeight,
+			const FrameTransform &transform)
+	{
+		return (0 == transform.mRotation) &&
+			(0 == transform.mCropLeft) && (0 == transform.mCropTop) &&
+			(srcWidth == transform.mCropWidth) && (srcHeight == transform.mCropHeight) &&
+			(srcWidth == dstWidth) && (srcHeight == dstHeight);
+	}
+
+	static void fill_black(uint8_t *dst, int pixels)
+	{
+		uint32_t *p = (uint32_t *) dst;
+
+		for (int i = 0; i < pixels / 2; i++) {
+			p[i] = YUYV_BLACK;
+		}
+	}
+
+	//source coordinate sampled by each of count output samples, at the sample centres
+	static void map_axis(int *lut, int count, int start, int span, bool reverse)
+	{
+		for (int d = 0; d < count; d++) {
+			int i = reverse ? (count - 1 - d) : d;
+			lut[d] = start + ((2 * i + 1) * span) / (2 * count);
+		}
+	}
+
+	//mirror a row of macro pixels, swapping the two lumas of each
+	static void yuyv_reverse_row(const uint8_t *src, uint8_t *dst, int width)
+	{
+		int pairs = width / 2;
+		int i = 0;
+
+#ifdef __ARM_NEON__
+		for (; i + 8 <= pairs; i += 8) {
+			uint8x8x4_t in = vld4_u8(src + (pairs - 8 - i) * 4);
+			uint8x8x4_t out;
+			out.val[0] = vrev64_u8(in.val[2]);
+			out.val[1] = vrev64_u8(in.val[1]);
+			out.val[2] = vrev64_u8(in.val[0]);
+			out.val[3] = vrev64_u8(in.val[3]);
+			vst4_u8(dst + i * 4, out);
+		}
+#endif
+		for (; i < pairs; i++) {
+			const uint8_t *s = src + (pairs - 1 - i) * 4;
+			uint8_t *d = dst + i * 4;
+			d[0] = s[2];
+			d[1] = s[1];
+			d[2] = s[0];
+			d[3] = s[3];
+		}
+	}
+
+	bool transformYUYV(const uint8_t *src, int srcWidth, int srcHeight,
+			uint8_t *dst, int dstWidth, int dstHeight,
+			const FrameTransform &transform)
+	{
+		int colLut[MAX_TRANSFORM_DIM];
+		int rowLut[MAX_TRANSFORM_DIM];
+		const int srcStride = srcWidth * 2;
+		const int dstStride = dstWidth * 2;
+		const int cropL = transform.mCropLeft;
+		const int cropT = transform.mCropTop;
+		const int cropW = transform.mCropWidth;
+		const int cropH = transform.mCropHeight;
+
+		if ( (dstWidth > MAX_TRANSFORM_DIM) || (dstHeight > MAX_TRANSFORM_DIM) ||
+				(dstWidth & 1) || (cropL & 1) || (cropW < 2) || (cropH < 1) ||
+				(cropL + cropW > srcWidth) || (cropT + cropH > srcHeight) ) {
+			return false;
+		}
+
+		if ( (0 == transform.mRotation) || (180 == transform.mRotation) ) {
+			bool flip = (180 == transform.mRotation);
+
+			// unscaled, rows are copied or mirrored whole
+			if ( (cropW == dstWidth) && (cropH == dstHeight) ) {
+				for (int dy = 0; dy < dstHeight; dy++) {
+					int sy = flip ? (cropT + cropH - 1 - dy) : (cropT + dy);
+					const uint8_t *srow = src + sy * srcStride + cropL * 2;
+					if (flip) {
+						yuyv_reverse_row(srow, dst + dy * dstStride, dstWidth);
+					} else {
+						memcpy(dst + dy * dstStride, srow, dstStride);
+					}
+				}
+				return true;
+			}
+
+			map_axis(colLut, dstWidth, cropL, cropW, flip);
+			map_axis(rowLut, dstHeight, cropT, cropH, flip);
+
+			for (int dy = 0; dy < dstHeight; dy++) {
+				const uint8_t *srow = src + rowLut[dy] * srcStride;
+				uint8_t *drow = dst + dy * dstStride;
+
+				for (int dx = 0; dx < dstWidth; dx += 2) {
+					int x0 = colLut[dx];
+					int c = (x0 & ~1) * 2;
+					drow[0] = srow[x0 * 2];
+					drow[1] = srow[c + 1];
+					drow[2] = srow[colLut[dx + 1] * 2];
+					drow[3] = srow[c + 3];
+					drow += 4;
+				}
+			}
+			return true;
+		}
+
+		if ( (90 != transform.mRotation) && (270 != transform.mRotation) ) {
+			return false;
+		}
+
+		// the rotated crop is cropH wide and cropW high, fit it and keep the aspect
+		int outW = dstWidth;
+		int outH = (dstWidth * cropW) / cropH;
+		if (outH > dstHeight) {
+			outH = dstHeight;
+			outW = ((dstHeight * cropH) / cropW) & ~1;
+		}
+		int offX = ((dstWidth - outW) / 2) & ~1;
+		int offY = (dstHeight - outH) / 2;
+
+		if ( (outW < 2) || (outH < 1) ) {
+			return false;
+		}
+
+		// output rows walk source columns, output columns walk source rows
+		bool cw = (90 == transform.mRotation);
+		map_axis(colLut, outH, cropL, cropW, !cw);
+		map_axis(rowLut, outW, cropT, cropH, cw);
+
+		if (offY > 0) {
+			fill_black(dst, offY * dstWidth);
+			fill_black(dst + (offY + outH) * dstStride, (dstHeight - offY - outH) * dstWidth);
+		}
+
+		for (int dy = 0; dy < outH; dy++) {
+			const int sx = colLut[dy];
+			const int yOff = sx * 2;
+			const int cOff = (sx & ~1) * 2;
+			uint8_t *line = dst + (offY + dy) * dstStride;
+			uint8_t *drow = line + offX * 2;
+
+			if (offX > 0) {
+				fill_black(line, offX);
+				fill_black(drow + outW * 2, dstWidth - offX - outW);
+			}
+
+			for (int dx = 0; dx < outW; dx += 2) {
+				const uint8_t *s0 = src + rowLut[dx] * srcStride;
+				const uint8_t *s1 = src + rowLut[dx + 1] * srcStride;
+				drow[0] = s0[yOff];
+				drow[1] = s0[cOff + 1];
+				drow[2] = s1[yOff];
+				drow[3] = s0[cOff + 3];
+				drow += 4;
+			}
+		}
+
+		return true;
+	}
+
+};
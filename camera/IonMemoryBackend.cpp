@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#define LOG_TAG "IonMemoryBackend"
+
+
+#include "CameraHal.h"
+#include "MemoryBackend.h"
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#ifdef CAMERA_DMABUF_SYNC
+#include <linux/dma-buf.h>
+#endif
+
+extern "C" {
+
+#include <ion.h>
+
+};
+
+namespace android {
+
+#ifndef ION_FLAG_CACHED
+///TI's ION, with the 5 argument ion_alloc(), maintains cached buffers by range.
+///Mirrored for headers that only carry the core ioctls
+#ifndef ION_IOC_INVAL_CACHED
+struct ion_cached_user_buf_data
+    {
+    struct ion_handle *handle;
+    size_t size;
+    unsigned long vaddr;
+    };
+#define ION_IOC_FLUSH_CACHED _IOWR(ION_IOC_MAGIC, 8, struct ion_cached_user_buf_data)
+#define ION_IOC_INVAL_CACHED _IOWR(ION_IOC_MAGIC, 9, struct ion_cached_user_buf_data)
+#endif
+#endif
+
+/*--------------------IonMemoryBackend Class STARTS here-----------------------------*/
+IonMemoryBackend::IonMemoryBackend()
+    : mIonFd(0),
+      mCachedHeap(true)
+{
+}
+
+IonMemoryBackend::~IonMemoryBackend()
+{
+    if ( mIonFd )
+        {
+        ion_close(mIonFd);
+        mIonFd = 0;
+        }
+}
+
+status_t IonMemoryBackend::initialize()
+{
+    ///The ION client stays open for the lifetime of the backend, pooled buffers depend on it
+    if ( 0 == mIonFd )
+        {
+        mIonFd = ion_open();
+        if ( 0 >= mIonFd )
+            {
+            LOGINFO("ion_open failed!!!");
+            mIonFd = 0;
+            return NO_INIT;
+            }
+        }
+
+    return NO_ERROR;
+}
+
+status_t IonMemoryBackend::allocate(size_t length, bool cached, Buffer &buffer)
+{
+    struct ion_handle *ionHandle = NULL;
+    unsigned char *ptr;
+    int mmap_fd;
+    int ret;
+
+    buffer.mCached = false;
+
+#ifdef ION_FLAG_CACHED
+    if ( cached && mCachedHeap )
+        {
+        ret = ion_alloc(mIonFd, length, 0, 1 << ION_HEAP_TYPE_SYSTEM, ION_FLAG_CACHED, &ionHandle);
+        if ( 0 <= ret )
+            {
+            buffer.mCached = true;
+            }
+        else
+            {
+            LOGINFO("Cached ION allocation failed with %d, using the carveout", ret);
+            }
+        }
+
+    if ( !buffer.mCached )
+        {
+        ret = ion_alloc(mIonFd, length, 0, 1 << ION_HEAP_TYPE_CARVEOUT, 0, &ionHandle);
+        }
+#else
+    ///Without the flag the heap decides, and the system heap maps its pages cached
+    if ( cached && mCachedHeap )
+        {
+        ret = ion_alloc(mIonFd, length, 0, 1 << ION_HEAP_TYPE_SYSTEM, &ionHandle);
+        if ( 0 <= ret )
+            {
+            buffer.mCached = true;
+            }
+        else
+            {
+            LOGINFO("System heap allocation failed with %d, using the carveout", ret);
+            }
+        }
+
+    if ( !buffer.mCached )
+        {
+        ret = ion_alloc(mIonFd, length, 0, 1 << ION_HEAP_TYPE_CARVEOUT, &ionHandle);
+        }
+#endif
+
+    if ( 0 > ret )
+        {
+        LOGINFO("ion_alloc resulted in error %d", ret);
+        return NO_MEMORY;
+        }
+
+    LOGINFO("Before mapping, handle = %x, nSize = %d", (unsigned int) ionHandle, length);
+
+    if ((ret = ion_map(mIonFd, ionHandle, length, PROT_READ | PROT_WRITE, MAP_SHARED, 0,
+                  &ptr, &mmap_fd)) < 0)
+        {
+        LOGINFO("Userspace mapping of ION buffers returned error %d", ret);
+        ion_free(mIonFd, ionHandle);
+        return NO_MEMORY;
+        }
+
+    buffer.mHandle = (uintptr_t) ionHandle;
+    buffer.mFd = mmap_fd;
+    buffer.mPtr = ptr;
+    buffer.mLength = length;
+
+    return NO_ERROR;
+}
+
+void IonMemoryBackend::release(const Buffer &buffer)
+{
+    munmap(buffer.mPtr, buffer.mLength);
+    close(buffer.mFd);
+    ion_free(mIonFd, (ion_handle*) buffer.mHandle);
+}
+
+status_t IonMemoryBackend::sync(const Buffer &buffer, int access, bool begin)
+{
+    status_t ret = NO_ERROR;
+
+#if defined(CAMERA_DMABUF_SYNC)
+
+    struct dma_buf_sync sync;
+
+    sync.flags = begin ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END;
+    if ( access & SYNC_READ )
+        {
+        sync.flags |= DMA_BUF_SYNC_READ;
+        }
+    if ( access & SYNC_WRITE )
+        {
+        sync.flags |= DMA_BUF_SYNC_WRITE;
+        }
+
+    if ( 0 > ioctl(buffer.mFd, DMA_BUF_IOCTL_SYNC, &sync) )
+        {
+        LOGINFO("DMA_BUF_IOCTL_SYNC failed %d", errno);
+        ret = UNKNOWN_ERROR;
+        }
+
+#elif !defined(ION_FLAG_CACHED)
+
+    ///Stale lines go before the CPU reads what the device wrote, dirty ones are
+    ///written back once the CPU has written
+    struct ion_cached_user_buf_data data;
+    int cmd = 0;
+
+    if ( begin && ( access & SYNC_READ ) )
+        {
+        cmd = ION_IOC_INVAL_CACHED;
+        }
+    else if ( !begin && ( access & SYNC_WRITE ) )
+        {
+        cmd = ION_IOC_FLUSH_CACHED;
+        }
+
+    if ( 0 != cmd )
+        {
+        data.handle = (struct ion_handle *) buffer.mHandle;
+        data.size = buffer.mLength;
+        data.vaddr = (unsigned long) buffer.mPtr;
+
+        if ( 0 > ioctl(mIonFd, cmd, &data) )
+            {
+            ///No way to keep a cached buffer coherent, later ones stay uncached
+            LOGINFO("ION cache maintenance failed %d, no more cached allocations", errno);
+            mCachedHeap = false;
+            ret = UNKNOWN_ERROR;
+            }
+        }
+
+#elif defined(ION_IOC_SYNC)
+
+    ///ion_sync_fd() only cleans for the device, which is what ending a CPU write needs
+    if ( !begin && ( access & SYNC_WRITE ) )
+        {
+        if ( 0 > ion_sync_fd(mIonFd, buffer.mFd) )
+            {
+            LOGINFO("ion_sync_fd failed %d", errno);
+            ret = UNKNOWN_ERROR;
+            }
+        }
+
+#endif
+
+    return ret;
+}
+
+};
+
+
+/*--------------------IonMemoryBackend Class ENDS here-----------------------------*/
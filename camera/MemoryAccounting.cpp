@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file MemoryAccounting.cpp
+*
+* This file implements the camera memory accounting shared by every HAL
+* instance in the process.
+*
+*/
+
+#define LOG_TAG "MemoryAccounting"
+
+#include "CameraHal.h"
+#include "MemoryAccounting.h"
+#include <cutils/properties.h>
+
+namespace android {
+
+	static Mutex gAccountingLock;
+	static MemoryAccounting::Usage gUsage[MemoryAccounting::MEM_CATEGORY_COUNT];
+	static size_t gTotal = 0;
+	static size_t gPeak = 0;
+	static size_t gBudget = 0;
+	static bool gBudgetLoaded = false;
+
+	static const char* const gCategoryNames[MemoryAccounting::MEM_CATEGORY_COUNT] = {
+		"preview buffers",
+		"driver buffers",
+		"image buffers",
+		"image pool",
+		"preview callback",
+		"picture",
+		"video metadata",
+		"encoder scratch",
+		"thumbnail",
+	};
+
+	void MemoryAccounting::loadBudgetLocked()
+	{
+		char value[PROPERTY_VALUE_MAX];
+
+		if (gBudgetLoaded) {
+			return;
+		}
+
+		if (0 < property_get("debug.camera.mem.budget.kb", value, NULL)) {
+			gBudget = (size_t) atoi(value) * 1024;
+		}
+
+		gBudgetLoaded = true;
+	}
+
+	void MemoryAccounting::add(Category category, size_t bytes)
+	{
+		if ((category >= MEM_CATEGORY_COUNT) || (0 == bytes)) {
+			return;
+		}
+
+		Mutex::Autolock lock(gAccountingLock);
+		Usage &usage = gUsage[category];
+
+		usage.mLive += bytes;
+		usage.mAllocations++;
+		if (usage.mLive > usage.mPeak) {
+			usage.mPeak = usage.mLive;
+		}
+
+		gTotal += bytes;
+		if (gTotal > gPeak) {
+			gPeak = gTotal;
+		}
+	}
+
+	void MemoryAccounting::remove(Category category, size_t bytes)
+	{
+		if ((category >= MEM_CATEGORY_COUNT) || (0 == bytes)) {
+			return;
+		}
+
+		Mutex::Autolock lock(gAccountingLock);
+		Usage &usage = gUsage[category];
+
+		if (bytes > usage.mLive) {
+			LOGINFO("%s released %d bytes with only %d accounted",
+					gCategoryNames[category], bytes, usage.mLive);
+			bytes = usage.mLive;
+		}
+
+		usage.mLive -= bytes;
+		gTotal -= bytes;
+	}
+
+	void MemoryAccounting::move(Category from, Category to, size_t bytes)
+	{
+		if ((from >= MEM_CATEGORY_COUNT) || (to >= MEM_CATEGORY_COUNT) || (0 == bytes)) {
+			return;
+		}
+
+		Mutex::Autolock lock(gAccountingLock);
+
+		if (bytes > gUsage[from].mLive) {
+			bytes = gUsage[from].mLive;
+		}
+
+		gUsage[from].mLive -= bytes;
+		gUsage[to].mLive += bytes;
+		if (gUsage[to].mLive > gUsage[to].mPeak) {
+			gUsage[to].mPeak = gUsage[to].mLive;
+		}
+	}
+
+	void MemoryAccounting::setBudget(size_t bytes)
+	{
+		Mutex::Autolock lock(gAccountingLock);
+
+		gBudget = bytes;
+		gBudgetLoaded = true;
+	}
+
+	size_t MemoryAccounting::getBudget()
+	{
+		Mutex::Autolock lock(gAccountingLock);
+
+		loadBudgetLocked();
+
+		return gBudget;
+	}
+
+	bool MemoryAccounting::fits(size_t bytes)
+	{
+		Mutex::Autolock lock(gAccountingLock);
+
+		loadBudgetLocked();
+
+		return (0 == gBudget) || ((gTotal <= gBudget) && (bytes <= gBudget - gTotal));
+	}
+
+	unsigned int MemoryAccounting::fitCount(Category category, size_t bytesPerBuffer,
+			unsigned int wanted, unsigned int minimum, size_t released)
+	{
+		size_t held;
+		unsigned int count;
+
+		if (0 == bytesPerBuffer) {
+			return wanted;
+		}
+
+		Mutex::Autolock lock(gAccountingLock);
+
+		loadBudgetLocked();
+
+		if (0 == gBudget) {
+			return wanted;
+		}
+
+		held = (gTotal > released) ? (gTotal - released) : 0;
+		count = (held < gBudget) ? ((gBudget - held) / bytesPerBuffer) : 0;
+
+		if (count >= wanted) {
+			return wanted;
+		}
+
+		if (count < minimum) {
+			count = minimum;
+		}
+
+		if ((count < wanted) && (category < MEM_CATEGORY_COUNT)) {
+			gUsage[category].mDegraded++;
+			LOGINFO("Memory budget of %d KB allows %u of %u %s",
+					gBudget / 1024, count, wanted, gCategoryNames[category]);
+		}
+
+		return count;
+	}
+
+	void MemoryAccounting::noteDegraded(Category category)
+	{
+		if (category >= MEM_CATEGORY_COUNT) {
+			return;
+		}
+
+		Mutex::Autolock lock(gAccountingLock);
+		gUsage[category].mDegraded++;
+	}
+
+	void MemoryAccounting::getUsage(Category category, Usage &usage)
+	{
+		if (category >= MEM_CATEGORY_COUNT) {
+			memset(&usage, 0, sizeof(usage));
+			return;
+		}
+
+		Mutex::Autolock lock(gAccountingLock);
+		usage = gUsage[category];
+	}
+
+	size_t MemoryAccounting::getTotal()
+	{
+		Mutex::Autolock lock(gAccountingLock);
+		return gTotal;
+	}
+
+	size_t MemoryAccounting::getPeak()
+	{
+		Mutex::Autolock lock(gAccountingLock);
+		return gPeak;
+	}
+
+	const char* MemoryAccounting::getName(Category category)
+	{
+		return (category < MEM_CATEGORY_COUNT) ? gCategoryNames[category] : "unknown";
+	}
+
+	status_t MemoryAccounting::dump(int fd)
+	{
+		char line[128];
+		Usage usage[MEM_CATEGORY_COUNT];
+		size_t total, peak, budget;
+
+		{
+			Mutex::Autolock lock(gAccountingLock);
+			loadBudgetLocked();
+			memcpy(usage, gUsage, sizeof(usage));
+			total = gTotal;
+			peak = gPeak;
+			budget = gBudget;
+		}
+
+		if (budget) {
+			snprintf(line, sizeof(line), "Camera memory, budget %u KB\n", budget / 1024);
+		} else {
+			snprintf(line, sizeof(line), "Camera memory, no budget\n");
+		}
+		write(fd, line, strlen(line));
+
+		snprintf(line, sizeof(line), "  %-18s %10s %10s %8s %8s\n",
+				"category", "live KB", "peak KB", "allocs", "degraded");
+		write(fd, line, strlen(line));
+
+		for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+			snprintf(line, sizeof(line), "  %-18s %10u %10u %8u %8u\n",
+					gCategoryNames[i], usage[i].mLive / 1024, usage[i].mPeak / 1024,
+					usage[i].mAllocations, usage[i].mDegraded);
+			write(fd, line, strlen(line));
+		}
+
+		snprintf(line, sizeof(line), "  %-18s %10u %10u\n", "total", total / 1024, peak / 1024);
+		write(fd, line, strlen(line));
+
+		return NO_ERROR;
+	}
+
+};
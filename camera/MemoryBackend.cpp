@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+
+#define LOG_TAG "MemoryBackend"
+
+
+#include "CameraHal.h"
+#include "MemoryBackend.h"
+#include <cutils/properties.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+namespace android {
+
+///Mirrors of the kernel uapi, for toolchains whose headers predate dma-heap and memfd
+
+#ifndef DMA_HEAP_IOCTL_ALLOC
+struct dma_heap_allocation_data
+    {
+    uint64_t len;
+    uint32_t fd;
+    uint32_t fd_flags;
+    uint64_t heap_flags;
+    };
+#define DMA_HEAP_IOCTL_ALLOC _IOWR('H', 0x0, struct dma_heap_allocation_data)
+#endif
+
+#ifndef DMA_BUF_IOCTL_SYNC
+struct dma_buf_sync
+    {
+    uint64_t flags;
+    };
+#define DMA_BUF_SYNC_READ (1 << 0)
+#define DMA_BUF_SYNC_WRITE (2 << 0)
+#define DMA_BUF_SYNC_START (0 << 2)
+#define DMA_BUF_SYNC_END (1 << 2)
+#define DMA_BUF_IOCTL_SYNC _IOW('b', 0, struct dma_buf_sync)
+#endif
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+#define ARRAY_SIZE(array) (sizeof((array)) / sizeof((array)[0]))
+
+#define DMA_HEAP_SYSTEM "/dev/dma_heap/system"
+#define DMA_HEAP_SYSTEM_UNCACHED "/dev/dma_heap/system-uncached"
+
+///Tried in this order when no backend is named
+static const char* const sBackendOrder[] = { "ion", "dmaheap", "memfd" };
+
+static int memfdCreate(const char* name, unsigned int flags)
+{
+#ifdef __NR_memfd_create
+    return syscall(__NR_memfd_create, name, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static MemoryBackend* newBackend(const char* name)
+{
+#ifdef CAMERA_ION_BACKEND
+    if ( 0 == strcmp(name, "ion") )
+        {
+        return new IonMemoryBackend();
+        }
+#endif
+
+    if ( 0 == strcmp(name, "dmaheap") )
+        {
+        return new LinuxMemoryBackend(LinuxMemoryBackend::MODE_DMA_HEAP);
+        }
+
+    if ( 0 == strcmp(name, "memfd") )
+        {
+        return new LinuxMemoryBackend(LinuxMemoryBackend::MODE_MEMFD);
+        }
+
+    return NULL;
+}
+
+sp<MemoryBackend> MemoryBackend::create(const char* name)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    if ( ( NULL == name ) && ( 0 < property_get("debug.camera.mem.backend", value, NULL) ) )
+        {
+        name = value;
+        }
+
+    for ( unsigned int i = 0; i < ARRAY_SIZE(sBackendOrder); i++ )
+        {
+        if ( ( NULL != name ) && ( 0 != strcmp(name, sBackendOrder[i]) ) )
+            {
+            continue;
+            }
+
+        sp<MemoryBackend> backend = newBackend(sBackendOrder[i]);
+        if ( ( NULL != backend.get() ) && ( NO_ERROR == backend->initialize() ) )
+            {
+            LOGINFO("Using the %s memory backend", backend->name());
+            return backend;
+            }
+
+        LOGINFO("The %s memory backend is not available", sBackendOrder[i]);
+        }
+
+    return NULL;
+}
+
+/*--------------------LinuxMemoryBackend Class STARTS here-----------------------------*/
+LinuxMemoryBackend::LinuxMemoryBackend(Mode mode)
+    : mMode(mode),
+      mHeapFd(-1),
+      mUncachedHeapFd(-1)
+{
+}
+
+LinuxMemoryBackend::~LinuxMemoryBackend()
+{
+    if ( 0 <= mHeapFd )
+        {
+        close(mHeapFd);
+        }
+
+    if ( 0 <= mUncachedHeapFd )
+        {
+        close(mUncachedHeapFd);
+        }
+}
+
+status_t LinuxMemoryBackend::initialize()
+{
+    if ( MODE_DMA_HEAP == mMode )
+        {
+        if ( 0 > mHeapFd )
+            {
+            mHeapFd = open(DMA_HEAP_SYSTEM, O_RDONLY | O_CLOEXEC);
+            if ( 0 > mHeapFd )
+                {
+                LOGINFO("Unable to open %s %d", DMA_HEAP_SYSTEM, errno);
+                return NO_INIT;
+                }
+
+            ///Optional, uncached requests fall back to the cached system heap
+            mUncachedHeapFd = open(DMA_HEAP_SYSTEM_UNCACHED, O_RDONLY | O_CLOEXEC);
+            }
+
+        return NO_ERROR;
+        }
+
+    ///Probe once, kernels before 3.17 have no memfd_create
+    int fd = memfdCreate("camera-probe", MFD_CLOEXEC);
+    if ( 0 > fd )
+        {
+        LOGINFO("memfd_create failed %d", errno);
+        return NO_INIT;
+        }
+
+    close(fd);
+
+    return NO_ERROR;
+}
+
+status_t LinuxMemoryBackend::allocate(size_t length, bool cached, Buffer &buffer)
+{
+    int flags = MAP_SHARED;
+    void *ptr;
+    int fd;
+
+    if ( MODE_DMA_HEAP == mMode )
+        {
+        struct dma_heap_allocation_data data;
+        int heapFd = ( !cached && ( 0 <= mUncachedHeapFd ) ) ? mUncachedHeapFd : mHeapFd;
+
+        memset(&data, 0, sizeof(data));
+        data.len = length;
+        data.fd_flags = O_RDWR | O_CLOEXEC;
+
+        if ( 0 > ioctl(heapFd, DMA_HEAP_IOCTL_ALLOC, &data) )
+            {
+            LOGINFO("DMA_HEAP_IOCTL_ALLOC of %d bytes failed %d", length, errno);
+            return NO_MEMORY;
+            }
+
+        fd = data.fd;
+        buffer.mCached = ( heapFd == mHeapFd );
+        }
+    else
+        {
+        fd = memfdCreate("camera-buffer", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if ( 0 > fd )
+            {
+            LOGINFO("memfd_create failed %d", errno);
+            return NO_MEMORY;
+            }
+
+        if ( 0 > ftruncate(fd, length) )
+            {
+            LOGINFO("Unable to size a memfd to %d bytes %d", length, errno);
+            close(fd);
+            return NO_MEMORY;
+            }
+
+        ///Fixed size like a dma-buf, and backed up front like the heaps are
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+
+        ///Ordinary page cache, only the CPU ever sees it
+        buffer.mCached = true;
+        }
+
+    ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if ( MAP_FAILED == ptr )
+        {
+        LOGINFO("Userspace mapping of %s buffer returned error %d", name(), errno);
+        close(fd);
+        return NO_MEMORY;
+        }
+
+    buffer.mHandle = 0;
+    buffer.mFd = fd;
+    buffer.mPtr = ptr;
+    buffer.mLength = length;
+
+    return NO_ERROR;
+}
+
+void LinuxMemoryBackend::release(const Buffer &buffer)
+{
+    munmap(buffer.mPtr, buffer.mLength);
+    close(buffer.mFd);
+}
+
+status_t LinuxMemoryBackend::sync(const Buffer &buffer, int access, bool begin)
+{
+    struct dma_buf_sync sync;
+
+    ///shmem has no device side to keep coherent
+    if ( MODE_MEMFD == mMode )
+        {
+        return NO_ERROR;
+        }
+
+    sync.flags = begin ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END;
+    if ( access & SYNC_READ )
+        {
+        sync.flags |= DMA_BUF_SYNC_READ;
+        }
+    if ( access & SYNC_WRITE )
+        {
+        sync.flags |= DMA_BUF_SYNC_WRITE;
+        }
+
+    if ( 0 > ioctl(buffer.mFd, DMA_BUF_IOCTL_SYNC, &sync) )
+        {
+        LOGINFO("DMA_BUF_IOCTL_SYNC failed %d", errno);
+        return UNKNOWN_ERROR;
+        }
+
+    return NO_ERROR;
+}
+
+};
+
+
+/*--------------------LinuxMemoryBackend Class ENDS here-----------------------------*/
@@ -20,16 +20,8 @@
 
 
 #include "CameraHal.h"
-
-extern "C" {
-
-#include <ion.h>
-
-//#include <timm_osal_interfaces.h>
-//#include <timm_osal_trace.h>
-
-
-};
+#include "MemoryBackend.h"
+#include <cutils/properties.h>
 
 namespace android {
 
@@ -39,21 +31,360 @@ namespace android {
 
 #define ALLOCATION_2D 2
 
+///Idle buffers kept mapped for reuse, overridable in KB with debug.camera.ionpool.kb
+#define DEFAULT_POOL_CAP (24 * 1024 * 1024)
+#define POOL_PAGE_SIZE 4096
+///Size classes per power of two, bounds the rounding waste to an eighth of a buffer
+#define POOL_CLASSES_PER_OCTAVE 8
+
 ///Utility Macro Declarations
 
 /*--------------------MemoryManager Class STARTS here-----------------------------*/
+MemoryManager::MemoryManager(const char* backend)
+    : mRowAlignment(DEFAULT_ROW_ALIGNMENT),
+      mCachedHeap(true),
+      mPoolBytes(0),
+      mPoolCap(DEFAULT_POOL_CAP),
+      mPoolHits(0),
+      mPoolMisses(0)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    if ( NULL != backend )
+        {
+        mBackendName = backend;
+        }
+
+    if ( 0 < property_get("debug.camera.ionpool.kb", value, NULL) )
+        {
+        mPoolCap = (size_t) atoi(value) * 1024;
+        }
+
+    if ( 0 < property_get("debug.camera.row.align", value, NULL) )
+        {
+        setRowAlignment(atoi(value));
+        }
+
+    ///Setting it to 0 forces every buffer onto an uncached heap where the backend has one
+    if ( 0 < property_get("debug.camera.ion.cached", value, NULL) )
+        {
+        mCachedHeap = ( 0 != atoi(value) );
+        }
+}
+
+MemoryManager::~MemoryManager()
+{
+    Mutex::Autolock lock(mLock);
+
+    trimPoolLocked(0);
+
+    if ( mBuffers.size() )
+        {
+        LOGINFO("%d buffers still allocated when the memory manager went away", mBuffers.size());
+        }
+}
+
+status_t MemoryManager::initialize()
+{
+    Mutex::Autolock lock(mLock);
+
+    return initializeLocked();
+}
+
+///The backend stays open for the lifetime of the manager, pooled buffers depend on it
+status_t MemoryManager::initializeLocked()
+{
+    if ( NULL != mBackend.get() )
+        {
+        return NO_ERROR;
+        }
+
+    mBackend = MemoryBackend::create(mBackendName.isEmpty() ? NULL : mBackendName.string());
+    if ( NULL == mBackend.get() )
+        {
+        LOGINFO("No memory backend could be initialized");
+        return NO_INIT;
+        }
+
+    return NO_ERROR;
+}
+
+size_t MemoryManager::sizeClass(size_t bytes)
+{
+    size_t granule = POOL_PAGE_SIZE;
+
+    bytes = ( bytes + POOL_PAGE_SIZE - 1 ) & ~( POOL_PAGE_SIZE - 1 );
+    while ( ( granule * POOL_CLASSES_PER_OCTAVE * 2 ) <= bytes )
+        {
+        granule <<= 1;
+        }
+
+    return ( bytes + granule - 1 ) & ~( granule - 1 );
+}
+
+status_t MemoryManager::getBuffer(size_t length, bool cached, Buffer &buffer)
+{
+    status_t ret;
+
+    cached = cached && mCachedHeap;
+
+    ///Most recently freed first, it is the likeliest to still be in the caches
+    for ( size_t i = mPool.size(); i > 0; i-- )
+        {
+        if ( ( mPool[i - 1].mLength == length ) && ( mPool[i - 1].mCached == cached ) )
+            {
+            buffer = mPool[i - 1];
+            mPool.removeAt(i - 1);
+            mPoolBytes -= length;
+            mPoolHits++;
+            MemoryAccounting::move(MemoryAccounting::MEM_IMAGE_POOL, MemoryAccounting::MEM_IMAGE_BUFFERS, length);
+            return NO_ERROR;
+            }
+        }
+
+    mPoolMisses++;
+
+    ///Under a memory budget idle buffers go before new ones come
+    if ( mPoolBytes && !MemoryAccounting::fits(length) )
+        {
+        trimPoolLocked(0);
+        }
+
+    ret = mBackend->allocate(length, cached, buffer);
+    if ( ( NO_ERROR != ret ) && mPoolBytes )
+        {
+        ///Idle buffers are the first thing given back when the heap runs short
+        LOGINFO("%s allocation failed, releasing %d pooled bytes", mBackend->name(), mPoolBytes);
+        trimPoolLocked(0);
+        ret = mBackend->allocate(length, cached, buffer);
+        }
+
+    if ( NO_ERROR != ret )
+        {
+        return NO_MEMORY;
+        }
+
+    buffer.mCpuAccess = 0;
+    MemoryAccounting::add(MemoryAccounting::MEM_IMAGE_BUFFERS, length);
+
+    return NO_ERROR;
+}
+
+status_t MemoryManager::syncBuffer(Buffer &buffer, int access, bool begin)
+{
+    if ( begin == ( 0 != buffer.mCpuAccess ) )
+        {
+        return NO_ERROR;
+        }
+
+    if ( begin )
+        {
+        buffer.mCpuAccess = access;
+        }
+    else
+        {
+        access = buffer.mCpuAccess;
+        buffer.mCpuAccess = 0;
+        }
+
+    ///Uncached mappings need no maintenance
+    if ( !buffer.mCached )
+        {
+        return NO_ERROR;
+        }
+
+    return mBackend->sync(buffer, access, begin);
+}
+
+status_t MemoryManager::beginCpuAccess(void* buf, int access)
+{
+    status_t ret = NO_ERROR;
+    uint32_t *bufEntry = (uint32_t*) buf;
+
+    if ( ( NULL == bufEntry ) || ( 0 == access ) )
+        {
+        return BAD_VALUE;
+        }
+
+    Mutex::Autolock lock(mLock);
+
+    while ( *bufEntry )
+        {
+        ssize_t index = mBuffers.indexOfKey(*bufEntry++);
+        if ( 0 > index )
+            {
+            return BAD_VALUE;
+            }
+
+        if ( NO_ERROR != syncBuffer(mBuffers.editValueAt(index), access, true) )
+            {
+            ret = UNKNOWN_ERROR;
+            }
+        }
+
+    return ret;
+}
+
+status_t MemoryManager::endCpuAccess(void* buf)
+{
+    status_t ret = NO_ERROR;
+    uint32_t *bufEntry = (uint32_t*) buf;
+
+    if ( NULL == bufEntry )
+        {
+        return BAD_VALUE;
+        }
+
+    Mutex::Autolock lock(mLock);
+
+    while ( *bufEntry )
+        {
+        ssize_t index = mBuffers.indexOfKey(*bufEntry++);
+        if ( 0 > index )
+            {
+            return BAD_VALUE;
+            }
+
+        if ( NO_ERROR != syncBuffer(mBuffers.editValueAt(index), 0, false) )
+            {
+            ret = UNKNOWN_ERROR;
+            }
+        }
+
+    return ret;
+}
+
+void MemoryManager::releaseBuffer(const Buffer &buffer)
+{
+    mBackend->release(buffer);
+}
+
+void MemoryManager::trimPoolLocked(size_t maxBytes)
+{
+    while ( ( mPoolBytes > maxBytes ) && !mPool.isEmpty() )
+        {
+        releaseBuffer(mPool[0]);
+        mPoolBytes -= mPool[0].mLength;
+        MemoryAccounting::remove(MemoryAccounting::MEM_IMAGE_POOL, mPool[0].mLength);
+        mPool.removeAt(0);
+        }
+}
+
+void MemoryManager::trimPool(size_t maxBytes)
+{
+    Mutex::Autolock lock(mLock);
+
+    trimPoolLocked(maxBytes);
+}
+
+void MemoryManager::setPoolCap(size_t maxBytes)
+{
+    Mutex::Autolock lock(mLock);
+
+    mPoolCap = maxBytes;
+    trimPoolLocked(mPoolCap);
+}
+
+status_t MemoryManager::setRowAlignment(unsigned int alignment)
+{
+    if ( ( alignment < 16 ) || ( alignment & ( alignment - 1 ) ) || ( alignment > POOL_PAGE_SIZE ) )
+        {
+        LOGINFO("Invalid row alignment %d", alignment);
+        return BAD_VALUE;
+        }
+
+    Mutex::Autolock lock(mLock);
+    mRowAlignment = alignment;
+
+    return NO_ERROR;
+}
+
+status_t MemoryManager::computeLayout(int width, int height, const char* format,
+                                      unsigned int alignment, PlaneLayout &layout)
+{
+    const uint32_t mask = alignment - 1;
+
+    if ( ( width <= 0 ) || ( height <= 0 ) || ( NULL == format ) ||
+         ( alignment & mask ) )
+        {
+        return BAD_VALUE;
+        }
+
+    memset(&layout, 0, sizeof(layout));
+    layout.mWidth = width;
+    layout.mHeight = height;
+
+    if ( ( 0 == strcmp(format, CameraParameters::PIXEL_FORMAT_YUV422I) ) ||
+         ( 0 == strcmp(format, CameraParameters::PIXEL_FORMAT_RGB565) ) )
+        {
+        layout.mPlanes = 1;
+        layout.mStride[0] = ( width * 2 + mask ) & ~mask;
+        layout.mSize = layout.mStride[0] * height;
+        }
+    else if ( 0 == strcmp(format, CameraParameters::PIXEL_FORMAT_YUV420SP) )
+        {
+        ///Luma, then interleaved chroma at half height
+        layout.mPlanes = 2;
+        layout.mStride[0] = ( width + mask ) & ~mask;
+        layout.mStride[1] = layout.mStride[0];
+        layout.mOffset[1] = layout.mStride[0] * height;
+        layout.mSize = layout.mOffset[1] + layout.mStride[1] * ( ( height + 1 ) / 2 );
+        }
+    else if ( 0 == strcmp(format, CameraParameters::PIXEL_FORMAT_YUV420P) )
+        {
+        ///YV12, luma then Cr then Cb, chroma at half width and height
+        const uint32_t chromaRows = ( height + 1 ) / 2;
+        layout.mPlanes = 3;
+        layout.mStride[0] = ( width + mask ) & ~mask;
+        layout.mStride[1] = ( ( width + 1 ) / 2 + mask ) & ~mask;
+        layout.mStride[2] = layout.mStride[1];
+        layout.mOffset[1] = layout.mStride[0] * height;
+        layout.mOffset[2] = layout.mOffset[1] + layout.mStride[1] * chromaRows;
+        layout.mSize = layout.mOffset[2] + layout.mStride[2] * chromaRows;
+        }
+    else
+        {
+        LOGINFO("No 2D layout for format %s", format);
+        return BAD_VALUE;
+        }
+
+    layout.mSize = ( layout.mSize + mask ) & ~mask;
+
+    return NO_ERROR;
+}
+
+status_t MemoryManager::getLayout(void* buf, PlaneLayout &layout)
+{
+    Mutex::Autolock lock(mLock);
+    ssize_t index = mLayouts.indexOfKey((unsigned int) buf);
+
+    if ( 0 > index )
+        {
+        return BAD_VALUE;
+        }
+
+    layout = mLayouts.valueAt(index);
+
+    return NO_ERROR;
+}
+
 void* MemoryManager::allocateBuffer(int width, int height, const char* format, int &bytes, int numBufs)
+{
+    return allocateBuffer(width, height, format, bytes, numBufs, false);
+}
+
+void* MemoryManager::allocateBuffer(int width, int height, const char* format, int &bytes, int numBufs, bool cached)
 {
     LOG_FUNCTION_NAME;
+
+    PlaneLayout layout;
+    bool layout2D = false;
+
+    Mutex::Autolock lock(mLock);
 
-    if(mIonFd == 0)
+    if ( NO_ERROR != initializeLocked() )
         {
-        mIonFd = ion_open();
-        if(mIonFd == 0)
-            {
-            LOGINFO("ion_open failed!!!");
-            return NULL;
-            }
+        return NULL;
         }
 
     ///We allocate numBufs+1 because the last entry will be marked NULL to indicate end of array, which is used when freeing
@@ -73,39 +404,45 @@ void* MemoryManager::allocateBuffer(int width, int height, const char* format, i
     ///If a value of an array element is NULL, it means we didnt allocate it
     memset(bufsArr, 0, sizeof(*bufsArr) * numArrayEntriesC);
 
-    //2D Allocations are not supported currently
+    ///2D request, the layout decides the size. Backend mappings are page aligned,
+    ///so the plane offsets and strides keep their alignment in memory
+    if ( ( 0 == bytes ) && ( 0 < width ) && ( 0 < height ) )
+        {
+        if ( NO_ERROR != computeLayout(width, height, format, mRowAlignment, layout) )
+            {
+            goto error;
+            }
+        bytes = layout.mSize;
+        layout2D = true;
+        }
+
     if(bytes != 0)
         {
-        struct ion_handle *handle;
-        int mmap_fd;
+        Buffer buffer;
+        size_t length = sizeClass(bytes);
+        unsigned int hits = mPoolHits;
+        nsecs_t start = systemTime();
 
-        ///1D buffers
+        ///1D buffers, rounded up to their size class so they can be pooled
         for (int i = 0; i < numBufs; i++)
             {
-            int ret = ion_alloc(mIonFd, bytes, 0, 1 << ION_HEAP_TYPE_CARVEOUT, &handle);
-            if(ret < 0)
+            if ( NO_ERROR != getBuffer(length, cached, buffer) )
                 {
-                LOGINFO("ion_alloc resulted in error %d", ret);
                 goto error;
                 }
 
-            LOGINFO("Before mapping, handle = %x, nSize = %d", handle, bytes);
-            if ((ret = ion_map(mIonFd, handle, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, 0,
-                          (unsigned char**)&bufsArr[i], &mmap_fd)) < 0)
-                {
-                LOGINFO("Userspace mapping of ION buffers returned error %d", ret);
-                ion_free(mIonFd, handle);
-                goto error;
-                }
-
-            mIonHandleMap.add(bufsArr[i], (unsigned int)handle);
-            mIonFdMap.add(bufsArr[i], (unsigned int) mmap_fd);
-            mIonBufLength.add(bufsArr[i], (unsigned int) bytes);
+            ///The array keeps the BufferProvider's 32 bit entries, the descriptor the full address
+            bufsArr[i] = (uint32_t) (uintptr_t) buffer.mPtr;
+            mBuffers.add(bufsArr[i], buffer);
             }
 
+        LOGINFO("%d buffers of %d bytes in %llu us, %d from the pool",
+                numBufs, length, ns2us(systemTime() - start), mPoolHits - hits);
         }
-    else // If bytes is not zero, then it is a 2-D tiler buffer request
+
+    if ( layout2D )
         {
+        mLayouts.add((unsigned int) bufsArr, layout);
         }
 
         LOG_FUNCTION_NAME_EXIT;
@@ -114,7 +451,7 @@ void* MemoryManager::allocateBuffer(int width, int height, const char* format, i
 
 error:
     LOGINFO("Freeing buffers already allocated after error occurred");
-    freeBuffers(bufsArr);
+    freeBuffersLocked(bufsArr);
 
     if ( NULL != mErrorNotifier.get() )
         {
@@ -125,8 +462,7 @@ error:
     return NULL;
 }
 
-//TODO: Get needed data to map tiler buffers
-//Return dummy data for now
+///Offsets belong to one allocation, callers copy them out with getLayout()
 uint32_t * MemoryManager::getOffsets()
 {
     LOG_FUNCTION_NAME;
@@ -146,6 +482,13 @@ int MemoryManager::getFd()
 }
 
 int MemoryManager::freeBuffers(void* buf)
+{
+    Mutex::Autolock lock(mLock);
+
+    return freeBuffersLocked(buf);
+}
+
+int MemoryManager::freeBuffersLocked(void* buf)
 {
     status_t ret = NO_ERROR;
     LOG_FUNCTION_NAME;
@@ -162,14 +505,27 @@ int MemoryManager::freeBuffers(void* buf)
     while(*bufEntry)
         {
         unsigned int ptr = (unsigned int) *bufEntry++;
-        if(mIonBufLength.valueFor(ptr))
+        ssize_t index = mBuffers.indexOfKey(ptr);
+        if(index >= 0)
             {
-            munmap((void *)ptr, mIonBufLength.valueFor(ptr));
-            close(mIonFdMap.valueFor(ptr));
-            ion_free(mIonFd, (ion_handle*)mIonHandleMap.valueFor(ptr));
-            mIonHandleMap.removeItem(ptr);
-            mIonBufLength.removeItem(ptr);
-            mIonFdMap.removeItem(ptr);
+            Buffer buffer = mBuffers.valueAt(index);
+            mBuffers.removeItemsAt(index);
+
+            ///Pooled buffers are back in device ownership
+            syncBuffer(buffer, 0, false);
+
+            ///Kept mapped for the next allocation of the same class
+            if ( buffer.mLength <= mPoolCap )
+                {
+                mPool.push_back(buffer);
+                mPoolBytes += buffer.mLength;
+                MemoryAccounting::move(MemoryAccounting::MEM_IMAGE_BUFFERS, MemoryAccounting::MEM_IMAGE_POOL, buffer.mLength);
+                }
+            else
+                {
+                releaseBuffer(buffer);
+                MemoryAccounting::remove(MemoryAccounting::MEM_IMAGE_BUFFERS, buffer.mLength);
+                }
             }
         else
             {
@@ -177,18 +533,15 @@ int MemoryManager::freeBuffers(void* buf)
             }
         }
 
+    mLayouts.removeItem((unsigned int) buf);
+
     ///@todo Check if this way of deleting array is correct, else use malloc/free
     uint32_t * bufArr = (uint32_t*)buf;
     delete [] bufArr;
 
-    if(mIonBufLength.size() == 0)
-        {
-        if(mIonFd)
-            {
-            ion_close(mIonFd);
-            mIonFd = 0;
-            }
-        }
+    ///Over the memory budget nothing stays pooled
+    trimPoolLocked(MemoryAccounting::fits(0) ? mPoolCap : 0);
+
     LOG_FUNCTION_NAME_EXIT;
     return ret;
 }
@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file ParameterStore.cpp
+*
+* This file implements the typed parameter store behind CameraHal::setParameters().
+*
+*/
+
+#define LOG_TAG "ParameterStore"
+
+#include "CameraHal.h"
+#include "ParameterStore.h"
+#include <limits.h>
+
+namespace android {
+
+	typedef struct {
+		const char* name;
+		ParameterStore::Type type;
+		ParameterStore::Apply apply;
+		const char* supported;  // parameter holding the supported values, NULL for none
+		const char* fixed;      // allowed values when there is no supported list
+		int min;
+		int max;
+		bool optional;          // a key missing from setParameters() is cleared, not kept
+	} ParamDesc;
+
+	static const char BOOLEAN_VALUES[] = "true,false";
+
+	// indexed by ParameterStore::Key
+	static const ParamDesc sParams[ParameterStore::PARAM_COUNT] = {
+		{ CameraParameters::KEY_PREVIEW_SIZE, ParameterStore::TYPE_SIZE, ParameterStore::APPLY_RESTART,
+			CameraParameters::KEY_SUPPORTED_PREVIEW_SIZES, NULL, 1, INT_MAX, false },
+		{ CameraParameters::KEY_PREVIEW_FORMAT, ParameterStore::TYPE_STRING, ParameterStore::APPLY_RESTART,
+			CameraParameters::KEY_SUPPORTED_PREVIEW_FORMATS, NULL, 0, -1, false },
+		// the UVC driver picks the rate for the size, there is nothing to program
+		{ CameraParameters::KEY_PREVIEW_FRAME_RATE, ParameterStore::TYPE_INT, ParameterStore::APPLY_HAL,
+			CameraParameters::KEY_SUPPORTED_PREVIEW_FRAME_RATES, NULL, 1, INT_MAX, false },
+		{ CameraParameters::KEY_PREVIEW_FPS_RANGE, ParameterStore::TYPE_RANGE, ParameterStore::APPLY_HAL,
+			CameraParameters::KEY_SUPPORTED_PREVIEW_FPS_RANGE, NULL, 1, INT_MAX, false },
+		{ CameraParameters::KEY_PICTURE_SIZE, ParameterStore::TYPE_SIZE, ParameterStore::APPLY_HAL,
+			CameraParameters::KEY_SUPPORTED_PICTURE_SIZES, NULL, 1, INT_MAX, false },
+		{ CameraParameters::KEY_PICTURE_FORMAT, ParameterStore::TYPE_STRING, ParameterStore::APPLY_HAL,
+			CameraParameters::KEY_SUPPORTED_PICTURE_FORMATS, NULL, 0, -1, false },
+		{ CameraParameters::KEY_JPEG_QUALITY, ParameterStore::TYPE_INT, ParameterStore::APPLY_HAL,
+			NULL, NULL, 1, 100, false },
+		{ CameraParameters::KEY_JPEG_THUMBNAIL_WIDTH, ParameterStore::TYPE_INT, ParameterStore::APPLY_HAL,
+			NULL, NULL, 0, INT_MAX, false },
+		{ CameraParameters::KEY_JPEG_THUMBNAIL_HEIGHT, ParameterStore::TYPE_INT, ParameterStore::APPLY_HAL,
+			NULL, NULL, 0, INT_MAX, false },
+		{ CameraParameters::KEY_JPEG_THUMBNAIL_QUALITY, ParameterStore::TYPE_INT, ParameterStore::APPLY_HAL,
+			NULL, NULL, 1, 100, false },
+		{ CameraProperties::JPEG_TARGET_SIZE, ParameterStore::TYPE_INT, ParameterStore::APPLY_HAL,
+			NULL, NULL, 0, INT_MAX, false },
+		{ CameraParameters::KEY_ROTATION, ParameterStore::TYPE_INT, ParameterStore::APPLY_HAL,
+			NULL, "0,90,180,270", 0, -1, false },
+		{ CameraParameters::KEY_GPS_LATITUDE, ParameterStore::TYPE_STRING, ParameterStore::APPLY_HAL,
+			NULL, NULL, 0, -1, true },
+		{ CameraParameters::KEY_GPS_LONGITUDE, ParameterStore::TYPE_STRING, ParameterStore::APPLY_HAL,
+			NULL, NULL, 0, -1, true },
+		{ CameraParameters::KEY_GPS_ALTITUDE, ParameterStore::TYPE_STRING, ParameterStore::APPLY_HAL,
+			NULL, NULL, 0, -1, true },
+		{ CameraParameters::KEY_GPS_TIMESTAMP, ParameterStore::TYPE_STRING, ParameterStore::APPLY_HAL,
+			NULL, NULL, 0, -1, true },
+		{ CameraParameters::KEY_GPS_PROCESSING_METHOD, ParameterStore::TYPE_STRING, ParameterStore::APPLY_HAL,
+			NULL, NULL, 0, -1, true },
+		{ CameraParameters::KEY_RECORDING_HINT, ParameterStore::TYPE_STRING, ParameterStore::APPLY_HAL,
+			NULL, BOOLEAN_VALUES, 0, -1, false },
+		{ CameraParameters::KEY_VIDEO_STABILIZATION, ParameterStore::TYPE_STRING, ParameterStore::APPLY_HAL,
+			NULL, BOOLEAN_VALUES, 0, -1, false },
+		{ CameraParameters::KEY_FLASH_MODE, ParameterStore::TYPE_STRING, ParameterStore::APPLY_HAL,
+			CameraParameters::KEY_SUPPORTED_FLASH_MODES, NULL, 0, -1, false },
+		{ CameraProperties::BURST, ParameterStore::TYPE_INT, ParameterStore::APPLY_HAL,
+			NULL, NULL, 0, INT_MAX, false },
+		{ CameraParameters::KEY_FOCUS_MODE, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			CameraParameters::KEY_SUPPORTED_FOCUS_MODES, NULL, 0, -1, false },
+		{ CameraParameters::KEY_FOCUS_AREAS, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			NULL, NULL, 0, -1, false },
+		{ CameraParameters::KEY_METERING_AREAS, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			NULL, NULL, 0, -1, false },
+		{ CameraParameters::KEY_WHITE_BALANCE, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			CameraParameters::KEY_SUPPORTED_WHITE_BALANCE, NULL, 0, -1, false },
+		{ CameraParameters::KEY_ANTIBANDING, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			CameraParameters::KEY_SUPPORTED_ANTIBANDING, NULL, 0, -1, false },
+		{ CameraParameters::KEY_EFFECT, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			CameraParameters::KEY_SUPPORTED_EFFECTS, NULL, 0, -1, false },
+		{ CameraParameters::KEY_SCENE_MODE, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			CameraParameters::KEY_SUPPORTED_SCENE_MODES, NULL, 0, -1, false },
+		// bounds come from the min and max exposure compensation parameters
+		{ CameraParameters::KEY_EXPOSURE_COMPENSATION, ParameterStore::TYPE_INT, ParameterStore::APPLY_LIVE,
+			NULL, NULL, 0, -1, false },
+		{ CameraParameters::KEY_AUTO_EXPOSURE_LOCK, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			NULL, BOOLEAN_VALUES, 0, -1, false },
+		{ CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			NULL, BOOLEAN_VALUES, 0, -1, false },
+		// upper bound comes from the max zoom parameter
+		{ CameraParameters::KEY_ZOOM, ParameterStore::TYPE_INT, ParameterStore::APPLY_LIVE,
+			NULL, NULL, 0, INT_MAX, false },
+		{ CameraProperties::ZSL_HISTORY, ParameterStore::TYPE_INT, ParameterStore::APPLY_LIVE,
+			NULL, NULL, 0, INT_MAX, false },
+		{ CameraProperties::ZSL_SELECT, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			NULL, "nearest,sharpest", 0, -1, false },
+		{ CameraProperties::PREVIEW_ROTATION, ParameterStore::TYPE_STRING, ParameterStore::APPLY_LIVE,
+			NULL, "auto,0,90,180,270", 0, -1, false },
+		// percent of the sensor control range, only present when the sensor has the control
+		{ CameraProperties::BRIGHTNESS_LEVEL, ParameterStore::TYPE_INT, ParameterStore::APPLY_LIVE,
+			NULL, NULL, 0, 100, true },
+		{ CameraProperties::CONTRAST_LEVEL, ParameterStore::TYPE_INT, ParameterStore::APPLY_LIVE,
+			NULL, NULL, 0, 100, true },
+		{ CameraProperties::SATURATION_LEVEL, ParameterStore::TYPE_INT, ParameterStore::APPLY_LIVE,
+			NULL, NULL, 0, 100, true },
+		{ CameraProperties::SHARPNESS_LEVEL, ParameterStore::TYPE_INT, ParameterStore::APPLY_LIVE,
+			NULL, NULL, 0, 100, true },
+	};
+
+	static bool isTrue(const char *valstr)
+	{
+		return (NULL != valstr) && (strcmp(valstr, CameraParameters::TRUE) == 0);
+	}
+
+	ParameterStore::ParameterStore()
+	{
+		for (int i = 0; i < PARAM_COUNT; i++) {
+			mValues[i].mInt[0] = mValues[i].mInt[1] = 0;
+			mValues[i].mSet = false;
+			mValidators[i].mMin = 0;
+			mValidators[i].mMax = -1;
+		}
+	}
+
+	const char* ParameterStore::name(Key key)
+	{
+		return (key < PARAM_COUNT) ? sParams[key].name : NULL;
+	}
+
+	ParameterStore::Apply ParameterStore::applyClass(Key key)
+	{
+		return (key < PARAM_COUNT) ? sParams[key].apply : APPLY_HAL;
+	}
+
+	uint64_t ParameterStore::applyMask(Apply apply)
+	{
+		uint64_t mask = 0;
+
+		for (int i = 0; i < PARAM_COUNT; i++) {
+			if (sParams[i].apply == apply) {
+				mask |= (1ULL << i);
+			}
+		}
+
+		return mask;
+	}
+
+	const char* ParameterStore::getString(Key key) const
+	{
+		return mValues[key].mSet ? mValues[key].mRaw.string() : NULL;
+	}
+
+	bool ParameterStore::parse(Type type, const char *str, int *out)
+	{
+		char *end;
+
+		out[0] = out[1] = 0;
+
+		switch (type) {
+		case TYPE_INT:
+			out[0] = strtol(str, &end, 10);
+			return (end != str) && ('\0' == *end);
+
+		case TYPE_SIZE:
+			return (2 == sscanf(str, "%dx%d", &out[0], &out[1])) && (0 < out[0]) && (0 < out[1]);
+
+		case TYPE_RANGE:
+			return (2 == sscanf(str, "%d,%d", &out[0], &out[1])) && (out[0] <= out[1]);
+
+		default:
+			return true;
+		}
+	}
+
+	int64_t ParameterStore::token(Type type, const int *values)
+	{
+		if (TYPE_INT == type) {
+			return values[0];
+		}
+
+		return ((int64_t) (uint32_t) values[0] << 32) | (uint32_t) values[1];
+	}
+
+	void ParameterStore::compile(Key key, const char *list)
+	{
+		const ParamDesc &desc = sParams[key];
+		Validator &validator = mValidators[key];
+		char item[64];
+		int values[2];
+
+		validator.mStrings.clear();
+		validator.mTokens.clear();
+		validator.mMin = desc.min;
+		validator.mMax = desc.max;
+
+		if ((NULL == list) || ('\0' == *list)) {
+			return;
+		}
+
+		if (TYPE_RANGE == desc.type) {
+			// "(min,max),(min,max)"
+			const char *p = list;
+			int n;
+			while (2 == sscanf(p, " (%d,%d)%n", &values[0], &values[1], &n)) {
+				validator.mTokens.add(token(desc.type, values));
+				p += n;
+				if (',' != *p) {
+					break;
+				}
+				p++;
+			}
+			return;
+		}
+
+		while (*list != '\0') {
+			const char *next = strchr(list, ',');
+			size_t len = next ? (size_t) (next - list) : strlen(list);
+
+			if (len < sizeof(item)) {
+				memcpy(item, list, len);
+				item[len] = '\0';
+				if (TYPE_STRING == desc.type) {
+					validator.mStrings.add(String8(item));
+				} else if (parse(desc.type, item, values)) {
+					validator.mTokens.add(token(desc.type, values));
+				}
+			}
+
+			if (NULL == next) {
+				break;
+			}
+			list = next + 1;
+		}
+	}
+
+	bool ParameterStore::validate(Key key, const char *str, const int *values) const
+	{
+		const ParamDesc &desc = sParams[key];
+		const Validator &validator = mValidators[key];
+
+		if (TYPE_STRING == desc.type) {
+			return validator.mStrings.isEmpty() || (0 <= validator.mStrings.indexOf(String8(str)));
+		}
+
+		if ((validator.mMin <= validator.mMax) &&
+				((values[0] < validator.mMin) || (values[0] > validator.mMax) ||
+				((TYPE_INT != desc.type) && (values[1] > validator.mMax)))) {
+			return false;
+		}
+
+		return validator.mTokens.isEmpty() || (0 <= validator.mTokens.indexOf(token(desc.type, values)));
+	}
+
+	void ParameterStore::initialize(const CameraParameters &params)
+	{
+		const char *valstr;
+
+		LOG_FUNCTION_NAME;
+
+		for (int i = 0; i < PARAM_COUNT; i++) {
+			const ParamDesc &desc = sParams[i];
+			Value &value = mValues[i];
+
+			if ((NULL != desc.supported) && (NULL != params.get(desc.supported))) {
+				compile((Key) i, params.get(desc.supported));
+			} else if (NULL != desc.fixed) {
+				compile((Key) i, desc.fixed);
+			} else {
+				compile((Key) i, NULL);
+			}
+
+			valstr = params.get(desc.name);
+			value.mSet = (NULL != valstr);
+			value.mRaw.setTo(value.mSet ? valstr : "");
+			parse(desc.type, value.mSet ? valstr : "", value.mInt);
+		}
+
+		if (((valstr = params.get(CameraParameters::KEY_MIN_EXPOSURE_COMPENSATION)) != NULL) && (*valstr != '\0')) {
+			mValidators[PARAM_EXPOSURE_COMPENSATION].mMin = atoi(valstr);
+			mValidators[PARAM_EXPOSURE_COMPENSATION].mMax = params.getInt(CameraParameters::KEY_MAX_EXPOSURE_COMPENSATION);
+		}
+
+		if (((valstr = params.get(CameraParameters::KEY_MAX_ZOOM)) != NULL) && (*valstr != '\0')) {
+			mValidators[PARAM_ZOOM].mMax = atoi(valstr);
+		}
+
+		// features the camera lacks can only be switched off
+		if (!isTrue(params.get(CameraParameters::KEY_VIDEO_STABILIZATION_SUPPORTED))) {
+			compile(PARAM_VIDEO_STABILIZATION, CameraParameters::FALSE);
+		}
+		if (!isTrue(params.get(CameraParameters::KEY_AUTO_EXPOSURE_LOCK_SUPPORTED))) {
+			compile(PARAM_AUTO_EXPOSURE_LOCK, CameraParameters::FALSE);
+		}
+		if (!isTrue(params.get(CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK_SUPPORTED))) {
+			compile(PARAM_AUTO_WHITEBALANCE_LOCK, CameraParameters::FALSE);
+		}
+
+		LOG_FUNCTION_NAME_EXIT;
+	}
+
+	status_t ParameterStore::update(const CameraParameters &params, ChangeSet &changes)
+	{
+		const char *strs[PARAM_COUNT];
+		int values[PARAM_COUNT][2];
+		status_t ret = NO_ERROR;
+
+		changes.clear();
+
+		for (int i = 0; i < PARAM_COUNT; i++) {
+			const ParamDesc &desc = sParams[i];
+			const Value &value = mValues[i];
+
+			strs[i] = params.get(desc.name);
+
+			if (NULL == strs[i]) {
+				if (desc.optional && value.mSet) {
+					changes.add((Key) i);
+				}
+				continue;
+			}
+
+			if (value.mSet && (strcmp(value.mRaw.string(), strs[i]) == 0)) {
+				continue;
+			}
+
+			if (!parse(desc.type, strs[i], values[i]) || !validate((Key) i, strs[i], values[i])) {
+				LOGINFO("Invalid %s: %s", desc.name, strs[i]);
+				ret = BAD_VALUE;
+				continue;
+			}
+
+			changes.add((Key) i);
+		}
+
+		if (NO_ERROR != ret) {
+			changes.clear();
+			return ret;
+		}
+
+		for (int i = 0; i < PARAM_COUNT; i++) {
+			if (!changes.has((Key) i)) {
+				continue;
+			}
+
+			Value &value = mValues[i];
+			if (NULL == strs[i]) {
+				value.mSet = false;
+				value.mRaw.setTo("");
+				value.mInt[0] = value.mInt[1] = 0;
+			} else {
+				value.mSet = true;
+				value.mRaw.setTo(strs[i]);
+				value.mInt[0] = values[i][0];
+				value.mInt[1] = values[i][1];
+			}
+		}
+
+		return NO_ERROR;
+	}
+
+	void ParameterStore::apply(const ChangeSet &changes, CameraParameters &params) const
+	{
+		for (int i = 0; i < PARAM_COUNT; i++) {
+			if (!changes.has((Key) i)) {
+				continue;
+			}
+
+			if (mValues[i].mSet) {
+				params.set(sParams[i].name, mValues[i].mRaw.string());
+			} else {
+				params.remove(sParams[i].name);
+			}
+		}
+	}
+
+};
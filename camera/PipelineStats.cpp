@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file PipelineStats.cpp
+*
+* This file implements the per camera pipeline counters.
+*
+*/
+
+#define LOG_TAG "PipelineStats"
+
+#include "CameraHal.h"
+#include "PipelineStats.h"
+
+namespace android {
+
+	// bucket i holds latencies up to its bound, the last one everything above
+	static const unsigned int sBucketLimitsMs[PIPELINE_LATENCY_BUCKETS] = {
+		1, 2, 4, 8, 12, 16, 20, 25, 33, 40, 50, 66, 100, 200, 500, 0,
+	};
+
+	static const char* const sStageNames[PipelineStats::STAGE_COUNT] = {
+		"capture",
+		"display",
+		"preview callback",
+		"video",
+		"encode",
+	};
+
+	static const char* const sOwnerNames[PipelineStats::OWNER_COUNT] = {
+		"driver",
+		"display",
+		"app",
+		"encoder",
+	};
+
+	PipelineStats::PipelineStats()
+	{
+		memset(mOwned, 0, sizeof(mOwned));
+		resetLocked();
+	}
+
+	void PipelineStats::resetLocked()
+	{
+		memset(mCounters, 0, sizeof(mCounters));
+		memcpy(mOwnedMax, mOwned, sizeof(mOwnedMax));
+		mSince = systemTime(SYSTEM_TIME_MONOTONIC);
+	}
+
+	void PipelineStats::reset()
+	{
+		Mutex::Autolock lock(mLock);
+		resetLocked();
+	}
+
+	void PipelineStats::frame(Stage stage, nsecs_t latency)
+	{
+		nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+		unsigned int bucket = 0;
+
+		if (stage >= STAGE_COUNT) {
+			return;
+		}
+
+		if (latency < 0) {
+			latency = 0;
+		}
+
+		while ( (bucket < PIPELINE_LATENCY_BUCKETS - 1) && (latency > ms2ns(sBucketLimitsMs[bucket])) ) {
+			bucket++;
+		}
+
+		Mutex::Autolock lock(mLock);
+		Counters &counters = mCounters[stage];
+
+		counters.mFrames++;
+		counters.mHistogram[bucket]++;
+		if (latency > counters.mLatencyMax) {
+			counters.mLatencyMax = latency;
+		}
+
+		if (0 == counters.mPeriodStart) {
+			counters.mPeriodStart = now;
+		} else if ( (now - counters.mPeriodStart) >= s2ns(1) ) {
+			counters.mLastSecondFrames = counters.mPeriodFrames;
+			counters.mPeriodFrames = 0;
+			counters.mPeriodStart = now;
+		}
+		counters.mPeriodFrames++;
+	}
+
+	void PipelineStats::drop(Stage stage, unsigned int count)
+	{
+		if (stage >= STAGE_COUNT) {
+			return;
+		}
+
+		Mutex::Autolock lock(mLock);
+		mCounters[stage].mDrops += count;
+	}
+
+	void PipelineStats::queueDepth(Stage stage, unsigned int depth)
+	{
+		if (stage >= STAGE_COUNT) {
+			return;
+		}
+
+		Mutex::Autolock lock(mLock);
+		Counters &counters = mCounters[stage];
+
+		counters.mQueueDepth = depth;
+		if (depth > counters.mQueueDepthMax) {
+			counters.mQueueDepthMax = depth;
+		}
+	}
+
+	void PipelineStats::updateOwnedLocked(Owner owner, int count)
+	{
+		if (count < 0) {
+			count = 0;
+		}
+
+		mOwned[owner] = count;
+		if (count > mOwnedMax[owner]) {
+			mOwnedMax[owner] = count;
+		}
+	}
+
+	void PipelineStats::setOwned(Owner owner, int count)
+	{
+		if (owner >= OWNER_COUNT) {
+			return;
+		}
+
+		Mutex::Autolock lock(mLock);
+		updateOwnedLocked(owner, count);
+	}
+
+	void PipelineStats::acquire(Owner owner)
+	{
+		if (owner >= OWNER_COUNT) {
+			return;
+		}
+
+		Mutex::Autolock lock(mLock);
+		updateOwnedLocked(owner, mOwned[owner] + 1);
+	}
+
+	void PipelineStats::release(Owner owner)
+	{
+		if (owner >= OWNER_COUNT) {
+			return;
+		}
+
+		Mutex::Autolock lock(mLock);
+		updateOwnedLocked(owner, mOwned[owner] - 1);
+	}
+
+	nsecs_t PipelineStats::percentileLocked(const Counters &counters, unsigned int percent) const
+	{
+		unsigned int total = 0, seen = 0, target;
+
+		for (int i = 0; i < PIPELINE_LATENCY_BUCKETS; i++) {
+			total += counters.mHistogram[i];
+		}
+
+		if (0 == total) {
+			return 0;
+		}
+
+		// the rank of the percentile, rounded up so p99 of few frames is the slowest
+		target = (total * percent + 99) / 100;
+
+		for (int i = 0; i < PIPELINE_LATENCY_BUCKETS - 1; i++) {
+			seen += counters.mHistogram[i];
+			if (seen >= target) {
+				nsecs_t bound = ms2ns(sBucketLimitsMs[i]);
+				return (bound < counters.mLatencyMax) ? bound : counters.mLatencyMax;
+			}
+		}
+
+		return counters.mLatencyMax;
+	}
+
+	void PipelineStats::getSnapshot(Snapshot &snapshot)
+	{
+		nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+		memset(&snapshot, 0, sizeof(snapshot));
+		snapshot.mMemoryTotal = MemoryAccounting::getTotal();
+		snapshot.mMemoryPeak = MemoryAccounting::getPeak();
+
+		Mutex::Autolock lock(mLock);
+
+		for (int i = 0; i < STAGE_COUNT; i++) {
+			const Counters &counters = mCounters[i];
+			StageStats &stage = snapshot.mStages[i];
+
+			stage.mFrames = counters.mFrames;
+			stage.mDrops = counters.mDrops;
+			// a stage that stopped has no rate, not the one it last had
+			if ( (0 != counters.mPeriodStart) && ((now - counters.mPeriodStart) < s2ns(2)) ) {
+				stage.mLastSecondFrames = counters.mLastSecondFrames;
+			}
+			stage.mQueueDepth = counters.mQueueDepth;
+			stage.mQueueDepthMax = counters.mQueueDepthMax;
+			stage.mLatencyP50 = percentileLocked(counters, 50);
+			stage.mLatencyP90 = percentileLocked(counters, 90);
+			stage.mLatencyP99 = percentileLocked(counters, 99);
+			stage.mLatencyMax = counters.mLatencyMax;
+		}
+
+		memcpy(snapshot.mOwned, mOwned, sizeof(snapshot.mOwned));
+		memcpy(snapshot.mOwnedMax, mOwnedMax, sizeof(snapshot.mOwnedMax));
+		snapshot.mSince = now - mSince;
+	}
+
+	bool PipelineStats::formatLine(const Snapshot &snapshot, unsigned int index, char *line, size_t length)
+	{
+		if (0 == index) {
+			snprintf(line, length, "Pipeline over the last %lld ms\n  %-16s %8s %6s %4s %5s %5s %8s %8s %8s %8s\n",
+					ns2ms(snapshot.mSince), "stage", "frames", "drops", "fps", "queue", "max",
+					"p50 us", "p90 us", "p99 us", "max us");
+			return true;
+		}
+		index--;
+
+		if (index < STAGE_COUNT) {
+			const StageStats &stage = snapshot.mStages[index];
+			snprintf(line, length, "  %-16s %8u %6u %4u %5u %5u %8lld %8lld %8lld %8lld\n",
+					sStageNames[index], stage.mFrames, stage.mDrops, stage.mLastSecondFrames,
+					stage.mQueueDepth, stage.mQueueDepthMax, ns2us(stage.mLatencyP50),
+					ns2us(stage.mLatencyP90), ns2us(stage.mLatencyP99), ns2us(stage.mLatencyMax));
+			return true;
+		}
+		index -= STAGE_COUNT;
+
+		if (0 == index) {
+			snprintf(line, length, "Buffers held\n  %-16s %8s %8s\n", "owner", "now", "max");
+			return true;
+		}
+		index--;
+
+		if (index < OWNER_COUNT) {
+			snprintf(line, length, "  %-16s %8d %8d\n", sOwnerNames[index],
+					snapshot.mOwned[index], snapshot.mOwnedMax[index]);
+			return true;
+		}
+		index -= OWNER_COUNT;
+
+		if (0 == index) {
+			snprintf(line, length, "Camera memory %u KB, peak %u KB\n",
+					snapshot.mMemoryTotal / 1024, snapshot.mMemoryPeak / 1024);
+			return true;
+		}
+
+		return false;
+	}
+
+	status_t PipelineStats::dump(int fd)
+	{
+		Snapshot snapshot;
+		char line[160];
+
+		getSnapshot(snapshot);
+
+		for (unsigned int i = 0; formatLine(snapshot, i, line, sizeof(line)); i++) {
+			write(fd, line, strlen(line));
+		}
+
+		return NO_ERROR;
+	}
+
+	void PipelineStats::log()
+	{
+		Snapshot snapshot;
+		char line[160];
+
+		getSnapshot(snapshot);
+
+		for (unsigned int i = 0; formatLine(snapshot, i, line, sizeof(line)); i++) {
+			LOGI("%s", line);
+		}
+	}
+
+	const char* PipelineStats::getStageName(Stage stage)
+	{
+		return (stage < STAGE_COUNT) ? sStageNames[stage] : "unknown";
+	}
+
+	const char* PipelineStats::getOwnerName(Owner owner)
+	{
+		return (owner < OWNER_COUNT) ? sOwnerNames[owner] : "unknown";
+	}
+
+};
@@ -24,6 +24,7 @@
 
 #include "V4LCameraAdapter.h"
 #include "CameraHal.h"
+#include "DeviceManager.h"
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -51,13 +52,78 @@ namespace android {
 	//frames skipped before recalculating the framerate
 #define FPS_PERIOD 30
 
-	const char *device = DEVICE;
+	//ZSL frames further than this from the shutter are not considered for sharpness
+#define ZSL_SELECT_WINDOW ms2ns(150)
+	//focus metric sampling step in rows and in luma samples
+#define FOCUS_ROW_STEP 8
+#define FOCUS_COL_STEP 4
+
+	//orientation must be this close to a quadrant before the preview follows it
+#define ROTATION_SNAP_DEGREES 30
+
+#define ARRAY_SIZE(array) (sizeof((array)) / sizeof((array)[0]))
+
+	//white balance presets, as the color temperature in Kelvin they stand for
+	typedef struct {
+		const char *mode;
+		int temperature;
+	} WhiteBalancePreset;
+
+	static const WhiteBalancePreset sWhiteBalancePresets[] = {
+		{ CameraParameters::WHITE_BALANCE_INCANDESCENT, 2800 },
+		{ CameraParameters::WHITE_BALANCE_WARM_FLUORESCENT, 3000 },
+		{ CameraParameters::WHITE_BALANCE_FLUORESCENT, 4000 },
+		{ CameraParameters::WHITE_BALANCE_DAYLIGHT, 5500 },
+		{ CameraParameters::WHITE_BALANCE_CLOUDY_DAYLIGHT, 6500 },
+		{ CameraParameters::WHITE_BALANCE_SHADE, 7500 },
+		{ CameraParameters::WHITE_BALANCE_TWILIGHT, 9000 },
+	};
+
+	//antibanding modes, indexed by the V4L2_CID_POWER_LINE_FREQUENCY value
+	static const char* const sAntibandingModes[] = {
+		CameraParameters::ANTIBANDING_OFF,
+		CameraParameters::ANTIBANDING_50HZ,
+		CameraParameters::ANTIBANDING_60HZ,
+		CameraParameters::ANTIBANDING_AUTO,
+	};
+
+	static bool isTrue(const char *valstr)
+	{
+		return (NULL != valstr) && (strcmp(valstr, CameraParameters::TRUE) == 0);
+	}
+
+	//a level missing from the parameters falls back to the driver default
+	static void requestLevel(V4LControls &controls, V4LControls::Control control, const char *level, int offset)
+	{
+		int percent = (NULL != level) ? atoi(level) : controls.getDefaultPercent(control);
+
+		controls.setPercent(control, percent + offset);
+	}
 
 	V4LCameraAdapter::V4LCameraAdapter()
 	{
 		LOG_FUNCTION_NAME;
 
-		// Nothing useful to do in the constructor
+		// the destructor relies on these even when initialize() was never reached
+		mCameraHandle = -1;
+		mVideoInfo = NULL;
+		strncpy(mDevice, DEVICE, sizeof(mDevice) - 1);
+		mDevice[sizeof(mDevice) - 1] = '\0';
+		mPreviewThreadIdle = true;
+		mPreviewThreadExit = false;
+		mDriverBufferCount = 0;
+		mDriverBufferLength = 0;
+		mDriverBufferTarget = 0;
+		mRetiredCount = 0;
+		mRetiredLength = 0;
+		mSensorIndex = 0;
+		mDeviceGeneration = 0;
+		mDequeueError = 0;
+		mLastSequence = -1;
+		mFrameSequence = 0;
+		mRecoveries = 0;
+		mLastRecoveryTime = 0;
+		mMaxRecoveryTime = 0;
 
 		LOG_FUNCTION_NAME_EXIT;
 	}
@@ -66,8 +132,25 @@ namespace android {
 	{
 		LOG_FUNCTION_NAME;
 
+		// wake the parked preview thread so it can exit
+		if (NULL != mPreviewThread.get()) {
+			mPreviewThread->requestExit();
+			{
+				Mutex::Autolock lock(mPreviewThreadLock);
+				mPreviewThreadExit = true;
+				mPreviewThreadCondition.broadcast();
+			}
+			mPreviewThread->requestExitAndWait();
+			mPreviewThread.clear();
+		}
+
+		releaseDriverBuffers();
+
 		// Close the camera handle and free the video info structure
-		close(mCameraHandle);
+		if (mCameraHandle >= 0) {
+			close(mCameraHandle);
+			mCameraHandle = -1;
+		}
 
 		if (mVideoInfo)
 		{
@@ -95,9 +178,19 @@ namespace android {
 			return NO_MEMORY;
 		}
 
-		if ((mCameraHandle = open(device, O_RDWR)) == -1)
+		// every camera streams from the node discovered for it, or the one it came back on after
+		// a replug; DEVICE is only the fallback
+		const char *node = properties->get(CameraProperties::DEVICE_NODE);
+		if ((NULL != node) && ('\0' != node[0])) {
+			strncpy(mDevice, node, sizeof(mDevice) - 1);
+			mDevice[sizeof(mDevice) - 1] = '\0';
+		}
+		mSensorIndex = atoi(properties->get(CameraProperties::CAMERA_SENSOR_INDEX));
+		DeviceManager::getInstance()->getNode(mSensorIndex, mDevice, sizeof(mDevice), mDeviceGeneration);
+
+		if ((mCameraHandle = open(mDevice, O_RDWR)) == -1)
 		{
-			LOGINFO("Error while opening handle to V4L2 Camera: %s", strerror(errno));
+			LOGINFO("Error while opening handle to V4L2 Camera %s: %s", mDevice, strerror(errno));
 			return -EINVAL;
 		}
 
@@ -122,15 +215,60 @@ namespace android {
 
 		// Initialize flags
 		mPreviewing = false;
+		mCapturing = false;
+		mCaptureFramesPending = 0;
+		mCaptureFramesSkipped = 0;
+		mVideoSnapshot = false;
+		mZslHead = 0;
+		mZslCount = 0;
+		mZslHistory = 0;
+		mZslSharpest = false;
+		mZslRequested = false;
+		mZslShutterTime = 0;
+		memset(mBufferRefs, 0, sizeof(mBufferRefs));
+		memset(mPreviewBufByIndex, 0, sizeof(mPreviewBufByIndex));
+		mZoomRatios[0] = ZOOM_RATIO_UNITY;
+		mZoomStages = 1;
+		mCurrentZoomIdx = 0;
+		mTargetZoomIdx = 0;
+		mSmoothZoom = false;
+		mZoomDone = false;
+		mPreviewRotation = 0;
+		mSensorRotation = 0;
 		mVideoInfo->isStreaming = false;
 		mRecording = false;
 
+		// what the HAL will hand over at preview start, see allocateDriverBuffers()
+		mDriverBufferTarget = atoi(properties->get(CameraProperties::REQUIRED_PREVIEW_BUFS));
+		if (mDriverBufferTarget > NB_BUFFER) {
+			mDriverBufferTarget = NB_BUFFER;
+		}
+
+		// enumeration is skipped when the cache was written for this very device
+		nsecs_t enumStart = systemTime();
+		mCapabilities.identify(mCameraHandle, mDevice, mVideoInfo->cap);
+		bool cached = mCapabilities.load();
+
+		// the controls are queried once, later requests are diffed against the cache
+		mControls.initialize(mCameraHandle, &mCapabilities);
+		mCapabilities.store();
+		LOGINFO("capabilities %s in %lld us", cached ? "from cache" : "enumerated",
+				ns2us(systemTime() - enumStart));
+		mExposureAutoMode = mControls.getCurrent(V4LControls::CONTROL_EXPOSURE_AUTO);
+		publishControls(properties);
+
 		LOG_FUNCTION_NAME_EXIT;
 
 		return ret;
 	}
 
 	status_t V4LCameraAdapter::setParameters(const CameraParameters &params)
+	{
+		return updateParameters(params, ParameterStore::ChangeSet::all());
+	}
+
+	status_t V4LCameraAdapter::updateParameters(const CameraParameters &params,
+			const ParameterStore::ChangeSet &changes)
 	{
 		LOG_FUNCTION_NAME;
 
@@ -140,30 +278,132 @@ namespace android {
 
 		params.getPreviewSize(&width, &height);
 
-		LOGINFO("Width * Height %d x %d format 0x%x", width, height, DEFAULT_PIXEL_FORMAT);
+		// the format only changes with the stream off, and only when it really moved
+		if ( (changes.has(ParameterStore::PARAM_PREVIEW_SIZE) || changes.has(ParameterStore::PARAM_PREVIEW_FORMAT)) &&
+				((mVideoInfo->width != width) || (mVideoInfo->height != height)) ) {
+			if (mVideoInfo->isStreaming) {
+				LOGINFO("Preview size %d x %d ignored while streaming", width, height);
+				ret = INVALID_OPERATION;
+			} else {
+				LOGINFO("Width * Height %d x %d format 0x%x", width, height, DEFAULT_PIXEL_FORMAT);
+
+				mVideoInfo->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+				mVideoInfo->format.fmt.pix.width = width;
+				mVideoInfo->format.fmt.pix.height = height;
+				mVideoInfo->format.fmt.pix.pixelformat = DEFAULT_PIXEL_FORMAT;
+
+				// kept driver buffers too small for the new frame are of no use
+				if ((size_t) (width * height << 1) > mDriverBufferLength) {
+					releaseDriverBuffers();
+				}
+
+				ret = ioctl(mCameraHandle, VIDIOC_S_FMT, &mVideoInfo->format);
+				if ((ret < 0) && (EBUSY == errno) && (0 < mDriverBufferCount)) {
+					// some drivers, uvcvideo among them, refuse a new format while buffers are allocated
+					releaseDriverBuffers();
+					ret = ioctl(mCameraHandle, VIDIOC_S_FMT, &mVideoInfo->format);
+				}
+				if (ret < 0) {
+					LOGINFO("Open: VIDIOC_S_FMT Failed: %s", strerror(errno));
+					return ret;
+				}
+
+				mVideoInfo->width = width;
+				mVideoInfo->height = height;
+				mVideoInfo->framesizeIn = (width * height << 1);
+				mVideoInfo->formatIn = DEFAULT_PIXEL_FORMAT;
+
+				// mapped now, on the HAL worker while the client is still setting up, so that
+				// starting the preview only has to queue them
+				if ((0 == mDriverBufferCount) && (0 < mDriverBufferTarget) &&
+						(allocateDriverBuffers(mDriverBufferTarget) < 0)) {
+					LOGINFO("Driver buffers not allocated ahead of preview");
+					releaseDriverBuffers();
+				}
+			}
+		}
 
-		mVideoInfo->width = width;
-		mVideoInfo->height = height;
-		mVideoInfo->framesizeIn = (width * height << 1);
-		mVideoInfo->formatIn = DEFAULT_PIXEL_FORMAT;
+		// ZSL depth only changes the number of frames held back from the stream,
+		// it is applied on the next frame
+		if (changes.has(ParameterStore::PARAM_ZSL_HISTORY)) {
+			int history = params.getInt(CameraProperties::ZSL_HISTORY);
+			if (history < 0) {
+				history = 0;
+			} else if (history > MAX_ZSL_FRAMES) {
+				history = MAX_ZSL_FRAMES;
+			}
+			Mutex::Autolock lock(mCaptureLock);
+			mZslHistory = history;
+		}
 
-		mVideoInfo->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		mVideoInfo->format.fmt.pix.width = width;
-		mVideoInfo->format.fmt.pix.height = height;
-		mVideoInfo->format.fmt.pix.pixelformat = DEFAULT_PIXEL_FORMAT;
+		if (changes.has(ParameterStore::PARAM_ZSL_SELECT)) {
+			bool sharpest = (NULL != params.get(CameraProperties::ZSL_SELECT)) &&
+				(strcmp(params.get(CameraProperties::ZSL_SELECT), CameraProperties::ZSL_SELECT_SHARPEST) == 0);
+			Mutex::Autolock lock(mCaptureLock);
+			mZslSharpest = sharpest;
+		}
 
-		ret = ioctl(mCameraHandle, VIDIOC_S_FMT, &mVideoInfo->format);
-		if (ret < 0) {
-			LOGINFO("Open: VIDIOC_S_FMT Failed: %s", strerror(errno));
-			return ret;
+		if (changes.has(ParameterStore::PARAM_ZOOM) || changes.has(ParameterStore::PARAM_PREVIEW_ROTATION) ||
+				(0 != strcmp(mParams.get(CameraParameters::KEY_ZOOM_RATIOS) ? mParams.get(CameraParameters::KEY_ZOOM_RATIOS) : "",
+					params.get(CameraParameters::KEY_ZOOM_RATIOS) ? params.get(CameraParameters::KEY_ZOOM_RATIOS) : "")))
+		{
+			Mutex::Autolock lock(mZoomLock);
+			const char *valstr;
+
+			// "100,125,..." in percent, index 0 is no zoom
+			if ( (valstr = params.get(CameraParameters::KEY_ZOOM_RATIOS)) != NULL ) {
+				const char *p = valstr;
+				mZoomStages = 0;
+				while ( (*p != '\0') && (mZoomStages < MAX_ZOOM_STAGES) ) {
+					mZoomRatios[mZoomStages++] = atoi(p);
+					p = strchr(p, ',');
+					if (NULL == p) {
+						break;
+					}
+					p++;
+				}
+				if (0 == mZoomStages) {
+					mZoomRatios[mZoomStages++] = ZOOM_RATIO_UNITY;
+				}
+			}
+
+			// a smooth zoom in flight owns the zoom index
+			if ( !mSmoothZoom && (params.get(CameraParameters::KEY_ZOOM) != NULL) ) {
+				int idx = params.getInt(CameraParameters::KEY_ZOOM);
+				if ( (idx >= 0) && (idx < mZoomStages) ) {
+					mCurrentZoomIdx = idx;
+					mTargetZoomIdx = idx;
+				}
+			}
+
+			mPreviewRotation = 0;
+			if ( (valstr = params.get(CameraProperties::PREVIEW_ROTATION)) != NULL ) {
+				if (strcmp(valstr, CameraProperties::PREVIEW_ROTATION_AUTO) == 0) {
+					mPreviewRotation = -1;
+				} else {
+					int rotation = atoi(valstr);
+					if ( (rotation == 90) || (rotation == 180) || (rotation == 270) ) {
+						mPreviewRotation = rotation;
+					}
+				}
+			}
 		}
 
-		
-		// Allocate memory for frame buffer
-		mFrameBuffer = (char *)calloc(1, width * height * 2);
+		if (changes.has(ParameterStore::PARAM_WHITE_BALANCE) || changes.has(ParameterStore::PARAM_ANTIBANDING) ||
+				changes.has(ParameterStore::PARAM_EFFECT) || changes.has(ParameterStore::PARAM_EXPOSURE_COMPENSATION) ||
+				changes.has(ParameterStore::PARAM_AUTO_EXPOSURE_LOCK) || changes.has(ParameterStore::PARAM_AUTO_WHITEBALANCE_LOCK) ||
+				changes.has(ParameterStore::PARAM_BRIGHTNESS) || changes.has(ParameterStore::PARAM_CONTRAST) ||
+				changes.has(ParameterStore::PARAM_SATURATION) || changes.has(ParameterStore::PARAM_SHARPNESS)) {
+			requestControls(params);
+			// while previewing, the preview thread writes what the commit interval held back
+			mControls.commit(!mPreviewing);
+		}
 
-		// Udpate the current parameter set
+		// Udpate the current parameter set, keeping the size the stream runs at
 		mParams = params;
+		if (0 < mVideoInfo->width) {
+			mParams.setPreviewSize(mVideoInfo->width, mVideoInfo->height);
+		}
 
 		LOG_FUNCTION_NAME_EXIT;
 		return ret;
@@ -196,7 +436,11 @@ namespace android {
 			ret = useBuffersPreview(bufArr, num);
 			break;
 
-			//@todo Insert Image capture case here
+		case CAMERA_IMAGE_CAPTURE:
+			// Capture ring is tracked by BaseCameraAdapter, frames are filled from the
+			// preview stream so there is nothing to register with the driver
+			ret = NO_ERROR;
+			break;
 
 		case CAMERA_VIDEO:
 			//@warn Video capture is not fully supported yet
@@ -214,11 +458,46 @@ namespace android {
 	{
 		int ret = NO_ERROR;
 
-		if(NULL == bufArr)
+		uint32_t *ptr = (uint32_t*) bufArr;
+
+		if((NULL == bufArr) || (num > NB_BUFFER))
 		{
 			return BAD_VALUE;
 		}
 
+		mPreviewBufs.clear();
+		memset(mPreviewBufByIndex, 0, sizeof(mPreviewBufByIndex));
+
+		// the mappings of the previous preview, or the ones made when the format was set,
+		// still serve when the count matches and the frame fits
+		if ((mDriverBufferCount == num) && (mDriverBufferLength >= (size_t) mVideoInfo->framesizeIn)) {
+			LOGINFO("Reusing %d driver buffers of %u bytes", num, mDriverBufferLength);
+		} else {
+			ret = allocateDriverBuffers(num);
+			if (ret < 0) {
+				return ret;
+			}
+		}
+
+		//Associate each Camera internal buffer with the one from Overlay
+		for (int i = 0; i < num; i++) {
+			LOGINFO("xxxxxxx bufArr index %d, address %x", i, ptr[i]);
+			mPreviewBufs.add((int)ptr[i], i);
+			mPreviewBufByIndex[i] = (char *) ptr[i];
+		}
+
+		// Update the preview buffer count
+		mPreviewBufferCount = num;
+
+		return ret;
+	}
+
+	status_t V4LCameraAdapter::allocateDriverBuffers(int num)
+	{
+		int ret = NO_ERROR;
+
+		releaseDriverBuffers();
+
 		//First allocate adapter internal buffers at V4L level for USB Cam
 		//These are the buffers from which we will copy the data into overlay buffers
 		/* Check if camera can handle NB_BUFFER buffers */
@@ -257,54 +536,586 @@ namespace android {
 				LOGINFO("Unable to map buffer (%s)", strerror(errno));
 				return -1;
 			}
+			MemoryAccounting::add(MemoryAccounting::MEM_DRIVER_BUFFERS, mVideoInfo->buf.length);
+			mDriverBufferLength = mVideoInfo->buf.length;
+			mDriverBufferCount = i + 1;
+		}
 
-			//Associate each Camera internal buffer with the one from Overlay
-			uint32_t *ptr = (uint32_t*) bufArr;
-			LOGINFO("xxxxxxx bufArr index %d, address %x", i, ptr[i]);
-			mPreviewBufs.add((int)ptr[i], i);
+		return ret;
+	}
+
+	status_t V4LCameraAdapter::takePicture(){
+		LOG_FUNCTION_NAME;
+
+		Mutex::Autolock lock(mCaptureLock);
+
+		if (!mPreviewing) {
+			LOGINFO("takePicture: stream is not running");
+			return NO_INIT;
 		}
 
+		if ((NULL == mCaptureBuffers) || (mCaptureBuffersCount < 1)) {
+			LOGINFO("takePicture: no capture buffers registered");
+			return NO_INIT;
+		}
 
-		// Update the preview buffer count
-		mPreviewBufferCount = num;
+		// Frames are picked off the running stream by the preview thread, so a
+		// burst runs at sensor rate and the stream is never stopped for a shot.
+		// With ZSL the first frame comes from the history taken before the shutter.
+		// While recording a single streamed frame is lent to the encoder. The adapter
+		// sends no recording frames of its own, so this is the preview buffer as the
+		// stream shows it, zoomed and rotated, lent without a further copy so the
+		// stream keeps its pacing.
+		mVideoSnapshot = mRecording;
+		mCaptureFramesPending = mVideoSnapshot ? 1 : mBurstFrames;
+		mCaptureFramesSkipped = 0;
+		mZslRequested = (mZslHistory > 0);
+		mZslShutterTime = systemTime(SYSTEM_TIME_MONOTONIC);
+		mCapturing = true;
+
+		LOGINFO("takePicture: %d frame(s) into a ring of %d%s", mCaptureFramesPending,
+				mCaptureBuffersCount, mVideoSnapshot ? ", video snapshot" : "");
 
-		return ret;
+		LOG_FUNCTION_NAME_EXIT;
+		return NO_ERROR;
 	}
 
-	status_t V4LCameraAdapter::takePicture(){
+	status_t V4LCameraAdapter::stopImageCapture()
+	{
 		LOG_FUNCTION_NAME;
 
-		status_t ret = NO_ERROR;
-		LOGINFO("takePicture mBufferIndex %d", mBufferIndex);
+		Mutex::Autolock lock(mCaptureLock);
 
-		char *src = this->dequeueBuffer(mBufferIndex);
-		if(!src){
-			return BAD_VALUE;
+		if (mCaptureFramesPending > 0) {
+			LOGINFO("Capture stopped with %d frame(s) outstanding", mCaptureFramesPending);
 		}
-			
-		int width = mVideoInfo->width;
-		int height = mVideoInfo->height;
-		int bufferSize = width * height * 2;
-		LOGINFO("width %d, height %d", width, height);
+		mCaptureFramesPending = 0;
+		mZslRequested = false;
+		mVideoSnapshot = false;
+		mCapturing = false;
 
-		memset(mFrameBuffer, 0, bufferSize);
-		memcpy(mFrameBuffer, src, bufferSize);
+		LOG_FUNCTION_NAME_EXIT;
+		return NO_ERROR;
+	}
+
+	void V4LCameraAdapter::captureFrame(char *src, int width, int height, const FrameTransform &transform)
+	{
+		LOG_FUNCTION_NAME;
 
+		void *buf = NULL;
+		size_t srcStride = width * 2;
+		size_t stride = srcStride;
+		size_t bytes;
 		CameraFrame frame;
+
+		{
+			Mutex::Autolock lock(mCaptureBufferLock);
+
+			// 2D capture buffers may pad every row out to their alignment
+			if (mCaptureBuffersStride > srcStride) {
+				stride = mCaptureBuffersStride;
+			}
+			bytes = stride * height;
+
+			if (bytes > mCaptureBuffersLength) {
+				LOGINFO("Capture buffer too small %d < %d", mCaptureBuffersLength, bytes);
+				return;
+			}
+
+			// a slot is free once every subscriber has returned it
+			for (int i = 0; i < mCaptureBuffersCount; i++) {
+				if (mCaptureBuffersAvailable.valueFor((unsigned int) mCaptureBuffers[i]) <= 0) {
+					buf = (void *) mCaptureBuffers[i];
+					break;
+				}
+			}
+		}
+
+		if (NULL == buf) {
+			// encoder is behind, try again on the next frame
+			mCaptureFramesSkipped++;
+			return;
+		}
+
+		// zoom crops the still the way it crops the preview, written unpadded into the slot
+		if ( !isIdentityTransform(width, height, width, height, transform) &&
+				transformYUYV((const uint8_t *) src, width, height, (uint8_t *) buf, width, height, transform) ) {
+			stride = srcStride;
+			bytes = stride * height;
+		} else if (stride == srcStride) {
+			memcpy(buf, src, bytes);
+		} else {
+			for (int y = 0; y < height; y++) {
+				memcpy((uint8_t *) buf + y * stride, src + y * srcStride, srcStride);
+			}
+		}
+		setInitFrameRefCount(buf, CameraFrame::IMAGE_FRAME);
+
 		frame.mFrameType = CameraFrame::IMAGE_FRAME;
-		frame.mBuffer = mFrameBuffer;
+		frame.mBuffer = buf;
 		frame.mWidth = width;
 		frame.mHeight = height;
-		frame.mLength = bufferSize;
+		frame.mLength = bytes;
+		frame.mAlignment = stride;
+		frame.mOffset = 0;
+		frame.mQuirks |= CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG;
+		frame.mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+
+		if (sendFrameToSubscribers(&frame) != NO_ERROR) {
+			LOGINFO("Failed to send capture frame to subscribers");
+		}
+
+		captureFrameDone();
+
+		LOG_FUNCTION_NAME_EXIT;
+	}
+
+	void V4LCameraAdapter::captureFrameDone()
+	{
+		bool done = false;
+
+		{
+			Mutex::Autolock lock(mCaptureLock);
+
+			if (mCapturing && (--mCaptureFramesPending <= 0)) {
+				mCapturing = false;
+				done = true;
+				LOGINFO("Capture done, %d stream frame(s) skipped waiting for a free slot",
+						mCaptureFramesSkipped);
+			}
+		}
+
+		if (done && (NULL != mEndImageCaptureCallback)) {
+			mEndImageCaptureCallback(mEndCaptureData);
+		}
+	}
+
+	uint32_t V4LCameraAdapter::focusMetric(const char *src, int width, int height)
+	{
+		const uint8_t *yuyv = (const uint8_t *) src;
+		uint32_t sum = 0;
+
+		// sum of absolute luma differences two pixels apart on a sparse grid,
+		// enough to rank frames of the same scene by motion blur
+		for (int y = FOCUS_ROW_STEP / 2; y < height; y += FOCUS_ROW_STEP) {
+			const uint8_t *row = yuyv + y * width * 2;
+			for (int x = 0; x + 2 < width; x += FOCUS_COL_STEP) {
+				int d = (int) row[(x + 2) * 2] - (int) row[x * 2];
+				sum += (d < 0) ? -d : d;
+			}
+		}
+
+		return sum;
+	}
+
+	void V4LCameraAdapter::holdZslFrame(int index, nsecs_t timestamp, const char *src, int width, int height,
+			int depth, bool sharpest)
+	{
+
+		// keep enough buffers queued for the driver to stream into
+		if (depth > mPreviewBufferCount - MIN_STREAM_BUFFERS) {
+			depth = mPreviewBufferCount - MIN_STREAM_BUFFERS;
+		}
+
+		// drop the oldest frames, including any left over from a larger depth
+		while ((mZslCount > 0) && (mZslCount >= depth)) {
+			int oldest = mZslRing[mZslHead].index;
+			mZslHead = (mZslHead + 1) % MAX_ZSL_FRAMES;
+			mZslCount--;
+			releaseDriverBuffer(oldest);
+		}
+
+		if (depth <= 0) {
+			return;
+		}
+
+		{
+			Mutex::Autolock lock(mBufferRefLock);
+			mBufferRefs[index]++;
+		}
+
+		ZslFrame &slot = mZslRing[(mZslHead + mZslCount) % MAX_ZSL_FRAMES];
+		slot.index = index;
+		slot.timestamp = timestamp;
+		slot.sharpness = sharpest ? focusMetric(src, width, height) : 0;
+		mZslCount++;
+	}
+
+	void V4LCameraAdapter::flushZslFrames()
+	{
+		while (mZslCount > 0) {
+			int oldest = mZslRing[mZslHead].index;
+			mZslHead = (mZslHead + 1) % MAX_ZSL_FRAMES;
+			mZslCount--;
+			releaseDriverBuffer(oldest);
+		}
+		mZslHead = 0;
+	}
+
+	void V4LCameraAdapter::sendZslFrame(int width, int height, bool sharpest, const FrameTransform &transform)
+	{
+		LOG_FUNCTION_NAME;
+
+		nsecs_t shutter;
+		ZslFrame *pick = NULL;
+		nsecs_t pickDelta = 0;
+
+		{
+			Mutex::Autolock lock(mCaptureLock);
+			shutter = mZslShutterTime;
+			mZslRequested = false;
+		}
+
+		// nearest to the shutter, or the sharpest within the selection window
+		for (int i = 0; i < mZslCount; i++) {
+			ZslFrame *cur = &mZslRing[(mZslHead + i) % MAX_ZSL_FRAMES];
+			nsecs_t delta = cur->timestamp - shutter;
+			if (delta < 0) {
+				delta = -delta;
+			}
+
+			if (NULL == pick) {
+				pick = cur;
+				pickDelta = delta;
+			} else if (sharpest && (delta <= ZSL_SELECT_WINDOW)) {
+				if ((pickDelta > ZSL_SELECT_WINDOW) || (cur->sharpness > pick->sharpness)) {
+					pick = cur;
+					pickDelta = delta;
+				}
+			} else if (delta < pickDelta) {
+				pick = cur;
+				pickDelta = delta;
+			}
+		}
+
+		if (NULL == pick) {
+			// nothing held yet, the next streamed frame is taken instead
+			LOGINFO("ZSL history empty, capturing from the stream");
+			Mutex::Autolock lock(mCaptureLock);
+			mZslRequested = false;
+			return;
+		}
+
+		LOGINFO("ZSL picked buffer %d, %lld us from shutter", pick->index, ns2us(pickDelta));
+
+		// a zoomed frame needs the crop, only the full frame can be lent as is
+		if (isIdentityTransform(width, height, width, height, transform)) {
+			lendDriverFrame(pick->index, mVideoInfo->mem[pick->index], pick->timestamp, width, height);
+		} else {
+			captureFrame((char *) mVideoInfo->mem[pick->index], width, height, transform);
+		}
+
+		LOG_FUNCTION_NAME_EXIT;
+	}
+
+	void V4LCameraAdapter::lendDriverFrame(int index, void *buf, nsecs_t timestamp, int width, int height)
+	{
+		LOG_FUNCTION_NAME;
+
+		CameraFrame frame;
+
+		// one reference per image subscriber, each returns the buffer on its own
+		setInitFrameRefCount(buf, CameraFrame::IMAGE_FRAME);
+		int subscribers = getFrameRefCount(buf, CameraFrame::IMAGE_FRAME);
+		{
+			Mutex::Autolock lock(mBufferRefLock);
+			mBufferRefs[index] += subscribers;
+		}
+
+		frame.mFrameType = CameraFrame::IMAGE_FRAME;
+		frame.mBuffer = buf;
+		frame.mWidth = width;
+		frame.mHeight = height;
+		frame.mLength = width * height * 2;
 		frame.mAlignment = width*2;
 		frame.mOffset = 0;
 		frame.mQuirks |= CameraFrame::ENCODE_RAW_YUV422I_TO_JPEG;
-		frame.mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);;
+		frame.mTimestamp = timestamp;
+
+		if (sendFrameToSubscribers(&frame) != NO_ERROR) {
+			LOGINFO("Failed to send driver buffer %d to subscribers", index);
+		}
+
+		captureFrameDone();
 
-		ret = sendFrameToSubscribers(&frame);
-		
 		LOG_FUNCTION_NAME_EXIT;
-		return ret;
+	}
+
+	void V4LCameraAdapter::releaseDriverBuffer(int index)
+	{
+		Mutex::Autolock lock(mBufferRefLock);
+
+		if ((index < 0) || (index >= mPreviewBufferCount)) {
+			return;
+		}
+
+		// a late return for a frame nobody counts any more
+		if (mBufferRefs[index] <= 0) {
+			return;
+		}
+
+		if (--mBufferRefs[index] > 0) {
+			return;
+		}
+		mBufferRefs[index] = 0;
+
+		if ( !mVideoInfo->isStreaming ) {
+			return;
+		}
+
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.index = index;
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+
+		if (ioctl(mCameraHandle, VIDIOC_QBUF, &buf) < 0) {
+			LOGINFO("VIDIOC_QBUF of buffer %d failed: %s", index, strerror(errno));
+			return;
+		}
+		nQueued++;
+	}
+
+	void V4LCameraAdapter::retireDriverBuffers()
+	{
+		// anything retired by an earlier recovery has long been returned
+		for (int i = 0; i < mRetiredCount; i++) {
+			if (munmap(mRetiredMem[i], mRetiredLength) < 0) {
+				LOGINFO("Unmap failed");
+			}
+			MemoryAccounting::remove(MemoryAccounting::MEM_DRIVER_BUFFERS, mRetiredLength);
+		}
+
+		for (int i = 0; i < mDriverBufferCount; i++) {
+			mRetiredMem[i] = mVideoInfo->mem[i];
+			mVideoInfo->mem[i] = NULL;
+		}
+		mRetiredCount = mDriverBufferCount;
+		mRetiredLength = mDriverBufferLength;
+		mDriverBufferCount = 0;
+		mDriverBufferLength = 0;
+	}
+
+	void V4LCameraAdapter::releaseDriverBuffers()
+	{
+		struct v4l2_requestbuffers rb;
+
+		for (int i = 0; i < mRetiredCount; i++) {
+			if (munmap(mRetiredMem[i], mRetiredLength) < 0) {
+				LOGINFO("Unmap failed");
+			}
+			MemoryAccounting::remove(MemoryAccounting::MEM_DRIVER_BUFFERS, mRetiredLength);
+		}
+		mRetiredCount = 0;
+
+		if (0 == mDriverBufferCount) {
+			return;
+		}
+
+		for (int i = 0; i < mDriverBufferCount; i++) {
+			if (munmap(mVideoInfo->mem[i], mDriverBufferLength) < 0) {
+				LOGINFO("Unmap failed");
+			}
+			MemoryAccounting::remove(MemoryAccounting::MEM_DRIVER_BUFFERS, mDriverBufferLength);
+		}
+		mDriverBufferCount = 0;
+		mDriverBufferLength = 0;
+
+		// a zero count frees them in the driver, which then accepts a new format
+		memset(&rb, 0, sizeof(rb));
+		rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		rb.memory = V4L2_MEMORY_MMAP;
+		rb.count = 0;
+		if (ioctl(mCameraHandle, VIDIOC_REQBUFS, &rb) < 0) {
+			LOGINFO("VIDIOC_REQBUFS 0 failed: %s", strerror(errno));
+		}
+	}
+
+	bool V4LCameraAdapter::isDeviceLost(int error)
+	{
+		// what uvcvideo and videobuf2 return once the device is gone
+		return (ENODEV == error) || (ENXIO == error) || (EIO == error);
+	}
+
+	status_t V4LCameraAdapter::reopenDevice(const char *node)
+	{
+		enum v4l2_buf_type bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		uint32_t identity = mCapabilities.getIdentity();
+		int ret;
+		int fd;
+
+		LOG_FUNCTION_NAME;
+
+		fd = open(node, O_RDWR);
+		if (fd < 0) {
+			ret = -errno;
+			LOGINFO("Reopening %s failed: %s", node, strerror(-ret));
+			return ret;
+		}
+
+		retireDriverBuffers();
+		if (mCameraHandle >= 0) {
+			close(mCameraHandle);
+		}
+		mCameraHandle = fd;
+		strncpy(mDevice, node, sizeof(mDevice) - 1);
+		mDevice[sizeof(mDevice) - 1] = '\0';
+
+		if (ioctl(mCameraHandle, VIDIOC_QUERYCAP, &mVideoInfo->cap) < 0) {
+			LOGINFO("VIDIOC_QUERYCAP on %s failed: %s", mDevice, strerror(errno));
+			return -EINVAL;
+		}
+
+		// the same camera keeps its queried controls, only values lost in the reset are written again
+		mCapabilities.identify(mCameraHandle, mDevice, mVideoInfo->cap);
+		if (mCapabilities.getIdentity() == identity) {
+			mControls.reattach(mCameraHandle);
+		} else {
+			LOGINFO("Device identity changed to %08x, enumerating again", mCapabilities.getIdentity());
+			mCapabilities.load();
+			mControls.initialize(mCameraHandle, &mCapabilities);
+			mCapabilities.store();
+
+			// the new camera starts from its own defaults, the application's settings are
+			// requested again and written with the commit once the stream is back
+			mExposureAutoMode = mControls.getCurrent(V4LControls::CONTROL_EXPOSURE_AUTO);
+			requestControls(mParams);
+		}
+
+		ret = ioctl(mCameraHandle, VIDIOC_S_FMT, &mVideoInfo->format);
+		if (ret < 0) {
+			LOGINFO("VIDIOC_S_FMT on %s failed: %s", mDevice, strerror(errno));
+			return ret;
+		}
+
+		ret = allocateDriverBuffers(mPreviewBufferCount);
+		if (ret < 0) {
+			return ret;
+		}
+
+		nQueued = 0;
+		nDequeued = 0;
+		mLastSequence = -1;
+
+		// a buffer the display or the encoder still holds keeps its preview buffer and its
+		// count, it goes back to the driver when the last holder returns it; the lock keeps
+		// such a return from slipping in before the stream is marked on again
+		{
+			Mutex::Autolock lock(mBufferRefLock);
+
+			for (int i = 0; i < mPreviewBufferCount; i++) {
+				if (0 < mBufferRefs[i]) {
+					continue;
+				}
+
+				memset(&mVideoInfo->buf, 0, sizeof(mVideoInfo->buf));
+				mVideoInfo->buf.index = i;
+				mVideoInfo->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+				mVideoInfo->buf.memory = V4L2_MEMORY_MMAP;
+
+				ret = ioctl(mCameraHandle, VIDIOC_QBUF, &mVideoInfo->buf);
+				if (ret < 0) {
+					LOGINFO("VIDIOC_QBUF Failed");
+					return -EINVAL;
+				}
+				nQueued++;
+			}
+
+			ret = ioctl(mCameraHandle, VIDIOC_STREAMON, &bufType);
+			if (ret < 0) {
+				LOGINFO("Unable to on streaming %s", strerror(errno));
+				return ret;
+			}
+			mVideoInfo->isStreaming = true;
+		}
+
+		LOGINFO("%d of %d buffers queued after reopen", nQueued, mPreviewBufferCount);
+
+		mControls.commit(true);
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_ERROR;
+	}
+
+	status_t V4LCameraAdapter::recoverDevice()
+	{
+		DeviceManager *devices = DeviceManager::getInstance();
+		const nsecs_t start = systemTime();
+		unsigned int generation = mDeviceGeneration;
+		char node[sizeof(mDevice)];
+		bool reported = false;
+		status_t ret;
+
+		LOG_FUNCTION_NAME;
+
+		LOGINFO("%s lost: %s, waiting for camera %d to come back", mDevice, strerror(mDequeueError),
+				mSensorIndex);
+
+		// nothing is queued to the dead handle by frames returned meanwhile
+		mVideoInfo->isStreaming = false;
+		flushZslFrames();
+		devices->markLost(mSensorIndex, generation);
+
+		for (;;) {
+			{
+				Mutex::Autolock lock(mPreviewThreadLock);
+				if (!mPreviewing || mPreviewThreadExit) {
+					LOGINFO("Preview stopped while camera %d was missing", mSensorIndex);
+					LOG_FUNCTION_NAME_EXIT;
+					return -ECANCELED;
+				}
+			}
+
+			ret = devices->waitForCamera(mSensorIndex, generation, DEVICE_RECOVERY_POLL,
+					node, sizeof(node), generation);
+			if (NO_INIT == ret) {
+				// not followed by the device manager, the same node is all there is to retry
+				usleep(ns2us(DEVICE_RECOVERY_POLL));
+				strncpy(node, mDevice, sizeof(node) - 1);
+				node[sizeof(node) - 1] = '\0';
+				ret = NO_ERROR;
+			}
+
+			if (NO_ERROR == ret) {
+				// stopPreview() waits for this thread under the same lock, so it cannot race the reopen
+				Mutex::Autolock lock(mPreviewThreadLock);
+				if (!mPreviewing || mPreviewThreadExit) {
+					continue;
+				}
+
+				if (NO_ERROR == reopenDevice(node)) {
+					mDeviceGeneration = generation;
+					break;
+				}
+
+				// back too early or already gone again, wait for its next appearance
+				mVideoInfo->isStreaming = false;
+				devices->markLost(mSensorIndex, generation);
+			}
+
+			if (!reported && (systemTime() - start > DEVICE_RECOVERY_TIMEOUT)) {
+				LOGINFO("Camera %d still missing after %lld ms", mSensorIndex, ns2ms(systemTime() - start));
+				if (NULL != mErrorNotifier) {
+					mErrorNotifier->errorNotify(-ENODEV);
+				}
+				reported = true;
+			}
+		}
+
+		const nsecs_t elapsed = systemTime() - start;
+		mRecoveries++;
+		mLastRecoveryTime = elapsed;
+		if (elapsed > mMaxRecoveryTime) {
+			mMaxRecoveryTime = elapsed;
+		}
+
+		LOGINFO("Camera %d streaming again on %s after %lld ms, %u recoveries, max %lld ms",
+				mSensorIndex, mDevice, ns2ms(elapsed), mRecoveries, ns2ms(mMaxRecoveryTime));
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_ERROR;
 	}
 
 	status_t V4LCameraAdapter::startPreview()
@@ -333,6 +1144,13 @@ namespace android {
 			nQueued++;
 		}
 
+		{
+			Mutex::Autolock lock(mBufferRefLock);
+			memset(mBufferRefs, 0, sizeof(mBufferRefs));
+		}
+		mZslHead = 0;
+		mZslCount = 0;
+
 		enum v4l2_buf_type bufType;
 		if (!mVideoInfo->isStreaming) {
 			bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -346,14 +1164,20 @@ namespace android {
 			mVideoInfo->isStreaming = true;
 		}
 
-		// Create and start preview thread for receiving buffers from V4L Camera
-		mPreviewThread = new PreviewThread(this);
-
-		LOGINFO("Created preview thread");
-
+		//Update the flag to indicate we are previewing, this also wakes a parked preview thread
+		{
+			Mutex::Autolock lock(mPreviewThreadLock);
+			mPreviewing = true;
+			mPreviewThreadIdle = false;
+			mPreviewThreadCondition.broadcast();
+		}
 
-		//Update the flag to indicate we are previewing
-		mPreviewing = true;
+		// Create and start preview thread for receiving buffers from V4L Camera, it outlives
+		// the preview and is only created the first time
+		if (NULL == mPreviewThread.get()) {
+			mPreviewThread = new PreviewThread(this);
+			LOGINFO("Created preview thread");
+		}
 
 		return ret;
 
@@ -374,8 +1198,12 @@ namespace android {
 
 		nQueued = 0;
 		nDequeued = 0;
-		mPreviewing = false;
-		
+		mLastSequence = -1;
+		{
+			Mutex::Autolock lock(mPreviewThreadLock);
+			mPreviewing = false;
+		}
+
 		LOGINFO("StopStreaming isStreaming %d\n", mVideoInfo->isStreaming);
 		if (mVideoInfo->isStreaming) {
 			bufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -388,19 +1216,29 @@ namespace android {
 			mVideoInfo->isStreaming = false;
 		}
 
-		mVideoInfo->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		mVideoInfo->buf.memory = V4L2_MEMORY_MMAP;
-
-		/* Unmap buffers */
-		for (int i = 0; i < mPreviewBufferCount; i++){
-			if (munmap(mVideoInfo->mem[i], mVideoInfo->buf.length) < 0)
-				LOGINFO("Unmap failed");
+		// park the preview thread before the held buffers go away, the stream off woke its
+		// dequeue; the mappings are kept for the next preview
+		{
+			Mutex::Autolock lock(mPreviewThreadLock);
+			while (!mPreviewThreadIdle) {
+				mPreviewThreadCondition.wait(mPreviewThreadLock);
+			}
 		}
+		flushZslFrames();
 
 		mPreviewBufs.clear();
+		memset(mPreviewBufByIndex, 0, sizeof(mPreviewBufByIndex));
 
-		mPreviewThread->requestExitAndWait();
-		mPreviewThread.clear();
+		// a request the interval held back is not lost with the preview thread
+		mControls.commit(true);
+
+		V4LControls::Stats stats;
+		mControls.getStats(stats);
+		LOGINFO("Controls: %u commits, %u deferred, %u written, %u coalesced, %u failed, %u ioctls, "
+				"apply %lld us last %lld us max, ioctl %lld us last %lld us max",
+				stats.mCommits, stats.mDeferred, stats.mWritten, stats.mCoalesced, stats.mFailed, stats.mIoctls,
+				ns2us(stats.mLastApplyTime), ns2us(stats.mMaxApplyTime),
+				ns2us(stats.mLastIoctlTime), ns2us(stats.mMaxIoctlTime));
 
 		LOG_FUNCTION_NAME_EXIT;
 		return ret;
@@ -429,7 +1267,8 @@ namespace android {
 
 	status_t V4LCameraAdapter::getPictureBufferSize(size_t &length, size_t bufferCount)
 	{
-		// We don't support image capture yet, safely return from here without messing up
+		// Stills are taken from the stream, one packed YUYV frame per buffer
+		length = mVideoInfo->width * mVideoInfo->height * 2;
 		return NO_ERROR;
 	}
 
@@ -468,37 +1307,154 @@ namespace android {
 	{
 		LOG_FUNCTION_NAME;
 
+		int quadrant = ((orientation + 45) / 90) % 4;
+		int distance = (int) orientation - quadrant * 90;
+
+		if (distance > 180) {
+			distance -= 360;
+		}
+		if (distance < 0) {
+			distance = -distance;
+		}
+
+		// only follow once the device is clearly in the new quadrant
+		if (distance <= ROTATION_SNAP_DEGREES) {
+			Mutex::Autolock lock(mZoomLock);
+			mSensorRotation = quadrant * 90;
+		}
+
 		LOG_FUNCTION_NAME_EXIT;
 	}
 
+	status_t V4LCameraAdapter::startSmoothZoom(int targetIdx)
+	{
+		LOG_FUNCTION_NAME;
+
+		Mutex::Autolock lock(mZoomLock);
+
+		if ( (targetIdx < 0) || (targetIdx >= mZoomStages) ) {
+			LOGINFO("Invalid zoom index %d, %d stages", targetIdx, mZoomStages);
+			return BAD_VALUE;
+		}
+
+		// the preview thread steps one index per frame
+		mTargetZoomIdx = targetIdx;
+		mSmoothZoom = true;
+		mZoomDone = false;
+
+		LOG_FUNCTION_NAME_EXIT;
+		return NO_ERROR;
+	}
+
+	status_t V4LCameraAdapter::stopSmoothZoom()
+	{
+		LOG_FUNCTION_NAME;
+
+		int idx;
+
+		{
+			Mutex::Autolock lock(mZoomLock);
+			mTargetZoomIdx = mCurrentZoomIdx;
+			mZoomDone = false;
+			if (!mSmoothZoom) {
+				return NO_ERROR;
+			}
+			mSmoothZoom = false;
+			idx = mCurrentZoomIdx;
+		}
+
+		notifyZoomSubscribers(idx, true);
+
+		LOG_FUNCTION_NAME_EXIT;
+		return NO_ERROR;
+	}
+
+	status_t V4LCameraAdapter::setState(CameraCommands operation)
+	{
+		bool zoomDone;
+
+		{
+			Mutex::Autolock lock(mZoomLock);
+			zoomDone = mZoomDone;
+			mZoomDone = false;
+		}
+
+		// A finished smooth zoom leaves the zoom state here, on the command
+		// thread, rather than from the preview thread which stopPreview() joins
+		if ( zoomDone && (CAMERA_START_SMOOTH_ZOOM != operation) &&
+				(CAMERA_STOP_SMOOTH_ZOOM != operation) ) {
+			if ( ZOOM_ACTIVE & getState() ) {
+				if (BaseCameraAdapter::setState(CAMERA_STOP_SMOOTH_ZOOM) == NO_ERROR) {
+					commitState();
+				} else {
+					rollbackState();
+				}
+			}
+		}
+
+		return BaseCameraAdapter::setState(operation);
+	}
+
+	void V4LCameraAdapter::advanceZoom(FrameTransform &transform, int width, int height)
+	{
+		int idx = -1;
+		bool reached = false;
+		int ratio;
+
+		{
+			Mutex::Autolock lock(mZoomLock);
+
+			if (mSmoothZoom && (mCurrentZoomIdx != mTargetZoomIdx)) {
+				mCurrentZoomIdx += (mTargetZoomIdx > mCurrentZoomIdx) ? 1 : -1;
+				idx = mCurrentZoomIdx;
+				if (mCurrentZoomIdx == mTargetZoomIdx) {
+					mSmoothZoom = false;
+					mZoomDone = true;
+					reached = true;
+				}
+			}
+
+			ratio = mZoomRatios[(mCurrentZoomIdx < mZoomStages) ? mCurrentZoomIdx : 0];
+			transform.mRotation = (mPreviewRotation < 0) ? mSensorRotation : mPreviewRotation;
+		}
+
+		zoomToCrop(width, height, ratio, transform);
+
+		if (idx >= 0) {
+			notifyZoomSubscribers(idx, reached);
+		}
+	}
+
 	status_t V4LCameraAdapter::queueBuffer(void* frameBuf, CameraFrame::FrameType frameType)
 	{
 		LOG_FUNCTION_NAME;
 
 		status_t ret = NO_ERROR;
 
-		if ( !mVideoInfo->isStreaming )
+		// capture ring slots are recycled by refcount, they never belong to the driver,
+		// ZSL frames are driver buffers lent to the encoder
+		if ( (CameraFrame::IMAGE_FRAME == frameType) || (CameraFrame::RAW_FRAME == frameType) )
 		{
+			// a frame lent before a reopen comes back with the mapping it was lent from,
+			// a video snapshot with the preview buffer it was lent from
+			for (int i = 0; i < mPreviewBufferCount; i++) {
+				if ( (mVideoInfo->mem[i] == frameBuf) || (mPreviewBufByIndex[i] == frameBuf) ||
+						((i < mRetiredCount) && (mRetiredMem[i] == frameBuf)) ) {
+					releaseDriverBuffer(i);
+					break;
+				}
+			}
 			return NO_ERROR;
 		}
 
-		int i = mPreviewBufs.valueFor(( unsigned int )frameBuf);
-		if(i<0)
+		ssize_t pos = mPreviewBufs.indexOfKey(( unsigned int )frameBuf);
+		if(pos < 0)
 		{
 			return BAD_VALUE;
 		}
 
-		mVideoInfo->buf.index = i;
-		mVideoInfo->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		mVideoInfo->buf.memory = V4L2_MEMORY_MMAP;
+		releaseDriverBuffer(mPreviewBufs.valueAt(pos));
 
-		ret = ioctl(mCameraHandle, VIDIOC_QBUF, &mVideoInfo->buf);
-		if (ret < 0) {
-			LOGINFO("Init: VIDIOC_QBUF Failed");
-			return -1;
-		}
-		LOGE("VIDIOC_QBUF nQueued %d\n", nQueued);
-		nQueued++;
 		LOG_FUNCTION_NAME_EXIT;
 		return ret;
 
@@ -513,11 +1469,21 @@ namespace android {
 
 		ret = ioctl(mCameraHandle, VIDIOC_DQBUF, &mVideoInfo->buf);
 		if (ret < 0) {
-			LOGINFO("VIDIOC_DQBUF Failed %s", strerror(errno));
+			mDequeueError = errno;
+			LOGINFO("VIDIOC_DQBUF Failed %s", strerror(mDequeueError));
 			return NULL;
 		}
 		nDequeued++;
 
+		// the driver counts every frame it captured, a gap is frames it had no free buffer for
+		if (NULL != mPipelineStats.get()) {
+			int sequence = mVideoInfo->buf.sequence;
+			if ( (mLastSequence >= 0) && (sequence > mLastSequence + 1) ) {
+				mPipelineStats->drop(PipelineStats::STAGE_CAPTURE, sequence - mLastSequence - 1);
+			}
+			mLastSequence = sequence;
+		}
+
 		index = mVideoInfo->buf.index;
 
 		return (char *)mVideoInfo->mem[index];
@@ -529,21 +1495,98 @@ namespace android {
 		int width, height;
 		CameraFrame frame;
 
-		if (mPreviewing)
+		{
+			Mutex::Autolock lock(mPreviewThreadLock);
+			while (!mPreviewing && !mPreviewThreadExit) {
+				mPreviewThreadIdle = true;
+				mPreviewThreadCondition.broadcast();
+				mPreviewThreadCondition.wait(mPreviewThreadLock);
+			}
+			if (mPreviewThreadExit) {
+				return NO_ERROR;
+			}
+		}
+
 		{
 			char *fp = this->dequeueBuffer(mBufferIndex);
 			if(!fp){
-				usleep(25000);
+				// a camera that was reset or unplugged is waited for and streams again in place
+				if (mPreviewing && isDeviceLost(mDequeueError)) {
+					recoverDevice();
+					return BAD_VALUE;
+				}
+				// a dequeue failing because preview stopped goes straight back to park
+				if (mPreviewing) {
+					usleep(25000);
+				}
 				return BAD_VALUE;
 			}
-			LOGINFO("current preview buffer index %d\n", mBufferIndex);
+			LOGFRAME("current preview buffer index %d\n", mBufferIndex);
+
+			uint32_t sequence = mFrameSequence++;
+			FrameTraceScope trace("capture", sequence, mBufferIndex);
+
+			// the format is only changed with the stream off, mParams may already hold the next one
+			int width = mVideoInfo->width, height = mVideoInfo->height;
+			LOGFRAME("preview size, width %d,height %d\n", width, height);
+
+			nsecs_t timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+
+			// this thread's own reference, dropped once the frame has been handed out
+			{
+				Mutex::Autolock lock(mBufferRefLock);
+				mBufferRefs[mBufferIndex] = 1;
+			}
+
+			// what takePicture() and setParameters() asked for, taken once for this frame
+			bool capturing, zslRequested, videoSnapshot, zslSharpest;
+			int zslHistory;
+			{
+				Mutex::Autolock lock(mCaptureLock);
+				capturing = mCapturing;
+				zslRequested = mZslRequested;
+				videoSnapshot = mVideoSnapshot;
+				zslHistory = mZslHistory;
+				zslSharpest = mZslSharpest;
+			}
+
+			if (zslHistory > 0 || mZslCount > 0) {
+				holdZslFrame(mBufferIndex, timestamp, fp, width, height, zslHistory, zslSharpest);
+			}
+
+			// crop for zoom and rotate while copying, a plain copy when neither is active
+			FrameTransform transform;
+			advanceZoom(transform, width, height);
+
+			bool lendPreview = false;
+			if (capturing) {
+				// stills get the zoom crop, the preview rotation is for the display only
+				FrameTransform still = transform;
+				still.mRotation = 0;
+
+				if (zslRequested) {
+					sendZslFrame(width, height, zslSharpest, still);
+				} else if (videoSnapshot && ((nQueued - nDequeued) >= MIN_STREAM_BUFFERS)) {
+					// lent once the preview copy below is made
+					lendPreview = true;
+				} else {
+					// a lent buffer would starve the stream, copy instead
+					captureFrame(fp, width, height, still);
+				}
+			}
 
-			int width, height;
-			mParams.getPreviewSize(&width, &height);
-			LOGINFO("preview size, width %d,height %d\n", width, height);
+			char *ptr = mPreviewBufByIndex[mBufferIndex];
+			if ( isIdentityTransform(width, height, width, height, transform) ||
+					!transformYUYV((const uint8_t *) fp, width, height,
+						(uint8_t *) ptr, width, height, transform) ) {
+				memcpy(ptr, fp, width * height * 2);
+			}
 
-			char *ptr = (char*) mPreviewBufs.keyAt(mBufferIndex);
-			memcpy(ptr, fp, width * height * 2);
+			// no copy of its own, the snapshot is the frame the stream shows; the preview buffer
+			// is not written again before its driver buffer comes back
+			if (lendPreview) {
+				lendDriverFrame(mBufferIndex, ptr, timestamp, width, height);
+			}
 
 			frame.mFrameType = CameraFrame::PREVIEW_FRAME_SYNC;
 			frame.mBuffer = ptr;
@@ -552,12 +1595,173 @@ namespace android {
 			frame.mLength = width*height*2;
 			frame.mAlignment = width*2;
 			frame.mOffset = 0;
-			frame.mTimestamp = systemTime(SYSTEM_TIME_MONOTONIC);;
+			frame.mTimestamp = timestamp;
+			frame.mSequence = sequence;
+
+			// every subscriber returns the preview copy on its own, each one holds the
+			// driver buffer until it does
+			setInitFrameRefCount(ptr, CameraFrame::PREVIEW_FRAME_SYNC);
+			int subscribers = getFrameRefCount(ptr, CameraFrame::PREVIEW_FRAME_SYNC);
+			{
+				Mutex::Autolock lock(mBufferRefLock);
+				mBufferRefs[mBufferIndex] += subscribers;
+			}
 
 			ret = sendFrameToSubscribers(&frame);
 			if(ret < 0)
 				LOGINFO("Failed to send frame to subscribers!\n");
+
+			releaseDriverBuffer(mBufferIndex);
+
+			if (NULL != mPipelineStats.get()) {
+				mPipelineStats->frame(PipelineStats::STAGE_CAPTURE, systemTime(SYSTEM_TIME_MONOTONIC) - timestamp);
+				mPipelineStats->setOwned(PipelineStats::OWNER_DRIVER, nQueued - nDequeued);
+			}
+
+			// control requests coalesced since the last commit, at most one transaction per interval
+			if (mControls.isPending()) {
+				mControls.commit(false);
+			}
 		}
 		return ret;
 	}
+
+	void V4LCameraAdapter::publishControls(CameraProperties::Properties* properties)
+	{
+		String8 modes;
+
+		LOG_FUNCTION_NAME;
+
+		if (NULL == properties) {
+			return;
+		}
+
+		if (mControls.isSupported(V4LControls::CONTROL_AUTO_WHITE_BALANCE)) {
+			int minimum = mControls.getMinimum(V4LControls::CONTROL_WHITE_BALANCE_TEMPERATURE);
+			int maximum = mControls.getMaximum(V4LControls::CONTROL_WHITE_BALANCE_TEMPERATURE);
+
+			modes.setTo(CameraParameters::WHITE_BALANCE_AUTO);
+			if (mControls.isSupported(V4LControls::CONTROL_WHITE_BALANCE_TEMPERATURE)) {
+				for (unsigned int i = 0; i < ARRAY_SIZE(sWhiteBalancePresets); i++) {
+					if ( (sWhiteBalancePresets[i].temperature >= minimum) &&
+							(sWhiteBalancePresets[i].temperature <= maximum) ) {
+						modes.append(CameraProperties::PARAMS_DELIMITER);
+						modes.append(sWhiteBalancePresets[i].mode);
+					}
+				}
+			}
+			properties->set(CameraProperties::SUPPORTED_WHITE_BALANCE, modes.string());
+			properties->set(CameraProperties::WHITEBALANCE, CameraParameters::WHITE_BALANCE_AUTO);
+			properties->set(CameraProperties::AUTO_WHITEBALANCE_LOCK_SUPPORTED, CameraParameters::TRUE);
+			properties->set(CameraProperties::AUTO_WHITEBALANCE_LOCK, CameraParameters::FALSE);
+		}
+
+		if (mControls.isSupported(V4LControls::CONTROL_POWER_LINE_FREQUENCY)) {
+			int minimum = mControls.getMinimum(V4LControls::CONTROL_POWER_LINE_FREQUENCY);
+			int maximum = mControls.getMaximum(V4LControls::CONTROL_POWER_LINE_FREQUENCY);
+			int current = mControls.getCurrent(V4LControls::CONTROL_POWER_LINE_FREQUENCY);
+
+			modes.setTo("");
+			for (int i = minimum; (i <= maximum) && (i < (int) ARRAY_SIZE(sAntibandingModes)); i++) {
+				if (!modes.isEmpty()) {
+					modes.append(CameraProperties::PARAMS_DELIMITER);
+				}
+				modes.append(sAntibandingModes[i]);
+			}
+			if ( !modes.isEmpty() && (current >= minimum) && (current < (int) ARRAY_SIZE(sAntibandingModes)) ) {
+				properties->set(CameraProperties::SUPPORTED_ANTIBANDING, modes.string());
+				properties->set(CameraProperties::ANTIBANDING, sAntibandingModes[current]);
+			}
+		}
+
+		if ( mControls.isSupported(V4LControls::CONTROL_EXPOSURE_AUTO) && (V4L2_EXPOSURE_MANUAL != mExposureAutoMode) ) {
+			properties->set(CameraProperties::AUTO_EXPOSURE_LOCK_SUPPORTED, CameraParameters::TRUE);
+			properties->set(CameraProperties::AUTO_EXPOSURE_LOCK, CameraParameters::FALSE);
+		}
+
+		if (mControls.isSupported(V4LControls::CONTROL_BRIGHTNESS)) {
+			properties->set(CameraProperties::BRIGHTNESS, mControls.getPercent(V4LControls::CONTROL_BRIGHTNESS));
+			properties->set(CameraProperties::SUPPORTED_EV_MIN, -EV_STEPS);
+			properties->set(CameraProperties::SUPPORTED_EV_MAX, EV_STEPS);
+			properties->set(CameraProperties::SUPPORTED_EV_STEP, "1");
+			properties->set(CameraProperties::EV_COMPENSATION, 0);
+		}
+
+		if (mControls.isSupported(V4LControls::CONTROL_CONTRAST)) {
+			properties->set(CameraProperties::CONTRAST, mControls.getPercent(V4LControls::CONTROL_CONTRAST));
+		}
+
+		if (mControls.isSupported(V4LControls::CONTROL_SATURATION)) {
+			properties->set(CameraProperties::SATURATION, mControls.getPercent(V4LControls::CONTROL_SATURATION));
+			modes.setTo(CameraParameters::EFFECT_NONE);
+			modes.append(CameraProperties::PARAMS_DELIMITER);
+			modes.append(CameraParameters::EFFECT_MONO);
+			properties->set(CameraProperties::SUPPORTED_EFFECTS, modes.string());
+			properties->set(CameraProperties::EFFECT, CameraParameters::EFFECT_NONE);
+		}
+
+		if (mControls.isSupported(V4LControls::CONTROL_SHARPNESS)) {
+			properties->set(CameraProperties::SHARPNESS, mControls.getPercent(V4LControls::CONTROL_SHARPNESS));
+		}
+
+		LOG_FUNCTION_NAME_EXIT;
+	}
+
+	void V4LCameraAdapter::requestControls(const CameraParameters &params)
+	{
+		const char *valstr;
+		int offset = 0;
+
+		LOG_FUNCTION_NAME;
+
+		// a preset fixes the temperature, the lock keeps whatever auto white balance settled on
+		int temperature = 0;
+		if ( (valstr = params.get(CameraParameters::KEY_WHITE_BALANCE)) != NULL ) {
+			for (unsigned int i = 0; i < ARRAY_SIZE(sWhiteBalancePresets); i++) {
+				if (strcmp(valstr, sWhiteBalancePresets[i].mode) == 0) {
+					temperature = sWhiteBalancePresets[i].temperature;
+					break;
+				}
+			}
+		}
+
+		if ( (0 < temperature) && mControls.isSupported(V4LControls::CONTROL_WHITE_BALANCE_TEMPERATURE) ) {
+			mControls.set(V4LControls::CONTROL_AUTO_WHITE_BALANCE, 0);
+			mControls.set(V4LControls::CONTROL_WHITE_BALANCE_TEMPERATURE, temperature);
+		} else {
+			mControls.set(V4LControls::CONTROL_AUTO_WHITE_BALANCE,
+					isTrue(params.get(CameraParameters::KEY_AUTO_WHITEBALANCE_LOCK)) ? 0 : 1);
+		}
+
+		if ( (valstr = params.get(CameraParameters::KEY_ANTIBANDING)) != NULL ) {
+			for (unsigned int i = 0; i < ARRAY_SIZE(sAntibandingModes); i++) {
+				if (strcmp(valstr, sAntibandingModes[i]) == 0) {
+					if ( (int) i <= mControls.getMaximum(V4LControls::CONTROL_POWER_LINE_FREQUENCY) ) {
+						mControls.set(V4LControls::CONTROL_POWER_LINE_FREQUENCY, i);
+					}
+					break;
+				}
+			}
+		}
+
+		// a manual exposure keeps the last one auto exposure picked
+		mControls.set(V4LControls::CONTROL_EXPOSURE_AUTO,
+				isTrue(params.get(CameraParameters::KEY_AUTO_EXPOSURE_LOCK)) ? (int) V4L2_EXPOSURE_MANUAL : mExposureAutoMode);
+
+		if (params.get(CameraParameters::KEY_EXPOSURE_COMPENSATION) != NULL) {
+			offset = params.getInt(CameraParameters::KEY_EXPOSURE_COMPENSATION) * EV_BRIGHTNESS_STEP;
+		}
+		requestLevel(mControls, V4LControls::CONTROL_BRIGHTNESS, params.get(CameraProperties::BRIGHTNESS_LEVEL), offset);
+		requestLevel(mControls, V4LControls::CONTROL_CONTRAST, params.get(CameraProperties::CONTRAST_LEVEL), 0);
+		requestLevel(mControls, V4LControls::CONTROL_SHARPNESS, params.get(CameraProperties::SHARPNESS_LEVEL), 0);
+
+		valstr = params.get(CameraParameters::KEY_EFFECT);
+		if ( (NULL != valstr) && (strcmp(valstr, CameraParameters::EFFECT_MONO) == 0) ) {
+			mControls.set(V4LControls::CONTROL_SATURATION, mControls.getMinimum(V4LControls::CONTROL_SATURATION));
+		} else {
+			requestLevel(mControls, V4LControls::CONTROL_SATURATION, params.get(CameraProperties::SATURATION_LEVEL), 0);
+		}
+
+		LOG_FUNCTION_NAME_EXIT;
+	}
 };
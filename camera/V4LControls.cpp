@@ -0,0 +1,499 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file V4LControls.cpp
+*
+* This file implements the cached and batched V4L2 image controls used by the
+* V4L camera adapter.
+*
+*/
+
+#define LOG_TAG "V4LControls"
+
+#include "CameraHal.h"
+#include "V4LControls.h"
+#include "CapabilityCache.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+namespace android {
+
+	// indexed by V4LControls::Control
+	static const uint32_t sControlIds[V4LControls::CONTROL_COUNT] = {
+		V4L2_CID_BRIGHTNESS,
+		V4L2_CID_CONTRAST,
+		V4L2_CID_SATURATION,
+		V4L2_CID_SHARPNESS,
+		V4L2_CID_AUTO_WHITE_BALANCE,
+		V4L2_CID_WHITE_BALANCE_TEMPERATURE,
+		V4L2_CID_POWER_LINE_FREQUENCY,
+		V4L2_CID_EXPOSURE_AUTO,
+	};
+
+	// Runs one extended control request over controls of a single class. Drivers
+	// without the extended ioctls, or a transaction the driver refuses as a whole,
+	// fall back to one control at a time so ok tells which values went through
+	static void transfer(int fd, bool set, struct v4l2_ext_control *controls, unsigned int count,
+			bool *ok, bool &extSupported, unsigned int &ioctls)
+	{
+		if (extSupported) {
+			struct v4l2_ext_controls ext;
+
+			memset(&ext, 0, sizeof(ext));
+			ext.ctrl_class = V4L2_CTRL_ID2CLASS(controls[0].id);
+			ext.count = count;
+			ext.controls = controls;
+
+			ioctls++;
+			if (ioctl(fd, set ? VIDIOC_S_EXT_CTRLS : VIDIOC_G_EXT_CTRLS, &ext) == 0) {
+				for (unsigned int i = 0; i < count; i++) {
+					ok[i] = true;
+				}
+				return;
+			}
+
+			if (ENOTTY == errno) {
+				LOGINFO("No extended control ioctls, controls are written one at a time");
+				extSupported = false;
+			}
+		}
+
+		for (unsigned int i = 0; i < count; i++) {
+			struct v4l2_control control;
+
+			control.id = controls[i].id;
+			control.value = controls[i].value;
+
+			ioctls++;
+			ok[i] = (ioctl(fd, set ? VIDIOC_S_CTRL : VIDIOC_G_CTRL, &control) == 0);
+			if (ok[i]) {
+				controls[i].value = control.value;
+			} else {
+				LOGINFO("Control 0x%x %s failed: %s", controls[i].id, set ? "write" : "read", strerror(errno));
+			}
+		}
+	}
+
+	// Splits controls into runs of the same class, one request per run
+	static void transferAll(int fd, bool set, struct v4l2_ext_control *controls, unsigned int count,
+			bool *ok, bool &extSupported, unsigned int &ioctls)
+	{
+		unsigned int start = 0;
+
+		while (start < count) {
+			unsigned int end = start + 1;
+
+			while ( (end < count) &&
+					(V4L2_CTRL_ID2CLASS(controls[end].id) == V4L2_CTRL_ID2CLASS(controls[start].id)) ) {
+				end++;
+			}
+
+			transfer(fd, set, controls + start, end - start, ok + start, extSupported, ioctls);
+			start = end;
+		}
+	}
+
+	V4LControls::V4LControls()
+		: mFd(-1), mExtSupported(true), mLastCommit(0), mFirstPending(0)
+	{
+		memset(mEntries, 0, sizeof(mEntries));
+		memset(&mStats, 0, sizeof(mStats));
+	}
+
+	status_t V4LControls::initialize(int fd, CapabilityCache *cache)
+	{
+		struct v4l2_ext_control controls[CONTROL_COUNT];
+		int indexes[CONTROL_COUNT];
+		bool ok[CONTROL_COUNT];
+		unsigned int count = 0;
+		unsigned int ioctls = 0;
+		unsigned int cached = 0;
+		nsecs_t start = systemTime();
+
+		LOG_FUNCTION_NAME;
+
+		Mutex::Autolock commitLock(mCommitLock);
+		Mutex::Autolock lock(mLock);
+
+		mFd = fd;
+		mExtSupported = true;
+
+		for (int i = 0; i < CONTROL_COUNT; i++) {
+			Entry &entry = mEntries[i];
+
+			memset(&entry, 0, sizeof(entry));
+			entry.mQuery.id = sControlIds[i];
+
+			// a control the driver refused before is not asked for again either
+			bool queried = false;
+			if ((NULL != cache) && cache->getControl(i, sControlIds[i], entry.mQuery, queried)) {
+				cached++;
+			} else {
+				ioctls++;
+				queried = (ioctl(fd, VIDIOC_QUERYCTRL, &entry.mQuery) >= 0);
+				if (NULL != cache) {
+					cache->setControl(i, sControlIds[i], queried ? &entry.mQuery : NULL);
+				}
+			}
+
+			if (!queried) {
+				continue;
+			}
+
+			if ( (entry.mQuery.flags & (V4L2_CTRL_FLAG_DISABLED | V4L2_CTRL_FLAG_READ_ONLY)) ||
+					((V4L2_CTRL_TYPE_INTEGER != entry.mQuery.type) &&
+					 (V4L2_CTRL_TYPE_BOOLEAN != entry.mQuery.type) &&
+					 (V4L2_CTRL_TYPE_MENU != entry.mQuery.type)) ) {
+				continue;
+			}
+
+			entry.mSupported = true;
+			entry.mCurrent = entry.mQuery.default_value;
+			entry.mRequested = entry.mCurrent;
+
+			memset(&controls[count], 0, sizeof(controls[count]));
+			controls[count].id = entry.mQuery.id;
+			indexes[count] = i;
+			count++;
+		}
+
+		// current values of all supported controls in one request per class
+		transferAll(fd, false, controls, count, ok, mExtSupported, ioctls);
+		for (unsigned int i = 0; i < count; i++) {
+			Entry &entry = mEntries[indexes[i]];
+			if (ok[i]) {
+				entry.mCurrent = controls[i].value;
+				entry.mRequested = entry.mCurrent;
+			}
+			LOGINFO("%s: %d [%d, %d] step %d default %d", entry.mQuery.name, entry.mCurrent,
+					entry.mQuery.minimum, entry.mQuery.maximum, entry.mQuery.step, entry.mQuery.default_value);
+		}
+
+		mStats.mIoctls += ioctls;
+
+		LOGINFO("%u of %d controls supported, %u from cache, queried with %u ioctls in %lld us", count,
+				CONTROL_COUNT, cached, ioctls, ns2us(systemTime() - start));
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_ERROR;
+	}
+
+	status_t V4LControls::reattach(int fd)
+	{
+		struct v4l2_ext_control controls[CONTROL_COUNT];
+		int indexes[CONTROL_COUNT];
+		bool ok[CONTROL_COUNT];
+		unsigned int count = 0;
+		unsigned int ioctls = 0;
+		unsigned int restored = 0;
+
+		LOG_FUNCTION_NAME;
+
+		Mutex::Autolock commitLock(mCommitLock);
+		Mutex::Autolock lock(mLock);
+
+		mFd = fd;
+		mExtSupported = true;
+
+		for (int i = 0; i < CONTROL_COUNT; i++) {
+			if (!mEntries[i].mSupported) {
+				continue;
+			}
+
+			memset(&controls[count], 0, sizeof(controls[count]));
+			controls[count].id = mEntries[i].mQuery.id;
+			indexes[count] = i;
+			count++;
+		}
+
+		transferAll(fd, false, controls, count, ok, mExtSupported, ioctls);
+		for (unsigned int i = 0; i < count; i++) {
+			Entry &entry = mEntries[indexes[i]];
+			int wanted = entry.mPending ? entry.mRequested : entry.mCurrent;
+
+			if (!ok[i]) {
+				continue;
+			}
+
+			// a request still pending keeps its value, everything else goes back to what was set
+			entry.mCurrent = controls[i].value;
+			if (wanted != entry.mCurrent) {
+				entry.mRequested = wanted;
+				entry.mPending = true;
+				restored++;
+			}
+		}
+
+		if ( (0 < restored) && (0 == mFirstPending) ) {
+			mFirstPending = systemTime();
+		}
+
+		mStats.mIoctls += ioctls;
+
+		LOGINFO("%u controls to restore after reopen", restored);
+
+		LOG_FUNCTION_NAME_EXIT;
+
+		return NO_ERROR;
+	}
+
+	bool V4LControls::isSupported(Control control) const
+	{
+		Mutex::Autolock lock(mLock);
+		return mEntries[control].mSupported;
+	}
+
+	int V4LControls::getMinimum(Control control) const
+	{
+		Mutex::Autolock lock(mLock);
+		return mEntries[control].mQuery.minimum;
+	}
+
+	int V4LControls::getMaximum(Control control) const
+	{
+		Mutex::Autolock lock(mLock);
+		return mEntries[control].mQuery.maximum;
+	}
+
+	int V4LControls::getCurrent(Control control) const
+	{
+		Mutex::Autolock lock(mLock);
+		return mEntries[control].mCurrent;
+	}
+
+	int V4LControls::percentOf(const Entry &entry, int value)
+	{
+		int range = entry.mQuery.maximum - entry.mQuery.minimum;
+
+		if (range <= 0) {
+			return 0;
+		}
+
+		return ((value - entry.mQuery.minimum) * 100 + range / 2) / range;
+	}
+
+	int V4LControls::getPercent(Control control) const
+	{
+		Mutex::Autolock lock(mLock);
+		return percentOf(mEntries[control], mEntries[control].mCurrent);
+	}
+
+	int V4LControls::getDefaultPercent(Control control) const
+	{
+		Mutex::Autolock lock(mLock);
+		return percentOf(mEntries[control], mEntries[control].mQuery.default_value);
+	}
+
+	int V4LControls::clamp(const Entry &entry, int value) const
+	{
+		int step = entry.mQuery.step;
+
+		if (value < entry.mQuery.minimum) {
+			value = entry.mQuery.minimum;
+		}
+
+		if ( (step > 1) && (V4L2_CTRL_TYPE_INTEGER == entry.mQuery.type) ) {
+			value = entry.mQuery.minimum + ((value - entry.mQuery.minimum + step / 2) / step) * step;
+		}
+
+		if (value > entry.mQuery.maximum) {
+			value = entry.mQuery.maximum;
+		}
+
+		return value;
+	}
+
+	void V4LControls::set(Control control, int value)
+	{
+		Mutex::Autolock lock(mLock);
+		Entry &entry = mEntries[control];
+
+		if (!entry.mSupported) {
+			return;
+		}
+
+		value = clamp(entry, value);
+
+		if (entry.mPending) {
+			if (entry.mRequested != value) {
+				mStats.mCoalesced++;
+			}
+		} else if (value != entry.mCurrent) {
+			if (0 == mFirstPending) {
+				mFirstPending = systemTime();
+			}
+		} else {
+			return;
+		}
+
+		entry.mRequested = value;
+		entry.mPending = true;
+	}
+
+	void V4LControls::setPercent(Control control, int percent)
+	{
+		int value;
+
+		{
+			Mutex::Autolock lock(mLock);
+			const Entry &entry = mEntries[control];
+			int range = entry.mQuery.maximum - entry.mQuery.minimum;
+
+			if (!entry.mSupported || (range <= 0)) {
+				return;
+			}
+
+			if (percent < 0) {
+				percent = 0;
+			} else if (percent > 100) {
+				percent = 100;
+			}
+
+			if (percentOf(entry, entry.mCurrent) == percent) {
+				value = entry.mCurrent;
+			} else {
+				value = entry.mQuery.minimum + (range * percent + 50) / 100;
+			}
+		}
+
+		set(control, value);
+	}
+
+	void V4LControls::setDefault(Control control)
+	{
+		int value;
+
+		{
+			Mutex::Autolock lock(mLock);
+			value = mEntries[control].mQuery.default_value;
+		}
+
+		set(control, value);
+	}
+
+	bool V4LControls::isPending() const
+	{
+		Mutex::Autolock lock(mLock);
+		return 0 != mFirstPending;
+	}
+
+	status_t V4LControls::commit(bool force)
+	{
+		struct v4l2_ext_control controls[CONTROL_COUNT];
+		int indexes[CONTROL_COUNT];
+		int previous[CONTROL_COUNT];
+		bool ok[CONTROL_COUNT];
+		unsigned int count = 0;
+		unsigned int ioctls = 0;
+		unsigned int failed = 0;
+		nsecs_t firstPending;
+		nsecs_t start, end;
+
+		Mutex::Autolock commitLock(mCommitLock);
+
+		{
+			Mutex::Autolock lock(mLock);
+
+			if (0 == mFirstPending) {
+				return NO_ERROR;
+			}
+
+			start = systemTime();
+			if ( !force && (start - mLastCommit < CONTROL_COMMIT_INTERVAL) ) {
+				mStats.mDeferred++;
+				return NO_ERROR;
+			}
+
+			// requests that came back to the current value cost nothing
+			for (int i = 0; i < CONTROL_COUNT; i++) {
+				Entry &entry = mEntries[i];
+
+				if (!entry.mPending) {
+					continue;
+				}
+
+				entry.mPending = false;
+				if (entry.mRequested == entry.mCurrent) {
+					continue;
+				}
+
+				memset(&controls[count], 0, sizeof(controls[count]));
+				controls[count].id = entry.mQuery.id;
+				controls[count].value = entry.mRequested;
+				indexes[count] = i;
+				count++;
+
+				// taken as written so a request made during the ioctl is diffed against it
+				previous[count - 1] = entry.mCurrent;
+				entry.mCurrent = entry.mRequested;
+			}
+
+			firstPending = mFirstPending;
+			mFirstPending = 0;
+		}
+
+		if (0 < count) {
+			transferAll(mFd, true, controls, count, ok, mExtSupported, ioctls);
+		}
+		end = systemTime();
+
+		{
+			Mutex::Autolock lock(mLock);
+
+			for (unsigned int i = 0; i < count; i++) {
+				if (ok[i]) {
+					mEntries[indexes[i]].mCurrent = controls[i].value;
+				} else {
+					mEntries[indexes[i]].mCurrent = previous[i];
+					failed++;
+				}
+			}
+
+			mLastCommit = end;
+			mStats.mIoctls += ioctls;
+			if (0 < count) {
+				mStats.mCommits++;
+				mStats.mWritten += count - failed;
+				mStats.mFailed += failed;
+				mStats.mLastIoctlTime = end - start;
+				if (mStats.mLastIoctlTime > mStats.mMaxIoctlTime) {
+					mStats.mMaxIoctlTime = mStats.mLastIoctlTime;
+				}
+				mStats.mLastApplyTime = end - firstPending;
+				if (mStats.mLastApplyTime > mStats.mMaxApplyTime) {
+					mStats.mMaxApplyTime = mStats.mLastApplyTime;
+				}
+			}
+		}
+
+		if (0 < count) {
+			LOGINFO("Wrote %u controls with %u ioctls in %lld us, %lld us after the first request",
+					count - failed, ioctls, ns2us(end - start), ns2us(end - firstPending));
+		}
+
+		return (0 == failed) ? NO_ERROR : UNKNOWN_ERROR;
+	}
+
+	void V4LControls::getStats(Stats &stats) const
+	{
+		Mutex::Autolock lock(mLock);
+		stats = mStats;
+	}
+
+};
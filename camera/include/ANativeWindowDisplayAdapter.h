@@ -48,6 +48,8 @@ public:
         int mHeightStride;
         int mLength;
         CameraFrame::FrameType mType;
+        nsecs_t mTimestamp;
+        uint32_t mSequence;
         } DisplayFrame;
 
     enum DisplayStates
@@ -58,6 +60,56 @@ public:
         DISPLAY_EXITED
         };
 
+    ///Owner of each preview buffer slot
+    enum SlotStates
+        {
+        SLOT_WITH_WINDOW = 0,
+        SLOT_DEQUEUED,
+        SLOT_WITH_CAMERA
+        };
+
+    ///Open addressed pointer to slot map, at least twice the largest buffer count
+    static const int SLOT_TABLE_SIZE = 64;
+
+    typedef struct
+        {
+        const void *mKey;
+        int mSlot;
+        } SlotEntry;
+
+    ///Gralloc mapping of the display buffers, replaceable to run without a gralloc module
+    typedef struct
+        {
+        int (*lock)(buffer_handle_t handle, int usage, const Rect &bounds, void **vaddr);
+        int (*unlock)(buffer_handle_t handle);
+        } BufferMapperOps;
+
+    ///A dequeued buffer whose gralloc lock failed, retried from the display thread
+    typedef struct
+        {
+        int mSlot;
+        int mTries;
+        nsecs_t mFirstFailure;
+        } LockRetry;
+
+    typedef struct
+        {
+        unsigned int mLockFailures;    ///< failed gralloc locks, first attempts and retries
+        unsigned int mLockRecovered;   ///< parked buffers locked on a later retry
+        unsigned int mLockAbandoned;   ///< parked buffers given back to the window
+        nsecs_t mRetryLatencyTotal;    ///< first failure to recovery, summed over recoveries
+        nsecs_t mRetryLatencyMax;
+        unsigned int mFramesDisplayed;
+        unsigned int mFramesDropped;   ///< superseded by a newer frame before their display slot
+        unsigned int mLastSecondDisplayed;
+        unsigned int mLastSecondDropped;
+        nsecs_t mLastSecondLatencyAvg; ///< capture to glass estimate over the last second
+        nsecs_t mLastSecondLatencyMax;
+        unsigned int mFirstFrames;     ///< previews whose first frame was posted
+        nsecs_t mFirstFrameLast;       ///< from the reference time given to enableDisplay() to the first post
+        nsecs_t mFirstFrameMax;
+        } DisplayStats;
+
 public:
 
     ANativeWindowDisplayAdapter();
@@ -69,6 +121,7 @@ public:
     virtual int setPreviewWindow(struct preview_stream_ops *window);
     virtual int setFrameProvider(FrameNotifier *frameProvider);
     virtual int setErrorHandler(ErrorNotifier *errorNotifier);
+    virtual void setPipelineStats(const sp<PipelineStats> &stats);
     virtual int enableDisplay(int width, int height, struct timeval *refTime = NULL, S3DParameters *s3dParams = NULL);
     virtual int disableDisplay(bool cancel_buffer = true);
     virtual status_t pauseDisplay(bool pause);
@@ -83,6 +136,11 @@ public:
 
     virtual int maxQueueableBuffers(unsigned int& queueable);
 
+    void getDisplayStats(DisplayStats &stats);
+
+    ///Must be called before any buffers are allocated, NULL restores GraphicBufferMapper
+    void setBufferMapper(const BufferMapperOps *ops);
+
     ///Class specific functions
     static void frameCallbackRelay(CameraFrame* caFrame);
     void frameCallback(CameraFrame* caFrame);
@@ -94,12 +152,27 @@ public:
     bool processHalMsg();
     status_t postFrame(ANativeWindowDisplayAdapter::DisplayFrame &dispFrame);
     bool handleFrameReturn();
+    bool lockAndReturnSlot(int slot);
+    void processLockRetries();
+    void dequeueAhead();
+    bool postPendingFrame();
+    void dropPendingFrame();
+    void updatePacingStats(nsecs_t now, nsecs_t latency);
+    int nextWakeup();
     status_t returnBuffersToWindow();
 
+    static void clearSlots(SlotEntry *table);
+    static void addSlot(SlotEntry *table, const void *key, int slot);
+    static int findSlot(const SlotEntry *table, const void *key);
+    void rebuildBufferSlots();
+
 public:
 
     static const int DISPLAY_TIMEOUT;
     static const int FAILED_DQS_TO_SUSPEND;
+    static const int LOCK_RETRY_INTERVAL;
+    static const nsecs_t LOCK_RETRY_LIMIT;
+    static const int DEFAULT_DISPLAY_FPS;
 
     class DisplayThread : public Thread
         {
@@ -156,7 +229,29 @@ private:
     uint32_t* mOffsetsMap;
     int mFD;
     KeyedVector<int, int> mFramesWithCameraAdapterMap;
+    SlotEntry mHandleSlots[SLOT_TABLE_SIZE];
+    SlotEntry mBufferSlots[SLOT_TABLE_SIZE];
+    int *mSlotState;
+    int mBuffersWithWindow;
+    int mMinUndequeued;
+    const BufferMapperOps *mMapper;
+    Vector<LockRetry> mLockRetries; ///< protected by mLock, retried by the display thread
+    unsigned int mLockRetryGeneration;  ///< bumped when the retries are dropped, protected by mLock
+    DisplayStats mStats;            ///< protected by mLock
+
+    //Pacing, the newest frame waits for the next display slot, protected by mLock
+    DisplayFrame mPendingFrame;
+    bool mFramePending;
+    nsecs_t mFrameInterval;
+    nsecs_t mNextPostTime;
+    nsecs_t mStatsPeriodStart;
+    nsecs_t mFirstFrameRef;         ///< start request on the systemTime() clock, 0 once its first frame is posted
+    unsigned int mPeriodDisplayed;
+    unsigned int mPeriodDropped;
+    nsecs_t mPeriodLatencyTotal;
+    nsecs_t mPeriodLatencyMax;
     sp<ErrorNotifier> mErrorNotifier;
+    sp<PipelineStats> mPipelineStats;
 
     uint32_t mFrameWidth;
     uint32_t mFrameHeight;
@@ -41,6 +41,8 @@ public:
 
     virtual int setErrorHandler(ErrorNotifier *errorNotifier);
 
+    virtual void setPipelineStats(const sp<PipelineStats> &stats);
+
     //Message/Frame notification APIs
     virtual void enableMsgType(int32_t msgs, frame_callback callback=NULL, event_callback eventCb=NULL, void* cookie=NULL);
     virtual void disableMsgType(int32_t msgs, void* cookie);
@@ -51,6 +53,7 @@ public:
     //APIs to configure Camera adapter and get the current parameter set
     virtual status_t setParameters(const CameraParameters& params) = 0;
     virtual void getParameters(CameraParameters& params)  = 0;
+    virtual status_t updateParameters(const CameraParameters& params, const ParameterStore::ChangeSet& changes);
 
     //API to send a command to the camera
     virtual status_t sendCommand(CameraCommands operation, int value1 = 0, int value2 = 0, int value3 = 0 );
@@ -229,8 +232,12 @@ protected:
     KeyedVector<int, bool> mCaptureBuffersAvailable;
     int mCaptureBuffersCount;
     size_t mCaptureBuffersLength;
+    size_t mCaptureBuffersStride;
     mutable Mutex mCaptureBufferLock;
 
+    //Frames requested by the last CAMERA_START_IMAGE_CAPTURE
+    int mBurstFrames;
+
     //Metadata buffermanagement
     int *mPreviewDataBuffers;
     KeyedVector<int, bool> mPreviewDataBuffersAvailable;
@@ -242,6 +249,7 @@ protected:
     TIUTILS::MessageQueue mAdapterQ;
     mutable Mutex mSubscriberLock;
     ErrorNotifier *mErrorNotifier;
+    sp<PipelineStats> mPipelineStats;
     release_image_buffers_callback mReleaseImageBuffersCallback;
     end_image_capture_callback mEndImageCaptureCallback;
     void *mReleaseData;
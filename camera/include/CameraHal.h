@@ -42,6 +42,12 @@
 #include "CameraProperties.h"
 #include "DebugUtils.h"
 #include "SensorListener.h"
+#include "MemoryBackend.h"
+#include "MemoryAccounting.h"
+#include "CameraLog.h"
+#include "PipelineStats.h"
+#include "FrameTrace.h"
+#include "ParameterStore.h"
 
 #include <ui/GraphicBufferAllocator.h>
 #include <ui/GraphicBuffer.h>
@@ -74,24 +80,32 @@
 #define LOCK_BUFFER_TRIES 5
 #define HAL_PIXEL_FORMAT_NV12 0x100
 
-///Camera HAL Logging Functions
-#define DEBUG_FLAG 1
-
+///Camera HAL Logging Functions, gated by the runtime level in CameraLog
 #ifndef DEBUG_LOG
 
 #undef LOG_FUNCTION_NAME
 #undef LOG_FUNCTION_NAME_EXIT
+#ifdef CAMERA_FUNCTION_TRACE
 #define LOG_FUNCTION_NAME \
-	if(DEBUG_FLAG) \
+	if(android::CameraLog::sLevel >= android::CAMERA_LOG_TRACE) \
 		LOGD("%d: %s() ENTER", __LINE__, __FUNCTION__);
 #define LOG_FUNCTION_NAME_EXIT \
-	if(DEBUG_FLAG) \
+	if(android::CameraLog::sLevel >= android::CAMERA_LOG_TRACE) \
 		LOGD("%d: %s() EXIT", __LINE__, __FUNCTION__);
+#else
+#define LOG_FUNCTION_NAME
+#define LOG_FUNCTION_NAME_EXIT
+#endif
 
 #define LOGINFO \
-	if(DEBUG_FLAG) \
+	if((android::CameraLog::sLevel >= android::CAMERA_LOG_INFO) && \
+			android::CameraLog::allow(__FILE__, __LINE__)) \
 		LOGE
 
+#define LOGFRAME \
+	if(android::CameraLog::sLevel >= android::CAMERA_LOG_FRAME) \
+		LOGD
+
 #endif
 
 
@@ -103,6 +117,22 @@ namespace android {
 
 #define PARAM_BUFFER            6000
 
+///Planes described by a PlaneLayout, YV12 needs three
+#define MAX_BUFFER_PLANES 3
+///Default row and plane alignment of 2D allocations, in bytes
+#define DEFAULT_ROW_ALIGNMENT 64
+
+///Vendor sendCommand() ids, past the framework's CAMERA_CMD_* range. All are accepted
+///without preview running. The report goes to the log, a non zero arg2 resets the
+///counters after reporting them. dumpsys gets them through dump()
+#define CAMERA_CMD_DUMP_PIPELINE_STATS 0x1000
+///arg1 is a CameraLogLevel
+#define CAMERA_CMD_SET_LOG_LEVEL 0x1001
+///arg1 non zero starts recording the frame trace, zero stops it
+#define CAMERA_CMD_ENABLE_TRACE 0x1002
+///Writes the Chrome trace JSON to a new file in FRAME_TRACE_DIR, its name is logged
+#define CAMERA_CMD_DUMP_TRACE 0x1003
+
 ///Forward declarations
 class CameraHal;
 class CameraFrame;
@@ -248,7 +278,8 @@ class CameraFrame
     mFd(0),
     mLength(0),
     mFrameMask(0),
-    mQuirks(0) {
+    mQuirks(0),
+    mSequence(0) {
 
       mYuv[0] = NULL;
       mYuv[1] = NULL;
@@ -268,7 +299,8 @@ class CameraFrame
     mFd(frame.mFd),
     mLength(frame.mLength),
     mFrameMask(frame.mFrameMask),
-    mQuirks(frame.mQuirks) {
+    mQuirks(frame.mQuirks),
+    mSequence(frame.mSequence) {
 
       mYuv[0] = frame.mYuv[0];
       mYuv[1] = frame.mYuv[1];
@@ -287,6 +319,8 @@ class CameraFrame
     unsigned mFrameMask;
     unsigned int mQuirks;
     unsigned int mYuv[2];
+    ///Running count of the frames the adapter captured, tying trace events to a frame
+    uint32_t mSequence;
     ///@todo add other member vars like  stride etc
 };
 
@@ -460,6 +494,20 @@ public:
     int disableEventNotification(int32_t eventTypes);
 };
 
+/**
+  * Placement of the planes inside each buffer of a 2D allocation. Every
+  * plane starts, and every row of it starts, on the row alignment.
+  */
+typedef struct
+    {
+    int mWidth;
+    int mHeight;
+    unsigned int mPlanes;
+    uint32_t mOffset[MAX_BUFFER_PLANES];   ///< from the start of the buffer
+    uint32_t mStride[MAX_BUFFER_PLANES];   ///< bytes per row
+    uint32_t mSize;                        ///< all planes and padding of one buffer
+    } PlaneLayout;
+
 /*
   * Interface for providing buffers
   */
@@ -529,6 +577,8 @@ public:
     //API for enabling/disabling measurement data
     void setMeasurements(bool enable);
 
+    void setPipelineStats(const sp<PipelineStats> &stats);
+
     //thread loops
     bool notificationThread();
 
@@ -598,6 +648,10 @@ private:
     status_t dummyRaw();
     void copyAndSendPictureFrame(CameraFrame* frame, int32_t msgType);
     void copyAndSendPreviewFrame(CameraFrame* frame, int32_t msgType);
+    void sendPendingPictures();
+    ///mRequestMemory and its release, with the memory accounted under category
+    camera_memory_t* requestMemory(size_t size, unsigned int count, MemoryAccounting::Category category);
+    void releaseMemory(camera_memory_t* memory, MemoryAccounting::Category category);
 
 private:
     mutable Mutex mLock;
@@ -638,10 +692,21 @@ private:
 
     //Burst mode active
     bool mBurst;
+
+    //In-order jpeg delivery, protected by mBurstLock
+    KeyedVector<void*, uint32_t> mEncodeSeq;
+    KeyedVector<void*, nsecs_t> mEncodeTimestamp;   ///< capture time of each encode in flight
+    KeyedVector<uint32_t, camera_memory_t*> mPendingPictures;
+    uint32_t mEncodeSeqNext;
+    uint32_t mEncodeSeqSent;
     mutable Mutex mRecordingLock;
     bool mRecording;
     bool mMeasurementEnabled;
 
+    sp<PipelineStats> mPipelineStats;
+    ///Frames posted to mFrameQ and not taken off it yet
+    volatile int32_t mFramesQueued;
+
     bool mUseMetaDataBufferMode;
     bool mRawAvailable;
 
@@ -661,24 +726,73 @@ private:
 class MemoryManager : public BufferProvider, public virtual RefBase
 {
 public:
-    MemoryManager():mIonFd(0){ }
+    ///backend names a MemoryBackend, NULL lets MemoryBackend::create() pick one
+    MemoryManager(const char* backend = NULL);
+    virtual ~MemoryManager();
 
     ///Initializes the memory manager creates any resources required
-    status_t initialize() { return NO_ERROR; }
+    status_t initialize();
+
+    enum CpuAccess
+        {
+        CPU_ACCESS_READ = MemoryBackend::SYNC_READ,
+        CPU_ACCESS_WRITE = MemoryBackend::SYNC_WRITE
+        };
 
     int setErrorHandler(ErrorNotifier *errorNotifier);
     virtual void* allocateBuffer(int width, int height, const char* format, int &bytes, int numBufs);
+    ///cached buffers come from a CPU cacheable heap, for buffers the CPU reads back
+    void* allocateBuffer(int width, int height, const char* format, int &bytes, int numBufs, bool cached);
     virtual uint32_t * getOffsets();
     virtual int getFd() ;
     virtual int freeBuffers(void* buf);
 
+    ///Hand the buffers of an allocateBuffer() array to the CPU and back. Only
+    ///cached buffers need it, the caches are cleaned or invalidated as needed
+    status_t beginCpuAccess(void* buf, int access);
+    status_t endCpuAccess(void* buf);
+
+    ///Layout of the buffers returned by a 2D allocateBuffer() call
+    status_t getLayout(void* buf, PlaneLayout &layout);
+    ///Power of two, at least 16, used by the next 2D allocations
+    status_t setRowAlignment(unsigned int alignment);
+    static status_t computeLayout(int width, int height, const char* format,
+                                  unsigned int alignment, PlaneLayout &layout);
+
+    ///Freed buffers stay mapped for reuse while the idle ones fit in this many bytes
+    void setPoolCap(size_t maxBytes);
+    ///Releases idle buffers, oldest first, until at most maxBytes stay pooled
+    void trimPool(size_t maxBytes);
+
 private:
 
+    ///mLength is the size class the buffer was allocated with
+    typedef MemoryBackend::Buffer Buffer;
+
+    static size_t sizeClass(size_t bytes);
+    status_t initializeLocked();
+    status_t getBuffer(size_t length, bool cached, Buffer &buffer);
+    status_t syncBuffer(Buffer &buffer, int access, bool begin);
+    void releaseBuffer(const Buffer &buffer);
+    void trimPoolLocked(size_t maxBytes);
+    int freeBuffersLocked(void* buf);
+
+    Mutex mLock;
     sp<ErrorNotifier> mErrorNotifier;
-    int mIonFd;
-    KeyedVector<unsigned int, unsigned int> mIonHandleMap;
-    KeyedVector<unsigned int, unsigned int> mIonFdMap;
-    KeyedVector<unsigned int, unsigned int> mIonBufLength;
+    sp<MemoryBackend> mBackend;
+    String8 mBackendName;
+    ///Buffers handed out, keyed by their entry in the allocateBuffer() array
+    KeyedVector<unsigned int, Buffer> mBuffers;
+    ///Layouts of the 2D allocations, keyed by the returned array
+    KeyedVector<unsigned int, PlaneLayout> mLayouts;
+    unsigned int mRowAlignment;
+    bool mCachedHeap;   ///< false when debug.camera.ion.cached turns cached buffers off
+    ///Idle mapped buffers, least recently freed first
+    Vector<Buffer> mPool;
+    size_t mPoolBytes;
+    size_t mPoolCap;
+    unsigned int mPoolHits;
+    unsigned int mPoolMisses;
 };
 
 
@@ -710,6 +824,7 @@ public:
          uint32_t *mOffsets;
          int mFd;
          size_t mLength;
+         size_t mStride;         ///< bytes per row, 0 when rows are packed
          size_t mCount;
          size_t mMaxQueueable;
         } BuffersDescriptor;
@@ -720,6 +835,7 @@ public:
         CAMERA_STOP_PREVIEW                         = 1,
         CAMERA_START_VIDEO                          = 2,
         CAMERA_STOP_VIDEO                           = 3,
+        ///value1 carries the number of frames to capture, 0 or 1 for a single shot
         CAMERA_START_IMAGE_CAPTURE                  = 4,
         CAMERA_STOP_IMAGE_CAPTURE                   = 5,
         CAMERA_PERFORM_AUTOFOCUS                    = 6,
@@ -776,6 +892,8 @@ public:
 
     virtual int setErrorHandler(ErrorNotifier *errorNotifier) = 0;
 
+    virtual void setPipelineStats(const sp<PipelineStats> &stats) = 0;
+
     //Message/Frame notification APIs
     virtual void enableMsgType(int32_t msgs,
                                frame_callback callback = NULL,
@@ -789,6 +907,8 @@ public:
     //APIs to configure Camera adapter and get the current parameter set
     virtual int setParameters(const CameraParameters& params) = 0;
     virtual void getParameters(CameraParameters& params) = 0;
+    //Applies only the keys in changes, params holds the complete set
+    virtual int updateParameters(const CameraParameters& params, const ParameterStore::ChangeSet& changes) = 0;
 
     //API to flush the buffers from Camera
      status_t flushBuffers()
@@ -847,6 +967,7 @@ public:
     virtual int setPreviewWindow(struct preview_stream_ops *window) = 0;
     virtual int setFrameProvider(FrameNotifier *frameProvider) = 0;
     virtual int setErrorHandler(ErrorNotifier *errorNotifier) = 0;
+    virtual void setPipelineStats(const sp<PipelineStats> &stats) = 0;
     virtual int enableDisplay(int width, int height, struct timeval *refTime = NULL, S3DParameters *s3dParams = NULL) = 0;
     virtual int disableDisplay(bool cancel_buffer = true) = 0;
     //Used for Snapshot review temp. pause
@@ -1013,6 +1134,11 @@ public:
      */
     int dump(int fd) const;
 
+    /**
+     * Pipeline counters, into the log
+     */
+    status_t dumpPipelineStats(bool reset);
+
 
 		status_t storeMetaDataInBuffers(bool enable);
 
@@ -1030,9 +1156,15 @@ public:
     // Destructor of CameraHal
     ~CameraHal();
 
-    /** Initialize CameraHal */
+    /** Initialize CameraHal, the device itself is probed on the worker thread */
     status_t initialize(CameraProperties::Properties*);
 
+    /** Waits for the open and preview start posted so far, returns how the open went */
+    status_t waitForWorker();
+
+    /** Abandons a posted preview start and waits for the worker to go idle */
+    void cancelPreviewStart();
+
     /** Deinitialize CameraHal */
     void deinitialize();
     /** Free image bufs */
@@ -1046,9 +1178,51 @@ public:
     void eventCallback(CameraHalEvent* event);
     void setEventProvider(int32_t eventMask, MessageNotifier * eventProvider);
 
+    //Internal class definitions
+    class WorkerThread : public Thread {
+        CameraHal* mCameraHal;
+        TIUTILS::MessageQueue mWorkerThreadQ;
+    public:
+        enum WorkerThreadCommands
+        {
+        WORKER_OPEN,
+        WORKER_START_PREVIEW,
+        WORKER_EXIT,
+        };
+    public:
+        WorkerThread(CameraHal* hal)
+            : Thread(false), mCameraHal(hal) { }
+        virtual bool threadLoop() {
+            return mCameraHal->workerThread();
+        }
+
+        TIUTILS::MessageQueue &msgQ() { return mWorkerThreadQ;}
+    };
+
+    //Friend declarations
+    friend class WorkerThread;
+
 /*--------------------Internal Member functions - Private---------------------------------*/
 private:
 
+    ///How a running preview picked up a change, cheapest first
+    enum PreviewRestartKind
+        {
+        RESTART_RESUME = 0,     ///< display resumed after a capture, nothing reconfigured
+        RESTART_SETTINGS,       ///< same format, the keys were applied to the running stream
+        RESTART_FORMAT,         ///< same geometry, only the preview callbacks were restarted
+        RESTART_GEOMETRY,       ///< new frame size, stream and display buffers reallocated
+        RESTART_KIND_COUNT
+        };
+
+    typedef struct
+        {
+        unsigned int mCount;
+        nsecs_t mLast;
+        nsecs_t mMax;
+        nsecs_t mTotal;
+        } RestartStats;
+
     /** @name internalFunctionsPrivate */
     //@{
 
@@ -1061,6 +1235,21 @@ private:
     /** Restart the preview with setParameter. */
     status_t        restartPreview();
 
+    /** Starts the preview on the calling thread, startPreview() posts this to the worker */
+    status_t        startPreviewInternal();
+
+    /** Probes the device and sets the defaults, run by the worker for initialize() */
+    status_t        openDevice();
+
+    /** Runs one posted open or preview start */
+    bool workerThread();
+
+    /** True once a posted preview start has been abandoned */
+    bool previewStartCancelled();
+
+    /** Records how long a restart of the given kind took since start */
+    void noteRestart(PreviewRestartKind kind, nsecs_t start);
+
     status_t parseResolution(const char *resStr, int &width, int &height);
 
     /** Allocate preview buffers */
@@ -1078,16 +1267,10 @@ private:
     /** Free video bufs */
     status_t freeVideoBufs(void *bufs);
 
-    //Check if a given resolution is supported by the current camera
-    //instance
     CameraAdapter* CameraAdapter_Factory(size_t sensor_index);
-    bool isResolutionValid(unsigned int width, unsigned int height, const char *supportedResolutions);
 
-    //Check if a given parameter is supported by the current camera
-    // instance
-    bool isParameterValid(const char *param, const char *supportedParams);
-    bool isParameterValid(int param, const char *supportedParams);
-    status_t doesSetParameterNeedUpdate(const char *new_param, const char *old_params, bool &update);
+    //Pushes the pending adapter keys, restart allows the ones that change the stream format
+    status_t applyAdapterParameters(bool restart);
 
     /** Initialize default parameters */
     void initDefaultParameters();
@@ -1157,6 +1340,9 @@ private:
     void* mCameraAdapterHandle;
 
     CameraParameters mParameters;
+    ParameterStore mParameterStore;
+    //Changed keys the adapter has not been given yet
+    ParameterStore::ChangeSet mAdapterChanges;
     bool mPreviewRunning;
     bool mPreviewStateOld;
     bool mRecordingEnabled;
@@ -1167,12 +1353,15 @@ private:
     int mPreviewDataFd;
     int mPreviewDataLength;
     int32_t *mImageBufs;
-    uint32_t *mImageOffsets;
+    uint32_t *mImageOffsets;    ///< points into mImageLayout
     int mImageFd;
     int mImageLength;
+    PlaneLayout mImageLayout;
+    unsigned int mImageBufCount;
     int32_t *mPreviewBufs;
     uint32_t *mPreviewOffsets;
     int mPreviewLength;
+    size_t mPreviewBufsBytes;   ///< what the preview buffers count for in MemoryAccounting
     int mPreviewFd;
     int32_t *mVideoBufs;
     uint32_t *mVideoOffsets;
@@ -1192,6 +1381,23 @@ private:
     uint32_t mPreviewHeight;
     int32_t mMaxZoomSupported;
 
+    RestartStats mRestartStats[RESTART_KIND_COUNT];
+    mutable Mutex mRestartStatsLock;
+
+    ///Shared with the adapter, display and notifier, which count frames into it
+    sp<PipelineStats> mPipelineStats;
+
+    //Open and preview start run on the worker, the rest is protected by mWorkerLock
+    sp<WorkerThread> mWorkerThread;
+    mutable Mutex mWorkerLock;
+    Condition mWorkerDone;
+    unsigned int mWorkerPending;    ///< posted jobs not finished yet
+    bool mWorkerCancel;             ///< a posted preview start is to be abandoned
+    status_t mOpenStatus;           ///< NO_INIT until the device has been probed
+    nsecs_t mOpenTime;              ///< how long probing took on the worker
+    bool mPreviewStartPending;      ///< posted, previewEnabled() already reports it
+    struct timeval mPreviewRequestTime; ///< time to first frame is measured from here
+
     int mVideoWidth;
     int mVideoHeight;
 
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraLog.h
+*
+* Runtime log level of the camera HAL. LOGINFO messages are rate limited per
+* call site, so a message on the frame path cannot flood the log, and
+* LOGFRAME messages, which fire on every frame, only come out at the frame
+* level. The level is read from debug.camera.loglevel at open and can be
+* changed through sendCommand().
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_CAMERA_LOG_H
+#define ANDROID_CAMERA_HARDWARE_CAMERA_LOG_H
+
+namespace android {
+
+#define CAMERA_LOG_LEVEL_PROPERTY "debug.camera.loglevel"
+
+///Messages a LOGINFO call site may log per second before the rest are counted and dropped
+#define CAMERA_LOG_RATE 10
+
+enum CameraLogLevel
+    {
+    CAMERA_LOG_ERROR = 0,           ///< LOGINFO off, only plain LOGE
+    CAMERA_LOG_INFO,                ///< LOGINFO, rate limited, the default
+    CAMERA_LOG_FRAME,               ///< LOGFRAME per frame messages as well, not rate limited
+    CAMERA_LOG_TRACE,               ///< function entry and exit, when built with CAMERA_FUNCTION_TRACE
+    };
+
+class CameraLog
+{
+public:
+
+    ///Read on every message, a plain int so the check costs one load
+    static volatile int sLevel;
+
+    static void setLevel(int level);
+    static int getLevel() { return sLevel; }
+    ///Applies debug.camera.loglevel, leaving the level alone when it is not set
+    static void loadLevel();
+
+    ///True when the call site has not used up its rate, logs what it dropped otherwise
+    static bool allow(const char *file, int line);
+};
+
+};
+
+#endif
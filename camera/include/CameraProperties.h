@@ -32,8 +32,8 @@
 
 namespace android {
 
-#define MAX_CAMERAS_SUPPORTED 2
-#define MAX_SIMUL_CAMERAS_SUPPORTED 1
+#define MAX_CAMERAS_SUPPORTED 8
+#define MAX_SIMUL_CAMERAS_SUPPORTED MAX_CAMERAS_SUPPORTED
 #define MAX_PROP_NAME_LENGTH 50
 #define MAX_PROP_VALUE_LENGTH 2048
 
@@ -47,6 +47,7 @@ public:
     static const char INVALID[];
     static const char CAMERA_NAME[];
     static const char CAMERA_SENSOR_INDEX[];
+    static const char DEVICE_NODE[];
     static const char ORIENTATION_INDEX[];
     static const char FACING_INDEX[];
     static const char S3D_SUPPORTED[];
@@ -109,6 +110,18 @@ public:
     static const char EXIF_MAKE[];
     static const char EXIF_MODEL[];
     static const char JPEG_THUMBNAIL_QUALITY[];
+    static const char JPEG_TARGET_SIZE[];
+    static const char BURST[];
+    static const char ZSL_HISTORY[];
+    static const char ZSL_SELECT[];
+    static const char ZSL_SELECT_NEAREST[];
+    static const char ZSL_SELECT_SHARPEST[];
+    static const char PREVIEW_ROTATION[];
+    static const char PREVIEW_ROTATION_AUTO[];
+    static const char BRIGHTNESS_LEVEL[];
+    static const char CONTRAST_LEVEL[];
+    static const char SATURATION_LEVEL[];
+    static const char SHARPNESS_LEVEL[];
     static const char MAX_FOCUS_AREAS[];
     static const char MAX_FD_HW_FACES[];
     static const char MAX_FD_SW_FACES[];
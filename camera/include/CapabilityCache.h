@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CapabilityCache.h
+*
+* Persistent copy of what the HAL enumerates from a V4L2 device at open. It is
+* keyed by a hash of the USB vendor and product id, serial number, firmware
+* revision and the VIDIOC_QUERYCAP strings, so a different or reflashed camera
+* on the same node is detected and enumerated again.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_CAPABILITY_CACHE_H
+#define ANDROID_CAMERA_HARDWARE_CAPABILITY_CACHE_H
+
+#include <stdint.h>
+#include <linux/videodev2.h>
+#include <utils/Errors.h>
+
+namespace android {
+
+///Directory holding one cache file per video node, "0" disables the cache
+#define CAPABILITY_CACHE_PROPERTY "persist.camera.capcache"
+#define CAPABILITY_CACHE_DIR "/data/misc/camera"
+
+///Bumped whenever the record layout or what is enumerated changes
+#define CAPABILITY_CACHE_VERSION 1
+#define CAPABILITY_CACHE_MAX_CONTROLS 16
+
+class CapabilityCache
+{
+public:
+
+    typedef struct
+        {
+        char mVendor[8];            ///< idVendor, empty when the device is not on USB
+        char mProduct[8];           ///< idProduct
+        char mRevision[8];          ///< bcdDevice, the firmware revision
+        char mSerial[64];
+        } UsbIdentity;
+
+public:
+
+    CapabilityCache();
+
+    ///Reads the device identity from QUERYCAP and sysfs and hashes it. node is the
+    ///video device path and names the cache file
+    status_t identify(int fd, const char *node, const struct v4l2_capability &cap);
+
+    ///Reads the cache file, true when it matches the identity and is intact
+    bool load();
+    ///Writes the records collected by setControl() if anything changed since load()
+    status_t store();
+
+    bool isValid() const { return mValid; }
+    bool isEnabled() const { return mEnabled; }
+    uint32_t getIdentity() const { return mIdentity; }
+    const UsbIdentity& getUsbIdentity() const { return mUsb; }
+
+    ///Cached VIDIOC_QUERYCTRL result for the control at index, false when the cache is
+    ///not valid or the id differs. queried is cleared for controls the driver refused
+    bool getControl(unsigned int index, uint32_t id, struct v4l2_queryctrl &query, bool &queried) const;
+    ///Records a VIDIOC_QUERYCTRL result, NULL when the driver refused the control
+    void setControl(unsigned int index, uint32_t id, const struct v4l2_queryctrl *query);
+
+private:
+
+    typedef struct
+        {
+        uint32_t mMagic;
+        uint32_t mVersion;
+        uint32_t mIdentity;
+        uint32_t mControlCount;
+        uint32_t mChecksum;         ///< over the records
+        } Header;
+
+    typedef struct
+        {
+        uint32_t mId;
+        uint32_t mQueried;
+        struct v4l2_queryctrl mQuery;
+        } ControlRecord;
+
+    static uint32_t hash(uint32_t seed, const void *data, size_t length);
+    static void readSysfs(const char *path, char *value, size_t length);
+
+    bool mEnabled;
+    bool mValid;                    ///< records were loaded from a matching file
+    bool mDirty;                    ///< records differ from the file
+    uint32_t mIdentity;
+    UsbIdentity mUsb;
+    char mPath[128];
+    ControlRecord mControls[CAPABILITY_CACHE_MAX_CONTROLS];
+};
+
+};
+
+#endif
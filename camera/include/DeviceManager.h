@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file DeviceManager.h
+*
+* Tracks which video node each camera id currently lives on. Cameras are
+* known by a stable identity, their USB vendor and product ids together with
+* their serial number, or the port they are plugged into when the serial does
+* not tell units apart, so a camera that is reset or replugged and comes back
+* on another node keeps its id. Nodes are watched through kernel
+* uevents, or inotify on /dev when the uevent socket is not available.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_DEVICE_MANAGER_H
+#define ANDROID_CAMERA_HARDWARE_DEVICE_MANAGER_H
+
+#include <utils/Errors.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <linux/videodev2.h>
+#include "CameraProperties.h"
+
+namespace android {
+
+///While a camera is missing the nodes are rescanned at least this often, in case an event was missed
+#define DEVICE_RESCAN_INTERVAL_MS 500
+
+class DeviceManager
+{
+public:
+
+    typedef struct
+        {
+        char mBusPath[32];          ///< USB port path such as 1-1.2, or the parent device name
+        char mVendor[8];            ///< USB idVendor, empty for other buses
+        char mProduct[8];           ///< USB idProduct, empty for other buses
+        char mSerial[64];           ///< empty when the device reports none
+        } Identity;
+
+public:
+
+    static DeviceManager* getInstance();
+
+    ///Reads the stable identity of the device behind a video node from sysfs
+    static status_t readIdentity(const char *node, Identity &identity);
+    static bool sameDevice(const Identity &a, const Identity &b);
+
+    ///True for a node that streams video capture, as opposed to the metadata or output
+    ///nodes drivers register alongside; cap is filled from VIDIOC_QUERYCAP
+    static bool isCaptureNode(const char *node, struct v4l2_capability &cap);
+
+    ///Binds a camera id to the device found on node at discovery
+    status_t registerCamera(int cameraId, const char *node);
+
+    ///Starts watching for nodes appearing and disappearing, once per process
+    status_t start();
+
+    ///Current node of the camera and the generation it was seen in, false while it is missing
+    bool getNode(int cameraId, char *node, size_t length, unsigned int &generation);
+
+    ///Reports that the node of that generation failed, without waiting for its remove event
+    void markLost(int cameraId, unsigned int generation);
+
+    ///Waits up to timeout for the camera to show up in a generation after the given one.
+    ///NO_INIT when the camera is not followed, for lack of registration or identity
+    status_t waitForCamera(int cameraId, unsigned int generation, nsecs_t timeout,
+                           char *node, size_t length, unsigned int &newGeneration);
+
+private:
+
+    typedef struct
+        {
+        bool mRegistered;
+        bool mPresent;
+        Identity mIdentity;
+        char mNode[32];
+        unsigned int mGeneration;   ///< bumped every time the camera (re)appears
+        nsecs_t mLostAt;
+        } Camera;
+
+    class WatchThread : public Thread {
+            DeviceManager* mManager;
+        public:
+            WatchThread(DeviceManager* manager) :
+                    Thread(false), mManager(manager) { }
+            virtual bool threadLoop() {
+                return mManager->watch();
+            }
+        };
+
+    DeviceManager();
+
+    bool watch();
+    void rescan();
+    bool anyLostLocked() const;
+
+    Camera mCameras[MAX_CAMERAS_SUPPORTED];
+    sp<WatchThread> mWatchThread;
+    int mUeventFd;
+    int mInotifyFd;
+    int mInotifyWatch;
+
+    Mutex mLock;
+    Condition mChanged;             ///< signalled when a camera appears or disappears
+};
+
+};
+
+#endif
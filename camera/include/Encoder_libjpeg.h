@@ -36,6 +36,8 @@ namespace android {
  */
 
 #define MAX_EXIF_TAGS_SUPPORTED 30
+// APP1 segment is limited to 64K; leave room for the IFD entries
+#define EXIF_THUMBNAIL_MAX_SIZE (60 * 1024)
 typedef void (*encoder_libjpeg_callback_t) (void* main_jpeg,
                                             void* thumb_jpeg,
                                             CameraFrame::FrameType type,
@@ -87,14 +89,32 @@ class ExifElementsTable {
 class Encoder_libjpeg : public Thread {
     /* public member types and variables */
     public:
+        ///Target-size rate control counters, shared by all encoder instances
+        struct RateControlStats {
+            uint32_t requests;   ///< encodes that asked for a target size
+            uint32_t hits;       ///< final jpeg came in at or under the target
+            uint32_t retries;    ///< encodes that needed the second pass
+        };
+
+        ///Cached compressor context counters, shared by all encoder instances
+        struct CompressorStats {
+            uint32_t images;           ///< images encoded on a cached context
+            uint32_t oneshot;          ///< images that fell back to a throwaway context
+            uint32_t contexts_created; ///< jpeg_create_compress() calls
+            uint32_t table_hits;       ///< quant tables reused instead of rescaled
+            uint32_t table_misses;     ///< jpeg_set_quality() calls
+            int64_t setup_ns;          ///< summed per-image setup, up to the first scanline
+        };
         struct params {
             uint8_t* src;
             int src_size;
             uint8_t* dst;
             int dst_size;
             int quality;
+            int target_size; // bytes, <= 0 encodes at fixed quality
             int in_width;
             int in_height;
+            int in_stride; // bytes per source row, 0 when rows are packed
             int out_width;
             int out_height;
             const char* format;
@@ -150,6 +170,9 @@ class Encoder_libjpeg : public Thread {
             return false;
         }
 
+        static void getRateControlStats(RateControlStats& stats);
+        static void getCompressorStats(CompressorStats& stats);
+
         void cancel() {
            if (mThumb.get()) {
                mThumb->cancel();
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameTrace.h
+*
+* Begin and end events of the frame path, recorded into a fixed size ring per
+* thread with the frame sequence number and buffer index they concern. Each
+* ring has a single writer, so recording takes no lock. Off by default, it is
+* switched by debug.camera.trace or CAMERA_CMD_ENABLE_TRACE, and
+* CAMERA_CMD_DUMP_TRACE writes the rings as Chrome trace JSON to a file in
+* FRAME_TRACE_DIR, which chrome://tracing and Perfetto open.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_FRAME_TRACE_H
+#define ANDROID_CAMERA_HARDWARE_FRAME_TRACE_H
+
+#include <stdint.h>
+#include <utils/Errors.h>
+
+namespace android {
+
+#define FRAME_TRACE_PROPERTY "debug.camera.trace"
+///Where CAMERA_CMD_DUMP_TRACE writes, as trace-<pid>-<n>.json
+#define FRAME_TRACE_DIR "/data/misc/camera"
+
+///Threads traced at once, a ring is handed on when its thread exits
+#define FRAME_TRACE_MAX_THREADS 16
+///Events kept per thread, a power of two. About four seconds of preview at 30 fps
+#define FRAME_TRACE_EVENTS 2048
+
+class FrameTrace
+{
+public:
+
+    ///Read before every event, a plain int so the check costs one load
+    static volatile int sEnabled;
+
+    static void setEnabled(bool enable);
+    ///Applies debug.camera.trace, leaving tracing alone when it is not set
+    static void loadEnabled();
+
+    ///phase is 'B' or 'E' as in the Chrome format, frame and buffer -1 when unknown
+    static void record(const char *name, char phase, int frame, int buffer);
+
+    ///Writes the events recorded so far as Chrome trace JSON
+    static status_t dump(int fd);
+    ///Same into a new file in FRAME_TRACE_DIR, its name returned in path
+    static status_t dumpToFile(char *path, size_t length);
+};
+
+///Records a begin event when constructed and the matching end event when destroyed
+class FrameTraceScope
+{
+public:
+
+    FrameTraceScope(const char *name, int frame = -1, int buffer = -1)
+        : mName(NULL), mFrame(frame), mBuffer(buffer)
+        {
+        if ( FrameTrace::sEnabled ) {
+            mName = name;
+            FrameTrace::record(name, 'B', frame, buffer);
+        }
+        }
+
+    ~FrameTraceScope()
+        {
+        if ( NULL != mName ) {
+            FrameTrace::record(mName, 'E', mFrame, mBuffer);
+        }
+        }
+
+    ///Frame and buffer learnt once the scope is running, reported with the end event
+    void setFrame(int frame, int buffer)
+        {
+        mFrame = frame;
+        mBuffer = buffer;
+        }
+
+private:
+    const char *mName;
+    int mFrame;
+    int mBuffer;
+};
+
+};
+
+#endif
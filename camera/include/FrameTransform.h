@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FrameTransform.h
+*
+* Single pass crop, scale and rotate of packed YUYV frames, used for the
+* copy from the capture buffers into the display buffers.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_FRAME_TRANSFORM_H
+#define ANDROID_CAMERA_HARDWARE_FRAME_TRANSFORM_H
+
+#include <stdint.h>
+
+namespace android {
+
+///Zoom ratios are expressed in percent, as in CameraParameters::KEY_ZOOM_RATIOS
+#define ZOOM_RATIO_UNITY 100
+///Largest destination dimension handled by transformYUYV
+#define MAX_TRANSFORM_DIM 2048
+
+struct FrameTransform {
+    int mCropLeft;      ///< source window, in pixels, left is kept even
+    int mCropTop;
+    int mCropWidth;
+    int mCropHeight;
+    int mRotation;      ///< clockwise, 0, 90, 180 or 270
+};
+
+/**
+ * @brief Centered crop for a zoom ratio, rotation is left unchanged
+ */
+void zoomToCrop(int width, int height, int zoomRatio, FrameTransform &transform);
+
+/**
+ * @brief Returns true when the transform is a plain copy for these sizes
+ */
+bool isIdentityTransform(int srcWidth, int srcHeight, int dstWidth, int dstHeight,
+                         const FrameTransform &transform);
+
+/**
+ * @brief Crops, scales and rotates a YUYV frame into a YUYV buffer in one pass
+ *
+ * 0 and 180 degrees fill the destination. 90 and 270 degrees keep the aspect
+ * ratio and letterbox the rest of the destination in black. Returns false,
+ * leaving dst untouched, when the sizes are not supported.
+ */
+bool transformYUYV(const uint8_t *src, int srcWidth, int srcHeight,
+                   uint8_t *dst, int dstWidth, int dstHeight,
+                   const FrameTransform &transform);
+
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file MemoryAccounting.h
+*
+* Process wide tally of the memory the camera HAL holds, per category, with
+* high-water marks and an optional budget the allocators degrade under.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_MEMORY_ACCOUNTING_H
+#define ANDROID_CAMERA_HARDWARE_MEMORY_ACCOUNTING_H
+
+#include <sys/types.h>
+#include <utils/Errors.h>
+
+namespace android {
+
+class MemoryAccounting
+{
+public:
+
+    enum Category
+        {
+        MEM_PREVIEW_BUFFERS = 0,    ///< window buffers the display adapter holds
+        MEM_DRIVER_BUFFERS,         ///< V4L2 buffers mapped by the adapter
+        MEM_IMAGE_BUFFERS,          ///< MemoryManager buffers handed out
+        MEM_IMAGE_POOL,             ///< idle MemoryManager buffers kept mapped
+        MEM_PREVIEW_CALLBACK,       ///< preview callback heap
+        MEM_PICTURE,                ///< raw and jpeg picture callback memory
+        MEM_VIDEO_METADATA,         ///< video metadata buffers
+        MEM_ENCODER_SCRATCH,        ///< encoder RGB and downscale buffers
+        MEM_THUMBNAIL,              ///< thumbnail jpeg output
+        MEM_CATEGORY_COUNT
+        };
+
+    typedef struct
+        {
+        size_t mLive;
+        size_t mPeak;
+        unsigned int mAllocations;
+        unsigned int mDegraded;     ///< allocations made smaller or skipped to stay in budget
+        } Usage;
+
+    static void add(Category category, size_t bytes);
+    static void remove(Category category, size_t bytes);
+    ///Moves bytes between categories without touching the total
+    static void move(Category from, Category to, size_t bytes);
+
+    ///Total budget in bytes, 0 for none. Defaults to debug.camera.mem.budget.kb
+    static void setBudget(size_t bytes);
+    static size_t getBudget();
+    ///True when bytes more stay within the budget
+    static bool fits(size_t bytes);
+    ///How many of wanted buffers of the given size fit, never fewer than minimum.
+    ///released is what the caller frees before allocating them
+    static unsigned int fitCount(Category category, size_t bytesPerBuffer,
+                                 unsigned int wanted, unsigned int minimum, size_t released);
+    static void noteDegraded(Category category);
+
+    static void getUsage(Category category, Usage &usage);
+    static size_t getTotal();
+    static size_t getPeak();
+    static const char* getName(Category category);
+
+    static status_t dump(int fd);
+
+private:
+    static void loadBudgetLocked();
+};
+
+};
+
+#endif
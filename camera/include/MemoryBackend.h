@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file MemoryBackend.h
+*
+* Allocators behind MemoryManager. Every backend hands out a buffer as a
+* shareable fd plus a shared read/write mapping of it, so the rest of the
+* HAL does not care where the memory came from.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_MEMORY_BACKEND_H
+#define ANDROID_CAMERA_HARDWARE_MEMORY_BACKEND_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+
+namespace android {
+
+class MemoryBackend : public virtual RefBase
+{
+public:
+
+    ///Directions of a CPU access, for cache maintenance
+    enum SyncAccess
+        {
+        SYNC_READ = 1 << 0,
+        SYNC_WRITE = 1 << 1
+        };
+
+    typedef struct
+        {
+        uintptr_t mHandle;      ///< backend private, 0 when the fd is all there is
+        int mFd;
+        void *mPtr;
+        size_t mLength;
+        bool mCached;           ///< what the backend granted, not what was asked for
+        int mCpuAccess;         ///< SyncAccess flags while the CPU owns it, kept by MemoryManager
+        } Buffer;
+
+    virtual ~MemoryBackend() {}
+
+    virtual const char* name() const = 0;
+    ///Opens the device or probes the syscalls the backend needs
+    virtual status_t initialize() = 0;
+    ///Allocates and maps length bytes, a multiple of the page size
+    virtual status_t allocate(size_t length, bool cached, Buffer &buffer) = 0;
+    ///Unmaps the buffer and gives it back
+    virtual void release(const Buffer &buffer) = 0;
+    ///Cache maintenance when the CPU takes (begin) or hands back a cached buffer
+    virtual status_t sync(const Buffer &buffer, int access, bool begin) = 0;
+
+    ///name is "ion", "dmaheap" or "memfd". NULL takes debug.camera.mem.backend,
+    ///or else the first of them that initializes
+    static sp<MemoryBackend> create(const char* name);
+};
+
+/**
+  * ION carveout, or the cached system heap when ION supports it
+  */
+class IonMemoryBackend : public MemoryBackend
+{
+public:
+    IonMemoryBackend();
+    virtual ~IonMemoryBackend();
+
+    virtual const char* name() const { return "ion"; }
+    virtual status_t initialize();
+    virtual status_t allocate(size_t length, bool cached, Buffer &buffer);
+    virtual void release(const Buffer &buffer);
+    virtual status_t sync(const Buffer &buffer, int access, bool begin);
+
+private:
+    int mIonFd;
+    bool mCachedHeap;   ///< false once cached allocations are known to be unsupported
+};
+
+/**
+  * Plain Linux allocations for targets without ION: dma-buf from /dev/dma_heap,
+  * or shmem from memfd_create()
+  */
+class LinuxMemoryBackend : public MemoryBackend
+{
+public:
+    enum Mode
+        {
+        MODE_DMA_HEAP = 0,
+        MODE_MEMFD
+        };
+
+    LinuxMemoryBackend(Mode mode);
+    virtual ~LinuxMemoryBackend();
+
+    virtual const char* name() const { return ( MODE_DMA_HEAP == mMode ) ? "dmaheap" : "memfd"; }
+    virtual status_t initialize();
+    virtual status_t allocate(size_t length, bool cached, Buffer &buffer);
+    virtual void release(const Buffer &buffer);
+    virtual status_t sync(const Buffer &buffer, int access, bool begin);
+
+private:
+    Mode mMode;
+    int mHeapFd;
+    int mUncachedHeapFd;    ///< -1 when the kernel has no uncached system heap
+};
+
+};
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file ParameterStore.h
+*
+* Typed copy of the parameters the HAL acts on. Incoming CameraParameters
+* are diffed against it key by key, so setParameters() only validates and
+* applies what the application actually changed.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_PARAMETER_STORE_H
+#define ANDROID_CAMERA_HARDWARE_PARAMETER_STORE_H
+
+#include <stdint.h>
+#include <utils/Errors.h>
+#include <utils/SortedVector.h>
+#include <utils/String8.h>
+#include <camera/CameraParameters.h>
+
+namespace android {
+
+class ParameterStore
+{
+public:
+
+    ///Every key the HAL validates and tracks, at most 64
+    enum Key
+        {
+        PARAM_PREVIEW_SIZE = 0,
+        PARAM_PREVIEW_FORMAT,
+        PARAM_PREVIEW_FRAME_RATE,
+        PARAM_PREVIEW_FPS_RANGE,
+        PARAM_PICTURE_SIZE,
+        PARAM_PICTURE_FORMAT,
+        PARAM_JPEG_QUALITY,
+        PARAM_JPEG_THUMBNAIL_WIDTH,
+        PARAM_JPEG_THUMBNAIL_HEIGHT,
+        PARAM_JPEG_THUMBNAIL_QUALITY,
+        PARAM_JPEG_TARGET_SIZE,
+        PARAM_ROTATION,
+        PARAM_GPS_LATITUDE,
+        PARAM_GPS_LONGITUDE,
+        PARAM_GPS_ALTITUDE,
+        PARAM_GPS_TIMESTAMP,
+        PARAM_GPS_PROCESSING_METHOD,
+        PARAM_RECORDING_HINT,
+        PARAM_VIDEO_STABILIZATION,
+        PARAM_FLASH_MODE,
+        PARAM_BURST,
+        PARAM_FOCUS_MODE,
+        PARAM_FOCUS_AREAS,
+        PARAM_METERING_AREAS,
+        PARAM_WHITE_BALANCE,
+        PARAM_ANTIBANDING,
+        PARAM_EFFECT,
+        PARAM_SCENE_MODE,
+        PARAM_EXPOSURE_COMPENSATION,
+        PARAM_AUTO_EXPOSURE_LOCK,
+        PARAM_AUTO_WHITEBALANCE_LOCK,
+        PARAM_ZOOM,
+        PARAM_ZSL_HISTORY,
+        PARAM_ZSL_SELECT,
+        PARAM_PREVIEW_ROTATION,
+        PARAM_BRIGHTNESS,
+        PARAM_CONTRAST,
+        PARAM_SATURATION,
+        PARAM_SHARPNESS,
+        PARAM_COUNT
+        };
+
+    ///What it takes for a change to a key to take effect
+    enum Apply
+        {
+        APPLY_HAL = 0,      ///< read by the HAL or the notifier when needed, the adapter never sees it
+        APPLY_LIVE,         ///< pushed to the adapter and applied to the running stream
+        APPLY_RESTART       ///< changes the stream format, preview has to be restarted
+        };
+
+    enum Type
+        {
+        TYPE_STRING = 0,
+        TYPE_INT,
+        TYPE_SIZE,          ///< "WxH"
+        TYPE_RANGE          ///< "min,max"
+        };
+
+    ///Keys changed by one setParameters() call, or waiting to be pushed to the adapter
+    class ChangeSet
+    {
+    public:
+        ChangeSet() : mKeys(0) {}
+
+        bool isEmpty() const { return 0 == mKeys; }
+        bool has(Key key) const { return 0 != ( mKeys & ( 1ULL << key ) ); }
+        void add(Key key) { mKeys |= ( 1ULL << key ); }
+        void remove(Key key) { mKeys &= ~( 1ULL << key ); }
+        void merge(const ChangeSet &changes) { mKeys |= changes.mKeys; }
+        void subtract(const ChangeSet &changes) { mKeys &= ~changes.mKeys; }
+        void clear() { mKeys = 0; }
+        ///True when any of the keys is of the given apply class
+        bool needs(Apply apply) const { return 0 != ( mKeys & ParameterStore::applyMask(apply) ); }
+        ///Only the keys of the given apply class
+        ChangeSet only(Apply apply) const { ChangeSet c; c.mKeys = mKeys & ParameterStore::applyMask(apply); return c; }
+
+        static ChangeSet all() { ChangeSet c; c.mKeys = ( 1ULL << PARAM_COUNT ) - 1; return c; }
+
+    private:
+        uint64_t mKeys;
+    };
+
+public:
+
+    ParameterStore();
+
+    ///Precompiles the validation sets from the supported value lists in params
+    ///and takes its values as the current ones, without validating them
+    void initialize(const CameraParameters &params);
+
+    ///Validates the keys of params that differ from the store. On success the
+    ///store takes the new values and changes holds the keys that moved; on
+    ///failure nothing is taken and BAD_VALUE is returned
+    status_t update(const CameraParameters &params, ChangeSet &changes);
+
+    ///Writes the changed keys into params, removing the ones that were cleared
+    void apply(const ChangeSet &changes, CameraParameters &params) const;
+
+    int getInt(Key key) const { return mValues[key].mInt[0]; }
+    void getPair(Key key, int &first, int &second) const { first = mValues[key].mInt[0]; second = mValues[key].mInt[1]; }
+    const char* getString(Key key) const;
+    bool isSet(Key key) const { return mValues[key].mSet; }
+
+    static const char* name(Key key);
+    static Apply applyClass(Key key);
+    ///All keys of the given apply class
+    static uint64_t applyMask(Apply apply);
+
+private:
+
+    typedef struct
+        {
+        String8 mRaw;
+        int mInt[2];
+        bool mSet;
+        } Value;
+
+    ///Allowed values of a key. Empty sets and an inverted range accept anything
+    typedef struct
+        {
+        SortedVector<String8> mStrings;
+        SortedVector<int64_t> mTokens;  ///< ints, packed sizes and packed ranges
+        int mMin;
+        int mMax;
+        } Validator;
+
+    static bool parse(Type type, const char *str, int *out);
+    static int64_t token(Type type, const int *values);
+    void compile(Key key, const char *list);
+    bool validate(Key key, const char *str, const int *values) const;
+
+    Value mValues[PARAM_COUNT];
+    Validator mValidators[PARAM_COUNT];
+};
+
+};
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file PipelineStats.h
+*
+* Frame counters of one camera, kept by the adapter, display and callback
+* notifier as frames pass through them: per stage frame rate, drops, queue
+* depth and latency histogram, and how many buffers each owner holds.
+* CameraHal::dump() and the CAMERA_CMD_DUMP_PIPELINE_STATS command render
+* them.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_PIPELINE_STATS_H
+#define ANDROID_CAMERA_HARDWARE_PIPELINE_STATS_H
+
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+///Latency histogram buckets, their bounds in ms are in PipelineStats.cpp
+#define PIPELINE_LATENCY_BUCKETS 16
+
+class PipelineStats : public virtual RefBase
+{
+public:
+
+    enum Stage
+        {
+        STAGE_CAPTURE = 0,          ///< dequeued from the driver and handed to subscribers
+        STAGE_DISPLAY,              ///< queued to the preview window
+        STAGE_PREVIEW_CALLBACK,     ///< preview frame delivered to the app
+        STAGE_VIDEO,                ///< video frame delivered to the recorder
+        STAGE_ENCODE,               ///< jpeg encoded and delivered
+        STAGE_COUNT
+        };
+
+    enum Owner
+        {
+        OWNER_DRIVER = 0,           ///< V4L2 buffers queued to the driver
+        OWNER_DISPLAY,              ///< window buffers with the compositor
+        OWNER_APP,                  ///< video frames the recorder has not released yet
+        OWNER_ENCODER,              ///< captures being encoded
+        OWNER_COUNT
+        };
+
+    typedef struct
+        {
+        unsigned int mFrames;
+        unsigned int mDrops;
+        unsigned int mLastSecondFrames; ///< frames in the last complete second, the fps
+        unsigned int mQueueDepth;
+        unsigned int mQueueDepthMax;
+        nsecs_t mLatencyP50;
+        nsecs_t mLatencyP90;
+        nsecs_t mLatencyP99;
+        nsecs_t mLatencyMax;
+        } StageStats;
+
+    typedef struct
+        {
+        StageStats mStages[STAGE_COUNT];
+        int mOwned[OWNER_COUNT];
+        int mOwnedMax[OWNER_COUNT];
+        size_t mMemoryTotal;        ///< MemoryAccounting, process wide
+        size_t mMemoryPeak;
+        nsecs_t mSince;             ///< when the counters were last reset
+        } Snapshot;
+
+public:
+
+    PipelineStats();
+
+    ///A frame left the stage, latency measured from its capture timestamp
+    void frame(Stage stage, nsecs_t latency);
+    void drop(Stage stage, unsigned int count = 1);
+    void queueDepth(Stage stage, unsigned int depth);
+
+    void setOwned(Owner owner, int count);
+    void acquire(Owner owner);
+    void release(Owner owner);
+
+    void getSnapshot(Snapshot &snapshot);
+    ///Clears the counters and histograms, the buffers owned are kept
+    void reset();
+
+    status_t dump(int fd);
+    ///Same as dump(), into the log
+    void log();
+
+    static const char* getStageName(Stage stage);
+    static const char* getOwnerName(Owner owner);
+
+private:
+
+    typedef struct
+        {
+        unsigned int mFrames;
+        unsigned int mDrops;
+        unsigned int mPeriodFrames;
+        unsigned int mLastSecondFrames;
+        nsecs_t mPeriodStart;
+        unsigned int mQueueDepth;
+        unsigned int mQueueDepthMax;
+        unsigned int mHistogram[PIPELINE_LATENCY_BUCKETS];
+        nsecs_t mLatencyMax;
+        } Counters;
+
+    void resetLocked();
+    void updateOwnedLocked(Owner owner, int count);
+    nsecs_t percentileLocked(const Counters &counters, unsigned int percent) const;
+    ///Renders the snapshot one line at a time, into line
+    static bool formatLine(const Snapshot &snapshot, unsigned int index, char *line, size_t length);
+
+    Mutex mLock;
+    Counters mCounters[STAGE_COUNT];
+    int mOwned[OWNER_COUNT];
+    int mOwnedMax[OWNER_COUNT];
+    nsecs_t mSince;
+};
+
+};
+
+#endif
@@ -22,6 +22,9 @@
 #include "CameraHal.h"
 #include "BaseCameraAdapter.h"
 #include "DebugUtils.h"
+#include "FrameTransform.h"
+#include "V4LControls.h"
+#include "CapabilityCache.h"
 
 namespace android {
 
@@ -29,6 +32,16 @@ namespace android {
 #define NB_BUFFER 10
 #define DEVICE  "/dev/video0"
 #define PICNAME "/vendor/capture"
+#define MAX_ZSL_FRAMES 4
+//driver buffers that must stay queued for the stream to keep running
+#define MIN_STREAM_BUFFERS 3
+#define MAX_ZOOM_STAGES 32
+//exposure compensation is applied as a brightness offset, in percent of its range per step
+#define EV_BRIGHTNESS_STEP 10
+#define EV_STEPS 2
+//a lost camera is looked for this often, and reported to the client once missing this long
+#define DEVICE_RECOVERY_POLL ms2ns(200)
+#define DEVICE_RECOVERY_TIMEOUT ms2ns(5000)
 
 
 struct VideoInfo {
@@ -45,6 +58,13 @@ struct VideoInfo {
 };
 
 
+///A streamed frame held back for zero shutter lag capture
+struct ZslFrame {
+    int index;          ///< V4L2 buffer index, stays dequeued while held
+    nsecs_t timestamp;
+    uint32_t sharpness; ///< focus metric, only computed when selecting by sharpness
+};
+
 /**
   * Class which completely abstracts the camera hardware interaction from camera hal
   */
@@ -72,6 +92,7 @@ public:
 
     //APIs to configure Camera adapter and get the current parameter set
     virtual status_t setParameters(const CameraParameters& params);
+    virtual status_t updateParameters(const CameraParameters& params, const ParameterStore::ChangeSet& changes);
     virtual void getParameters(CameraParameters& params);
     virtual status_t takePicture();
 
@@ -91,6 +112,10 @@ protected:
     virtual status_t getFrameSize(size_t &width, size_t &height);
     virtual status_t getPictureBufferSize(size_t &length, size_t bufferCount);
     virtual status_t getFrameDataSize(size_t &dataFrameSize, size_t bufferCount);
+    virtual status_t stopImageCapture();
+    virtual status_t startSmoothZoom(int targetIdx);
+    virtual status_t stopSmoothZoom();
+    virtual status_t setState(CameraCommands operation);
     virtual void onOrientationEvent(uint32_t orientation, uint32_t tilt);
 //-----------------------------------------------------------------------------
 
@@ -117,6 +142,42 @@ private:
     char* dequeueBuffer(int &index);
     int previewThread();
 
+    //Copies a streamed frame into a free capture ring slot, cropped for zoom, and sends it for encoding
+    void captureFrame(char *src, int width, int height, const FrameTransform &transform);
+    void captureFrameDone();
+    //Sends a driver buffer, or the preview buffer copied from it, for encoding as is;
+    //the driver buffer is requeued when the encoder returns it
+    void lendDriverFrame(int index, void *buf, nsecs_t timestamp, int width, int height);
+
+    //Zero shutter lag history
+    void holdZslFrame(int index, nsecs_t timestamp, const char *src, int width, int height,
+            int depth, bool sharpest);
+    void sendZslFrame(int width, int height, bool sharpest, const FrameTransform &transform);
+    void flushZslFrames();
+    static uint32_t focusMetric(const char *src, int width, int height);
+
+    //Driver buffers are requeued once preview, ZSL and capture all let go
+    void releaseDriverBuffer(int index);
+
+    //Maps num driver buffers for the current format, replacing any kept ones
+    status_t allocateDriverBuffers(int num);
+    //Unmaps and frees the driver buffers, they are otherwise kept across preview restarts
+    void releaseDriverBuffers();
+    //Sets the mappings of a lost handle aside, a ZSL frame may still be lent out of them
+    void retireDriverBuffers();
+
+    //A camera that was reset or replugged is reopened and streams into the same preview buffers
+    static bool isDeviceLost(int error);
+    status_t recoverDevice();
+    status_t reopenDevice(const char *node);
+
+    //Digital zoom and rotation applied while copying into the display buffers
+    void advanceZoom(FrameTransform &transform, int width, int height);
+
+    //Sensor image controls, published as camera properties and requested from the parameters
+    void publishControls(CameraProperties::Properties* properties);
+    void requestControls(const CameraParameters &params);
+
 public:
 
 private:
@@ -127,7 +188,7 @@ private:
     CameraParameters mParams;
 
     bool mPreviewing;
-    bool mCapturing;
+    bool mCapturing;    ///< protected by mCaptureLock
     Mutex mLock;
 
     int mFrameCount;
@@ -139,17 +200,76 @@ private:
     float mFPS, mLastFPS;
 
     int mSensorIndex;
+    char mDevice[32];   ///< video node this adapter streams from
+    unsigned int mDeviceGeneration;     ///< DeviceManager generation mDevice was opened in
+    int mDequeueError;  ///< errno of the last failed VIDIOC_DQBUF
+
+    //Device recovery, written by the preview thread only
+    unsigned int mRecoveries;
+    nsecs_t mLastRecoveryTime;
+    nsecs_t mMaxRecoveryTime;
 
      // protected by mLock
     sp<PreviewThread>   mPreviewThread;
 
+    //The preview thread is parked instead of joined when preview stops, protected by mPreviewThreadLock
+    Mutex mPreviewThreadLock;
+    Condition mPreviewThreadCondition;
+    bool mPreviewThreadIdle;    ///< parked, no frame or driver buffer in use
+    bool mPreviewThreadExit;
+
+    //Mapped driver buffers, reused by the next preview while the count matches and the frame fits
+    int mDriverBufferCount;
+    size_t mDriverBufferLength;
+    int mDriverBufferTarget;    ///< count mapped ahead of preview start, 0 disables it
+    void *mRetiredMem[NB_BUFFER];
+    int mRetiredCount;
+    size_t mRetiredLength;
+
     struct VideoInfo *mVideoInfo;
-    char * mFrameBuffer;
     int mCameraHandle;
 
+    //Still capture is served from the preview stream, protected by mCaptureLock
+    Mutex mCaptureLock;
+    int mCaptureFramesPending;
+    int mCaptureFramesSkipped;
+    bool mVideoSnapshot;    ///< taken while recording, the streamed preview buffer itself is encoded
+
+    //ZSL ring, owned by the preview thread; mZslHistory, mZslSharpest and mZslRequested
+    //are protected by mCaptureLock, the preview thread reads them once per frame
+    ZslFrame mZslRing[MAX_ZSL_FRAMES];
+    int mZslHead;
+    int mZslCount;
+    int mZslHistory;
+    bool mZslSharpest;
+    bool mZslRequested;
+    nsecs_t mZslShutterTime;
+
+    Mutex mBufferRefLock;
+    int mBufferRefs[NB_BUFFER];
+    char *mPreviewBufByIndex[NB_BUFFER];
+
+    //Zoom and rotation, protected by mZoomLock
+    Mutex mZoomLock;
+    int mZoomRatios[MAX_ZOOM_STAGES];
+    int mZoomStages;
+    int mCurrentZoomIdx;
+    int mTargetZoomIdx;
+    bool mSmoothZoom;
+    bool mZoomDone;         ///< smooth zoom reached its target, leave the zoom state on the next command
+    int mPreviewRotation;   ///< fixed rotation, or -1 to follow the orientation sensor
+    int mSensorRotation;
+
+    //Requests are coalesced and written from the preview thread at most once per CONTROL_COMMIT_INTERVAL
+    V4LControls mControls;
+    CapabilityCache mCapabilities;  ///< what initialize() would otherwise enumerate, kept across opens
+    int mExposureAutoMode;  ///< auto exposure mode restored when the exposure lock is released
+
     int mBufferIndex;
     int nQueued;
     int nDequeued;
+    int mLastSequence;  ///< V4L2 sequence of the last frame dequeued, -1 at stream start
+    uint32_t mFrameSequence;    ///< frames dequeued since open, never reset so trace numbers stay unique
 
 };
 };
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file V4LControls.h
+*
+* Cached V4L2 image controls. Requests are only recorded, commit() writes the
+* ones that differ from the sensor in one VIDIOC_S_EXT_CTRLS per control class
+* and at most once per CONTROL_COMMIT_INTERVAL, so a slider drag costs a few
+* USB control transfers instead of one per step.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_V4L_CONTROLS_H
+#define ANDROID_CAMERA_HARDWARE_V4L_CONTROLS_H
+
+#include <linux/videodev2.h>
+#include <utils/Errors.h>
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+namespace android {
+
+class CapabilityCache;
+
+///Requests coming in faster than this are coalesced into the next commit
+#define CONTROL_COMMIT_INTERVAL ms2ns(50)
+
+class V4LControls
+{
+public:
+
+    ///Controls the HAL drives, in the order they are written within a transaction
+    enum Control
+        {
+        CONTROL_BRIGHTNESS = 0,
+        CONTROL_CONTRAST,
+        CONTROL_SATURATION,
+        CONTROL_SHARPNESS,
+        CONTROL_AUTO_WHITE_BALANCE,         ///< before the temperature, which is inactive while it is on
+        CONTROL_WHITE_BALANCE_TEMPERATURE,
+        CONTROL_POWER_LINE_FREQUENCY,
+        CONTROL_EXPOSURE_AUTO,
+        CONTROL_COUNT
+        };
+
+    typedef struct
+        {
+        unsigned int mCommits;      ///< commits that wrote at least one control
+        unsigned int mDeferred;     ///< commits postponed by the interval
+        unsigned int mIoctls;       ///< every control ioctl, queries included
+        unsigned int mWritten;      ///< control values written to the sensor
+        unsigned int mCoalesced;    ///< requests replaced before they were written
+        unsigned int mFailed;       ///< control values the driver refused
+        nsecs_t mLastApplyTime;     ///< from the first pending request to the end of its commit
+        nsecs_t mMaxApplyTime;
+        nsecs_t mLastIoctlTime;     ///< time spent in the write ioctls of the last commit
+        nsecs_t mMaxIoctlTime;
+        } Stats;
+
+public:
+
+    V4LControls();
+
+    ///Queries every control once and reads back the current values. Query results come
+    ///from cache when it is valid for the device, otherwise they are recorded into it
+    status_t initialize(int fd, CapabilityCache *cache);
+
+    ///Moves the controls to a reopened handle of the same device. The query results are kept,
+    ///values the device lost in a reset are requested again for the next commit()
+    status_t reattach(int fd);
+
+    bool isSupported(Control control) const;
+    int getMinimum(Control control) const;
+    int getMaximum(Control control) const;
+    ///Value read at initialize() or last written
+    int getCurrent(Control control) const;
+    ///Current value in percent of the control range
+    int getPercent(Control control) const;
+    ///Driver default in percent of the control range
+    int getDefaultPercent(Control control) const;
+
+    ///Records a request, clamped and stepped to the control range. Nothing is written until commit()
+    void set(Control control, int value);
+    ///Records a request in percent of the control range. The current value is kept when it already
+    ///maps to the same percent, so reapplying a published percent does not move the sensor
+    void setPercent(Control control, int percent);
+    ///Records a request for the driver default
+    void setDefault(Control control);
+
+    bool isPending() const;
+
+    ///Writes the pending requests that differ from the current values. Unless force is set,
+    ///a commit within CONTROL_COMMIT_INTERVAL of the previous one is deferred and its requests
+    ///stay pending for the next call
+    status_t commit(bool force);
+
+    void getStats(Stats &stats) const;
+
+private:
+
+    typedef struct
+        {
+        struct v4l2_queryctrl mQuery;
+        bool mSupported;
+        int mCurrent;
+        int mRequested;
+        bool mPending;
+        } Entry;
+
+    static int percentOf(const Entry &entry, int value);
+    int clamp(const Entry &entry, int value) const;
+
+    int mFd;
+    Entry mEntries[CONTROL_COUNT];
+    bool mExtSupported;             ///< cleared when the driver has no extended control ioctls
+    nsecs_t mLastCommit;
+    nsecs_t mFirstPending;          ///< time of the oldest request not yet written
+    Stats mStats;
+
+    mutable Mutex mLock;            ///< entries and stats
+    Mutex mCommitLock;              ///< one commit at a time, held across the ioctls
+};
+
+};
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CacheBench.cpp
+*
+* Compares CPU work on cached and uncached capture buffers: a plain read
+* pass, the capture copy into the buffer, and a full JPEG encode with
+* thumbnail as AppCallbackNotifier runs it. -m picks the memory backend, so
+* the same passes run on ION, dma-heap or memfd buffers.
+*
+*/
+
+#include "CameraHal.h"
+#include "Encoder_libjpeg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace android {
+
+#define BENCH_DEFAULT_WIDTH 640
+#define BENCH_DEFAULT_HEIGHT 480
+#define BENCH_DEFAULT_ITERATIONS 10
+#define BENCH_THUMB_WIDTH 160
+#define BENCH_THUMB_HEIGHT 120
+#define BENCH_QUALITY 90
+
+	typedef struct
+		{
+		nsecs_t mRead;
+		nsecs_t mCopy;
+		nsecs_t mEncode;
+		bool mCached;
+		} PassTimes;
+
+	static Mutex sEncodeLock;
+	static Condition sEncodeDone;
+	static bool sEncoded;
+
+	static void encodeDone(void* main_jpeg, void* thumb_jpeg, CameraFrame::FrameType type,
+			void* cookie1, void* cookie2, void* cookie3)
+	{
+		Mutex::Autolock lock(sEncodeLock);
+		sEncoded = true;
+		sEncodeDone.signal();
+	}
+
+	// gradient plus noise, so the encoder has realistic work to do
+	static void fillFrame(uint8_t* frame, int width, int height, int stride)
+	{
+		uint32_t seed = 12345;
+
+		for (int y = 0; y < height; y++) {
+			uint8_t* row = frame + y * stride;
+			for (int x = 0; x < width * 2; x++) {
+				seed = seed * 1103515245 + 12345;
+				row[x] = (uint8_t) (((x + y) & 0xFF) ^ ((seed >> 16) & 0x1F));
+			}
+		}
+	}
+
+	static uint32_t readPass(const uint8_t* buf, size_t bytes)
+	{
+		const uint32_t* p = (const uint32_t*) buf;
+		uint32_t sum = 0;
+
+		for (size_t i = 0; i < bytes / 4; i++) {
+			sum += p[i];
+		}
+
+		return sum;
+	}
+
+	static nsecs_t encode(uint8_t* src, int width, int height, int stride, size_t length)
+	{
+		Encoder_libjpeg::params main_jpeg;
+		Encoder_libjpeg::params tn_jpeg;
+		nsecs_t start;
+
+		memset(&main_jpeg, 0, sizeof(main_jpeg));
+		main_jpeg.src = src;
+		main_jpeg.src_size = length;
+		main_jpeg.dst = (uint8_t*) malloc(length);
+		main_jpeg.dst_size = length;
+		main_jpeg.quality = BENCH_QUALITY;
+		main_jpeg.in_width = width;
+		main_jpeg.in_height = height;
+		main_jpeg.in_stride = stride;
+		main_jpeg.out_width = width;
+		main_jpeg.out_height = height;
+		main_jpeg.format = CameraParameters::PIXEL_FORMAT_YUV422I;
+
+		tn_jpeg = main_jpeg;
+		tn_jpeg.dst_size = EXIF_THUMBNAIL_MAX_SIZE;
+		tn_jpeg.dst = (uint8_t*) malloc(tn_jpeg.dst_size);
+		tn_jpeg.out_width = BENCH_THUMB_WIDTH;
+		tn_jpeg.out_height = BENCH_THUMB_HEIGHT;
+
+		if ( (NULL == main_jpeg.dst) || (NULL == tn_jpeg.dst) ) {
+			free(main_jpeg.dst);
+			free(tn_jpeg.dst);
+			return -1;
+		}
+
+		sEncoded = false;
+		start = systemTime();
+
+		// the encoder holds a reference on itself until its thread is done
+		sp<Encoder_libjpeg> encoder = new Encoder_libjpeg(&main_jpeg, &tn_jpeg, encodeDone,
+				CameraFrame::IMAGE_FRAME, NULL, NULL, NULL);
+		encoder->run();
+
+		{
+			Mutex::Autolock lock(sEncodeLock);
+			while (!sEncoded) {
+				sEncodeDone.wait(sEncodeLock);
+			}
+		}
+
+		nsecs_t elapsed = systemTime() - start;
+		encoder->join();
+
+		free(main_jpeg.dst);
+		free(tn_jpeg.dst);
+
+		return elapsed;
+	}
+
+	static int runPass(MemoryManager* mm, bool cached, int width, int height,
+			int iterations, PassTimes &times)
+	{
+		int bytes = 0;
+		PlaneLayout layout;
+		uint8_t* frame;
+		uint8_t* src;
+		uint32_t* bufs;
+		volatile uint32_t sink = 0;
+
+		bufs = (uint32_t*) mm->allocateBuffer(width, height, CameraParameters::PIXEL_FORMAT_YUV422I,
+				bytes, 1, cached);
+		if ( (NULL == bufs) || (NO_ERROR != mm->getLayout(bufs, layout)) ) {
+			printf("allocation failed\n");
+			return -1;
+		}
+
+		mm->beginCpuAccess(bufs, MemoryManager::CPU_ACCESS_READ | MemoryManager::CPU_ACCESS_WRITE);
+		frame = (uint8_t*) bufs[0];
+
+		// the driver side frame the capture path copies from is ordinary memory
+		src = (uint8_t*) malloc(width * height * 2);
+		if (NULL == src) {
+			mm->freeBuffers(bufs);
+			return -1;
+		}
+		fillFrame(src, width, height, width * 2);
+
+		memset(&times, 0, sizeof(times));
+		times.mCached = cached;
+
+		for (int i = 0; i < iterations; i++) {
+			nsecs_t start = systemTime();
+			for (int y = 0; y < height; y++) {
+				memcpy(frame + y * layout.mStride[0], src + y * width * 2, width * 2);
+			}
+			times.mCopy += systemTime() - start;
+
+			start = systemTime();
+			sink += readPass(frame, layout.mStride[0] * height);
+			times.mRead += systemTime() - start;
+
+			nsecs_t encodeTime = encode(frame, width, height, layout.mStride[0], bytes);
+			if (encodeTime < 0) {
+				free(src);
+				mm->freeBuffers(bufs);
+				return -1;
+			}
+			times.mEncode += encodeTime;
+		}
+
+		free(src);
+		mm->freeBuffers(bufs);
+
+		times.mRead /= iterations;
+		times.mCopy /= iterations;
+		times.mEncode /= iterations;
+
+		return 0;
+	}
+
+	static void printPass(const PassTimes &times, size_t bytes)
+	{
+		double mb = bytes / (1024.0 * 1024.0);
+
+		printf("%-9s read %7.3f ms (%6.1f MB/s)  copy in %7.3f ms (%6.1f MB/s)  encode %8.3f ms\n",
+			   times.mCached ? "cached" : "uncached",
+			   times.mRead / 1000000.0, mb * 1000000000.0 / (times.mRead ? times.mRead : 1),
+			   times.mCopy / 1000000.0, mb * 1000000000.0 / (times.mCopy ? times.mCopy : 1),
+			   times.mEncode / 1000000.0);
+	}
+
+};
+
+using namespace android;
+
+int main(int argc, char **argv)
+{
+	int width = BENCH_DEFAULT_WIDTH;
+	int height = BENCH_DEFAULT_HEIGHT;
+	int iterations = BENCH_DEFAULT_ITERATIONS;
+	const char* backend = NULL;
+	PassTimes uncached, cached;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w:h:n:m:")) != -1) {
+		switch (opt) {
+			case 'w': width = atoi(optarg); break;
+			case 'h': height = atoi(optarg); break;
+			case 'n': iterations = atoi(optarg); break;
+			case 'm': backend = optarg; break;
+			default:
+				printf("usage: %s [-w width] [-h height] [-n iterations] [-m ion|dmaheap|memfd]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if ( (width < BENCH_THUMB_WIDTH) || (height < BENCH_THUMB_HEIGHT) || (width & 1) || (iterations < 1) ) {
+		printf("usage: %s [-w width] [-h height] [-n iterations] [-m ion|dmaheap|memfd]\n", argv[0]);
+		return 1;
+	}
+
+	sp<MemoryManager> mm = new MemoryManager(backend);
+	if (NO_ERROR != mm->initialize()) {
+		printf("no memory backend available\n");
+		return 1;
+	}
+
+	// no pooling, every pass maps fresh buffers from its own heap
+	mm->setPoolCap(0);
+
+	if ( (0 != runPass(mm.get(), false, width, height, iterations, uncached)) ||
+			(0 != runPass(mm.get(), true, width, height, iterations, cached)) ) {
+		return 1;
+	}
+
+	printf("%dx%d YUYV, %d iterations, %s backend\n", width, height, iterations,
+		   backend ? backend : "default");
+	printPass(uncached, width * height * 2);
+	printPass(cached, width * height * 2);
+	printf("encode speedup %.2fx\n", (double) uncached.mEncode / (cached.mEncode ? cached.mEncode : 1));
+
+	return 0;
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file DisplayBench.cpp
+*
+* Drives ANativeWindowDisplayAdapter with a synthetic camera and the fake
+* preview window, then reports throughput, per stage latency and where the
+* buffers spent their time.
+*
+*/
+
+#include "ANativeWindowDisplayAdapter.h"
+#include "FakePreviewWindow.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace android {
+
+	// normally defined by CameraHal.cpp, which the bench does not link
+	const uint32_t MessageNotifier::EVENT_BIT_FIELD_POSITION = 0;
+	const uint32_t MessageNotifier::FRAME_BIT_FIELD_POSITION = 0;
+
+#define BENCH_DEFAULT_WIDTH 640
+#define BENCH_DEFAULT_HEIGHT 480
+#define BENCH_DEFAULT_FPS 30
+#define BENCH_DEFAULT_SECONDS 10
+#define BENCH_DEFAULT_BUFFERS 6
+#define BENCH_DEFAULT_UNDEQUEUED 2
+#define BENCH_DEFAULT_LATENCY_MS 8
+#define BENCH_DEFAULT_REFRESH 60
+
+	typedef struct
+		{
+		int mWidth;
+		int mHeight;
+		int mFps;
+		int mSeconds;
+		int mBuffers;
+		int mMinUndequeued;
+		int mLatencyMs;
+		int mRefreshHz;
+		bool mFill;
+		} BenchConfig;
+
+	///Stands in for the camera adapter, owns nothing but the buffer bookkeeping
+	class FakeCamera : public FrameNotifier
+	{
+	public:
+
+		typedef struct
+			{
+			unsigned int mSent;
+			unsigned int mStarved;      ///< ticks with no buffer to fill
+			unsigned int mReturned;
+			nsecs_t mDeliverTotal;      ///< time spent inside the frame callback
+			nsecs_t mDeliverMax;
+			nsecs_t mRoundTripTotal;    ///< frame sent until the buffer came back
+			nsecs_t mRoundTripMax;
+			} Stats;
+
+		FakeCamera() : mCallback(NULL), mCookie(NULL)
+		{
+			memset(&mStats, 0, sizeof(mStats));
+		}
+
+		virtual void enableMsgType(int32_t msgs, frame_callback frameCb, event_callback eventCb, void* cookie)
+		{
+			Mutex::Autolock lock(mLock);
+			if (msgs & CameraFrame::PREVIEW_FRAME_SYNC) {
+				mCallback = frameCb;
+				mCookie = cookie;
+			}
+		}
+
+		virtual void disableMsgType(int32_t msgs, void* cookie)
+		{
+			Mutex::Autolock lock(mLock);
+			if (msgs & CameraFrame::PREVIEW_FRAME_SYNC) {
+				mCallback = NULL;
+			}
+		}
+
+		virtual void returnFrame(void* frameBuf, CameraFrame::FrameType frameType)
+		{
+			Mutex::Autolock lock(mLock);
+			ssize_t index = mSentAt.indexOfKey(frameBuf);
+
+			if (index >= 0) {
+				nsecs_t roundTrip = systemTime() - mSentAt.valueAt(index);
+				mSentAt.removeItemsAt(index);
+				mStats.mReturned++;
+				mStats.mRoundTripTotal += roundTrip;
+				if (roundTrip > mStats.mRoundTripMax) {
+					mStats.mRoundTripMax = roundTrip;
+				}
+			}
+
+			addFree(frameBuf);
+		}
+
+		virtual void addFramePointers(void *frameBuf, void *buf)
+		{
+			Mutex::Autolock lock(mLock);
+			addFree(frameBuf);
+		}
+
+		virtual void removeFramePointers()
+		{
+			Mutex::Autolock lock(mLock);
+			mFree.clear();
+			mSentAt.clear();
+		}
+
+		void sendFrame(int width, int height, bool fill)
+		{
+			frame_callback callback;
+			CameraFrame frame;
+			void *buf;
+			unsigned int seq;
+
+			{
+				Mutex::Autolock lock(mLock);
+
+				callback = mCallback;
+				if (NULL == callback) {
+					return;
+				}
+
+				if (mFree.isEmpty()) {
+					mStats.mStarved++;
+					return;
+				}
+
+				buf = mFree[0];
+				mFree.removeAt(0);
+				frame.mCookie = mCookie;
+				frame.mTimestamp = systemTime();
+				mSentAt.add(buf, frame.mTimestamp);
+				seq = ++mStats.mSent;
+			}
+
+			// the copy a real sensor would cost, or just a stripe to see frames move
+			if (fill) {
+				memset(buf, seq & 0xFF, width * height * 2);
+			} else {
+				memset(buf, seq & 0xFF, width * 2);
+			}
+
+			frame.mBuffer = buf;
+			frame.mFrameType = CameraFrame::PREVIEW_FRAME_SYNC;
+			frame.mWidth = width;
+			frame.mHeight = height;
+			frame.mAlignment = width * 2;
+			frame.mLength = width * height * 2;
+
+			callback(&frame);
+
+			nsecs_t deliver = systemTime() - frame.mTimestamp;
+			Mutex::Autolock lock(mLock);
+			mStats.mDeliverTotal += deliver;
+			if (deliver > mStats.mDeliverMax) {
+				mStats.mDeliverMax = deliver;
+			}
+		}
+
+		int freeCount()
+		{
+			Mutex::Autolock lock(mLock);
+			return mFree.size();
+		}
+
+		void getStats(Stats &stats)
+		{
+			Mutex::Autolock lock(mLock);
+			stats = mStats;
+		}
+
+	private:
+
+		void addFree(void *buf)
+		{
+			for (size_t i = 0; i < mFree.size(); i++) {
+				if (buf == mFree[i]) {
+					return;
+				}
+			}
+			mFree.add(buf);
+		}
+
+		Mutex mLock;
+		frame_callback mCallback;
+		void *mCookie;
+		Vector<void *> mFree;
+		KeyedVector<void *, nsecs_t> mSentAt;
+		Stats mStats;
+	};
+
+	static double toMs(nsecs_t t)
+	{
+		return t / 1000000.0;
+	}
+
+	static double average(nsecs_t total, unsigned int count)
+	{
+		return count ? toMs(total) / count : 0.0;
+	}
+
+	static void usage(const char *name)
+	{
+		printf("usage: %s [-w width] [-h height] [-f fps] [-t seconds] [-b buffers]\n"
+			   "       [-u min undequeued] [-l compositor latency ms] [-r refresh Hz] [-c]\n"
+			   "  -c fills every frame, otherwise only the first line is written\n", name);
+	}
+
+	static int runBench(const BenchConfig &config)
+	{
+		FakePreviewWindow window(config.mMinUndequeued, ms2ns(config.mLatencyMs), config.mRefreshHz);
+		FakeCamera camera;
+		sp<ANativeWindowDisplayAdapter> display = new ANativeWindowDisplayAdapter();
+		ANativeWindowDisplayAdapter::DisplayStats displayStats;
+		FakePreviewWindow::Stats windowStats;
+		FakePreviewWindow::Occupancy occupancy;
+		FakeCamera::Stats cameraStats;
+		int bytes = 0;
+		void *buffers;
+		unsigned int samples = 0;
+		int maxQueued = 0;
+		double camTotal = 0, dequeuedTotal = 0, queuedTotal = 0, screenTotal = 0, freeTotal = 0;
+
+		if ( (NO_ERROR != display->initialize()) || (NO_ERROR != window.start()) ) {
+			printf("setup failed\n");
+			return -1;
+		}
+
+		display->setBufferMapper(FakePreviewWindow::mapper());
+		display->setPreviewWindow(window.window());
+		display->setFrameProvider(&camera);
+
+		buffers = display->allocateBuffer(config.mWidth, config.mHeight,
+				CameraParameters::PIXEL_FORMAT_YUV422I, bytes, config.mBuffers);
+		if (NULL == buffers) {
+			printf("buffer allocation failed\n");
+			return -1;
+		}
+
+		if (NO_ERROR != display->enableDisplay(config.mWidth, config.mHeight)) {
+			printf("enableDisplay failed\n");
+			display->freeBuffers(buffers);
+			return -1;
+		}
+
+		const nsecs_t period = s2ns(1) / config.mFps;
+		const nsecs_t start = systemTime();
+		const nsecs_t end = start + s2ns(config.mSeconds);
+		nsecs_t next = start;
+
+		while (next < end) {
+			camera.sendFrame(config.mWidth, config.mHeight, config.mFill);
+
+			window.getOccupancy(occupancy);
+			camTotal += camera.freeCount();
+			freeTotal += occupancy.mFree;
+			dequeuedTotal += occupancy.mDequeued;
+			queuedTotal += occupancy.mQueued;
+			screenTotal += occupancy.mOnScreen;
+			if (occupancy.mQueued > maxQueued) {
+				maxQueued = occupancy.mQueued;
+			}
+			samples++;
+
+			next += period;
+			nsecs_t now = systemTime();
+			if (next > now) {
+				usleep(ns2us(next - now));
+			}
+		}
+
+		const nsecs_t elapsed = systemTime() - start;
+
+		display->disableDisplay();
+		display->freeBuffers(buffers);
+		window.stop();
+
+		camera.getStats(cameraStats);
+		window.getStats(windowStats);
+		display->getDisplayStats(displayStats);
+
+		const double seconds = elapsed / 1000000000.0;
+
+		printf("%dx%d @ %d fps for %.2f s, %d buffers, %d undequeued, %d ms compositor latency, %d Hz\n",
+			   config.mWidth, config.mHeight, config.mFps, seconds, config.mBuffers,
+			   config.mMinUndequeued, config.mLatencyMs, config.mRefreshHz);
+
+		printf("\nthroughput\n");
+		printf("  produced   %6u  %6.1f fps  (%u ticks starved)\n",
+			   cameraStats.mSent, cameraStats.mSent / seconds, cameraStats.mStarved);
+		printf("  posted     %6u  %6.1f fps  (%u dropped by pacing)\n",
+			   displayStats.mFramesDisplayed, displayStats.mFramesDisplayed / seconds,
+			   displayStats.mFramesDropped);
+		printf("  on screen  %6u  %6.1f fps\n",
+			   windowStats.mDisplayed, windowStats.mDisplayed / seconds);
+
+		printf("\nlatency ms           avg      max\n");
+		printf("  frame callback  %7.3f  %7.3f\n",
+			   average(cameraStats.mDeliverTotal, cameraStats.mSent), toMs(cameraStats.mDeliverMax));
+		printf("  dequeue wait    %7.3f  %7.3f\n",
+			   average(windowStats.mDequeueWaitTotal, windowStats.mDequeues), toMs(windowStats.mDequeueWaitMax));
+		printf("  queue to screen %7.3f  %7.3f\n",
+			   average(windowStats.mQueueToScreenTotal, windowStats.mDisplayed), toMs(windowStats.mQueueToScreenMax));
+		printf("  buffer round    %7.3f  %7.3f\n",
+			   average(cameraStats.mRoundTripTotal, cameraStats.mReturned), toMs(cameraStats.mRoundTripMax));
+
+		printf("\nbuffer occupancy (average per tick)\n");
+		if (samples > 0) {
+			printf("  camera free %.2f  window free %.2f  dequeued %.2f  queued %.2f (max %d)  on screen %.2f\n",
+				   camTotal / samples, freeTotal / samples, dequeuedTotal / samples,
+				   queuedTotal / samples, maxQueued, screenTotal / samples);
+		}
+
+		printf("\nwindow  dequeues %u  enqueues %u  cancels %u\n",
+			   windowStats.mDequeues, windowStats.mEnqueues, windowStats.mCancels);
+		printf("gralloc lock failures %u  recovered %u  abandoned %u\n",
+			   displayStats.mLockFailures, displayStats.mLockRecovered, displayStats.mLockAbandoned);
+
+		return 0;
+	}
+
+};
+
+using namespace android;
+
+int main(int argc, char **argv)
+{
+	BenchConfig config;
+	int opt;
+
+	config.mWidth = BENCH_DEFAULT_WIDTH;
+	config.mHeight = BENCH_DEFAULT_HEIGHT;
+	config.mFps = BENCH_DEFAULT_FPS;
+	config.mSeconds = BENCH_DEFAULT_SECONDS;
+	config.mBuffers = BENCH_DEFAULT_BUFFERS;
+	config.mMinUndequeued = BENCH_DEFAULT_UNDEQUEUED;
+	config.mLatencyMs = BENCH_DEFAULT_LATENCY_MS;
+	config.mRefreshHz = BENCH_DEFAULT_REFRESH;
+	config.mFill = false;
+
+	while ((opt = getopt(argc, argv, "w:h:f:t:b:u:l:r:c")) != -1) {
+		switch (opt) {
+			case 'w': config.mWidth = atoi(optarg); break;
+			case 'h': config.mHeight = atoi(optarg); break;
+			case 'f': config.mFps = atoi(optarg); break;
+			case 't': config.mSeconds = atoi(optarg); break;
+			case 'b': config.mBuffers = atoi(optarg); break;
+			case 'u': config.mMinUndequeued = atoi(optarg); break;
+			case 'l': config.mLatencyMs = atoi(optarg); break;
+			case 'r': config.mRefreshHz = atoi(optarg); break;
+			case 'c': config.mFill = true; break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if ( (config.mWidth <= 0) || (config.mHeight <= 0) || (config.mFps <= 0) ||
+			(config.mSeconds <= 0) || (config.mBuffers <= config.mMinUndequeued) ) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	return runBench(config) ? 1 : 0;
+}
@@ -0,0 +1,424 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FakePreviewWindow.cpp
+*
+* Malloc backed preview_stream_ops with a simulated compositor.
+*
+*/
+
+#include "FakePreviewWindow.h"
+#include <cutils/native_handle.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace android {
+
+///Bytes per pixel reserved for each buffer, enough for YUYV and NV12
+#define FAKE_WINDOW_BPP 2
+///How long dequeue_buffer waits for the compositor before giving up
+#define DEQUEUE_TIMEOUT s2ns(1)
+
+	FakePreviewWindow *FakePreviewWindow::sActive = NULL;
+
+	FakePreviewWindow::FakePreviewWindow(int minUndequeued, nsecs_t compositorLatency, int refreshHz)
+	: mBuffers(NULL),
+	  mBufferCount(0),
+	  mWidth(0),
+	  mHeight(0),
+	  mOnScreen(-1),
+	  mRunning(false),
+	  mMinUndequeued(minUndequeued),
+	  mLatency(compositorLatency)
+	{
+		memset(&mWindow, 0, sizeof(mWindow));
+		mWindow.mSelf = this;
+		mWindow.mOps.dequeue_buffer = dequeue_buffer;
+		mWindow.mOps.enqueue_buffer = enqueue_buffer;
+		mWindow.mOps.cancel_buffer = cancel_buffer;
+		mWindow.mOps.set_buffer_count = set_buffer_count;
+		mWindow.mOps.set_buffers_geometry = set_buffers_geometry;
+		mWindow.mOps.set_crop = set_crop;
+		mWindow.mOps.set_usage = set_usage;
+		mWindow.mOps.set_swap_interval = set_swap_interval;
+		mWindow.mOps.get_min_undequeued_buffer_count = get_min_undequeued_buffer_count;
+		mWindow.mOps.lock_buffer = lock_buffer;
+
+		mRefreshPeriod = s2ns(1) / ((refreshHz > 0) ? refreshHz : 60);
+		memset(&mStats, 0, sizeof(mStats));
+
+		sActive = this;
+	}
+
+	FakePreviewWindow::~FakePreviewWindow()
+	{
+		stop();
+		freeBuffers();
+
+		if (this == sActive) {
+			sActive = NULL;
+		}
+	}
+
+	preview_stream_ops_t* FakePreviewWindow::window()
+	{
+		return &mWindow.mOps;
+	}
+
+	const ANativeWindowDisplayAdapter::BufferMapperOps* FakePreviewWindow::mapper()
+	{
+		static const ANativeWindowDisplayAdapter::BufferMapperOps ops = {
+			mapper_lock,
+			mapper_unlock
+		};
+
+		return &ops;
+	}
+
+	status_t FakePreviewWindow::start()
+	{
+		Mutex::Autolock lock(mLock);
+
+		if (mRunning) {
+			return NO_ERROR;
+		}
+
+		mRunning = true;
+		mCompositor = new CompositorThread(this);
+		if ( NULL == mCompositor.get() ) {
+			mRunning = false;
+			return NO_MEMORY;
+		}
+
+		return mCompositor->run("FakeCompositor", PRIORITY_DISPLAY);
+	}
+
+	void FakePreviewWindow::stop()
+	{
+		sp<CompositorThread> compositor;
+
+		{
+			Mutex::Autolock lock(mLock);
+			mRunning = false;
+			compositor = mCompositor;
+			mCompositor.clear();
+			mFreeCondition.broadcast();
+		}
+
+		if ( NULL != compositor.get() ) {
+			compositor->requestExitAndWait();
+		}
+	}
+
+	void FakePreviewWindow::getStats(Stats &stats)
+	{
+		Mutex::Autolock lock(mLock);
+		stats = mStats;
+	}
+
+	void FakePreviewWindow::getOccupancy(Occupancy &occupancy)
+	{
+		Mutex::Autolock lock(mLock);
+
+		memset(&occupancy, 0, sizeof(occupancy));
+		for (int i = 0; i < mBufferCount; i++) {
+			switch (mBuffers[i].mState) {
+				case BUFFER_FREE:
+					occupancy.mFree++;
+					break;
+				case BUFFER_DEQUEUED:
+					occupancy.mDequeued++;
+					break;
+				case BUFFER_QUEUED:
+					occupancy.mQueued++;
+					break;
+				case BUFFER_ON_SCREEN:
+					occupancy.mOnScreen++;
+					break;
+			}
+		}
+	}
+
+	FakePreviewWindow* FakePreviewWindow::self(const preview_stream_ops_t *w)
+	{
+		return ((const Window *) w)->mSelf;
+	}
+
+	int FakePreviewWindow::findBuffer(buffer_handle_t *buffer)
+	{
+		if (NULL == buffer) {
+			return -1;
+		}
+
+		for (int i = 0; i < mBufferCount; i++) {
+			if (*buffer == mBuffers[i].mHandle) {
+				return i;
+			}
+		}
+
+		return -1;
+	}
+
+	void FakePreviewWindow::freeBuffers()
+	{
+		for (int i = 0; i < mBufferCount; i++) {
+			native_handle_delete(mBuffers[i].mHandle);
+			free(mBuffers[i].mData);
+		}
+
+		delete [] mBuffers;
+		mBuffers = NULL;
+		mBufferCount = 0;
+		mOnScreen = -1;
+		mQueue.clear();
+	}
+
+	int FakePreviewWindow::dequeue_buffer(preview_stream_ops_t *w, buffer_handle_t **buffer, int *stride)
+	{
+		FakePreviewWindow *win = self(w);
+		Mutex::Autolock lock(win->mLock);
+		nsecs_t start = systemTime();
+		int index = -1;
+
+		for (;;) {
+			for (int i = 0; i < win->mBufferCount; i++) {
+				if (BUFFER_FREE == win->mBuffers[i].mState) {
+					index = i;
+					break;
+				}
+			}
+
+			if ( (index >= 0) || !win->mRunning ) {
+				break;
+			}
+
+			if ( NO_ERROR != win->mFreeCondition.waitRelative(win->mLock, DEQUEUE_TIMEOUT) ) {
+				break;
+			}
+		}
+
+		if (index < 0) {
+			return -EBUSY;
+		}
+
+		Buffer &b = win->mBuffers[index];
+		if (NULL == b.mData) {
+			b.mData = malloc(win->mWidth * win->mHeight * FAKE_WINDOW_BPP);
+			if (NULL == b.mData) {
+				return -ENOMEM;
+			}
+		}
+
+		nsecs_t wait = systemTime() - start;
+		win->mStats.mDequeues++;
+		win->mStats.mDequeueWaitTotal += wait;
+		if (wait > win->mStats.mDequeueWaitMax) {
+			win->mStats.mDequeueWaitMax = wait;
+		}
+
+		b.mState = BUFFER_DEQUEUED;
+		*buffer = &b.mHandleSlot;
+		*stride = win->mWidth;
+
+		return 0;
+	}
+
+	int FakePreviewWindow::enqueue_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer)
+	{
+		FakePreviewWindow *win = self(w);
+		Mutex::Autolock lock(win->mLock);
+		int index = win->findBuffer(buffer);
+
+		if ( (index < 0) || (BUFFER_DEQUEUED != win->mBuffers[index].mState) ) {
+			return -EINVAL;
+		}
+
+		win->mBuffers[index].mState = BUFFER_QUEUED;
+		win->mBuffers[index].mQueuedAt = systemTime();
+		win->mQueue.push_back(index);
+		win->mStats.mEnqueues++;
+
+		return 0;
+	}
+
+	int FakePreviewWindow::cancel_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer)
+	{
+		FakePreviewWindow *win = self(w);
+		Mutex::Autolock lock(win->mLock);
+		int index = win->findBuffer(buffer);
+
+		if ( (index < 0) || (BUFFER_DEQUEUED != win->mBuffers[index].mState) ) {
+			return -EINVAL;
+		}
+
+		win->mBuffers[index].mState = BUFFER_FREE;
+		win->mStats.mCancels++;
+		win->mFreeCondition.signal();
+
+		return 0;
+	}
+
+	int FakePreviewWindow::set_buffer_count(preview_stream_ops_t *w, int count)
+	{
+		FakePreviewWindow *win = self(w);
+		Mutex::Autolock lock(win->mLock);
+
+		if (count <= win->mMinUndequeued) {
+			return -EINVAL;
+		}
+
+		win->freeBuffers();
+
+		win->mBuffers = new Buffer[count];
+		if (NULL == win->mBuffers) {
+			return -ENOMEM;
+		}
+
+		memset(win->mBuffers, 0, sizeof(Buffer) * count);
+		for (int i = 0; i < count; i++) {
+			win->mBuffers[i].mHandle = native_handle_create(0, 1);
+			if (NULL == win->mBuffers[i].mHandle) {
+				win->mBufferCount = i;
+				win->freeBuffers();
+				return -ENOMEM;
+			}
+			win->mBuffers[i].mHandle->data[0] = i;
+			win->mBuffers[i].mHandleSlot = win->mBuffers[i].mHandle;
+			win->mBuffers[i].mState = BUFFER_FREE;
+		}
+		win->mBufferCount = count;
+
+		return 0;
+	}
+
+	int FakePreviewWindow::set_buffers_geometry(preview_stream_ops_t *w, int width, int height, int format)
+	{
+		FakePreviewWindow *win = self(w);
+		Mutex::Autolock lock(win->mLock);
+
+		if ( (width <= 0) || (height <= 0) ) {
+			return -EINVAL;
+		}
+
+		// backing store follows the geometry, it is reallocated on the next dequeue
+		if ( (width * height) != (win->mWidth * win->mHeight) ) {
+			for (int i = 0; i < win->mBufferCount; i++) {
+				if (BUFFER_FREE == win->mBuffers[i].mState) {
+					free(win->mBuffers[i].mData);
+					win->mBuffers[i].mData = NULL;
+				}
+			}
+		}
+
+		win->mWidth = width;
+		win->mHeight = height;
+
+		return 0;
+	}
+
+	int FakePreviewWindow::set_crop(preview_stream_ops_t *w, int left, int top, int right, int bottom)
+	{
+		return 0;
+	}
+
+	int FakePreviewWindow::set_usage(preview_stream_ops_t *w, int usage)
+	{
+		return 0;
+	}
+
+	int FakePreviewWindow::set_swap_interval(preview_stream_ops_t *w, int interval)
+	{
+		return 0;
+	}
+
+	int FakePreviewWindow::get_min_undequeued_buffer_count(const preview_stream_ops_t *w, int *count)
+	{
+		*count = self(w)->mMinUndequeued;
+		return 0;
+	}
+
+	int FakePreviewWindow::lock_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer)
+	{
+		return 0;
+	}
+
+	int FakePreviewWindow::mapper_lock(buffer_handle_t handle, int usage, const Rect &bounds, void **vaddr)
+	{
+		FakePreviewWindow *win = sActive;
+
+		if (NULL == win) {
+			return -ENODEV;
+		}
+
+		Mutex::Autolock lock(win->mLock);
+		for (int i = 0; i < win->mBufferCount; i++) {
+			if (handle == win->mBuffers[i].mHandle) {
+				*vaddr = win->mBuffers[i].mData;
+				return (NULL != *vaddr) ? 0 : -EINVAL;
+			}
+		}
+
+		return -EINVAL;
+	}
+
+	int FakePreviewWindow::mapper_unlock(buffer_handle_t handle)
+	{
+		return 0;
+	}
+
+	bool FakePreviewWindow::composite()
+	{
+		nsecs_t now = systemTime();
+		nsecs_t vsync = now - (now % mRefreshPeriod) + mRefreshPeriod;
+
+		usleep(ns2us(vsync - now));
+
+		Mutex::Autolock lock(mLock);
+
+		if (!mRunning) {
+			return false;
+		}
+
+		now = systemTime();
+		if ( mQueue.empty() || ((now - mBuffers[*mQueue.begin()].mQueuedAt) < mLatency) ) {
+			return true;
+		}
+
+		// one buffer latched per refresh, in queue order
+		int index = *mQueue.begin();
+		mQueue.erase(mQueue.begin());
+
+		if (mOnScreen >= 0) {
+			mBuffers[mOnScreen].mState = BUFFER_FREE;
+			mFreeCondition.signal();
+		}
+		mOnScreen = index;
+		mBuffers[index].mState = BUFFER_ON_SCREEN;
+
+		nsecs_t latency = now - mBuffers[index].mQueuedAt;
+		mStats.mDisplayed++;
+		mStats.mQueueToScreenTotal += latency;
+		if (latency > mStats.mQueueToScreenMax) {
+			mStats.mQueueToScreenMax = latency;
+		}
+
+		return true;
+	}
+
+};
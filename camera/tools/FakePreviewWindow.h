@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FakePreviewWindow.h
+*
+* In-process stand-in for the preview window and gralloc mapper, so the
+* display adapter can be driven without SurfaceFlinger.
+*
+*/
+
+#ifndef ANDROID_CAMERA_HARDWARE_FAKE_PREVIEW_WINDOW_H
+#define ANDROID_CAMERA_HARDWARE_FAKE_PREVIEW_WINDOW_H
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+#include <utils/List.h>
+#include <hardware/camera.h>
+#include "ANativeWindowDisplayAdapter.h"
+
+namespace android {
+
+/**
+ * Buffer queue with a compositor thread that latches one queued buffer per
+ * refresh, once it has been queued for at least the compositor latency, and
+ * releases the previously shown buffer.
+ */
+class FakePreviewWindow
+{
+public:
+
+    typedef struct
+        {
+        unsigned int mDequeues;
+        unsigned int mEnqueues;
+        unsigned int mCancels;
+        unsigned int mDisplayed;
+        nsecs_t mDequeueWaitTotal;    ///< time dequeue_buffer blocked for a free buffer
+        nsecs_t mDequeueWaitMax;
+        nsecs_t mQueueToScreenTotal;  ///< enqueue to latch, summed over displayed buffers
+        nsecs_t mQueueToScreenMax;
+        } Stats;
+
+    typedef struct
+        {
+        int mFree;
+        int mDequeued;
+        int mQueued;
+        int mOnScreen;
+        } Occupancy;
+
+    FakePreviewWindow(int minUndequeued, nsecs_t compositorLatency, int refreshHz);
+    ~FakePreviewWindow();
+
+    preview_stream_ops_t* window();
+    static const ANativeWindowDisplayAdapter::BufferMapperOps* mapper();
+
+    status_t start();
+    void stop();
+
+    void getStats(Stats &stats);
+    void getOccupancy(Occupancy &occupancy);
+
+private:
+
+    enum BufferStates
+        {
+        BUFFER_FREE = 0,
+        BUFFER_DEQUEUED,
+        BUFFER_QUEUED,
+        BUFFER_ON_SCREEN
+        };
+
+    typedef struct
+        {
+        native_handle_t *mHandle;
+        buffer_handle_t mHandleSlot; ///< what buffer_handle_t* returned to the HAL point at
+        void *mData;
+        int mState;
+        nsecs_t mQueuedAt;
+        } Buffer;
+
+    ///preview_stream_ops must be the first member so the ops pointer maps back to us
+    typedef struct
+        {
+        preview_stream_ops_t mOps;
+        FakePreviewWindow *mSelf;
+        } Window;
+
+    class CompositorThread : public Thread {
+            FakePreviewWindow* mWindow;
+        public:
+            CompositorThread(FakePreviewWindow* window) :
+                    Thread(false), mWindow(window) { }
+            virtual bool threadLoop() {
+                return mWindow->composite();
+            }
+        };
+
+    static FakePreviewWindow* self(const preview_stream_ops_t *w);
+    static int dequeue_buffer(preview_stream_ops_t *w, buffer_handle_t **buffer, int *stride);
+    static int enqueue_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer);
+    static int cancel_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer);
+    static int set_buffer_count(preview_stream_ops_t *w, int count);
+    static int set_buffers_geometry(preview_stream_ops_t *w, int width, int height, int format);
+    static int set_crop(preview_stream_ops_t *w, int left, int top, int right, int bottom);
+    static int set_usage(preview_stream_ops_t *w, int usage);
+    static int set_swap_interval(preview_stream_ops_t *w, int interval);
+    static int get_min_undequeued_buffer_count(const preview_stream_ops_t *w, int *count);
+    static int lock_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer);
+
+    static int mapper_lock(buffer_handle_t handle, int usage, const Rect &bounds, void **vaddr);
+    static int mapper_unlock(buffer_handle_t handle);
+
+    int findBuffer(buffer_handle_t *buffer);
+    void freeBuffers();
+    bool composite();
+
+    Window mWindow;
+    sp<CompositorThread> mCompositor;
+    Mutex mLock;
+    Condition mFreeCondition;
+    Buffer *mBuffers;
+    int mBufferCount;
+    int mWidth;
+    int mHeight;
+    List<int> mQueue;
+    int mOnScreen;
+    bool mRunning;
+
+    int mMinUndequeued;
+    nsecs_t mLatency;
+    nsecs_t mRefreshPeriod;
+
+    Stats mStats;
+
+    static FakePreviewWindow *sActive;
+};
+
+};
+
+#endif
@@ -0,0 +1,571 @@
+/*
+ * Copyright (C) Texas Instruments - http://www.ti.com/
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file MultiCameraBench.cpp
+*
+* Opens the cameras of the installed HAL module through its entry points,
+* adding one camera per step, and reports per camera and aggregate preview
+* frame rate together with the CPU the process spent. Every camera previews
+* into its own window of gralloc buffers, so the whole HAL path from the
+* V4L adapter to the display adapter is measured.
+*
+*/
+
+#include "CameraHal.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <hardware/hardware.h>
+#include <hardware/camera.h>
+#include <ui/GraphicBuffer.h>
+
+namespace android {
+
+#define BENCH_DEFAULT_WIDTH 640
+#define BENCH_DEFAULT_HEIGHT 480
+#define BENCH_DEFAULT_SECONDS 5
+#define BENCH_DEFAULT_WARMUP_SECONDS 2
+#define BENCH_MAX_WINDOW_BUFFERS 16
+
+	typedef struct
+		{
+		int mWidth;
+		int mHeight;
+		int mSeconds;
+		int mMaxCameras;
+		bool mCopy;
+		} BenchConfig;
+
+	///Preview window of one camera, gralloc buffers that are free again as soon as they are queued
+	class BenchWindow
+	{
+	public:
+
+		BenchWindow()
+			: mBufferCount(0), mWidth(0), mHeight(0), mFormat(0), mUsage(0), mFrames(0)
+		{
+			memset(&mWindow, 0, sizeof(mWindow));
+			mWindow.mSelf = this;
+			mWindow.mOps.dequeue_buffer = dequeue_buffer;
+			mWindow.mOps.enqueue_buffer = enqueue_buffer;
+			mWindow.mOps.cancel_buffer = cancel_buffer;
+			mWindow.mOps.set_buffer_count = set_buffer_count;
+			mWindow.mOps.set_buffers_geometry = set_buffers_geometry;
+			mWindow.mOps.set_crop = set_crop;
+			mWindow.mOps.set_usage = set_usage;
+			mWindow.mOps.set_swap_interval = set_swap_interval;
+			mWindow.mOps.get_min_undequeued_buffer_count = get_min_undequeued_buffer_count;
+			mWindow.mOps.lock_buffer = lock_buffer;
+			releaseBuffers();
+		}
+
+		preview_stream_ops_t* window()
+		{
+			return &mWindow.mOps;
+		}
+
+		unsigned int getFrames()
+		{
+			Mutex::Autolock lock(mLock);
+			return mFrames;
+		}
+
+	private:
+
+		///preview_stream_ops must be the first member so the ops pointer maps back to us
+		typedef struct
+			{
+			preview_stream_ops_t mOps;
+			BenchWindow *mSelf;
+			} Window;
+
+		static BenchWindow* self(const preview_stream_ops_t *w)
+		{
+			return ((const Window *) w)->mSelf;
+		}
+
+		int findBuffer(buffer_handle_t *buffer)
+		{
+			for (int i = 0; (NULL != buffer) && (i < mBufferCount); i++) {
+				if ( (NULL != mBuffers[i].get()) && (*buffer == mBuffers[i]->handle) ) {
+					return i;
+				}
+			}
+
+			return -1;
+		}
+
+		static int dequeue_buffer(preview_stream_ops_t *w, buffer_handle_t **buffer, int *stride)
+		{
+			BenchWindow *win = self(w);
+			Mutex::Autolock lock(win->mLock);
+
+			for (int i = 0; i < win->mBufferCount; i++) {
+				if (win->mDequeued[i]) {
+					continue;
+				}
+
+				// allocated on first use, once geometry and usage are known
+				if (NULL == win->mBuffers[i].get()) {
+					win->mBuffers[i] = new GraphicBuffer(win->mWidth, win->mHeight, win->mFormat, win->mUsage);
+					if ( (NULL == win->mBuffers[i].get()) || (NO_ERROR != win->mBuffers[i]->initCheck()) ) {
+						win->mBuffers[i].clear();
+						return -ENOMEM;
+					}
+				}
+
+				win->mDequeued[i] = true;
+				*buffer = (buffer_handle_t *) &win->mBuffers[i]->handle;
+				*stride = win->mBuffers[i]->getStride();
+				return 0;
+			}
+
+			return -EBUSY;
+		}
+
+		static int enqueue_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer)
+		{
+			BenchWindow *win = self(w);
+			Mutex::Autolock lock(win->mLock);
+			int index = win->findBuffer(buffer);
+
+			if (index < 0) {
+				return -EINVAL;
+			}
+
+			win->mDequeued[index] = false;
+			win->mFrames++;
+
+			return 0;
+		}
+
+		static int cancel_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer)
+		{
+			BenchWindow *win = self(w);
+			Mutex::Autolock lock(win->mLock);
+			int index = win->findBuffer(buffer);
+
+			if (index < 0) {
+				return -EINVAL;
+			}
+
+			win->mDequeued[index] = false;
+
+			return 0;
+		}
+
+		static int set_buffer_count(preview_stream_ops_t *w, int count)
+		{
+			BenchWindow *win = self(w);
+			Mutex::Autolock lock(win->mLock);
+
+			if ( (count <= 0) || (count > BENCH_MAX_WINDOW_BUFFERS) ) {
+				return -EINVAL;
+			}
+
+			win->releaseBuffers();
+			win->mBufferCount = count;
+
+			return 0;
+		}
+
+		static int set_buffers_geometry(preview_stream_ops_t *w, int width, int height, int format)
+		{
+			BenchWindow *win = self(w);
+			Mutex::Autolock lock(win->mLock);
+
+			if ( (width <= 0) || (height <= 0) ) {
+				return -EINVAL;
+			}
+
+			win->releaseBuffers();
+			win->mWidth = width;
+			win->mHeight = height;
+			win->mFormat = format;
+
+			return 0;
+		}
+
+		static int set_crop(preview_stream_ops_t *w, int left, int top, int right, int bottom)
+		{
+			return 0;
+		}
+
+		static int set_usage(preview_stream_ops_t *w, int usage)
+		{
+			BenchWindow *win = self(w);
+			Mutex::Autolock lock(win->mLock);
+
+			win->mUsage = usage;
+
+			return 0;
+		}
+
+		static int set_swap_interval(preview_stream_ops_t *w, int interval)
+		{
+			return 0;
+		}
+
+		static int get_min_undequeued_buffer_count(const preview_stream_ops_t *w, int *count)
+		{
+			// nothing is ever on screen, every buffer may be dequeued
+			*count = 0;
+			return 0;
+		}
+
+		static int lock_buffer(preview_stream_ops_t *w, buffer_handle_t *buffer)
+		{
+			return 0;
+		}
+
+		void releaseBuffers()
+		{
+			for (int i = 0; i < BENCH_MAX_WINDOW_BUFFERS; i++) {
+				mBuffers[i].clear();
+				mDequeued[i] = false;
+			}
+		}
+
+		Window mWindow;
+		Mutex mLock;
+		sp<GraphicBuffer> mBuffers[BENCH_MAX_WINDOW_BUFFERS];
+		bool mDequeued[BENCH_MAX_WINDOW_BUFFERS];
+		int mBufferCount;
+		int mWidth;
+		int mHeight;
+		int mFormat;
+		int mUsage;
+		unsigned int mFrames;
+	};
+
+	///One camera opened through the HAL module, as the camera service would
+	class BenchCamera : public RefBase
+	{
+	public:
+
+		BenchCamera(int id)
+			: mId(id), mDevice(NULL), mCallbacks(0), mErrors(0)
+		{
+		}
+
+		virtual ~BenchCamera()
+		{
+			close();
+		}
+
+		status_t open(camera_module_t *module, int width, int height, bool callbacks)
+		{
+			CameraParameters params;
+			char name[16];
+			char *flat;
+			int ret;
+
+			snprintf(name, sizeof(name), "%d", mId);
+			ret = module->common.methods->open(&module->common, name, (hw_device_t **) &mDevice);
+			if ( (ret < 0) || (NULL == mDevice) ) {
+				printf("camera %d: open failed: %d\n", mId, ret);
+				mDevice = NULL;
+				return (ret < 0) ? ret : UNKNOWN_ERROR;
+			}
+
+			mDevice->ops->set_callbacks(mDevice, notifyCallback, dataCallback, dataTimestampCallback,
+					requestMemory, this);
+
+			flat = mDevice->ops->get_parameters(mDevice);
+			if (NULL == flat) {
+				printf("camera %d: no parameters\n", mId);
+				return UNKNOWN_ERROR;
+			}
+			params.unflatten(String8(flat));
+			if (NULL != mDevice->ops->put_parameters) {
+				mDevice->ops->put_parameters(mDevice, flat);
+			} else {
+				free(flat);
+			}
+
+			params.setPreviewSize(width, height);
+			params.setPreviewFormat(CameraParameters::PIXEL_FORMAT_YUV422I);
+			ret = mDevice->ops->set_parameters(mDevice, params.flatten().string());
+			if (ret < 0) {
+				printf("camera %d: %dx%d rejected: %d\n", mId, width, height, ret);
+				return ret;
+			}
+
+			ret = mDevice->ops->set_preview_window(mDevice, mWindow.window());
+			if (ret < 0) {
+				printf("camera %d: set_preview_window failed: %d\n", mId, ret);
+				return ret;
+			}
+
+			// the application callback costs the copy the HAL makes of every frame for it
+			if (callbacks) {
+				mDevice->ops->enable_msg_type(mDevice, CAMERA_MSG_PREVIEW_FRAME);
+			}
+
+			ret = mDevice->ops->start_preview(mDevice);
+			if (ret < 0) {
+				printf("camera %d: start_preview failed: %d\n", mId, ret);
+				return ret;
+			}
+
+			printf("camera %d: previewing %dx%d\n", mId, width, height);
+
+			return NO_ERROR;
+		}
+
+		void close()
+		{
+			if (NULL == mDevice) {
+				return;
+			}
+
+			mDevice->ops->disable_msg_type(mDevice, CAMERA_MSG_ALL_MSGS);
+			mDevice->ops->stop_preview(mDevice);
+			mDevice->ops->release(mDevice);
+			mDevice->common.close(&mDevice->common);
+			mDevice = NULL;
+		}
+
+		unsigned int getFrames()
+		{
+			return mWindow.getFrames();
+		}
+
+		unsigned int getCallbacks()
+		{
+			Mutex::Autolock lock(mLock);
+			return mCallbacks;
+		}
+
+		unsigned int getErrors()
+		{
+			Mutex::Autolock lock(mLock);
+			return mErrors;
+		}
+
+		int id() const { return mId; }
+
+	private:
+
+		static void notifyCallback(int32_t msgType, int32_t ext1, int32_t ext2, void *user)
+		{
+			BenchCamera *camera = (BenchCamera *) user;
+
+			if (CAMERA_MSG_ERROR == msgType) {
+				Mutex::Autolock lock(camera->mLock);
+				camera->mErrors++;
+			}
+		}
+
+		static void dataCallback(int32_t msgType, const camera_memory_t *data, unsigned int index,
+				camera_frame_metadata_t *metadata, void *user)
+		{
+			BenchCamera *camera = (BenchCamera *) user;
+
+			if (CAMERA_MSG_PREVIEW_FRAME == msgType) {
+				Mutex::Autolock lock(camera->mLock);
+				camera->mCallbacks++;
+			}
+		}
+
+		static void dataTimestampCallback(nsecs_t timestamp, int32_t msgType, const camera_memory_t *data,
+				unsigned int index, void *user)
+		{
+		}
+
+		static void releaseMemory(camera_memory_t *mem)
+		{
+			if (NULL != mem->handle) {
+				munmap(mem->data, mem->size);
+			} else {
+				free(mem->data);
+			}
+			delete mem;
+		}
+
+		// what the camera service hands out, a mapping of the HAL's fd or plain heap memory
+		static camera_memory_t* requestMemory(int fd, size_t size, unsigned int count, void *user)
+		{
+			camera_memory_t *mem = new camera_memory_t;
+
+			mem->size = size * count;
+			mem->handle = NULL;
+			mem->release = releaseMemory;
+
+			if (fd >= 0) {
+				mem->data = mmap(NULL, mem->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (MAP_FAILED == mem->data) {
+					delete mem;
+					return NULL;
+				}
+				mem->handle = mem;
+			} else {
+				mem->data = malloc(mem->size);
+				if (NULL == mem->data) {
+					delete mem;
+					return NULL;
+				}
+			}
+
+			return mem;
+		}
+
+		int mId;
+		camera_device_t *mDevice;
+		BenchWindow mWindow;
+
+		Mutex mLock;
+		unsigned int mCallbacks;
+		unsigned int mErrors;
+	};
+
+	static nsecs_t cpuTime()
+	{
+		struct rusage usage;
+
+		getrusage(RUSAGE_SELF, &usage);
+
+		return s2ns(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+				us2ns(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+	}
+
+	static void usage(const char *name)
+	{
+		printf("usage: %s [-w width] [-h height] [-t seconds per step] [-n max cameras] [-c]\n"
+			   "  -c enables preview callbacks, which cost the HAL one more copy of every frame\n", name);
+	}
+
+	static int runBench(const BenchConfig &config)
+	{
+		camera_module_t *module = NULL;
+		Vector< sp<BenchCamera> > cameras;
+		unsigned int base[MAX_CAMERAS_SUPPORTED];
+		int count;
+
+		// the installed HAL, loaded and discovered the way the camera service does it
+		if ( (hw_get_module(CAMERA_HARDWARE_MODULE_ID, (const hw_module_t **) &module) < 0) ||
+				(NULL == module) ) {
+			printf("camera HAL module not found\n");
+			return -1;
+		}
+
+		count = module->get_number_of_cameras();
+		if ( (config.mMaxCameras > 0) && (count > config.mMaxCameras) ) {
+			count = config.mMaxCameras;
+		}
+		if (count > MAX_CAMERAS_SUPPORTED) {
+			count = MAX_CAMERAS_SUPPORTED;
+		}
+		if (count <= 0) {
+			printf("no cameras reported by the HAL\n");
+			return -1;
+		}
+
+		printf("%d camera(s), %dx%d preview, %d s per step%s\n\n", count, config.mWidth,
+			   config.mHeight, config.mSeconds, config.mCopy ? ", preview callbacks" : "");
+		printf("cameras  aggregate fps  per camera fps            cpu %%  cpu %% per camera\n");
+
+		for (int n = 0; n < count; n++) {
+			sp<BenchCamera> camera = new BenchCamera(n);
+			if (NO_ERROR != camera->open(module, config.mWidth, config.mHeight, config.mCopy)) {
+				break;
+			}
+			cameras.add(camera);
+
+			// let the new camera settle before measuring
+			sleep(BENCH_DEFAULT_WARMUP_SECONDS);
+
+			for (size_t i = 0; i < cameras.size(); i++) {
+				base[i] = cameras[i]->getFrames();
+			}
+			const nsecs_t cpuStart = cpuTime();
+			const nsecs_t start = systemTime();
+
+			sleep(config.mSeconds);
+
+			const double seconds = (systemTime() - start) / 1000000000.0;
+			const double cpu = 100.0 * (cpuTime() - cpuStart) / (seconds * 1000000000.0);
+			unsigned int total = 0;
+			char perCamera[128];
+			int pos = 0;
+
+			perCamera[0] = '\0';
+			for (size_t i = 0; i < cameras.size(); i++) {
+				unsigned int frames = cameras[i]->getFrames() - base[i];
+				total += frames;
+				if (pos < (int) sizeof(perCamera)) {
+					pos += snprintf(perCamera + pos, sizeof(perCamera) - pos, "%s%.1f",
+									i ? " " : "", frames / seconds);
+				}
+			}
+
+			printf("%7u  %13.1f  %-24s %6.1f  %15.1f\n", cameras.size(), total / seconds, perCamera,
+				   cpu, cpu / cameras.size());
+		}
+
+		for (size_t i = 0; i < cameras.size(); i++) {
+			cameras[i]->close();
+			if (config.mCopy) {
+				printf("camera %d: %u preview callbacks\n", cameras[i]->id(), cameras[i]->getCallbacks());
+			}
+			if (cameras[i]->getErrors()) {
+				printf("camera %d: %u errors reported\n", cameras[i]->id(), cameras[i]->getErrors());
+			}
+		}
+
+		return cameras.isEmpty() ? -1 : 0;
+	}
+
+};
+
+using namespace android;
+
+int main(int argc, char **argv)
+{
+	BenchConfig config;
+	int opt;
+
+	config.mWidth = BENCH_DEFAULT_WIDTH;
+	config.mHeight = BENCH_DEFAULT_HEIGHT;
+	config.mSeconds = BENCH_DEFAULT_SECONDS;
+	config.mMaxCameras = 0;
+	config.mCopy = false;
+
+	while ((opt = getopt(argc, argv, "w:h:t:n:c")) != -1) {
+		switch (opt) {
+			case 'w': config.mWidth = atoi(optarg); break;
+			case 'h': config.mHeight = atoi(optarg); break;
+			case 't': config.mSeconds = atoi(optarg); break;
+			case 'n': config.mMaxCameras = atoi(optarg); break;
+			case 'c': config.mCopy = true; break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if ( (config.mWidth <= 0) || (config.mHeight <= 0) || (config.mSeconds <= 0) ) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	return runBench(config) ? 1 : 0;
+}
@@ -22,6 +22,7 @@
  *******************************************************************************/
 
 #include <stdlib.h>
+#include <sys/time.h>
 
 #include "v4l2uvc.h"
 #include "utils.h"
@@ -30,6 +31,122 @@ static int debug = 1;
 
 static int init_v4l2(struct vdIn *vd);
 
+/* VIDIOC_QUERYCTRL results, queried once per control and kept with the last
+ * value read or written so unchanged values are not sent to the camera again */
+#define CTRL_CACHE_SIZE 64
+#define MAX_LOAD_CONTROLS 128
+
+struct ctrlCacheEntry {
+    int fd;
+    int result;                 /* isv4l2Control() result */
+    int valueKnown;
+    int value;
+    struct v4l2_queryctrl queryctrl;
+};
+
+static struct ctrlCacheEntry ctrlCache[CTRL_CACHE_SIZE];
+static int ctrlCacheCount = 0;
+static unsigned int ctrlIoctls = 0;
+
+static long elapsedUs(struct timeval *start) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000000L
+            + (now.tv_usec - start->tv_usec);
+}
+
+static struct ctrlCacheEntry *lookupControl(int fd, int control) {
+    static struct ctrlCacheEntry uncached;
+    struct ctrlCacheEntry *entry;
+    int i;
+
+    for (i = 0; i < ctrlCacheCount; i++) {
+        if (ctrlCache[i].fd == fd && ctrlCache[i].queryctrl.id == (__u32) control)
+            return &ctrlCache[i];
+    }
+    entry = (ctrlCacheCount < CTRL_CACHE_SIZE) ?
+            &ctrlCache[ctrlCacheCount++] : &uncached;
+
+    memset(entry, 0, sizeof(*entry));
+    entry->fd = fd;
+    entry->result = -1;
+    entry->queryctrl.id = control;
+    ctrlIoctls++;
+    if (ioctl(fd, VIDIOC_QUERYCTRL, &entry->queryctrl) < 0) {
+        printf("ioctl querycontrol error %d \n", errno);
+        entry->queryctrl.id = control;
+    } else if (entry->queryctrl.flags & V4L2_CTRL_FLAG_DISABLED) {
+        printf("control %s disabled \n", (char *) entry->queryctrl.name);
+    } else if (entry->queryctrl.type == V4L2_CTRL_TYPE_BOOLEAN) {
+        entry->result = 1;
+    } else if (entry->queryctrl.type == V4L2_CTRL_TYPE_INTEGER
+            || entry->queryctrl.type == V4L2_CTRL_TYPE_MENU) {
+        entry->result = 0;
+    } else {
+        printf("contol %s unsupported  \n", (char *) entry->queryctrl.name);
+    }
+    return entry;
+}
+
+static int writeControl(int fd, struct v4l2_control *control) {
+    struct ctrlCacheEntry *entry = lookupControl(fd, control->id);
+    ctrlIoctls++;
+    if (ioctl(fd, VIDIOC_S_CTRL, control) < 0) {
+        entry->valueKnown = 0;
+        return -1;
+    }
+    entry->value = control->value;
+    entry->valueKnown = 1;
+    return 0;
+}
+
+/* One extended control request over controls of a single class. Private
+ * controls, drivers without the extended ioctls and transactions the driver
+ * refuses as a whole go one control at a time so ok[] tells what went through */
+static void transferControls(int fd, int set, struct v4l2_ext_control *controls,
+        int count, int *ok) {
+    struct v4l2_ext_controls ext;
+    struct v4l2_control control_s;
+    int i;
+
+    if (controls[0].id < V4L2_CID_PRIVATE_BASE) {
+        memset(&ext, 0, sizeof(ext));
+        ext.ctrl_class = V4L2_CTRL_ID2CLASS(controls[0].id);
+        ext.count = count;
+        ext.controls = controls;
+        ctrlIoctls++;
+        if (ioctl(fd, set ? VIDIOC_S_EXT_CTRLS : VIDIOC_G_EXT_CTRLS, &ext) == 0) {
+            for (i = 0; i < count; i++)
+                ok[i] = 1;
+            return;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        control_s.id = controls[i].id;
+        control_s.value = controls[i].value;
+        ctrlIoctls++;
+        ok[i] = (ioctl(fd, set ? VIDIOC_S_CTRL : VIDIOC_G_CTRL, &control_s) == 0);
+        if (ok[i])
+            controls[i].value = control_s.value;
+    }
+}
+
+/* controls must be sorted by class, one request per run of the same class */
+static void transferAllControls(int fd, int set,
+        struct v4l2_ext_control *controls, int count, int *ok) {
+    int start = 0, end;
+
+    while (start < count) {
+        end = start + 1;
+        while (end < count && controls[start].id < V4L2_CID_PRIVATE_BASE
+                && V4L2_CTRL_ID2CLASS(controls[end].id)
+                        == V4L2_CTRL_ID2CLASS(controls[start].id))
+            end++;
+        transferControls(fd, set, controls + start, end - start, ok + start);
+        start = end;
+    }
+}
+
 int check_videoIn(struct vdIn *vd, char *device) {
     int ret;
     if (vd == NULL || device == NULL)
@@ -290,27 +407,77 @@ int save_controls(int vd) {
 
 int load_controls(int vd) //struct vdIn *vd)
 {
-    struct v4l2_control control;
+    struct v4l2_ext_control requested[MAX_LOAD_CONTROLS];
+    struct v4l2_ext_control current[MAX_LOAD_CONTROLS];
+    struct v4l2_ext_control tmp;
+    struct ctrlCacheEntry *entry;
+    int ok[MAX_LOAD_CONTROLS];
+    int count = 0, changed = 0, written = 0;
+    int i, j;
+    unsigned int ioctls = ctrlIoctls;
+    struct timeval start;
     FILE *configfile;
-    memset(&control, 0, sizeof(control));
     configfile = fopen("luvcview.cfg", "r");
     if (configfile == NULL) {
         printf("configfile luvcview.cfg open failed, errno = %d (%s)\n", errno,
                 strerror(errno));
-    } else {
-        printf("loading controls from luvcview.cfg \n");
-        char buffer[512];
-        fgets(buffer, sizeof(buffer), configfile);
-        while (NULL != fgets(buffer, sizeof(buffer), configfile)) {
-            sscanf(buffer, "%i%i", &control.id, &control.value);
-            if (ioctl(vd, VIDIOC_S_CTRL, &control))
-                printf("ERROR id:%d val:%d \n", control.id, control.value);
-            else
-                printf("OK    id:%d val:%d \n", control.id, control.value);
-            usleep(20);
+        return 0;
+    }
+    printf("loading controls from luvcview.cfg \n");
+    gettimeofday(&start, NULL);
+    char buffer[512];
+    fgets(buffer, sizeof(buffer), configfile);
+    while (count < MAX_LOAD_CONTROLS
+            && NULL != fgets(buffer, sizeof(buffer), configfile)) {
+        memset(&requested[count], 0, sizeof(requested[count]));
+        if (sscanf(buffer, "%i%i", &requested[count].id,
+                &requested[count].value) != 2)
+            continue;
+        entry = lookupControl(vd, requested[count].id);
+        if (entry->result < 0
+                || (entry->queryctrl.flags & V4L2_CTRL_FLAG_READ_ONLY)) {
+            printf("ERROR id:%d val:%d \n", requested[count].id,
+                    requested[count].value);
+            continue;
         }
-        fclose(configfile);
+        count++;
     }
+    fclose(configfile);
+
+    /* group by class, keeping the file order within a class */
+    for (i = 1; i < count; i++) {
+        tmp = requested[i];
+        for (j = i; j > 0 && V4L2_CTRL_ID2CLASS(requested[j - 1].id)
+                > V4L2_CTRL_ID2CLASS(tmp.id); j--)
+            requested[j] = requested[j - 1];
+        requested[j] = tmp;
+    }
+
+    /* read every value at once and only write the ones that differ */
+    memcpy(current, requested, count * sizeof(current[0]));
+    transferAllControls(vd, 0, current, count, ok);
+    for (i = 0; i < count; i++) {
+        if (ok[i] && current[i].value == requested[i].value) {
+            entry = lookupControl(vd, requested[i].id);
+            entry->value = current[i].value;
+            entry->valueKnown = 1;
+            continue;
+        }
+        requested[changed++] = requested[i];
+    }
+
+    transferAllControls(vd, 1, requested, changed, ok);
+    for (i = 0; i < changed; i++) {
+        entry = lookupControl(vd, requested[i].id);
+        entry->valueKnown = ok[i];
+        entry->value = requested[i].value;
+        if (ok[i])
+            written++;
+        printf("%s id:%d val:%d \n", ok[i] ? "OK   " : "ERROR",
+                requested[i].id, requested[i].value);
+    }
+    printf("%d controls, %d changed, %d written with %u ioctls in %ld us\n",
+            count, changed, written, ctrlIoctls - ioctls, elapsedUs(&start));
     return 0;
 }
 
@@ -618,42 +785,37 @@ err: vd->signalquit = 0;
         return 0;
     }
 
-/* return >= 0 ok otherwhise -1 */
+/* return >= 0 ok otherwhise -1, 1 for boolean controls */
 static int isv4l2Control(struct vdIn *vd, int control,
         struct v4l2_queryctrl *queryctrl) {
-    int err = 0;
-    queryctrl->id = control;
-    if ((err = ioctl(vd->fd, VIDIOC_QUERYCTRL, queryctrl)) < 0) {
-        printf("ioctl querycontrol error %d \n", errno);
-    } else if (queryctrl->flags & V4L2_CTRL_FLAG_DISABLED) {
-        printf("control %s disabled \n", (char *) queryctrl->name);
-    } else if (queryctrl->flags & V4L2_CTRL_TYPE_BOOLEAN) {
-        return 1;
-    } else if (queryctrl->type & V4L2_CTRL_TYPE_INTEGER) {
-        return 0;
-    } else {
-        printf("contol %s unsupported  \n", (char *) queryctrl->name);
-    }
-    return -1;
+    struct ctrlCacheEntry *entry = lookupControl(vd->fd, control);
+    *queryctrl = entry->queryctrl;
+    return entry->result;
 }
 
 int v4l2GetControl(struct vdIn *vd, int control) {
     struct v4l2_queryctrl queryctrl;
     struct v4l2_control control_s;
+    struct ctrlCacheEntry *entry;
     int err;
     if (isv4l2Control(vd, control, &queryctrl) < 0)
         return -1;
     control_s.id = control;
+    ctrlIoctls++;
     if ((err = ioctl(vd->fd, VIDIOC_G_CTRL, &control_s)) < 0) {
         printf("ioctl get control error\n");
         return -1;
     }
+    entry = lookupControl(vd->fd, control);
+    entry->value = control_s.value;
+    entry->valueKnown = 1;
     return control_s.value;
 }
 
 int v4l2SetControl(struct vdIn *vd, int control, int value) {
     struct v4l2_control control_s;
     struct v4l2_queryctrl queryctrl;
+    struct ctrlCacheEntry *entry;
     int min, max, step, val_def;
     int err;
     if (isv4l2Control(vd, control, &queryctrl) < 0)
@@ -662,10 +824,15 @@ int v4l2SetControl(struct vdIn *vd, int control, int value) {
     max = queryctrl.maximum;
     step = queryctrl.step;
     val_def = queryctrl.default_value;
+    /* the camera already has it, no need for a USB control transfer */
+    entry = lookupControl(vd->fd, control);
+    if (entry->valueKnown && entry->value == value
+            && !(queryctrl.flags & V4L2_CTRL_FLAG_WRITE_ONLY))
+        return 0;
     if ((value >= min) && (value <= max)) {
         control_s.id = control;
         control_s.value = value;
-        if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+        if ((err = writeControl(vd->fd, &control_s)) < 0) {
             printf("ioctl set control error\n");
             return -1;
         }
@@ -691,7 +858,7 @@ int v4l2UpControl(struct vdIn *vd, int control) {
     if (current <= max) {
         control_s.id = control;
         control_s.value = current;
-        if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+        if ((err = writeControl(vd->fd, &control_s)) < 0) {
             printf("ioctl set control error\n");
             return -1;
         }
@@ -721,7 +888,7 @@ int v4l2DownControl(struct vdIn *vd, int control) {
     if (current >= min) {
         control_s.id = control;
         control_s.value = current;
-        if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+        if ((err = writeControl(vd->fd, &control_s)) < 0) {
             printf("ioctl set control error\n");
             return -1;
         }
@@ -743,7 +910,7 @@ int v4l2ToggleControl(struct vdIn *vd, int control) {
     current = v4l2GetControl(vd, control);
     control_s.id = control;
     control_s.value = !current;
-    if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+    if ((err = writeControl(vd->fd, &control_s)) < 0) {
         printf("ioctl toggle control error\n");
         return -1;
     }
@@ -759,7 +926,7 @@ int v4l2ResetControl(struct vdIn *vd, int control) {
     val_def = queryctrl.default_value;
     control_s.id = control;
     control_s.value = val_def;
-    if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+    if ((err = writeControl(vd->fd, &control_s)) < 0) {
         printf("ioctl reset control error\n");
         return -1;
     }
@@ -777,7 +944,7 @@ int v4l2ResetPanTilt(struct vdIn *vd, int pantilt) {
     val = (unsigned char) pantilt;
     control_s.id = control;
     control_s.value = val;
-    if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+    if ((err = writeControl(vd->fd, &control_s)) < 0) {
         printf("ioctl reset Pan control error\n");
         return -1;
     }
@@ -795,7 +962,7 @@ int v4L2UpDownPan(struct vdIn *vd, short inc) {
         return -1;
     control_s.id = control;
     control_s.value = inc;
-    if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+    if ((err = writeControl(vd->fd, &control_s)) < 0) {
         printf("ioctl pan updown control error\n");
         return -1;
     }
@@ -812,7 +979,7 @@ int v4L2UpDownTilt(struct vdIn *vd, short inc) {
         return -1;
     control_s.id = control;
     control_s.value = inc;
-    if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+    if ((err = writeControl(vd->fd, &control_s)) < 0) {
         printf("ioctl tiltupdown control error\n");
         return -1;
     }
@@ -874,7 +1041,7 @@ int v4L2UpDownPan(struct vdIn *vd, short inc)
     pan.s16.tilt = 0;
 
     control_s.value = pan.value;
-    if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+    if ((err = writeControl(vd->fd, &control_s)) < 0) {
         printf("ioctl pan updown control error\n");
         return -1;
     }
@@ -895,7 +1062,7 @@ int v4L2UpDownTilt(struct vdIn *vd, short inc)
     pan.s16.tilt = inc;
 
     control_s.value = pan.value;
-    if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+    if ((err = writeControl(vd->fd, &control_s)) < 0) {
         printf("ioctl tiltupdown control error\n");
         return -1;
     }
@@ -914,7 +1081,7 @@ int v4l2SetLightFrequencyFilter(struct vdIn *vd, int flt) {
 
     control_s.value = flt;
 
-    if ((err = ioctl(vd->fd, VIDIOC_S_CTRL, &control_s)) < 0) {
+    if ((err = writeControl(vd->fd, &control_s)) < 0) {
         printf("ioctl set_light_frequency_filter error\n");
         return -1;
     }